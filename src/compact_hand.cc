@@ -0,0 +1,161 @@
+// Copyright 2016 Yuki Hamada
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/compact_hand.h"
+
+#include <algorithm>
+
+#include "src/compact_parsed_hand.h"
+#include "src/mahjong_common_util.h"
+
+namespace ycraft {
+namespace mahjong {
+
+const int CompactHand::kMaxNumClosedTiles;
+const int CompactHand::kMaxNumMelds;
+const int CompactField::kMaxNumDora;
+
+void CompactHand::Clear() {
+  num_closed_tiles = 0;
+  agari_tile = CompactParsedHand::kUnknownTileCode;
+  num_melds = 0;
+  agari_type = AgariType::UNKNOWN_AGARI_TYPE;
+  richi_type = RichiType::UNKNOWN_RICHI_TYPE;
+  agari_states = 0;
+}
+
+bool CompactHand::AddClosedTile(uint8_t code) {
+  if (num_closed_tiles == kMaxNumClosedTiles) {
+    return false;
+  }
+  closed_tile[num_closed_tiles++] = code;
+  return true;
+}
+
+bool CompactHand::SetClosedTiles(const uint8_t* counts) {
+  num_closed_tiles = 0;
+  for (int index = 0; index < kNumTileIndices; ++index) {
+    for (int i = 0; i < counts[index]; ++i) {
+      if (!AddClosedTile(index)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool CompactHand::AddMeld(HandElementType type, uint8_t tile) {
+  if (num_melds == kMaxNumMelds) {
+    return false;
+  }
+  meld[num_melds].type = type;
+  meld[num_melds].tile = tile;
+  ++num_melds;
+  return true;
+}
+
+HandValidatorResult::Type ToCompactHand(const Hand& hand,
+                                        CompactHand* compact_hand) {
+  compact_hand->Clear();
+
+  // Check the sizes first, so that nothing is copied from an oversized hand.
+  if (hand.closed_tile_size() > CompactHand::kMaxNumClosedTiles ||
+      hand.chiied_tile_size() + hand.ponned_tile_size() +
+              hand.kanned_tile_size() >
+          CompactHand::kMaxNumMelds) {
+    return HandValidatorResult::ERROR_WRONG_NUM_TILES;
+  }
+  if (hand.agari().state_size() > CompactParsedHand::kMaxNumAgariStates) {
+    return HandValidatorResult::ERROR_TOO_MANY_AGARI_STATES;
+  }
+
+  for (const int closed_tile : hand.closed_tile()) {
+    const int index = GetTileIndex(static_cast<TileType>(closed_tile));
+    if (index < 0) {
+      return HandValidatorResult::ERROR_UNKNOWN_TILE;
+    }
+    compact_hand->AddClosedTile(index);
+  }
+  // An unknown agari tile is kept as is, so that hands waiting for a tile can
+  // be converted. HandParser::Validate rejects it for complete hands.
+  compact_hand->agari_tile = CompactParsedHand::GetTileCode(hand.agari_tile());
+
+  for (const Hand_Chii& chiied_tile : hand.chiied_tile()) {
+    if (chiied_tile.tile_size() != 3) {
+      return HandValidatorResult::ERROR_INVALID_CHII;
+    }
+    int indices[3];
+    for (int i = 0; i < 3; ++i) {
+      indices[i] = GetTileIndex(static_cast<TileType>(chiied_tile.tile(i)));
+      if (indices[i] < 0) {
+        return HandValidatorResult::ERROR_UNKNOWN_TILE;
+      }
+    }
+    std::sort(indices, indices + 3);
+    if (!CanStartShuntsu(indices[0]) || indices[1] != indices[0] + 1 ||
+        indices[2] != indices[0] + 2) {
+      return HandValidatorResult::ERROR_INVALID_CHII;
+    }
+    compact_hand->AddMeld(HandElementType::MINSHUNTSU, indices[0]);
+  }
+  for (const Hand_Pon& ponned_tile : hand.ponned_tile()) {
+    const int index = GetTileIndex(ponned_tile.tile());
+    if (index < 0) {
+      return HandValidatorResult::ERROR_UNKNOWN_TILE;
+    }
+    compact_hand->AddMeld(HandElementType::MINKOUTSU, index);
+  }
+  for (const Hand_Kan& kanned_tile : hand.kanned_tile()) {
+    const int index = GetTileIndex(kanned_tile.tile());
+    if (index < 0) {
+      return HandValidatorResult::ERROR_UNKNOWN_TILE;
+    }
+    compact_hand->AddMeld(kanned_tile.is_closed() ? HandElementType::ANKANTSU
+                                                  : HandElementType::MINKANTSU,
+                          index);
+  }
+
+  const Agari& agari = hand.agari();
+  compact_hand->agari_type = agari.type();
+  for (const int state : agari.state()) {
+    // Values out of the bit set can't be valid AgariState values.
+    if (0 <= state && state < 32) {
+      compact_hand->AddAgariState(static_cast<AgariState>(state));
+    }
+  }
+  compact_hand->richi_type = hand.richi_type();
+  return HandValidatorResult::OK;
+}
+
+bool ToCompactField(const Field& field, CompactField* compact_field) {
+  if (field.dora_size() > CompactField::kMaxNumDora ||
+      field.uradora_size() > CompactField::kMaxNumDora) {
+    return false;
+  }
+  compact_field->wind = field.wind();
+  compact_field->num_dora = field.dora_size();
+  for (int i = 0; i < field.dora_size(); ++i) {
+    compact_field->dora[i] = CompactParsedHand::GetTileCode(field.dora(i));
+  }
+  compact_field->num_uradora = field.uradora_size();
+  for (int i = 0; i < field.uradora_size(); ++i) {
+    compact_field->uradora[i] =
+        CompactParsedHand::GetTileCode(field.uradora(i));
+  }
+  compact_field->honba = field.honba();
+  return true;
+}
+
+}  // namespace mahjong
+}  // namespace ycraft
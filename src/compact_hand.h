@@ -0,0 +1,111 @@
+// Copyright 2016 Yuki Hamada
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_COMPACT_HAND_H_
+#define SRC_COMPACT_HAND_H_
+
+#include <cstdint>
+
+#include "proto/mahjong_scorecalculator.pb.h"
+
+namespace ycraft {
+namespace mahjong {
+
+// CompactHand is a fixed-size value type that holds the same data as Hand.
+// HandParser and ScoreCalculator work on this type, and the overloads taking
+// Hand convert it first, so callers that keep tiles in their own arrays can
+// skip building protos.
+//
+// Tiles are tile codes, i.e. tile indices of their TileType (see
+// GetTileIndex), same as CompactParsedHand.
+struct CompactHand {
+  // A closed hand without the agari tile.
+  static const int kMaxNumClosedTiles = 13;
+  static const int kMaxNumMelds = 4;
+
+  struct Meld {
+    // MINSHUNTSU for chii, MINKOUTSU for pon, and MINKANTSU or ANKANTSU for
+    // kan.
+    HandElementType type;
+
+    // Tile code of the smallest tile of the meld.
+    uint8_t tile;
+  };
+
+  int num_closed_tiles;
+  uint8_t closed_tile[kMaxNumClosedTiles];
+  uint8_t agari_tile;
+
+  int num_melds;
+  Meld meld[kMaxNumMelds];
+
+  AgariType agari_type;
+  RichiType richi_type;
+
+  // Bit (1 << state) is set for each AgariState of the agari.
+  uint32_t agari_states;
+
+  // Removes all tiles and melds, and resets all the other fields. The agari
+  // tile becomes CompactParsedHand::kUnknownTileCode.
+  void Clear();
+
+  // Appends a closed tile. Returns false if there's no room for it.
+  bool AddClosedTile(uint8_t code);
+
+  // Replaces closed tiles with the tiles of the given counts, which has
+  // kNumTileIndices entries. Returns false if there are too many tiles.
+  bool SetClosedTiles(const uint8_t* counts);
+
+  // Appends a meld. Returns false if there's no room for it.
+  bool AddMeld(HandElementType type, uint8_t tile);
+
+  void AddAgariState(AgariState state) { agari_states |= 1u << state; }
+  bool HasAgariState(AgariState state) const {
+    return (agari_states >> state) & 1;
+  }
+};
+
+// CompactField is a fixed-size value type that holds the same data as Field.
+struct CompactField {
+  // A dora indicator and 4 kan dora indicators.
+  static const int kMaxNumDora = 5;
+
+  TileType wind;
+
+  // Tile codes of dora and ura-dora tiles.
+  int num_dora;
+  uint8_t dora[kMaxNumDora];
+  int num_uradora;
+  uint8_t uradora[kMaxNumDora];
+
+  int honba;
+};
+
+// Converts the given hand into a compact one. Returns an error if the given
+// hand has too many tiles, melds or agari states, a malformed chii, or a tile
+// other than the agari tile that isn't concrete. CompactHand can't hold such
+// hands, so HandParser reports the same errors for them. Other checks are
+// left to HandParser::Validate. An agari tile that isn't concrete is stored
+// as CompactParsedHand::kUnknownTileCode.
+HandValidatorResult::Type ToCompactHand(const Hand& hand,
+                                        CompactHand* compact_hand);
+
+// Converts the given field into a compact one. Returns false if the given
+// field has too many dora or ura-dora tiles.
+bool ToCompactField(const Field& field, CompactField* compact_field);
+
+}  // namespace mahjong
+}  // namespace ycraft
+
+#endif  // SRC_COMPACT_HAND_H_
@@ -0,0 +1,248 @@
+// Copyright 2016 Yuki Hamada
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/compact_parsed_hand.h"
+
+#include "src/mahjong_common_util.h"
+
+namespace ycraft {
+namespace mahjong {
+
+namespace {
+// Returns the flag bit of the given tile state, or 0 if it can't be
+// represented.
+uint8_t GetTileStateFlag(TileState state) {
+  switch (state) {
+    case TileState::AGARI_HAI:
+      return CompactParsedHand::kAgariHai;
+    case TileState::AGARI_HAI_TSUMO:
+      return CompactParsedHand::kAgariHaiTsumo;
+    case TileState::AGARI_HAI_RON:
+      return CompactParsedHand::kAgariHaiRon;
+    default:
+      return 0;
+  }
+}
+
+// Returns the type of the given element completed by ron if is_ron is true,
+// or by tsumo otherwise.
+HandElementType GetAgariElementType(HandElementType type, bool is_ron) {
+  switch (type) {
+    case HandElementType::ANTOITSU:
+    case HandElementType::MINTOITSU:
+      return is_ron ? HandElementType::MINTOITSU : HandElementType::ANTOITSU;
+    case HandElementType::ANKOUTSU:
+    case HandElementType::MINKOUTSU:
+      return is_ron ? HandElementType::MINKOUTSU : HandElementType::ANKOUTSU;
+    case HandElementType::ANSHUNTSU:
+    case HandElementType::MINSHUNTSU:
+      return is_ron ? HandElementType::MINSHUNTSU : HandElementType::ANSHUNTSU;
+    default:
+      return type;
+  }
+}
+}  // namespace
+
+const int CompactParsedHand::kMaxNumElements;
+const int CompactParsedHand::kMaxNumTiles;
+const int CompactParsedHand::kMaxNumAgariStates;
+const uint8_t CompactParsedHand::kUnknownTileCode;
+const uint8_t CompactParsedHand::kAgariHai;
+const uint8_t CompactParsedHand::kAgariHaiTsumo;
+const uint8_t CompactParsedHand::kAgariHaiRon;
+
+TileType CompactParsedHand::tile_type(int i) const {
+  return tile[i] == kUnknownTileCode ? TileType::UNKNOWN_TILE
+                                     : GetTileTypeFromIndex(tile[i]);
+}
+
+uint8_t CompactParsedHand::GetTileCode(TileType type) {
+  const int index = GetTileIndex(type);
+  return index < 0 ? kUnknownTileCode : index;
+}
+
+void CompactParsedHand::Clear() {
+  num_elements = 0;
+  element_begin[0] = 0;
+  machi_type = MachiType::UNKNOWN_MACHI_TYPE;
+  agari_type = AgariType::UNKNOWN_AGARI_TYPE;
+  agari_format = AgariFormat::UNKNOWN_AGARI_FORMAT;
+  num_agari_states = 0;
+  signature = 0;
+  open_melds = nullptr;
+}
+
+bool CompactParsedHand::AddElement(HandElementType type) {
+  if (num_elements == kMaxNumElements) {
+    return false;
+  }
+  element_type[num_elements] = type;
+  element_begin[num_elements + 1] = element_begin[num_elements];
+  ++num_elements;
+  return true;
+}
+
+bool CompactParsedHand::AddTile(uint8_t code, uint8_t flags) {
+  const int i = num_tiles();
+  if (num_elements == 0 || i == kMaxNumTiles) {
+    return false;
+  }
+  tile[i] = code;
+  tile_flags[i] = flags;
+  ++element_begin[num_elements];
+  return true;
+}
+
+bool CompactParsedHand::CanMergeOpenMelds() const {
+  return open_melds == nullptr ||
+         (num_elements + open_melds->num_elements <= kMaxNumElements &&
+          num_tiles() + open_melds->num_tiles() <= kMaxNumTiles);
+}
+
+bool CompactParsedHand::MergeOpenMelds() {
+  if (!CanMergeOpenMelds()) {
+    return false;
+  }
+  if (open_melds == nullptr) {
+    return true;
+  }
+
+  const CompactParsedHand& melds = *open_melds;
+  open_melds = nullptr;
+  for (int i = 0; i < melds.num_elements; ++i) {
+    AddElement(melds.element_type[i]);
+    for (int j = melds.element_begin[i]; j < melds.element_begin[i + 1]; ++j) {
+      AddTile(melds.tile[j], melds.tile_flags[j]);
+    }
+  }
+  return true;
+}
+
+bool ToCompactParsedHand(const ParsedHand& parsed_hand,
+                         CompactParsedHand* compact_parsed_hand) {
+  compact_parsed_hand->Clear();
+  for (const Element& element : parsed_hand.element()) {
+    if (!compact_parsed_hand->AddElement(element.type())) {
+      return false;
+    }
+    for (const Tile& tile : element.tile()) {
+      uint8_t flags = 0;
+      for (const int state : tile.state()) {
+        const uint8_t flag = GetTileStateFlag(static_cast<TileState>(state));
+        if (flag == 0 || (flags & flag) != 0) {
+          return false;
+        }
+        flags |= flag;
+      }
+      if (!compact_parsed_hand->AddTile(
+              CompactParsedHand::GetTileCode(tile.type()), flags)) {
+        return false;
+      }
+    }
+  }
+
+  const Agari& agari = parsed_hand.agari();
+  if (agari.state_size() > CompactParsedHand::kMaxNumAgariStates) {
+    return false;
+  }
+  compact_parsed_hand->machi_type = parsed_hand.machi_type();
+  compact_parsed_hand->agari_type = agari.type();
+  compact_parsed_hand->agari_format = agari.format();
+  compact_parsed_hand->num_agari_states = agari.state_size();
+  for (int i = 0; i < agari.state_size(); ++i) {
+    compact_parsed_hand->agari_state[i] = agari.state(i);
+  }
+  compact_parsed_hand->signature = parsed_hand.signature();
+  return true;
+}
+
+void ToParsedHand(const CompactParsedHand& compact_parsed_hand,
+                  ParsedHand* parsed_hand) {
+  for (int i = 0; i < compact_parsed_hand.GetNumElements(); ++i) {
+    Element* element = parsed_hand->add_element();
+    element->set_type(compact_parsed_hand.GetElementType(i));
+    for (int j = compact_parsed_hand.GetElementBegin(i);
+         j < compact_parsed_hand.GetElementEnd(i); ++j) {
+      Tile* tile = element->add_tile();
+      tile->set_type(compact_parsed_hand.GetTileType(j));
+
+      const uint8_t flags = compact_parsed_hand.GetTileFlags(j);
+      if (flags & CompactParsedHand::kAgariHai) {
+        tile->add_state(TileState::AGARI_HAI);
+      }
+      if (flags & CompactParsedHand::kAgariHaiTsumo) {
+        tile->add_state(TileState::AGARI_HAI_TSUMO);
+      }
+      if (flags & CompactParsedHand::kAgariHaiRon) {
+        tile->add_state(TileState::AGARI_HAI_RON);
+      }
+    }
+  }
+
+  parsed_hand->set_machi_type(compact_parsed_hand.machi_type);
+  Agari* agari = parsed_hand->mutable_agari();
+  agari->set_type(compact_parsed_hand.agari_type);
+  for (int i = 0; i < compact_parsed_hand.num_agari_states; ++i) {
+    agari->add_state(compact_parsed_hand.agari_state[i]);
+  }
+  agari->set_format(compact_parsed_hand.agari_format);
+  parsed_hand->set_signature(compact_parsed_hand.signature);
+}
+
+bool IsMenzen(const CompactParsedHand& parsed_hand) {
+  for (int i = 0; i < parsed_hand.GetNumElements(); ++i) {
+    const HandElementType type = parsed_hand.GetElementType(i);
+    if (type != HandElementType::MINSHUNTSU &&
+        type != HandElementType::MINKOUTSU &&
+        type != HandElementType::MINKANTSU) {
+      continue;
+    }
+
+    // Same as IsMenzen for ParsedHand, a mentsu completed by a RON tile is
+    // still menzen.
+    bool contains_agari_tile = false;
+    for (int j = parsed_hand.GetElementBegin(i);
+         j < parsed_hand.GetElementEnd(i); ++j) {
+      contains_agari_tile |= parsed_hand.GetTileFlags(j) != 0;
+    }
+    if (!contains_agari_tile) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void SetAgariType(AgariType agari_type, CompactParsedHand* parsed_hand) {
+  const bool is_ron = agari_type == AgariType::RON;
+  const uint8_t agari_tile_flags =
+      is_ron ? CompactParsedHand::kAgariHaiRon
+             : CompactParsedHand::kAgariHaiTsumo;
+  parsed_hand->agari_type = agari_type;
+
+  // Open melds never contain the agari tile, so only own elements change.
+  for (int i = 0; i < parsed_hand->num_elements; ++i) {
+    for (int j = parsed_hand->element_begin[i];
+         j < parsed_hand->element_begin[i + 1]; ++j) {
+      uint8_t* const flags = &parsed_hand->tile_flags[j];
+      if (*flags != 0) {
+        *flags = (*flags & CompactParsedHand::kAgariHai) | agari_tile_flags;
+        parsed_hand->element_type[i] =
+            GetAgariElementType(parsed_hand->element_type[i], is_ron);
+      }
+    }
+  }
+}
+
+}  // namespace mahjong
+}  // namespace ycraft
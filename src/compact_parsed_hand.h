@@ -0,0 +1,169 @@
+// Copyright 2016 Yuki Hamada
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_COMPACT_PARSED_HAND_H_
+#define SRC_COMPACT_PARSED_HAND_H_
+
+#include <cstdint>
+
+#include "proto/mahjong_scorecalculator.pb.h"
+
+namespace ycraft {
+namespace mahjong {
+
+// CompactParsedHand is a fixed-size value type that holds the same data as
+// ParsedHand. HandParser, YakuApplier and FuCalculator work on this type, so
+// no memory is allocated per parsed hand until it is converted into the proto.
+//
+// Tiles of all elements are stored in a single array. Tiles of the i-th
+// element are in [element_begin[i], element_begin[i + 1]). Each tile is a
+// tile code, which is the tile index of its TileType (see GetTileIndex), with
+// flag bits for its TileState.
+//
+// Open melds are identical in all parsed hands of a hand, so HandParser keeps
+// them in a separate CompactParsedHand and each parsed hand refers to it by
+// open_melds instead of copying them. Consumers should access elements and
+// tiles through the Get* methods below, which see elements of the open melds
+// after elements of this parsed hand.
+struct CompactParsedHand {
+  // Chiitoitsu has the most elements.
+  static const int kMaxNumElements = 7;
+
+  // 4 kantsu and a toitsu.
+  static const int kMaxNumTiles = 18;
+
+  // The number of distinct AgariState values.
+  static const int kMaxNumAgariStates = 5;
+
+  // Tile code for a tile that doesn't have a tile index.
+  static const uint8_t kUnknownTileCode = 0xff;
+
+  // Flag bits of tile states.
+  static const uint8_t kAgariHai = 0x1;
+  static const uint8_t kAgariHaiTsumo = 0x2;
+  static const uint8_t kAgariHaiRon = 0x4;
+
+  int num_elements;
+  HandElementType element_type[kMaxNumElements];
+  uint8_t element_begin[kMaxNumElements + 1];
+
+  uint8_t tile[kMaxNumTiles];
+  uint8_t tile_flags[kMaxNumTiles];
+
+  MachiType machi_type;
+  AgariType agari_type;
+  AgariFormat agari_format;
+  int num_agari_states;
+  AgariState agari_state[kMaxNumAgariStates];
+
+  uint64_t signature;
+
+  // Open melds shared by parsed hands of a hand, or nullptr. This must outlive
+  // this parsed hand.
+  const CompactParsedHand* open_melds;
+
+  // Accessors of elements and tiles owned by this parsed hand.
+  int num_tiles() const { return element_begin[num_elements]; }
+  TileType tile_type(int i) const;
+
+  // Accessors of elements and tiles including the open melds.
+  int GetNumElements() const;
+  int GetNumTiles() const;
+  HandElementType GetElementType(int element) const;
+  int GetElementBegin(int element) const;
+  int GetElementEnd(int element) const;
+  TileType GetTileType(int tile) const;
+  uint8_t GetTileFlags(int tile) const;
+
+  // Returns the tile code of the given tile type.
+  static uint8_t GetTileCode(TileType type);
+
+  // Removes all elements, and resets all the other fields.
+  void Clear();
+
+  // Appends an element of the given type without any tile. Returns false if
+  // there's no room for it.
+  bool AddElement(HandElementType type);
+
+  // Appends a tile to the last element. Returns false if there's no room for
+  // it.
+  bool AddTile(uint8_t code, uint8_t flags);
+
+  // Returns true if elements of the open melds can be copied into this parsed
+  // hand.
+  bool CanMergeOpenMelds() const;
+
+  // Copies elements of the open melds into this parsed hand, so that this no
+  // longer refers to them. Returns false if there's no room for them.
+  bool MergeOpenMelds();
+};
+
+inline int CompactParsedHand::GetNumElements() const {
+  return num_elements + (open_melds ? open_melds->num_elements : 0);
+}
+
+inline int CompactParsedHand::GetNumTiles() const {
+  return num_tiles() + (open_melds ? open_melds->num_tiles() : 0);
+}
+
+inline HandElementType CompactParsedHand::GetElementType(int element) const {
+  return element < num_elements
+             ? element_type[element]
+             : open_melds->element_type[element - num_elements];
+}
+
+inline int CompactParsedHand::GetElementBegin(int element) const {
+  return element < num_elements || open_melds == nullptr
+             ? element_begin[element]
+             : num_tiles() + open_melds->element_begin[element - num_elements];
+}
+
+inline int CompactParsedHand::GetElementEnd(int element) const {
+  return GetElementBegin(element + 1);
+}
+
+inline TileType CompactParsedHand::GetTileType(int tile) const {
+  const int num_own_tiles = num_tiles();
+  return tile < num_own_tiles ? tile_type(tile)
+                              : open_melds->tile_type(tile - num_own_tiles);
+}
+
+inline uint8_t CompactParsedHand::GetTileFlags(int tile) const {
+  const int num_own_tiles = num_tiles();
+  return tile < num_own_tiles ? tile_flags[tile]
+                              : open_melds->tile_flags[tile - num_own_tiles];
+}
+
+// Converts the given parsed hand into a compact one. Returns false if the
+// given parsed hand has too many elements, tiles or agari states, or it has a
+// tile state that can't be represented.
+bool ToCompactParsedHand(const ParsedHand& parsed_hand,
+                         CompactParsedHand* compact_parsed_hand);
+
+// Converts the given compact parsed hand into the proto.
+void ToParsedHand(const CompactParsedHand& compact_parsed_hand,
+                  ParsedHand* parsed_hand);
+
+bool IsMenzen(const CompactParsedHand& parsed_hand);
+
+// Changes the agari type of the given parsed hand, i.e. the flags of the agari
+// tile and whether the element it completes is closed. The rest of a parsed
+// hand doesn't depend on the agari type, so a parsed hand of ron turns into
+// the one HandParser would generate for tsumo and vice versa.
+void SetAgariType(AgariType agari_type, CompactParsedHand* parsed_hand);
+
+}  // namespace mahjong
+}  // namespace ycraft
+
+#endif  // SRC_COMPACT_PARSED_HAND_H_
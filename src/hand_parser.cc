@@ -15,402 +15,1393 @@
 #include "src/hand_parser.h"
 
 #include <algorithm>
-#include <functional>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
-#include <set>
 
 #include "src/mahjong_common_util.h"
+#include "src/suit_decomposition_table.h"
+#include "src/tile_bitboard.h"
 
 namespace ycraft {
 namespace mahjong {
 
 namespace {
-inline bool CheckSame(const Tile& lhs, const Tile& rhs) {
-  if (lhs.type() != rhs.type() || lhs.state_size() != rhs.state_size()) {
+const int kMaxNumSignatureElements = 7;
+
+// Tile indices in [0, kNumJihaiTiles) are jihai tiles, and the rest are
+// HandParser::kNumSuits suits of SuitDecompositionTable::kNumTilesInSuit
+// tiles.
+const int kNumJihaiTiles = 7;
+
+// Tile indices of yaochuhai, i.e. jihai tiles and terminal tiles.
+const int kNumYaochuhaiKinds = 13;
+const int kYaochuhaiIndices[kNumYaochuhaiKinds] = {0,  1,  2,  3,  4,  5, 6,
+                                                   7,  15, 16, 24, 25, 33};
+
+// Returns true if the given tile counts form kokushi-musou, i.e. every kind
+// of yaochuhai appears and one of them makes a toitsu. The number of tiles
+// has to be 14.
+inline bool IsKokushi(const int* counts) {
+  int mask = 0;
+  int num_yaochuhai = 0;
+  for (int i = 0; i < kNumYaochuhaiKinds; ++i) {
+    const int count = counts[kYaochuhaiIndices[i]];
+    mask |= (count > 0) << i;
+    num_yaochuhai += count;
+  }
+  // If all 14 tiles are yaochuhai and all 13 kinds appear, exactly one of
+  // them appears twice.
+  return mask == (1 << kNumYaochuhaiKinds) - 1 && num_yaochuhai == 14;
+}
+
+// Adds num_tiles tiles of the given tile code to the counts. Returns false if
+// the tile code isn't a tile index.
+inline bool AddTileCount(int code, int num_tiles, int* counts) {
+  if (code >= kNumTileIndices) {
     return false;
   }
+  counts[code] += num_tiles;
+  return true;
+}
+
+inline int CountBits(uint32_t bits) {
+  int num_bits = 0;
+  for (; bits != 0; bits &= bits - 1) {
+    ++num_bits;
+  }
+  return num_bits;
+}
 
-  // This equality check is designed by assuming that the given state does not
-  // contain duplicated objects.
-  for (const int state : lhs.state()) {
-    if (std::find(rhs.state().begin(), rhs.state().end(),
-                  static_cast<TileState>(state)) == rhs.state().end()) {
+// Finds decompositions of tiles in the given suit.
+inline bool FindSuitDecompositions(const SuitDecompositionTable& table,
+                                   const int* counts, int suit,
+                                   const SuitDecomposition** begin,
+                                   const SuitDecomposition** end) {
+  const int* suit_counts =
+      counts + kNumJihaiTiles + suit * SuitDecompositionTable::kNumTilesInSuit;
+  for (int i = 0; i < SuitDecompositionTable::kNumTilesInSuit; ++i) {
+    if (suit_counts[i] > 4) {
       return false;
     }
   }
+  return table.Find(SuitDecompositionTable::Encode(suit_counts), begin, end);
+}
 
-  return true;
+// Returns the machi type of a parsed hand whose agari tile completes the
+// given element.
+inline MachiType GetMachiType(HandElementType element_type,
+                              int element_tile_index, int agari_tile_index) {
+  switch (element_type) {
+    case HandElementType::TOITSU:
+      return MachiType::TANKI;
+    case HandElementType::KOUTSU:
+      return MachiType::SHABO;
+    case HandElementType::SHUNTSU: {
+      if (agari_tile_index == element_tile_index + 1) {
+        return MachiType::KANCHAN;
+      }
+      // Only 12 waiting for 3 and 89 waiting for 7 are penchan. 34 waiting
+      // for 3 or 56 waiting for 7 are ryanmen.
+      const int offset = (element_tile_index - kNumJihaiTiles) %
+                         SuitDecompositionTable::kNumTilesInSuit;
+      if ((offset == 0 && agari_tile_index == element_tile_index + 2) ||
+          (offset == 6 && agari_tile_index == element_tile_index)) {
+        return MachiType::PENCHAN;
+      }
+      return MachiType::RYANMEN;
+    }
+    default:
+      std::cerr << "Unexpected hand element type: " << element_type
+                << std::endl;
+      return MachiType::UNKNOWN_MACHI_TYPE;
+  }
 }
 
-inline bool CheckSame(const Element& lhs, const Element& rhs) {
-  static bool is_used[10];
+// Computes a signature of a parsed hand. Among parsed hands of a same hand,
+// two parsed hands have the same signature if and only if they have the same
+// closed elements, the same machi type and format, and the agari tile
+// completes the same kind of element. The layout from the least significant
+// bit is:
+//   [0, 2): format
+//   [2, 5): machi kind
+//   [5, 8): position of the element completed by the agari tile in the sorted
+//           element codes
+//   [8, 64): up to 7 sorted element codes of 8 bits, each of which consists of
+//            the base type and the first tile index.
+inline uint64_t ComputeSignature(int num_elements,
+                                 const HandElementType* element_types,
+                                 const int* element_tile_indices,
+                                 int agari_element, MachiType machi_type,
+                                 AgariFormat format) {
+  uint8_t codes[kMaxNumSignatureElements];
+  uint8_t agari_code = 0;
+  for (int i = 0; i < num_elements; ++i) {
+    uint8_t code = element_tile_indices[i];
+    switch (element_types[i]) {
+      case HandElementType::TOITSU:
+        code |= 1 << 6;
+        break;
+      case HandElementType::KOUTSU:
+        code |= 2 << 6;
+        break;
+      default:
+        code |= 3 << 6;
+        break;
+    }
+    if (i == agari_element) {
+      agari_code = code;
+    }
 
-  if (lhs.type() != rhs.type()) return false;
-  if (lhs.tile_size() != rhs.tile_size()) return false;
+    // Insertion sort.
+    int j = i;
+    for (; j > 0 && codes[j - 1] > code; --j) {
+      codes[j] = codes[j - 1];
+    }
+    codes[j] = code;
+  }
 
-  memset(is_used, 0, sizeof(is_used));
-  for (const Tile& tile : lhs.tile()) {
-    bool found = false;
-    for (int i = 0; i < rhs.tile_size(); ++i) {
-      if (is_used[i]) continue;
-      if (!CheckSame(tile, rhs.tile(i))) continue;
-      is_used[i] = true;
-      found = true;
-      break;
+  uint64_t signature = 0;
+  int agari_position = 0;
+  for (int i = num_elements - 1; i >= 0; --i) {
+    signature = (signature << 8) | codes[i];
+    if (codes[i] == agari_code) {
+      agari_position = i;
     }
-    if (!found) return false;
   }
+  signature = (signature << 3) | agari_position;
+  signature = (signature << 3) | (machi_type & MachiType::MASK_MACHI_KIND);
+  signature = (signature << 2) | format;
+  return signature;
+}
 
-  return true;
+// Returns flag bits of the agari tile for the given agari type.
+inline uint8_t GetAgariTileFlags(AgariType agari_type) {
+  return agari_type == AgariType::TSUMO ? CompactParsedHand::kAgariHaiTsumo
+                                        : CompactParsedHand::kAgariHaiRon;
 }
 
-inline bool CheckSame(const ParsedHand& lhs, const ParsedHand& rhs) {
-  static bool is_used[10];
+// Returns the base type (TOITSU, KOUTSU or SHUNTSU) of the given type of a
+// closed element.
+inline HandElementType GetBaseType(HandElementType element_type) {
+  switch (element_type) {
+    case HandElementType::ANTOITSU:
+    case HandElementType::MINTOITSU:
+      return HandElementType::TOITSU;
+    case HandElementType::ANKOUTSU:
+    case HandElementType::MINKOUTSU:
+      return HandElementType::KOUTSU;
+    case HandElementType::ANSHUNTSU:
+    case HandElementType::MINSHUNTSU:
+      return HandElementType::SHUNTSU;
+    default:
+      return HandElementType::UNKNOWN_HAND_ELEMENT_TYPE;
+  }
+}
 
-  if (lhs.element_size() != rhs.element_size() ||
-      lhs.agari().format() != rhs.agari().format() ||
-      lhs.machi_type() != rhs.machi_type()) {
-    return false;
+// Returns the group of the given tile index: 0 for jihai tiles, and 1 plus
+// the suit for the others.
+inline int GetGroup(int tile_index) {
+  return tile_index < kNumJihaiTiles
+             ? 0
+             : 1 + (tile_index - kNumJihaiTiles) /
+                       SuitDecompositionTable::kNumTilesInSuit;
+}
+
+// Returns true if an element of the given base type starting at
+// element_tile_index contains a tile of tile_index.
+inline bool ContainsTileIndex(HandElementType element_type,
+                              int element_tile_index, int tile_index) {
+  if (element_type == HandElementType::SHUNTSU) {
+    return element_tile_index <= tile_index &&
+           tile_index <= element_tile_index + 2;
   }
+  return element_tile_index == tile_index;
+}
 
-  memset(is_used, 0, sizeof(is_used));
-  for (const Element& element : lhs.element()) {
-    bool found = false;
-    for (int i = 0; i < rhs.element_size(); ++i) {
-      if (is_used[i]) continue;
-      if (!CheckSame(element, rhs.element(i))) continue;
-      is_used[i] = true;
-      found = true;
-      break;
+// PhaseTimer adds the wall time of its scope to the given counter. It does
+// nothing if the counter is nullptr, so timing costs nothing unless stats are
+// collected.
+class PhaseTimer {
+ public:
+  explicit PhaseTimer(uint64_t* nanos) : nanos_(nanos) {
+    if (nanos_ != nullptr) {
+      start_ = std::chrono::steady_clock::now();
     }
-    if (!found) return false;
   }
 
-  return true;
+  ~PhaseTimer() {
+    if (nanos_ != nullptr) {
+      *nanos_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     std::chrono::steady_clock::now() - start_)
+                     .count();
+    }
+  }
+
+ private:
+  PhaseTimer(const PhaseTimer&) = delete;
+  PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+  uint64_t* const nanos_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+// Returns the given counter of the stats, or nullptr if there are no stats.
+inline uint64_t* GetCounter(HandParserStats* stats,
+                            uint64_t HandParserStats::*counter) {
+  return stats != nullptr ? &(stats->*counter) : nullptr;
 }
 }  // namespace
 
+void HandParserStats::Clear() {
+  num_hands = 0;
+  num_suit_lookups = 0;
+  num_decompositions = 0;
+  num_parsed_hands = 0;
+  num_duplicates = 0;
+  setup_nanos = 0;
+  regular_nanos = 0;
+  chiitoitsu_nanos = 0;
+  irregular_nanos = 0;
+  dedup_nanos = 0;
+}
+
+void HandParserStats::Add(const HandParserStats& other) {
+  num_hands += other.num_hands;
+  num_suit_lookups += other.num_suit_lookups;
+  num_decompositions += other.num_decompositions;
+  num_parsed_hands += other.num_parsed_hands;
+  num_duplicates += other.num_duplicates;
+  setup_nanos += other.setup_nanos;
+  regular_nanos += other.regular_nanos;
+  chiitoitsu_nanos += other.chiitoitsu_nanos;
+  irregular_nanos += other.irregular_nanos;
+  dedup_nanos += other.dedup_nanos;
+}
+
+HandParserBatchResult::HandParserBatchResult() : offsets_(1, 0) {}
+
+void HandParserBatchResult::Clear() {
+  parsed_hands_.clear();
+  offsets_.resize(1);
+  validator_results_.clear();
+}
+
+void HandParserBatchResult::Append(const HandParserBatchResult& other) {
+  const int base = parsed_hands_.size();
+  parsed_hands_.insert(parsed_hands_.end(), other.parsed_hands_.begin(),
+                       other.parsed_hands_.end());
+  for (int hand = 0; hand < other.num_hands(); ++hand) {
+    offsets_.push_back(base + other.offsets_[hand + 1]);
+  }
+  validator_results_.insert(validator_results_.end(),
+                            other.validator_results_.begin(),
+                            other.validator_results_.end());
+}
+
 HandParser::HandParser()
-    : hand_(nullptr), num_free_tiles_(0), result_(nullptr) {}
+    // Build the shared table up front so that the first Parse call doesn't
+    // pay for it.
+    : suit_table_(SuitDecompositionTable::GetInstance()) {}
+
+HandParser::HandParser(const SuitDecompositionTable& suit_table)
+    : suit_table_(suit_table) {}
 
 HandParser::~HandParser() {}
 
-void HandParser::Parse(const Hand& hand, HandParserResult* result) {
-  Setup(hand, result);
-  RunDfs();
-  CheckChiiToitsu();
-  CheckIrregular();
-  DeduplicateResult();
+void HandParser::Parse(const Hand& hand, HandParserResult* result) const {
+  CompactHand compact_hand;
+  const HandValidatorResult::Type validator_result =
+      ToCompactHand(hand, &compact_hand);
+  State state;
+  Setup(compact_hand, validator_result, nullptr, &state);
+  CollectParsedHands(&state, result);
 }
 
-void HandParser::Setup(const Hand& hand, HandParserResult* result) {
-  num_free_tiles_ = hand.closed_tile_size() + 1;
+void HandParser::Parse(const Hand& hand,
+                       std::vector<CompactParsedHand>* result) const {
+  CompactHand compact_hand;
+  const HandValidatorResult::Type validator_result =
+      ToCompactHand(hand, &compact_hand);
+  State state;
+  Setup(compact_hand, validator_result, nullptr, &state);
+  CollectParsedHands(&state, result);
+}
 
-  for (int i = 0; i < hand.closed_tile_size(); ++i) {
-    free_tiles_[i] = hand.closed_tile(i);
-  }
-  free_tiles_[num_free_tiles_ - 1] = hand.agari_tile();
+void HandParser::Parse(const CompactHand& hand,
+                       HandParserResult* result) const {
+  Parse(hand, result, nullptr);
+}
 
-  std::sort(free_tiles_, free_tiles_ + num_free_tiles_);
+void HandParser::Parse(const CompactHand& hand,
+                       std::vector<CompactParsedHand>* result) const {
+  Parse(hand, result, nullptr);
+}
 
-  memset(free_tile_group_ids_, 0,
-         num_free_tiles_ * sizeof(free_tile_group_ids_[0]));
+void HandParser::Parse(const CompactHand& hand, HandParserResult* result,
+                       HandParserStats* stats) const {
+  State state;
+  Setup(hand, HandValidatorResult::OK, stats, &state);
+  CollectParsedHands(&state, result);
+}
 
-  hand_ = &hand;
-  result_ = result;
+void HandParser::Parse(const CompactHand& hand,
+                       std::vector<CompactParsedHand>* result,
+                       HandParserStats* stats) const {
+  State state;
+  Setup(hand, HandValidatorResult::OK, stats, &state);
+  CollectParsedHands(&state, result);
 }
 
-void HandParser::RunDfs() { Dfs(0, 1, false); }
+void HandParser::ParseBatch(const CompactHand* hands, int num_hands,
+                            HandParserBatchResult* result) const {
+  ParseBatch(hands, num_hands, result, nullptr);
+}
 
-void HandParser::Dfs(int i, int id, bool has_jantou) {
-  if (i == num_free_tiles_ && has_jantou) {
-    AddAgarikeiResult(id - 1, AgariFormat::REGULAR_AGARI);
-    return;
+void HandParser::ParseBatch(const CompactHand* hands, int num_hands,
+                            HandParserBatchResult* result,
+                            HandParserStats* stats) const {
+  // A single state is set up again for each hand.
+  State state;
+  for (int i = 0; i < num_hands; ++i) {
+    Setup(hands[i], HandValidatorResult::OK, stats, &state);
+    CollectParsedHands(&state, &result->parsed_hands_);
+    result->offsets_.push_back(result->parsed_hands_.size());
+    result->validator_results_.push_back(state.validator_result);
   }
+}
 
-  if (free_tile_group_ids_[i]) {
-    Dfs(i + 1, id, has_jantou);
-    return;
+void HandParser::CollectParsedHands(State* state,
+                                    HandParserResult* result) const {
+  result->set_validator_result(state->validator_result);
+  result->set_is_ryanpeikou_chiitoitsu(state->is_ryanpeikou_chiitoitsu);
+  CompactParsedHand parsed_hand;
+  while (Next(state, &parsed_hand)) {
+    ToParsedHand(parsed_hand, result->add_parsed_hand());
+  }
+}
+
+void HandParser::CollectParsedHands(
+    State* state, std::vector<CompactParsedHand>* result) const {
+  CompactParsedHand parsed_hand;
+  while (Next(state, &parsed_hand)) {
+    // The open melds live in the state, so copy them into the parsed hand.
+    parsed_hand.MergeOpenMelds();
+    result->push_back(parsed_hand);
   }
+}
+
+HandValidatorResult::Type HandParser::Validate(const Hand& hand) const {
+  CompactHand compact_hand;
+  const HandValidatorResult::Type validator_result =
+      ToCompactHand(hand, &compact_hand);
+  if (validator_result != HandValidatorResult::OK) {
+    return validator_result;
+  }
+  return Validate(compact_hand);
+}
 
-  free_tile_group_ids_[i] = id;
+HandValidatorResult::Type HandParser::Validate(const CompactHand& hand) const {
+  return Validate(hand, true);
+}
 
-  // toitsu
-  if (!has_jantou) {
-    free_tile_element_types_[i] = HandElementType::TOITSU;
-    for (int j = i + 1; j < num_free_tiles_ && free_tiles_[i] == free_tiles_[j];
-         ++j) {
-      if (free_tile_group_ids_[j] == 0) {
-        free_tile_group_ids_[j] = id;
-        free_tile_element_types_[j] = HandElementType::TOITSU;
-        Dfs(j + 1, id + 1, true);
+HandValidatorResult::Type HandParser::Validate(const CompactHand& hand,
+                                               bool has_agari_tile) const {
+  // Check the sizes first, so that the rest never looks at an oversized hand.
+  if (hand.num_closed_tiles < 0 ||
+      hand.num_closed_tiles > CompactHand::kMaxNumClosedTiles ||
+      hand.num_melds < 0 || hand.num_melds > CompactHand::kMaxNumMelds ||
+      hand.num_closed_tiles + 3 * hand.num_melds != 13) {
+    return HandValidatorResult::ERROR_WRONG_NUM_TILES;
+  }
+  if (CountBits(hand.agari_states) > CompactParsedHand::kMaxNumAgariStates) {
+    return HandValidatorResult::ERROR_TOO_MANY_AGARI_STATES;
+  }
 
-        // Reset id.
-        free_tile_group_ids_[j] = 0;
+  // Count all the tiles of the hand including melds.
+  int counts[kNumTileIndices] = {};
+  for (int i = 0; i < hand.num_closed_tiles; ++i) {
+    if (!AddTileCount(hand.closed_tile[i], 1, counts)) {
+      return HandValidatorResult::ERROR_UNKNOWN_TILE;
+    }
+  }
+  if (has_agari_tile && !AddTileCount(hand.agari_tile, 1, counts)) {
+    return HandValidatorResult::ERROR_UNKNOWN_TILE;
+  }
+  for (int i = 0; i < hand.num_melds; ++i) {
+    const CompactHand::Meld& meld = hand.meld[i];
+    bool is_valid_meld = true;
+    switch (meld.type) {
+      case HandElementType::MINSHUNTSU:
+        if (!CanStartShuntsu(meld.tile)) {
+          return HandValidatorResult::ERROR_INVALID_CHII;
+        }
+        for (int j = 0; j < 3; ++j) {
+          AddTileCount(meld.tile + j, 1, counts);
+        }
         break;
-      }
+      case HandElementType::MINKOUTSU:
+        is_valid_meld = AddTileCount(meld.tile, 3, counts);
+        break;
+      case HandElementType::MINKANTSU:
+      case HandElementType::ANKANTSU:
+        is_valid_meld = AddTileCount(meld.tile, 4, counts);
+        break;
+      default:
+        is_valid_meld = false;
+        break;
+    }
+    if (!is_valid_meld) {
+      return HandValidatorResult::ERROR_UNKNOWN_TILE;
+    }
+  }
+
+  for (int index = 0; index < kNumTileIndices; ++index) {
+    if (counts[index] > 4) {
+      return HandValidatorResult::ERROR_TOO_MANY_SAME_TILES;
+    }
+  }
+  return HandValidatorResult::OK;
+}
+
+bool HandParser::IsAgari(const Hand& hand) const {
+  CompactHand compact_hand;
+  return ToCompactHand(hand, &compact_hand) == HandValidatorResult::OK &&
+         IsAgari(compact_hand);
+}
+
+bool HandParser::IsAgari(const CompactHand& hand) const {
+  if (Validate(hand) != HandValidatorResult::OK) {
+    return false;
+  }
+
+  int counts[kNumTileIndices] = {};
+  for (int i = 0; i < hand.num_closed_tiles; ++i) {
+    ++counts[hand.closed_tile[i]];
+  }
+  ++counts[hand.agari_tile];
+  return IsAgari(counts, hand.num_closed_tiles + 1, hand.num_melds != 0);
+}
+
+bool HandParser::IsAgari(const TileType* tiles, int num_tiles) const {
+  int counts[kNumTileIndices] = {};
+  for (int i = 0; i < num_tiles; ++i) {
+    const int index = GetTileIndex(tiles[i]);
+    if (index < 0) {
+      return false;
     }
+    ++counts[index];
+  }
+  return IsAgari(counts, num_tiles, num_tiles != 14);
+}
+
+bool HandParser::IsAgari(const int* counts, int num_tiles,
+                         bool has_naki) const {
+  if (num_tiles > 14 || num_tiles % 3 != 2) {
+    return false;
   }
 
-  // koutsu
+  // Regular format. Tiles of each suit can contain a jantou only when the
+  // number of the tiles is 3n + 2, so it's enough to count such suits.
   {
-    int counter = 0;
-    int using_tile_indices[2];
-    free_tile_element_types_[i] = HandElementType::KOUTSU;
-    for (int j = i + 1; j < num_free_tiles_ && free_tiles_[i] == free_tiles_[j];
-         ++j) {
-      if (free_tile_group_ids_[j] == 0) {
-        using_tile_indices[counter] = j;
-        ++counter;
-
-        free_tile_group_ids_[j] = id;
-        free_tile_element_types_[j] = HandElementType::KOUTSU;
-
-        if (counter == 2) {
-          Dfs(j + 1, id + 1, has_jantou);
-          break;
+    bool is_regular = true;
+    int num_jantou = 0;
+    for (int index = 0; index < kNumJihaiTiles && is_regular; ++index) {
+      if (counts[index] == 2) {
+        ++num_jantou;
+      } else if (counts[index] != 0 && counts[index] != 3) {
+        is_regular = false;
+      }
+    }
+    for (int suit = 0; suit < kNumSuits && is_regular; ++suit) {
+      const SuitDecomposition* begin;
+      const SuitDecomposition* end;
+      if (!FindSuitDecompositions(suit_table_, counts, suit, &begin, &end)) {
+        is_regular = false;
+      } else if (begin->has_jantou) {
+        ++num_jantou;
+      }
+    }
+    if (is_regular && num_jantou == 1) {
+      return true;
+    }
+  }
+
+  if (has_naki || num_tiles != 14) {
+    return false;
+  }
+
+  // Chiitoitsu and kokushi formats. Of 14 tiles, kokushi-musou is all 13
+  // kinds of yaochuhai and nothing else.
+  const TileBitboard board = TileBitboard::FromCounts(counts);
+  const TileBitboard yaochuhai = GetYaochuhaiMask();
+  return CountKinds(GetPairMask(board)) == 7 ||
+         (IsSubset(board, yaochuhai) &&
+          GetOccupiedMask(board) == yaochuhai);
+}
+
+HandValidatorResult::Type HandParser::GetMachi(const Hand& hand,
+                                               MachiSet* machi_set) const {
+  machi_set->Clear();
+  CompactHand compact_hand;
+  const HandValidatorResult::Type validator_result =
+      ToCompactHand(hand, &compact_hand);
+  if (validator_result != HandValidatorResult::OK) {
+    return validator_result;
+  }
+  return GetMachi(compact_hand, machi_set);
+}
+
+HandValidatorResult::Type HandParser::GetMachi(const CompactHand& hand,
+                                               MachiSet* machi_set) const {
+  machi_set->Clear();
+  const HandValidatorResult::Type validator_result = Validate(hand, false);
+  if (validator_result != HandValidatorResult::OK) {
+    return validator_result;
+  }
+
+  int counts[kNumTileIndices] = {};
+  for (int i = 0; i < hand.num_closed_tiles; ++i) {
+    ++counts[hand.closed_tile[i]];
+  }
+
+  GetRegularMachi(counts, machi_set);
+
+  if (hand.num_melds == 0) {
+    // Chiitoitsu waits for the single tile of 6 toitsu and a tile.
+    int num_toitsu = 0;
+    int single_tile_index = -1;
+    bool is_chiitoitsu = true;
+    for (int index = 0; index < kNumTileIndices && is_chiitoitsu; ++index) {
+      if (counts[index] == 2) {
+        ++num_toitsu;
+      } else if (counts[index] == 1 && single_tile_index < 0) {
+        single_tile_index = index;
+      } else if (counts[index] != 0) {
+        is_chiitoitsu = false;
+      }
+    }
+    if (is_chiitoitsu && num_toitsu == 6) {
+      machi_set->Add(single_tile_index, MachiType::TANKI);
+    }
+
+    // Kokushi-musou waits for any yaochuhai if it has all 13 kinds, or for
+    // the missing kind if it has 12 kinds and a toitsu.
+    int mask = 0;
+    int num_yaochuhai = 0;
+    for (int i = 0; i < kNumYaochuhaiKinds; ++i) {
+      const int count = counts[kYaochuhaiIndices[i]];
+      mask |= (count > 0) << i;
+      num_yaochuhai += count;
+    }
+    const int full_mask = (1 << kNumYaochuhaiKinds) - 1;
+    if (num_yaochuhai == 13 && mask == full_mask) {
+      for (int i = 0; i < kNumYaochuhaiKinds; ++i) {
+        machi_set->Add(kYaochuhaiIndices[i], MachiType::JUSANMEN);
+      }
+    } else if (num_yaochuhai == 13 &&
+               CountBits(mask) == kNumYaochuhaiKinds - 1) {
+      for (int i = 0; i < kNumYaochuhaiKinds; ++i) {
+        if (((mask >> i) & 1) == 0) {
+          machi_set->Add(kYaochuhaiIndices[i], MachiType::TANKI);
         }
       }
     }
+  }
 
-    // Reset IDs.
-    for (int j = 0; j < counter; ++j) {
-      free_tile_group_ids_[using_tile_indices[j]] = 0;
+  // The hand can't wait for a tile of which it holds all 4.
+  for (int i = 0; i < hand.num_melds; ++i) {
+    const CompactHand::Meld& meld = hand.meld[i];
+    if (meld.type == HandElementType::MINSHUNTSU) {
+      for (int j = 0; j < 3; ++j) {
+        ++counts[meld.tile + j];
+      }
+    } else {
+      counts[meld.tile] += meld.type == HandElementType::MINKOUTSU ? 3 : 4;
+    }
+  }
+  for (int index = 0; index < kNumTileIndices; ++index) {
+    if (counts[index] >= 4) {
+      machi_set->Remove(index);
     }
   }
+  return HandValidatorResult::OK;
+}
 
-  // shuntsu
-  if (IsSequentialTileType(free_tiles_[i])) {
-    int counter = 0;
-    int using_tile_indices[2];
-    free_tile_element_types_[i] = HandElementType::SHUNTSU;
-    TileType prev = free_tiles_[i];
-    for (int j = i + 1; j < num_free_tiles_ && free_tiles_[j] - prev <= 1;
-         ++j) {
-      if (free_tile_group_ids_[j] == 0 && free_tiles_[j] - prev == 1) {
-        using_tile_indices[counter] = j;
-        ++counter;
+void HandParser::GetRegularMachi(int* counts, MachiSet* machi_set) const {
+  // Free tiles are split into jihai tiles and 3 suits. Adding a tile only
+  // changes its own group, so the other groups are looked up only once.
+  const int kNumGroups = kNumSuits + 1;
+  bool is_valid_group[kNumGroups];
+  int num_group_jantou[kNumGroups];
 
-        prev = free_tiles_[j];
-        free_tile_group_ids_[j] = id;
-        free_tile_element_types_[j] = HandElementType::SHUNTSU;
+  int num_invalid_jihai = 0;
+  num_group_jantou[0] = 0;
+  for (int index = 0; index < kNumJihaiTiles; ++index) {
+    num_invalid_jihai += counts[index] == 1 || counts[index] == 4;
+    num_group_jantou[0] += counts[index] == 2;
+  }
+  is_valid_group[0] = num_invalid_jihai == 0;
 
-        if (counter == 2) {
-          Dfs(i + 1, id + 1, has_jantou);
-          break;
-        }
+  const SuitDecomposition* begin;
+  const SuitDecomposition* end;
+  for (int suit = 0; suit < kNumSuits; ++suit) {
+    is_valid_group[suit + 1] =
+        FindSuitDecompositions(suit_table_, counts, suit, &begin, &end);
+    num_group_jantou[suit + 1] =
+        is_valid_group[suit + 1] ? begin->has_jantou : 0;
+  }
+
+  int num_invalid_groups = 0;
+  int num_jantou = 0;
+  for (int group = 0; group < kNumGroups; ++group) {
+    num_invalid_groups += !is_valid_group[group];
+    num_jantou += num_group_jantou[group];
+  }
+
+  // Jihai tiles complete a toitsu or a koutsu.
+  if (num_invalid_groups - !is_valid_group[0] == 0) {
+    for (int index = 0; index < kNumJihaiTiles; ++index) {
+      const int count = counts[index];
+      if ((count != 1 && count != 2) || num_invalid_jihai != (count == 1)) {
+        continue;
       }
+      const int num_jihai_jantou =
+          num_group_jantou[0] + (count == 1) - (count == 2);
+      if (num_jantou - num_group_jantou[0] + num_jihai_jantou == 1) {
+        machi_set->Add(index,
+                       count == 1 ? MachiType::TANKI : MachiType::SHABO);
+      }
+    }
+  }
+
+  // A suit tile completes any element containing it in decompositions of
+  // its suit.
+  for (int suit = 0; suit < kNumSuits; ++suit) {
+    const int group = suit + 1;
+    if (num_invalid_groups - !is_valid_group[group] != 0) {
+      continue;
     }
+    const int base_index =
+        kNumJihaiTiles + suit * SuitDecompositionTable::kNumTilesInSuit;
+    for (int offset = 0; offset < SuitDecompositionTable::kNumTilesInSuit;
+         ++offset) {
+      const int index = base_index + offset;
+      ++counts[index];
+      const bool found =
+          FindSuitDecompositions(suit_table_, counts, suit, &begin, &end);
+      --counts[index];
+      if (!found ||
+          num_jantou - num_group_jantou[group] + begin->has_jantou != 1) {
+        continue;
+      }
 
-    // Reset IDs.
-    for (int j = 0; j < counter; ++j) {
-      free_tile_group_ids_[using_tile_indices[j]] = 0;
+      for (const SuitDecomposition* decomposition = begin;
+           decomposition != end; ++decomposition) {
+        for (int i = 0; i < decomposition->num_elements; ++i) {
+          const HandElementType element_type = decomposition->element_type[i];
+          const int element_tile_index =
+              base_index + decomposition->element_offset[i];
+          if (ContainsTileIndex(element_type, element_tile_index, index)) {
+            machi_set->Add(index, GetMachiType(element_type,
+                                               element_tile_index, index));
+          }
+        }
+      }
     }
   }
+}
+
+void HandParser::Setup(const CompactHand& hand,
+                       HandValidatorResult::Type validator_result,
+                       HandParserStats* stats, State* state) const {
+  PhaseTimer timer(GetCounter(stats, &HandParserStats::setup_nanos));
+  if (stats != nullptr) {
+    ++stats->num_hands;
+  }
+  ResetState(hand, stats, state);
 
-  // Reset ID.
-  free_tile_group_ids_[i] = 0;
+  // Reject malformed hands before touching the rest of the state.
+  if (validator_result == HandValidatorResult::OK) {
+    validator_result = Validate(hand);
+  }
+  state->validator_result = validator_result;
+  if (validator_result != HandValidatorResult::OK) {
+    return;
+  }
+
+  SetupTiles(hand, state);
+  state->agari_tile_index = hand.agari_tile;
+  AddFreeTile(state->agari_tile_index, state);
+
+  // A hand can be both regular and chiitoitsu only if it's ryanpeikou, so the
+  // two flags together tell callers to compare both formats.
+  const bool is_regular = SetupSuitTableLookup(state);
+  state->is_chiitoitsu = IsChiiToitsu(*state);
+  state->is_ryanpeikou_chiitoitsu = is_regular && state->is_chiitoitsu;
+  state->phase = is_regular ? State::REGULAR : State::CHIITOITSU;
 }
 
-void HandParser::CheckChiiToitsu() {
-  if (hand_->chiied_tile_size() != 0 || hand_->ponned_tile_size() != 0 ||
-      hand_->kanned_tile_size() != 0) {
+void HandParser::SetupWaitingHand(const CompactHand& hand, State* state,
+                                  bool* is_valid_group) const {
+  ResetState(hand, nullptr, state);
+  state->validator_result = Validate(hand, false);
+  if (state->validator_result != HandValidatorResult::OK) {
     return;
   }
 
-  std::set<TileType> used_tiles;
-  for (int i = 1; i < num_free_tiles_; i += 2) {
-    if (free_tiles_[i - 1] != free_tiles_[i]) {
-      return;
+  SetupTiles(hand, state);
+  state->agari_tile_index = CompactParsedHand::kUnknownTileCode;
+  is_valid_group[0] = SetupJihaiElements(state);
+  for (int suit = 0; suit < kNumSuits; ++suit) {
+    is_valid_group[suit + 1] = LookupSuit(suit, state);
+  }
+}
+
+bool HandParser::CompleteWaitingHand(int agari_tile_index,
+                                     const bool* is_valid_group,
+                                     State* state) const {
+  state->agari_tile_index = agari_tile_index;
+  AddFreeTile(agari_tile_index, state);
+
+  // Only the group of the agari tile changes, so the other groups keep the
+  // elements and the lookups of the waiting hand.
+  const int agari_group =
+      agari_tile_index < kNumJihaiTiles
+          ? 0
+          : 1 + (agari_tile_index - kNumJihaiTiles) /
+                    SuitDecompositionTable::kNumTilesInSuit;
+  bool is_regular = agari_group == 0 ? SetupJihaiElements(state)
+                                     : LookupSuit(agari_group - 1, state);
+  int num_jantou = state->num_jihai_jantou;
+  for (int group = 0; group <= kNumSuits && is_regular; ++group) {
+    if (group != agari_group) {
+      is_regular = is_valid_group[group];
     }
-    if (!used_tiles.insert(free_tiles_[i]).second) {
-      return;
+    if (group > 0 && is_regular) {
+      num_jantou += state->suit_begins[group - 1]->has_jantou;
     }
   }
-  if (used_tiles.size() != 7) {
-    return;
+  is_regular = is_regular && num_jantou == 1;
+  state->has_started_suit_table_lookup = false;
+
+  state->is_chiitoitsu = IsChiiToitsu(*state);
+  state->is_ryanpeikou_chiitoitsu = is_regular && state->is_chiitoitsu;
+  state->phase = is_regular ? State::REGULAR : State::CHIITOITSU;
+  return is_regular || state->is_chiitoitsu ||
+         (state->melds.num_elements == 0 && state->num_free_tiles == 14 &&
+          IsKokushi(state->free_tile_counts));
+}
+
+void HandParser::ResetState(const CompactHand& hand, HandParserStats* stats,
+                            State* state) {
+  state->stats = stats;
+  state->hand = &hand;
+  state->phase = State::DONE;
+  state->format = AgariFormat::UNKNOWN_AGARI_FORMAT;
+  state->num_elements = 0;
+  state->next_agari_element = 0;
+  state->is_chiitoitsu = false;
+  state->is_ryanpeikou_chiitoitsu = false;
+}
+
+void HandParser::SetupTiles(const CompactHand& hand, State* state) {
+  memset(state->signatures, 0, sizeof(state->signatures));
+  memset(state->free_tile_counts, 0, sizeof(state->free_tile_counts));
+  state->num_free_tiles = 0;
+  state->occupied_tiles = 0;
+  state->paired_tiles = 0;
+  for (int i = 0; i < hand.num_closed_tiles; ++i) {
+    AddFreeTile(hand.closed_tile[i], state);
+  }
+
+  // Melds of a valid hand always fit in CompactParsedHand.
+  CompactParsedHand* melds = &state->melds;
+  melds->Clear();
+  for (int i = 0; i < hand.num_melds; ++i) {
+    const CompactHand::Meld& meld = hand.meld[i];
+    melds->AddElement(meld.type);
+    switch (meld.type) {
+      case HandElementType::MINSHUNTSU:
+        for (int j = 0; j < 3; ++j) {
+          melds->AddTile(meld.tile + j, 0);
+        }
+        break;
+      case HandElementType::MINKOUTSU:
+        for (int j = 0; j < 3; ++j) {
+          melds->AddTile(meld.tile, 0);
+        }
+        break;
+      default:
+        for (int j = 0; j < 4; ++j) {
+          melds->AddTile(meld.tile, 0);
+        }
+        break;
+    }
   }
+}
 
-  for (int i = 1; i < num_free_tiles_; i += 2) {
-    free_tile_group_ids_[i - 1] = free_tile_group_ids_[i] = 1 + i / 2;
-    free_tile_element_types_[i - 1] = free_tile_element_types_[i] =
-        HandElementType::TOITSU;
+void HandParser::AddFreeTile(int index, State* state) {
+  ++state->num_free_tiles;
+  const uint64_t bit = static_cast<uint64_t>(1) << index;
+  state->occupied_tiles |= bit;
+  if (++state->free_tile_counts[index] == 2) {
+    state->paired_tiles |= bit;
+  } else {
+    state->paired_tiles &= ~bit;
   }
+}
 
-  AddAgarikeiResult(7, AgariFormat::CHITOITSU_AGARI);
+bool HandParser::Next(State* state, CompactParsedHand* parsed_hand) const {
+  HandParserStats* const stats = state->stats;
+  while (true) {
+    {
+      PhaseTimer timer(GetCounter(stats,
+                                  state->format == AgariFormat::CHITOITSU_AGARI
+                                      ? &HandParserStats::chiitoitsu_nanos
+                                      : &HandParserStats::regular_nanos));
+      if (NextAgarikeiResult(state, parsed_hand)) {
+        if (stats != nullptr) {
+          ++stats->num_parsed_hands;
+        }
+        return true;
+      }
+    }
 
-  // Reset IDs.
-  memset(free_tile_group_ids_, 0,
-         num_free_tiles_ * sizeof(free_tile_group_ids_[0]));
+    switch (state->phase) {
+      case State::REGULAR: {
+        PhaseTimer timer(GetCounter(stats, &HandParserStats::regular_nanos));
+        if (!NextSuitDecomposition(state)) {
+          state->phase = State::CHIITOITSU;
+        } else if (stats != nullptr) {
+          ++stats->num_decompositions;
+        }
+        break;
+      }
+      case State::CHIITOITSU: {
+        PhaseTimer timer(GetCounter(stats, &HandParserStats::chiitoitsu_nanos));
+        state->phase = State::IRREGULAR;
+        if (CheckChiiToitsu(state) && stats != nullptr) {
+          ++stats->num_decompositions;
+        }
+        break;
+      }
+      case State::IRREGULAR: {
+        PhaseTimer timer(GetCounter(stats, &HandParserStats::irregular_nanos));
+        state->phase = State::DONE;
+        if (CheckIrregular(state, parsed_hand)) {
+          if (stats != nullptr) {
+            ++stats->num_decompositions;
+            ++stats->num_parsed_hands;
+          }
+          return true;
+        }
+        break;
+      }
+      case State::DONE:
+        return false;
+    }
+  }
 }
 
-void HandParser::CheckIrregular() {
-  if (num_free_tiles_ != 14) {
-    return;
+bool HandParser::SetupSuitTableLookup(State* state) const {
+  if (!SetupJihaiElements(state)) {
+    return false;
+  }
+
+  // Whether a suit has a jantou only depends on the number of its tiles, so
+  // all decompositions of a suit agree on it.
+  int num_jantou = state->num_jihai_jantou;
+  for (int suit = 0; suit < kNumSuits; ++suit) {
+    if (!LookupSuit(suit, state)) {
+      return false;
+    }
+    num_jantou += state->suit_begins[suit]->has_jantou;
   }
+  if (num_jantou != 1) {
+    return false;
+  }
+  state->has_started_suit_table_lookup = false;
+  return true;
+}
 
-  ParsedHand* parsed_hand = result_->add_parsed_hand();
-  *parsed_hand->mutable_agari() = hand_->agari();
-  parsed_hand->mutable_agari()->set_format(AgariFormat::IRREGULAR_AGARI);
+bool HandParser::SetupJihaiElements(State* state) const {
+  state->num_jihai_elements = 0;
+  state->num_jihai_jantou = 0;
+  for (int index = 0; index < kNumJihaiTiles; ++index) {
+    switch (state->free_tile_counts[index]) {
+      case 0:
+        break;
+      case 2:
+        ++state->num_jihai_jantou;
+        state->element_types[state->num_jihai_elements] =
+            HandElementType::TOITSU;
+        state->element_tile_indices[state->num_jihai_elements++] = index;
+        break;
+      case 3:
+        state->element_types[state->num_jihai_elements] =
+            HandElementType::KOUTSU;
+        state->element_tile_indices[state->num_jihai_elements++] = index;
+        break;
+      default:
+        return false;
+    }
+  }
+  return true;
+}
 
-  Element* element = parsed_hand->add_element();
-  element->set_type(HandElementType::UNKNOWN_HAND_ELEMENT_TYPE);
-  for (const int closed_tile : hand_->closed_tile()) {
-    Tile* tile = element->add_tile();
-    tile->set_type(static_cast<TileType>(closed_tile));
+bool HandParser::LookupSuit(int suit, State* state) const {
+  if (state->stats != nullptr) {
+    ++state->stats->num_suit_lookups;
+  }
+  if (!FindSuitDecompositions(suit_table_, state->free_tile_counts, suit,
+                              &state->suit_begins[suit],
+                              &state->suit_ends[suit])) {
+    return false;
   }
-  Tile* tile = element->add_tile();
-  tile->set_type(hand_->agari_tile());
-  tile->add_state((hand_->agari().type() == AgariType::TSUMO)
-                      ? TileState::AGARI_HAI_TSUMO
-                      : TileState::AGARI_HAI_RON);
+  state->suit_decompositions[suit] = state->suit_begins[suit];
+  return true;
 }
 
-void HandParser::AddAgarikeiResult(int last_id, const AgariFormat& format) {
-  for (int agari_group_id = 1; agari_group_id <= last_id; ++agari_group_id) {
-    bool valid_agari_group_id = false;
-    for (int i = 0; i < num_free_tiles_; ++i) {
-      if (free_tile_group_ids_[i] == agari_group_id &&
-          free_tiles_[i] == hand_->agari_tile()) {
-        valid_agari_group_id = true;
+bool HandParser::NextSuitDecomposition(State* state) const {
+  const SuitDecomposition** decompositions = state->suit_decompositions;
+
+  // Advance the cursor like nested loops of manzu, souzu and pinzu. The first
+  // call stays at the first decompositions.
+  if (!state->has_started_suit_table_lookup) {
+    state->has_started_suit_table_lookup = true;
+  } else {
+    int suit = kNumSuits - 1;
+    for (; suit >= 0; --suit) {
+      if (++decompositions[suit] != state->suit_ends[suit]) {
         break;
       }
+      decompositions[suit] = state->suit_begins[suit];
+    }
+    if (suit < 0) {
+      return false;
+    }
+  }
+
+  // SetupSuitTableLookup has checked that every combination has exactly one
+  // jantou.
+  state->format = AgariFormat::REGULAR_AGARI;
+  state->num_elements = state->num_jihai_elements;
+  for (int suit = 0; suit < kNumSuits; ++suit) {
+    AppendSuitDecomposition(suit, *decompositions[suit], state);
+  }
+  state->next_agari_element = 0;
+  return true;
+}
+
+void HandParser::AppendSuitDecomposition(
+    int suit, const SuitDecomposition& decomposition, State* state) const {
+  const int base_index =
+      kNumJihaiTiles + suit * SuitDecompositionTable::kNumTilesInSuit;
+  for (int i = 0; i < decomposition.num_elements; ++i) {
+    state->element_types[state->num_elements] = decomposition.element_type[i];
+    state->element_tile_indices[state->num_elements++] =
+        base_index + decomposition.element_offset[i];
+  }
+}
+
+bool HandParser::IsChiiToitsu(const State& state) const {
+  // 14 tiles where every kind appears exactly twice are 7 distinct toitsu.
+  return state.melds.num_elements == 0 && state.num_free_tiles == 14 &&
+         state.occupied_tiles == state.paired_tiles;
+}
+
+bool HandParser::CheckChiiToitsu(State* state) const {
+  if (!state->is_chiitoitsu) {
+    return false;
+  }
+
+  state->num_elements = 0;
+  uint64_t paired_tiles = state->paired_tiles;
+  for (int index = 0; paired_tiles != 0; ++index, paired_tiles >>= 1) {
+    if (paired_tiles & 1) {
+      state->element_types[state->num_elements] = HandElementType::TOITSU;
+      state->element_tile_indices[state->num_elements++] = index;
     }
+  }
 
-    if (!valid_agari_group_id) {
+  state->format = AgariFormat::CHITOITSU_AGARI;
+  state->next_agari_element = 0;
+  return true;
+}
+
+bool HandParser::CheckIrregular(State* state,
+                                CompactParsedHand* parsed_hand) const {
+  // Kokushi-musou is the only irregular format.
+  if (state->melds.num_elements != 0 || state->num_free_tiles != 14 ||
+      !IsKokushi(state->free_tile_counts)) {
+    return false;
+  }
+
+  // It's the 13-sided wait if the agari tile makes the toitsu.
+  const MachiType machi_type =
+      state->free_tile_counts[state->agari_tile_index] == 2
+          ? MachiType::JUSANMEN
+          : MachiType::TANKI;
+
+  const CompactHand& hand = *state->hand;
+  SetupParsedHand(AgariFormat::IRREGULAR_AGARI, *state, parsed_hand);
+  parsed_hand->machi_type = machi_type;
+  parsed_hand->signature = ComputeSignature(
+      0, nullptr, nullptr, -1, machi_type, AgariFormat::IRREGULAR_AGARI);
+
+  // 14 tiles always fit in a single element.
+  parsed_hand->AddElement(HandElementType::UNKNOWN_HAND_ELEMENT_TYPE);
+  for (int i = 0; i < hand.num_closed_tiles; ++i) {
+    parsed_hand->AddTile(hand.closed_tile[i], 0);
+  }
+  parsed_hand->AddTile(hand.agari_tile, GetAgariTileFlags(hand.agari_type));
+  return true;
+}
+
+bool HandParser::NextAgarikeiResult(State* state,
+                                    CompactParsedHand* parsed_hand) const {
+  const CompactHand& hand = *state->hand;
+  const AgariFormat format = state->format;
+  const int num_elements = state->num_elements;
+  const HandElementType* element_types = state->element_types;
+  const int* element_tile_indices = state->element_tile_indices;
+
+  const bool is_ron = IsAgariTypeMatched(AgariType::RON, hand.agari_type);
+  const uint8_t agari_tile_flags = GetAgariTileFlags(hand.agari_type);
+
+  while (state->next_agari_element < num_elements) {
+    const int agari_element = state->next_agari_element++;
+    if (!ContainsTileIndex(element_types[agari_element],
+                           element_tile_indices[agari_element],
+                           state->agari_tile_index)) {
       continue;
     }
 
-    ParsedHand* parsed_hand = result_->add_parsed_hand();
+    const MachiType machi_type = GetMachiType(
+        element_types[agari_element], element_tile_indices[agari_element],
+        state->agari_tile_index);
+    bool is_duplicate;
+    uint64_t signature;
+    {
+      PhaseTimer timer(
+          GetCounter(state->stats, &HandParserStats::dedup_nanos));
+      signature =
+          ComputeSignature(num_elements, element_types, element_tile_indices,
+                           agari_element, machi_type, format);
+      is_duplicate = !InsertSignature(signature, state);
+    }
+    if (is_duplicate) {
+      if (state->stats != nullptr) {
+        ++state->stats->num_duplicates;
+      }
+      continue;
+    }
 
-    *parsed_hand->mutable_agari() = hand_->agari();
-    parsed_hand->mutable_agari()->set_format(format);
+    SetupParsedHand(format, *state, parsed_hand);
+    parsed_hand->machi_type = machi_type;
+    parsed_hand->signature = signature;
 
     // Parse closed tiles
-    for (int id = 1; id <= last_id; ++id) {
-      Element* element = parsed_hand->add_element();
-
-      // Set element type.
-      for (int i = 0; i < num_free_tiles_; ++i) {
-        if (free_tile_group_ids_[i] == id) {
-          bool contains_ron_hai =
-              (id == agari_group_id &&
-               IsAgariTypeMatched(AgariType::RON, hand_->agari().type()));
-          if (IsHandElementTypeMatched(HandElementType::TOITSU,
-                                       free_tile_element_types_[i])) {
-            element->set_type(contains_ron_hai ? HandElementType::MINTOITSU
-                                               : HandElementType::ANTOITSU);
-          } else if (IsHandElementTypeMatched(HandElementType::KOUTSU,
-                                              free_tile_element_types_[i])) {
-            element->set_type(contains_ron_hai ? HandElementType::MINKOUTSU
-                                               : HandElementType::ANKOUTSU);
-          } else if (IsHandElementTypeMatched(HandElementType::SHUNTSU,
-                                              free_tile_element_types_[i])) {
-            element->set_type(contains_ron_hai ? HandElementType::MINSHUNTSU
-                                               : HandElementType::ANSHUNTSU);
-          } else {
-            std::cerr << "Unexpected HandElementType: "
-                      << HandElementType_Name(free_tile_element_types_[i])
-                      << std::endl;
-          }
+    bool fits = true;
+    for (int i = 0; i < num_elements && fits; ++i) {
+      const bool contains_ron_hai = (i == agari_element && is_ron);
+
+      HandElementType type = HandElementType::UNKNOWN_HAND_ELEMENT_TYPE;
+      int num_tiles = 0;
+      int tile_index_step = 0;
+      switch (element_types[i]) {
+        case HandElementType::TOITSU:
+          type = contains_ron_hai ? HandElementType::MINTOITSU
+                                  : HandElementType::ANTOITSU;
+          num_tiles = 2;
+          break;
+        case HandElementType::KOUTSU:
+          type = contains_ron_hai ? HandElementType::MINKOUTSU
+                                  : HandElementType::ANKOUTSU;
+          num_tiles = 3;
+          break;
+        case HandElementType::SHUNTSU:
+          type = contains_ron_hai ? HandElementType::MINSHUNTSU
+                                  : HandElementType::ANSHUNTSU;
+          num_tiles = 3;
+          tile_index_step = 1;
+          break;
+        default:
+          std::cerr << "Unexpected HandElementType: "
+                    << HandElementType_Name(element_types[i]) << std::endl;
           break;
-        }
       }
+      fits = parsed_hand->AddElement(type);
 
       // Set tiles
       bool has_set_agari_tile = false;
-      for (int i = 0; i < num_free_tiles_; ++i) {
-        if (free_tile_group_ids_[i] == id) {
-          Tile* tile = element->add_tile();
-          tile->set_type(free_tiles_[i]);
-
-          if (!has_set_agari_tile && free_tiles_[i] == hand_->agari_tile() &&
-              id == agari_group_id) {
-            has_set_agari_tile = true;
-            tile->add_state((hand_->agari().type() == AgariType::TSUMO)
-                                ? TileState::AGARI_HAI_TSUMO
-                                : TileState::AGARI_HAI_RON);
-
-            // Set matchi type.
-            if (IsHandElementTypeMatched(HandElementType::TOITSU,
-                                         free_tile_element_types_[i])) {
-              parsed_hand->set_machi_type(MachiType::TANKI);
-            } else if (IsHandElementTypeMatched(HandElementType::KOUTSU,
-                                                free_tile_element_types_[i])) {
-              parsed_hand->set_machi_type(MachiType::SHABO);
-            } else if (IsHandElementTypeMatched(HandElementType::SHUNTSU,
-                                                free_tile_element_types_[i])) {
-              // free_tiles_[] is sorted in ascendant order and we add tiles
-              // into element in the same manner. Thus, if the current element
-              // tile size is 2, that means this tile is the middle tile of
-              // shuntsu.
-              if (element->tile_size() == 2) {
-                parsed_hand->set_machi_type(MachiType::KANCHAN);
-              } else {
-                if (IsTileTypeMatched(TileType::TILE_3, free_tiles_[i]) ||
-                    IsTileTypeMatched(TileType::TILE_7, free_tiles_[i])) {
-                  parsed_hand->set_machi_type(MachiType::PENCHAN);
-                } else {
-                  parsed_hand->set_machi_type(MachiType::RYANMEN);
-                }
-              }
-            } else {
-              std::cerr << "Unexpected hand element type: "
-                        << free_tile_element_types_[i] << std::endl;
-            }
-          }
+      for (int j = 0; j < num_tiles && fits; ++j) {
+        const int tile_index = element_tile_indices[i] + j * tile_index_step;
+        uint8_t flags = 0;
+        if (i == agari_element && !has_set_agari_tile &&
+            tile_index == state->agari_tile_index) {
+          has_set_agari_tile = true;
+          flags = agari_tile_flags;
         }
+        fits = parsed_hand->AddTile(tile_index, flags);
       }
     }
 
-    // Parse Naki tiles
-    for (int i = 0; i < hand_->chiied_tile_size(); ++i) {
-      const Hand_Chii& chiied_tile = hand_->chiied_tile(i);
+    // Refer to Naki tiles
+    if (fits && state->melds.num_elements > 0) {
+      parsed_hand->open_melds = &state->melds;
+      fits = parsed_hand->CanMergeOpenMelds();
+    }
 
-      Element* element = parsed_hand->add_element();
-      element->set_type(HandElementType::MINSHUNTSU);
-      for (int j = 0; j < chiied_tile.tile_size(); ++j) {
-        Tile* tile = element->add_tile();
-        tile->set_type(chiied_tile.tile(j));
-      }
+    // Skip the parsed hand if the hand has too many tiles to be a valid hand.
+    if (fits) {
+      return true;
     }
+  }
+  return false;
+}
 
-    for (int i = 0; i < hand_->ponned_tile_size(); ++i) {
-      const Hand_Pon& ponned_tile = hand_->ponned_tile(i);
+void HandParser::SetupParsedHand(const AgariFormat& format, const State& state,
+                                 CompactParsedHand* parsed_hand) const {
+  const CompactHand& hand = *state.hand;
+  parsed_hand->Clear();
+  parsed_hand->agari_type = hand.agari_type;
+  parsed_hand->agari_format = format;
 
-      Element* element = parsed_hand->add_element();
-      element->set_type(HandElementType::MINKOUTSU);
-      for (int j = 0; j < 3; ++j) {
-        Tile* tile = element->add_tile();
-        tile->set_type(ponned_tile.tile());
-      }
+  // Validate has checked the number of agari states.
+  int num_agari_states = 0;
+  uint32_t agari_states = hand.agari_states;
+  for (int i = 0; agari_states != 0; ++i, agari_states >>= 1) {
+    if (agari_states & 1) {
+      parsed_hand->agari_state[num_agari_states++] =
+          static_cast<AgariState>(i);
     }
+  }
+  parsed_hand->num_agari_states = num_agari_states;
+}
 
-    for (int i = 0; i < hand_->kanned_tile_size(); ++i) {
-      const Hand_Kan& kanned_tile = hand_->kanned_tile(i);
+bool HandParser::InsertSignature(uint64_t signature, State* state) {
+  // Signatures are never zero, so zero marks an empty slot.
+  const int mask = kSignatureSetSize - 1;
+  for (int i = 0, slot = (signature ^ (signature >> 29)) & mask;
+       i < kSignatureSetSize; ++i, slot = (slot + 1) & mask) {
+    if (state->signatures[slot] == signature) {
+      return false;
+    }
+    if (state->signatures[slot] == 0) {
+      state->signatures[slot] = signature;
+      return true;
+    }
+  }
+  // The set is full. Keep the parsed hand rather than dropping a valid one.
+  return true;
+}
 
-      Element* element = parsed_hand->add_element();
-      element->set_type(kanned_tile.is_closed() ? HandElementType::ANKANTSU
-                                                : HandElementType::MINKANTSU);
-      for (int j = 0; j < 4; ++j) {
-        Tile* tile = element->add_tile();
-        tile->set_type(kanned_tile.tile());
-      }
+void HandParser::PermuteParsedHands(const SuitPermutation& permutation,
+                                    const CompactHand& hand,
+                                    CompactParsedHand* parsed_hands,
+                                    int num_parsed_hands) const {
+  // Regular parsed hands are ordered by the decompositions of each suit of
+  // the hand, the same as the nested loops of NextSuitDecomposition.
+  if (num_parsed_hands == 0) {
+    return;
+  }
+  int counts[kNumTileIndices] = {};
+  for (int i = 0; i < hand.num_closed_tiles; ++i) {
+    AddTileCount(hand.closed_tile[i], 1, counts);
+  }
+  AddTileCount(hand.agari_tile, 1, counts);
+  const SuitDecomposition* suit_begins[kNumSuits] = {};
+  const SuitDecomposition* suit_ends[kNumSuits] = {};
+  for (int suit = 0; suit < kNumSuits; ++suit) {
+    if (!FindSuitDecompositions(suit_table_, counts, suit, &suit_begins[suit],
+                                &suit_ends[suit])) {
+      suit_begins[suit] = suit_ends[suit] = nullptr;
     }
   }
+
+  // Sort by the keys, breaking ties by the current order.
+  std::vector<CompactParsedHand> permuted_hands(parsed_hands,
+                                           parsed_hands + num_parsed_hands);
+  std::vector<std::pair<uint64_t, int>> keys(num_parsed_hands);
+  for (int i = 0; i < num_parsed_hands; ++i) {
+    PermuteSuits(permutation, &permuted_hands[i]);
+    keys[i].first = RestoreParsedHand(hand.num_melds, suit_begins, suit_ends,
+                                      &permuted_hands[i]);
+    keys[i].second = i;
+  }
+  std::sort(keys.begin(), keys.end());
+  for (int i = 0; i < num_parsed_hands; ++i) {
+    parsed_hands[i] = permuted_hands[keys[i].second];
+  }
 }
 
-void HandParser::DeduplicateResult() {
-  HandParserResult dedupedResult;
-  for (const ParsedHand& parsed_hand : result_->parsed_hand()) {
-    bool duplicated = false;
-    for (const ParsedHand& entry : dedupedResult.parsed_hand()) {
-      duplicated |= CheckSame(parsed_hand, entry);
-      if (duplicated) break;
+uint64_t HandParser::RestoreParsedHand(
+    int num_melds, const SuitDecomposition* const* suit_begins,
+    const SuitDecomposition* const* suit_ends,
+    CompactParsedHand* parsed_hand) {
+  // Keys have the phase at the top, so that the formats come in the order of
+  // Next.
+  const int kPhaseShift = 56;
+  const AgariFormat format = parsed_hand->agari_format;
+  if (format == AgariFormat::IRREGULAR_AGARI) {
+    // The signature of kokushi-musou doesn't depend on its tiles.
+    return static_cast<uint64_t>(State::IRREGULAR) << kPhaseShift;
+  }
+
+  // Elements of each group are consecutive and follow the decomposition of
+  // the group, so a stable sort by groups restores the order of Parse.
+  const int num_elements = parsed_hand->num_elements - num_melds;
+  int order[kMaxNumElements];
+  int groups[kMaxNumElements];
+  for (int i = 0; i < num_elements; ++i) {
+    order[i] = i;
+    groups[i] = GetGroup(parsed_hand->tile[parsed_hand->element_begin[i]]);
+  }
+  std::stable_sort(order, order + num_elements, [&groups](int a, int b) {
+    return groups[a] < groups[b];
+  });
+
+  const CompactParsedHand original = *parsed_hand;
+  HandElementType element_types[kMaxNumElements];
+  int element_tile_indices[kMaxNumElements];
+  int agari_element = 0;
+  parsed_hand->num_elements = 0;
+  for (int i = 0; i < original.num_elements; ++i) {
+    // Melds stay after closed elements.
+    const int element = i < num_elements ? order[i] : i;
+    const int begin = original.element_begin[element];
+    parsed_hand->AddElement(original.element_type[element]);
+    for (int j = begin; j < original.element_begin[element + 1]; ++j) {
+      parsed_hand->AddTile(original.tile[j], original.tile_flags[j]);
+      if (i < num_elements && original.tile_flags[j] != 0) {
+        agari_element = i;
+      }
+    }
+    if (i < num_elements) {
+      element_types[i] = GetBaseType(original.element_type[element]);
+      element_tile_indices[i] = original.tile[begin];
+    }
+  }
+  parsed_hand->signature =
+      ComputeSignature(num_elements, element_types, element_tile_indices,
+                       agari_element, parsed_hand->machi_type, format);
+
+  if (format == AgariFormat::CHITOITSU_AGARI) {
+    return static_cast<uint64_t>(State::CHIITOITSU) << kPhaseShift |
+           agari_element;
+  }
+  // The index of the decomposition of each suit, and the agari element.
+  uint64_t key = static_cast<uint64_t>(State::REGULAR);
+  int element = 0;
+  for (int suit = 0; suit < kNumSuits; ++suit) {
+    while (element < num_elements && groups[order[element]] <= suit) {
+      ++element;
+    }
+    int end = element;
+    while (end < num_elements && groups[order[end]] == suit + 1) {
+      ++end;
+    }
+    const int base_index =
+        kNumJihaiTiles + suit * SuitDecompositionTable::kNumTilesInSuit;
+    int index = 0;
+    for (const SuitDecomposition* decomposition = suit_begins[suit];
+         decomposition != suit_ends[suit]; ++decomposition, ++index) {
+      bool matches = decomposition->num_elements == end - element;
+      for (int i = 0; i < decomposition->num_elements && matches; ++i) {
+        matches = decomposition->element_type[i] ==
+                      element_types[element + i] &&
+                  base_index + decomposition->element_offset[i] ==
+                      element_tile_indices[element + i];
+      }
+      if (matches) {
+        break;
+      }
     }
-    if (!duplicated) dedupedResult.add_parsed_hand()->CopyFrom(parsed_hand);
+    key = key << 16 | index;
   }
-  result_->Swap(&dedupedResult);
+  return key << 8 | agari_element;
+}
+
+HandParser::Generator::Generator(const HandParser& hand_parser,
+                                 const Hand& hand)
+    : hand_parser_(hand_parser) {
+  const HandValidatorResult::Type validator_result =
+      ToCompactHand(hand, &hand_);
+  hand_parser_.Setup(hand_, validator_result, nullptr, &state_);
+}
+
+HandParser::Generator::Generator(const HandParser& hand_parser,
+                                 const CompactHand& hand)
+    : Generator(hand_parser, hand, nullptr) {}
+
+HandParser::Generator::Generator(const HandParser& hand_parser,
+                                 const CompactHand& hand,
+                                 HandParserStats* stats)
+    : hand_parser_(hand_parser), hand_(hand) {
+  hand_parser_.Setup(hand_, HandValidatorResult::OK, stats, &state_);
+}
+
+bool HandParser::Generator::Next(CompactParsedHand* parsed_hand) {
+  return hand_parser_.Next(&state_, parsed_hand);
+}
+
+bool HandParser::Generator::IsRyanpeikouChiiToitsu() const {
+  return state_.is_ryanpeikou_chiitoitsu;
+}
+
+HandValidatorResult::Type HandParser::Generator::GetValidatorResult() const {
+  return state_.validator_result;
+}
+
+HandParser::WaitParser::WaitParser(const HandParser& hand_parser,
+                                   const CompactHand& hand)
+    : hand_parser_(hand_parser), hand_(hand) {
+  hand_.agari_tile = CompactParsedHand::kUnknownTileCode;
+  hand_parser_.SetupWaitingHand(hand_, &waiting_state_, is_valid_group_);
+  // The waiting state has no parsed hands until Start.
+  state_ = waiting_state_;
+  if (waiting_state_.validator_result != HandValidatorResult::OK) {
+    return;
+  }
+
+  // Count tiles of melds too, so that tiles of which the hand holds all 4
+  // are rejected without validating each completed hand.
+  std::copy(waiting_state_.free_tile_counts,
+            waiting_state_.free_tile_counts + kNumTileIndices, tile_counts_);
+  const CompactParsedHand& melds = waiting_state_.melds;
+  for (int i = 0; i < melds.num_tiles(); ++i) {
+    ++tile_counts_[melds.tile[i]];
+  }
+}
+
+bool HandParser::WaitParser::Start(int agari_tile_index,
+                                   AgariType agari_type) {
+  state_ = waiting_state_;
+  if (waiting_state_.validator_result != HandValidatorResult::OK ||
+      agari_tile_index < 0 || agari_tile_index >= kNumTileIndices ||
+      tile_counts_[agari_tile_index] >= 4) {
+    return false;
+  }
+
+  hand_.agari_tile = agari_tile_index;
+  hand_.agari_type = agari_type;
+  return hand_parser_.CompleteWaitingHand(agari_tile_index, is_valid_group_,
+                                          &state_);
+}
+
+bool HandParser::WaitParser::Next(CompactParsedHand* parsed_hand) {
+  return hand_parser_.Next(&state_, parsed_hand);
+}
+
+bool HandParser::WaitParser::IsRyanpeikouChiiToitsu() const {
+  return state_.is_ryanpeikou_chiitoitsu;
+}
+
+HandValidatorResult::Type HandParser::WaitParser::GetValidatorResult() const {
+  return waiting_state_.validator_result;
 }
 
 }  // namespace mahjong
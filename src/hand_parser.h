@@ -15,40 +15,525 @@
 #ifndef SRC_HAND_PARSER_H_
 #define SRC_HAND_PARSER_H_
 
+#include <algorithm>
+#include <cstdint>
 #include <string>
+#include <vector>
 
 #include "proto/mahjong_scorecalculator.pb.h"
+#include "src/compact_hand.h"
+#include "src/compact_parsed_hand.h"
+#include "src/mahjong_common_util.h"
+#include "src/suit_permutation.h"
 
 namespace ycraft {
 namespace mahjong {
 
+struct SuitDecomposition;
+class SuitDecompositionTable;
+
+// MachiSet holds the tiles that complete a hand waiting for a tile, and the
+// machi types each of them can form.
+struct MachiSet {
+  // Bit i is set if the tile of index i completes the hand.
+  uint64_t tiles;
+
+  // Bit k of machi_kinds[i] is set if the tile of index i can form the machi
+  // type whose kind (MachiType & MASK_MACHI_KIND) is k.
+  uint8_t machi_kinds[kNumTileIndices];
+
+  void Clear() {
+    tiles = 0;
+    std::fill(machi_kinds, machi_kinds + kNumTileIndices, 0);
+  }
+
+  void Add(int tile_index, MachiType machi_type) {
+    tiles |= static_cast<uint64_t>(1) << tile_index;
+    machi_kinds[tile_index] |= 1 << (machi_type & MachiType::MASK_MACHI_KIND);
+  }
+
+  void Remove(int tile_index) {
+    tiles &= ~(static_cast<uint64_t>(1) << tile_index);
+    machi_kinds[tile_index] = 0;
+  }
+
+  bool Contains(int tile_index) const { return (tiles >> tile_index) & 1; }
+
+  bool HasMachiType(int tile_index, MachiType machi_type) const {
+    return (machi_kinds[tile_index] >>
+            (machi_type & MachiType::MASK_MACHI_KIND)) &
+           1;
+  }
+};
+
+// HandParserStats holds counters of HandParser. Counters are added to by each
+// call, so a single instance can aggregate many calls, e.g. one instance per
+// thread, or be cleared before each call. Counters start at 0.
+struct HandParserStats {
+  HandParserStats() { Clear(); }
+
+  // Hands set up for parsing, including invalid ones.
+  uint64_t num_hands;
+
+  // Suit shapes looked up in SuitDecompositionTable, which is what parsing
+  // searches.
+  uint64_t num_suit_lookups;
+
+  // Decompositions of hands into elements: combinations of decompositions of
+  // each suit, chiitoitsu and kokushi-musou.
+  uint64_t num_decompositions;
+
+  // Parsed hands generated, and the ones dropped because a parsed hand of the
+  // same signature had been generated.
+  uint64_t num_parsed_hands;
+  uint64_t num_duplicates;
+
+  // Wall time in nanoseconds of validating and counting tiles, and of
+  // generating parsed hands of each format. Checking signatures of duplicates
+  // is also counted in the time of its format.
+  uint64_t setup_nanos;
+  uint64_t regular_nanos;
+  uint64_t chiitoitsu_nanos;
+  uint64_t irregular_nanos;
+  uint64_t dedup_nanos;
+
+  void Clear();
+  void Add(const HandParserStats& other);
+};
+
+// HandParserBatchResult holds parsed hands of a batch of hands in the order
+// of the hands. Parsed hands of all the hands share a single vector, and none
+// of them refers to open melds. Clearing an instance keeps its storage, so
+// parsing batches into the same instance stops allocating memory once the
+// storage has grown to the largest batch.
+class HandParserBatchResult {
+ public:
+  HandParserBatchResult();
+
+  int num_hands() const { return validator_results_.size(); }
+
+  // The result of validating the given hand. A hand has no parsed hands
+  // unless this is OK.
+  HandValidatorResult::Type validator_result(int hand) const {
+    return validator_results_[hand];
+  }
+
+  // Parsed hands of the given hand are [begin(hand), end(hand)).
+  const CompactParsedHand* begin(int hand) const {
+    return parsed_hands_.data() + offsets_[hand];
+  }
+  const CompactParsedHand* end(int hand) const {
+    return parsed_hands_.data() + offsets_[hand + 1];
+  }
+  int num_parsed_hands(int hand) const {
+    return offsets_[hand + 1] - offsets_[hand];
+  }
+
+  // Removes all the hands.
+  void Clear();
+
+  // Appends all the hands of the given result, e.g. a result of another
+  // slice of the same batch parsed by another thread.
+  void Append(const HandParserBatchResult& other);
+
+ private:
+  friend class HandParser;
+
+  std::vector<CompactParsedHand> parsed_hands_;
+
+  // Parsed hands of hand i start at offsets_[i]. This has an extra element
+  // for the end of the last hand.
+  std::vector<int> offsets_;
+
+  std::vector<HandValidatorResult::Type> validator_results_;
+};
+
 class HandParser {
  public:
+  class Generator;
+  class WaitParser;
+
+  /**
+   * Looks up suits in the shared SuitDecompositionTable, which is built on
+   * first use.
+   */
   HandParser();
+
+  /**
+   * Same as above, but looks up suits in the given table instead of the
+   * shared one, e.g. a table mapped by SuitDecompositionTable::Load so that
+   * nothing is built at startup. The table must outlive this parser.
+   */
+  explicit HandParser(const SuitDecompositionTable& suit_table);
+
   ~HandParser();
 
   /**
    * Parses given hand and saves the result into the given result
-   * variable. You can use this method repeatedly.
+   * variable. You can use this method repeatedly. This method keeps all the
+   * intermediate state on the stack, so one instance can be shared by multiple
+   * threads.
+   */
+  void Parse(const Hand& hand, HandParserResult* result) const;
+
+  /**
+   * Same as above, but appends parsed hands to the given vector as
+   * CompactParsedHand. This doesn't allocate any memory other than the vector,
+   * so reusing the vector makes parsing allocation-free.
+   */
+  void Parse(const Hand& hand, std::vector<CompactParsedHand>* result) const;
+
+  /**
+   * Same as the above two, but take a CompactHand. The overloads taking Hand
+   * convert it into CompactHand and call these, so callers holding tiles in
+   * their own arrays don't need to build protos.
+   */
+  void Parse(const CompactHand& hand, HandParserResult* result) const;
+  void Parse(const CompactHand& hand,
+             std::vector<CompactParsedHand>* result) const;
+
+  /**
+   * Same as above, but also adds counters of parsing the hand to the given
+   * stats. Counters are only collected by these overloads and by generators
+   * given stats, so the others pay nothing for them.
+   */
+  void Parse(const CompactHand& hand, HandParserResult* result,
+             HandParserStats* stats) const;
+  void Parse(const CompactHand& hand, std::vector<CompactParsedHand>* result,
+             HandParserStats* stats) const;
+
+  /**
+   * Parses the given hands and appends their parsed hands to the given
+   * result in the same order. This sets up the intermediate state once for
+   * the whole batch. Batches can be split into slices, e.g. one per thread,
+   * whose results are appended in order afterwards.
+   */
+  void ParseBatch(const CompactHand* hands, int num_hands,
+                  HandParserBatchResult* result) const;
+
+  /**
+   * Same as above, but also adds counters of parsing the hands to the given
+   * stats.
    */
-  void Parse(const Hand& hand, HandParserResult* result);
+  void ParseBatch(const CompactHand* hands, int num_hands,
+                  HandParserBatchResult* result, HandParserStats* stats) const;
+
+  /**
+   * Maps parsed hands that Parse generated for the given hand with its suits
+   * permuted back to the given hand, with open melds merged. This applies the
+   * given permutation to their tiles, and restores the order of elements, the
+   * order of parsed hands and signatures that Parse generates for the given
+   * hand. Only tiles of a kokushi-musou element keep the order of the closed
+   * tiles they were parsed from.
+   */
+  void PermuteParsedHands(const SuitPermutation& permutation,
+                          const CompactHand& hand,
+                          CompactParsedHand* parsed_hands,
+                          int num_parsed_hands) const;
+
+  /**
+   * Checks that the given hand is well-formed: it has 14 tiles counting a
+   * kantsu as 3 tiles, all tiles are concrete, chii are 3 consecutive tiles
+   * and no kind has more than 4 tiles including melds. Parse and IsAgari
+   * reject hands that fail this check before any search.
+   */
+  HandValidatorResult::Type Validate(const Hand& hand) const;
+  HandValidatorResult::Type Validate(const CompactHand& hand) const;
+
+  /**
+   * Same as above, but ignores the agari tile if has_agari_tile is false, so
+   * that hands waiting for a tile can be checked.
+   */
+  HandValidatorResult::Type Validate(const CompactHand& hand,
+                                     bool has_agari_tile) const;
+
+  /**
+   * Returns true if the given hand is complete in any of the regular,
+   * chiitoitsu or kokushi formats. Unlike Parse, this doesn't build any
+   * decomposition and never allocates memory.
+   */
+  bool IsAgari(const Hand& hand) const;
+  bool IsAgari(const CompactHand& hand) const;
+
+  /**
+   * Same as above, but takes free tiles (closed tiles and the agari tile) of a
+   * hand. The number of melds is derived from num_tiles, which has to be
+   * 3n + 2.
+   */
+  bool IsAgari(const TileType* tiles, int num_tiles) const;
+
+  /**
+   * Finds all the tiles that complete the given hand, and the machi types
+   * each of them can form. The agari tile of the hand is ignored, so the hand
+   * has 13 tiles counting a kantsu as 3 tiles. Tiles of which the hand
+   * already holds all 4 are excluded. Unlike calling Parse for each tile,
+   * this looks up each suit once and only looks up the suit of each candidate
+   * tile again. Returns an error and leaves the set empty if the hand is
+   * invalid.
+   */
+  HandValidatorResult::Type GetMachi(const Hand& hand,
+                                     MachiSet* machi_set) const;
+  HandValidatorResult::Type GetMachi(const CompactHand& hand,
+                                     MachiSet* machi_set) const;
+
+ private:
+  // The maximum number of elements that closed tiles can form (chiitoitsu).
+  static const int kMaxNumElements = 7;
+
+  // Tiles other than jihai tiles are split into 3 suits.
+  static const int kNumSuits = 3;
+
+  // The capacity of the signature set used to drop duplicated parsed hands.
+  // This has to be a power of two.
+  static const int kSignatureSetSize = 64;
+
+  // State holds intermediate data of parsing a single hand. Parsed hands are
+  // generated in the order of regular, chiitoitsu and irregular formats.
+  struct State {
+    enum Phase { REGULAR, CHIITOITSU, IRREGULAR, DONE };
+
+    const CompactHand* hand;
+    Phase phase;
+
+    // Counters to add to, or nullptr.
+    HandParserStats* stats;
+
+    HandValidatorResult::Type validator_result;
+
+    // Open melds of the hand. Every parsed hand refers to them as its
+    // open_melds.
+    CompactParsedHand melds;
+
+    int num_free_tiles;
+    int agari_tile_index;
+    int free_tile_counts[kNumTileIndices];
+
+    // Bit i of occupied_tiles is set if free_tile_counts[i] > 0, and bit i of
+    // paired_tiles is set if free_tile_counts[i] == 2. These are maintained
+    // while counting free tiles, so chiitoitsu is detected without another
+    // pass over the tiles.
+    uint64_t occupied_tiles;
+    uint64_t paired_tiles;
+    bool is_chiitoitsu;
+    bool is_ryanpeikou_chiitoitsu;
+
+    // Cursor over the cross product of decompositions of each suit. Jihai
+    // elements are stored at the head of the element arrays.
+    int num_jihai_elements;
+    int num_jihai_jantou;
+    const SuitDecomposition* suit_begins[kNumSuits];
+    const SuitDecomposition* suit_ends[kNumSuits];
+    const SuitDecomposition* suit_decompositions[kNumSuits];
+    bool has_started_suit_table_lookup;
+
+    // Elements of the current decomposition. Each element is identified by
+    // its base type (TOITSU, KOUTSU or SHUNTSU) and the index of its first
+    // tile. Parsed hands of the decomposition are generated for each element
+    // that can contain the agari tile, starting from next_agari_element.
+    AgariFormat format;
+    int num_elements;
+    HandElementType element_types[kMaxNumElements];
+    int element_tile_indices[kMaxNumElements];
+    int next_agari_element;
+
+    // Open addressing hash set of signatures of the parsed hands generated so
+    // far.
+    uint64_t signatures[kSignatureSetSize];
+  };
+
+  // Initializes the state. validator_result is the result of converting the
+  // hand into CompactHand. If it isn't OK, the hand is invalid or it can't be
+  // represented as CompactParsedHand, this sets the phase to DONE. Counters
+  // are added to stats unless it's nullptr.
+  void Setup(const CompactHand& hand,
+             HandValidatorResult::Type validator_result, HandParserStats* stats,
+             State* state) const;
+
+  // Initializes the state of a hand waiting for a tile, i.e. without its
+  // agari tile, and looks up jihai tiles and each suit of it. is_valid_group
+  // receives whether jihai tiles and each suit can be decomposed, in this
+  // order. The state has no parsed hands.
+  void SetupWaitingHand(const CompactHand& hand, State* state,
+                        bool* is_valid_group) const;
+
+  // Adds the given agari tile to the state set up by SetupWaitingHand, and
+  // looks up only the group of the tile again. Returns false if the tile
+  // doesn't complete the hand in any format.
+  bool CompleteWaitingHand(int agari_tile_index, const bool* is_valid_group,
+                           State* state) const;
+
+  static void ResetState(const CompactHand& hand, HandParserStats* stats,
+                         State* state);
+
+  // Counts closed tiles of the hand as free tiles and stores its melds.
+  static void SetupTiles(const CompactHand& hand, State* state);
+  static void AddFreeTile(int index, State* state);
+  bool IsAgari(const int* counts, int num_tiles, bool has_naki) const;
+
+  // Adds tiles that complete the given counts of free tiles in the regular
+  // format to the machi set.
+  void GetRegularMachi(int* counts, MachiSet* machi_set) const;
+
+  // Generates the next parsed hand into parsed_hand. Returns false if there
+  // are no more parsed hands.
+  bool Next(State* state, CompactParsedHand* parsed_hand) const;
+
+  // Generates all the parsed hands of the state into the given result.
+  void CollectParsedHands(State* state, HandParserResult* result) const;
+  void CollectParsedHands(State* state,
+                          std::vector<CompactParsedHand>* result) const;
+
+  // Looks up decompositions of each suit in SuitDecompositionTable, and
+  // prepares the cursor over their cross product. Returns false if any suit
+  // can't be decomposed.
+  bool SetupSuitTableLookup(State* state) const;
+
+  // Stores elements of jihai tiles at the head of the element arrays. Returns
+  // false if any jihai tile is neither a toitsu nor a koutsu.
+  bool SetupJihaiElements(State* state) const;
+
+  // Looks up decompositions of the given suit and moves its cursor to the
+  // first one. Returns false if the suit can't be decomposed.
+  bool LookupSuit(int suit, State* state) const;
+
+  // Moves the cursor to the next decomposition of the regular format, and
+  // stores its elements together with jihai elements. Returns false if there
+  // are no more decompositions.
+  bool NextSuitDecomposition(State* state) const;
+  void AppendSuitDecomposition(int suit, const SuitDecomposition& decomposition,
+                               State* state) const;
+
+  // Returns true if the free tiles are seven distinct pairs. This only checks
+  // the masks of the state.
+  bool IsChiiToitsu(const State& state) const;
+
+  // Stores the elements of chiitoitsu if the state has been detected as
+  // chiitoitsu by Setup.
+  bool CheckChiiToitsu(State* state) const;
+  bool CheckIrregular(State* state, CompactParsedHand* parsed_hand) const;
+
+  // Generates the next parsed hand of the current decomposition. Returns false
+  // if all the parsed hands of the decomposition have been generated.
+  bool NextAgarikeiResult(State* state, CompactParsedHand* parsed_hand) const;
+
+  // Clears the given parsed hand and fills its agari of the given format.
+  void SetupParsedHand(const AgariFormat& format, const State& state,
+                       CompactParsedHand* parsed_hand) const;
+
+  // Inserts the given signature into the signature set of the state. Returns
+  // false if the signature is already in the set.
+  static bool InsertSignature(uint64_t signature, State* state);
+
+  // Moves closed elements of the given parsed hand, whose suits have been
+  // permuted, into the order of jihai tiles and then suits, computes its
+  // signature again and returns the key that orders it among parsed hands of
+  // the hand. The hand has the given number of melds and the given
+  // decompositions of each suit.
+  static uint64_t RestoreParsedHand(int num_melds,
+                                    const SuitDecomposition* const* suit_begins,
+                                    const SuitDecomposition* const* suit_ends,
+                                    CompactParsedHand* parsed_hand);
+
+  const SuitDecompositionTable& suit_table_;
+};
+
+// Generator generates parsed hands of a hand one by one in the same order as
+// HandParser::Parse. Consumers can stop at any point without paying for the
+// rest of parsed hands. The given HandParser must outlive this, while the hand
+// is copied. Generated parsed hands refer to open melds owned by this
+// generator, so they are valid only while this generator is alive. Call
+// MergeOpenMelds to keep them longer.
+class HandParser::Generator {
+ public:
+  Generator(const HandParser& hand_parser, const Hand& hand);
+  Generator(const HandParser& hand_parser, const CompactHand& hand);
+
+  // Same as above, but adds counters to the given stats, which must outlive
+  // this generator.
+  Generator(const HandParser& hand_parser, const CompactHand& hand,
+            HandParserStats* stats);
+
+  /**
+   * Stores the next parsed hand into the given parsed hand and returns true.
+   * Returns false if there are no more parsed hands.
+   */
+  bool Next(CompactParsedHand* parsed_hand);
+
+  /**
+   * Returns true if the hand is both chiitoitsu and a regular hand, i.e. it
+   * yields parsed hands of both formats. This is known before the first call
+   * of Next.
+   */
+  bool IsRyanpeikouChiiToitsu() const;
+
+  /**
+   * Returns the result of validating the hand. Next returns false unless this
+   * is OK.
+   */
+  HandValidatorResult::Type GetValidatorResult() const;
+
+ private:
+  Generator(const Generator&) = delete;
+  Generator& operator=(const Generator&) = delete;
+
+  const HandParser& hand_parser_;
+  CompactHand hand_;
+  State state_;
+};
+
+// WaitParser parses a hand waiting for a tile once, and then parses the hand
+// completed by each tile. The agari tile of the given hand is ignored, so the
+// hand has 13 tiles counting a kantsu as 3 tiles. Jihai tiles and each suit
+// of the waiting hand are looked up once, so completing the hand only looks
+// up the group of the added tile again. Parsed hands of a completed hand are
+// generated in the same order as HandParser::Parse. The given HandParser must
+// outlive this, while the hand is copied. Generated parsed hands refer to
+// open melds owned by this parser, so they are valid only while this parser
+// is alive.
+class HandParser::WaitParser {
+ public:
+  WaitParser(const HandParser& hand_parser, const CompactHand& hand);
+
+  /**
+   * Completes the hand with the given tile and agari type, and starts
+   * generating its parsed hands. Returns false if the tile doesn't complete
+   * the hand or the hand already holds all 4 of it, in which case Next
+   * returns false until the next call of this method.
+   */
+  bool Start(int agari_tile_index, AgariType agari_type);
+
+  /**
+   * Stores the next parsed hand of the completed hand into the given parsed
+   * hand and returns true. Returns false if there are no more parsed hands.
+   */
+  bool Next(CompactParsedHand* parsed_hand);
+
+  /**
+   * Returns true if the completed hand is both chiitoitsu and a regular hand.
+   */
+  bool IsRyanpeikouChiiToitsu() const;
+
+  /**
+   * Returns the result of validating the waiting hand. Start returns false
+   * unless this is OK.
+   */
+  HandValidatorResult::Type GetValidatorResult() const;
 
  private:
-  void Setup(const Hand& hand, HandParserResult* result);
-  void RunDfs();
-  void Dfs(int i, int id, bool has_jantou);
-  void CheckChiiToitsu();
-  void CheckIrregular();
-  void AddAgarikeiResult(int last_id, const AgariFormat& format);
-  void DeduplicateResult();
-
-  const Hand* hand_;
-  int num_free_tiles_;
-  int free_tile_group_ids_[14];
-  TileType free_tiles_[14];
-  HandElementType free_tile_element_types_[14];
-
-  HandParserResult* result_;
+  WaitParser(const WaitParser&) = delete;
+  WaitParser& operator=(const WaitParser&) = delete;
+
+  const HandParser& hand_parser_;
+  CompactHand hand_;
+
+  // The state of the waiting hand, which is copied into state_ and completed
+  // for each tile.
+  State waiting_state_;
+  State state_;
+  bool is_valid_group_[kNumSuits + 1];
+
+  // Tile counts of the waiting hand including melds.
+  int tile_counts_[kNumTileIndices];
 };
 
 }  // namespace mahjong
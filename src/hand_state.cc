@@ -0,0 +1,310 @@
+// Copyright 2016 Yuki Hamada
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/hand_state.h"
+
+#include <algorithm>
+
+#include "src/compact_parsed_hand.h"
+#include "src/mahjong_common_util.h"
+
+namespace ycraft {
+namespace mahjong {
+
+const int HandState::kNoTile;
+
+HandState::HandState(const HandParser& hand_parser)
+    : hand_parser_(hand_parser),
+      num_melds_(0),
+      drawn_tile_(kNoTile),
+      is_rinshan_(false),
+      richi_type_(RichiType::UNKNOWN_RICHI_TYPE) {
+  const int counts[kNumTileIndices] = {};
+  state_.Setup(counts, 0);
+  Update();
+}
+
+bool HandState::Reset(const Hand& hand) {
+  CompactHand compact_hand;
+  if (mahjong::ToCompactHand(hand, &compact_hand) != HandValidatorResult::OK) {
+    return false;
+  }
+  return Reset(compact_hand);
+}
+
+bool HandState::Reset(const CompactHand& hand) {
+  const bool has_agari_tile =
+      hand.agari_tile != CompactParsedHand::kUnknownTileCode;
+  if (hand_parser_.Validate(hand, has_agari_tile) != HandValidatorResult::OK) {
+    return false;
+  }
+
+  int counts[kNumTileIndices] = {};
+  for (int i = 0; i < hand.num_closed_tiles; ++i) {
+    ++counts[hand.closed_tile[i]];
+  }
+  if (has_agari_tile) {
+    ++counts[hand.agari_tile];
+  }
+  state_.Setup(counts, hand.num_melds);
+  num_melds_ = hand.num_melds;
+  std::copy(hand.meld, hand.meld + hand.num_melds, meld_);
+  drawn_tile_ = has_agari_tile ? hand.agari_tile : kNoTile;
+  is_rinshan_ = has_agari_tile && hand.HasAgariState(AgariState::RINSHAN);
+  richi_type_ = hand.richi_type;
+  Update();
+  return true;
+}
+
+bool HandState::Draw(TileType tile) {
+  const int index = GetTileIndex(tile);
+  if (index < 0 || GetNumTiles() != 13) {
+    return false;
+  }
+  // The hand can't hold a 5th copy, including the ones in its melds.
+  if (CountCopies(index) >= 4) {
+    return false;
+  }
+
+  state_.AddTile(index);
+  drawn_tile_ = index;
+  Update();
+  return true;
+}
+
+bool HandState::Discard(TileType tile) {
+  const int index = GetTileIndex(tile);
+  if (index < 0 || !NeedsDiscard() || !RemoveClosedTiles(index, 1)) {
+    return false;
+  }
+  drawn_tile_ = kNoTile;
+  is_rinshan_ = false;
+  Update();
+  return true;
+}
+
+bool HandState::Pon(TileType tile) {
+  const int index = GetTileIndex(tile);
+  if (index < 0 || GetNumTiles() != 13 ||
+      num_melds_ == CompactHand::kMaxNumMelds || CountCopies(index) >= 4 ||
+      !RemoveClosedTiles(index, 2)) {
+    return false;
+  }
+  meld_[num_melds_].type = HandElementType::MINKOUTSU;
+  meld_[num_melds_].tile = index;
+  state_.SetNumMelds(++num_melds_);
+  Update();
+  return true;
+}
+
+bool HandState::Chii(TileType tile, TileType smallest) {
+  const int index = GetTileIndex(tile);
+  const int first = GetTileIndex(smallest);
+  if (index < 0 || first < 0 || !CanStartShuntsu(first) ||
+      index < first || index >= first + 3 || GetNumTiles() != 13 ||
+      num_melds_ == CompactHand::kMaxNumMelds || CountCopies(index) >= 4) {
+    return false;
+  }
+  for (int i = first; i < first + 3; ++i) {
+    if (i != index && count(i) == 0) {
+      return false;
+    }
+  }
+
+  for (int i = first; i < first + 3; ++i) {
+    if (i != index) {
+      state_.RemoveTile(i);
+    }
+  }
+  meld_[num_melds_].type = HandElementType::MINSHUNTSU;
+  meld_[num_melds_].tile = first;
+  state_.SetNumMelds(++num_melds_);
+  Update();
+  return true;
+}
+
+bool HandState::Kan(TileType tile) {
+  const int index = GetTileIndex(tile);
+  if (index < 0) {
+    return false;
+  }
+
+  if (!NeedsDiscard()) {
+    // Daiminkan of a discarded tile.
+    if (GetNumTiles() != 13 || num_melds_ == CompactHand::kMaxNumMelds ||
+        CountCopies(index) >= 4 || !RemoveClosedTiles(index, 3)) {
+      return false;
+    }
+    meld_[num_melds_].type = HandElementType::MINKANTSU;
+    meld_[num_melds_].tile = index;
+    state_.SetNumMelds(++num_melds_);
+  } else {
+    // Kakan upgrades the pon of the tile, if any. Otherwise it's ankan.
+    CompactHand::Meld* pon = nullptr;
+    for (int i = 0; i < num_melds_; ++i) {
+      if (meld_[i].type == HandElementType::MINKOUTSU &&
+          meld_[i].tile == index) {
+        pon = &meld_[i];
+      }
+    }
+    if (pon != nullptr) {
+      if (!RemoveClosedTiles(index, 1)) {
+        return false;
+      }
+      pon->type = HandElementType::MINKANTSU;
+    } else {
+      if (num_melds_ == CompactHand::kMaxNumMelds ||
+          !RemoveClosedTiles(index, 4)) {
+        return false;
+      }
+      meld_[num_melds_].type = HandElementType::ANKANTSU;
+      meld_[num_melds_].tile = index;
+      state_.SetNumMelds(++num_melds_);
+    }
+  }
+  drawn_tile_ = kNoTile;
+  is_rinshan_ = true;
+  Update();
+  return true;
+}
+
+bool HandState::NeedsDiscard() const { return GetNumTiles() == 14; }
+
+bool HandState::IsTenpai() const { return machi_.tiles != 0; }
+
+bool HandState::IsAgari() const {
+  return NeedsDiscard() && shanten_.shanten == -1;
+}
+
+void HandState::ToCompactHand(CompactHand* hand) const {
+  hand->Clear();
+  for (int index = 0; index < kNumTileIndices; ++index) {
+    const int num_tiles = count(index) - (index == drawn_tile_ ? 1 : 0);
+    for (int i = 0; i < num_tiles; ++i) {
+      hand->AddClosedTile(index);
+    }
+  }
+  for (int i = 0; i < num_melds_; ++i) {
+    hand->AddMeld(meld_[i].type, meld_[i].tile);
+  }
+  if (drawn_tile_ != kNoTile) {
+    hand->agari_tile = drawn_tile_;
+    hand->agari_type = AgariType::TSUMO;
+    if (is_rinshan_) {
+      hand->AddAgariState(AgariState::RINSHAN);
+    }
+  } else if (NeedsDiscard()) {
+    // The hand has just called a tile. Move the last closed tile to the
+    // agari tile so that the hand has 14 tiles.
+    hand->agari_tile = hand->closed_tile[--hand->num_closed_tiles];
+  } else {
+    hand->agari_tile = CompactParsedHand::kUnknownTileCode;
+  }
+  hand->richi_type = richi_type_;
+}
+
+void HandState::ToHand(Hand* hand) const {
+  CompactHand compact_hand;
+  ToCompactHand(&compact_hand);
+
+  hand->Clear();
+  for (int i = 0; i < compact_hand.num_closed_tiles; ++i) {
+    hand->add_closed_tile(GetTileTypeFromIndex(compact_hand.closed_tile[i]));
+  }
+  hand->set_agari_tile(
+      compact_hand.agari_tile != CompactParsedHand::kUnknownTileCode
+          ? GetTileTypeFromIndex(compact_hand.agari_tile)
+          : TileType::UNKNOWN_TILE);
+  for (int i = 0; i < compact_hand.num_melds; ++i) {
+    const CompactHand::Meld& meld = compact_hand.meld[i];
+    const TileType tile = GetTileTypeFromIndex(meld.tile);
+    switch (meld.type) {
+      case HandElementType::MINSHUNTSU: {
+        Hand_Chii* chii = hand->add_chiied_tile();
+        for (int j = 0; j < 3; ++j) {
+          chii->add_tile(GetTileTypeFromIndex(meld.tile + j));
+        }
+        break;
+      }
+      case HandElementType::MINKOUTSU:
+        hand->add_ponned_tile()->set_tile(tile);
+        break;
+      default: {
+        Hand_Kan* kan = hand->add_kanned_tile();
+        kan->set_tile(tile);
+        kan->set_is_closed(meld.type == HandElementType::ANKANTSU);
+        break;
+      }
+    }
+  }
+  hand->mutable_agari()->set_type(compact_hand.agari_type);
+  if (compact_hand.HasAgariState(AgariState::RINSHAN)) {
+    hand->mutable_agari()->add_state(AgariState::RINSHAN);
+  }
+  hand->set_richi_type(richi_type_);
+}
+
+void HandState::ToPlayer(TileType wind, Player* player) const {
+  player->set_wind(wind);
+  ToHand(player->mutable_hand());
+}
+
+bool HandState::RemoveClosedTiles(int index, int num_tiles) {
+  if (count(index) < num_tiles) {
+    return false;
+  }
+  for (int i = 0; i < num_tiles; ++i) {
+    state_.RemoveTile(index);
+  }
+  // A called or discarded tile is no longer the drawn one.
+  drawn_tile_ = kNoTile;
+  return true;
+}
+
+int HandState::CountCopies(int index) const {
+  int num_tiles = count(index);
+  for (int i = 0; i < num_melds_; ++i) {
+    const CompactHand::Meld& meld = meld_[i];
+    if (meld.type == HandElementType::MINSHUNTSU) {
+      num_tiles += meld.tile <= index && index < meld.tile + 3 ? 1 : 0;
+    } else if (meld.tile == index) {
+      num_tiles += meld.type == HandElementType::MINKOUTSU ? 3 : 4;
+    }
+  }
+  return num_tiles;
+}
+
+int HandState::GetNumTiles() const {
+  int num_tiles = 3 * num_melds_;
+  for (int index = 0; index < kNumTileIndices; ++index) {
+    num_tiles += count(index);
+  }
+  return num_tiles;
+}
+
+void HandState::Update() {
+  state_.Calculate(&shanten_);
+
+  // Machi are searched only while the hand is tenpai, which is when they can
+  // change.
+  machi_.Clear();
+  if (GetNumTiles() == 13 && shanten_.shanten == 0) {
+    CompactHand hand;
+    ToCompactHand(&hand);
+    hand_parser_.GetMachi(hand, &machi_);
+  }
+}
+
+}  // namespace mahjong
+}  // namespace ycraft
@@ -0,0 +1,149 @@
+// Copyright 2016 Yuki Hamada
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_HAND_STATE_H_
+#define SRC_HAND_STATE_H_
+
+#include "proto/mahjong_scorecalculator.pb.h"
+#include "src/compact_hand.h"
+#include "src/hand_parser.h"
+#include "src/shanten_calculator.h"
+
+namespace ycraft {
+namespace mahjong {
+
+// HandState is a hand of a player that changes with events during a game:
+// draws, discards and calls. It keeps tile counts, shanten numbers and, while
+// the hand waits for a tile, its machi up to date after each event, so
+// callers tracking a game don't have to build and parse a Hand every turn.
+// Shanten numbers are updated by looking up only the suits of the tiles that
+// changed.
+//
+// A hand is in one of 2 phases. It either has 13 tiles counting a kantsu as 3
+// tiles and needs to draw or call a tile, or has 14 tiles and needs to
+// discard one. Events that don't fit the current phase are rejected.
+class HandState {
+ public:
+  // The given parser has to outlive this. The hand starts with no tiles, so
+  // call Reset first.
+  explicit HandState(const HandParser& hand_parser);
+
+  /**
+   * Replaces the hand with closed tiles and melds of the given hand. The
+   * agari tile is taken as a drawn tile if it's concrete. Returns false and
+   * leaves the state unchanged if the hand fails HandParser::Validate.
+   */
+  bool Reset(const Hand& hand);
+  bool Reset(const CompactHand& hand);
+
+  // Each of the events below returns false and leaves the state unchanged if
+  // it doesn't fit the current phase or the tiles of the hand.
+
+  // Draws the given tile into a hand of 13 tiles.
+  bool Draw(TileType tile);
+
+  // Discards the given tile from a hand of 14 tiles.
+  bool Discard(TileType tile);
+
+  // Calls pon of the given discarded tile with 2 closed tiles. Like Draw,
+  // every call fails if the called tile would be a 5th copy with the melds.
+  bool Pon(TileType tile);
+
+  // Calls chii of the given discarded tile. The meld starts with smallest,
+  // and its other 2 tiles come from closed tiles.
+  bool Chii(TileType tile, TileType smallest);
+
+  // Calls kan of the given tile. A hand of 13 tiles calls it on a discarded
+  // tile with 3 closed tiles (daiminkan). A hand of 14 tiles declares it with
+  // 4 closed tiles (ankan), or adds a closed tile to its pon (kakan). The hand
+  // then has to draw a replacement tile, which is flagged as rinshan.
+  bool Kan(TileType tile);
+
+  void set_richi_type(RichiType richi_type) { richi_type_ = richi_type; }
+  RichiType richi_type() const { return richi_type_; }
+
+  // The number of closed tiles of the given tile index, including the drawn
+  // tile.
+  int count(int index) const { return state_.count(index); }
+
+  int num_melds() const { return num_melds_; }
+  const CompactHand::Meld& meld(int i) const { return meld_[i]; }
+
+  // True if the hand has 14 tiles and has to discard one.
+  bool NeedsDiscard() const;
+
+  // Shanten numbers of the current tiles.
+  const ShantenResult& shanten() const { return shanten_; }
+
+  // True if the hand has 13 tiles and waits for a tile.
+  bool IsTenpai() const;
+
+  // True if the hand has 14 tiles and they are complete.
+  bool IsAgari() const;
+
+  // Tiles the hand waits for and their machi types. Empty unless IsTenpai.
+  const MachiSet& machi() const { return machi_; }
+
+  /**
+   * Exports the hand, which passes HandParser::Validate in either phase. The
+   * drawn tile, if any, is the agari tile of a tsumo, flagged as rinshan if
+   * it replaced a kan. A hand of 14 tiles that has just called a tile has no
+   * drawn tile, so its last closed tile becomes the agari tile with
+   * UNKNOWN_AGARI_TYPE. Such a hand isn't a win, but ShantenCalculator can
+   * find its discards. Otherwise the agari tile is UNKNOWN_TILE, and callers
+   * checking a ron set it and the agari type.
+   */
+  void ToCompactHand(CompactHand* hand) const;
+  void ToHand(Hand* hand) const;
+  void ToPlayer(TileType wind, Player* player) const;
+
+ private:
+  static const int kNoTile = -1;
+
+  // Removes the given number of closed tiles of the given index if the hand
+  // has them.
+  bool RemoveClosedTiles(int index, int num_tiles);
+
+  // The number of copies of the given tile index in closed tiles and melds.
+  int CountCopies(int index) const;
+
+  // Sum of closed tiles and melds counting a kantsu as 3 tiles.
+  int GetNumTiles() const;
+
+  // Updates shanten numbers and machi after tiles or melds change.
+  void Update();
+
+  const HandParser& hand_parser_;
+  ShantenState state_;
+
+  int num_melds_;
+  CompactHand::Meld meld_[CompactHand::kMaxNumMelds];
+
+  // Tile index of the last drawn tile while the hand has 14 tiles, or kNoTile
+  // if the hand has called a tile instead.
+  int drawn_tile_;
+
+  // True if the hand has called kan and not discarded since.
+  bool is_rinshan_;
+
+  RichiType richi_type_;
+
+  ShantenResult shanten_;
+  MachiSet machi_;
+};
+
+}  // namespace mahjong
+}  // namespace ycraft
+
+#endif  // SRC_HAND_STATE_H_
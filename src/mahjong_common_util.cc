@@ -40,6 +40,21 @@ bool IsMatchedForHierarchalData(unsigned int required, unsigned int actual) {
   return required == actual;
 }
 
+const TileType kTileTypes[kNumTileIndices] = {
+    TileType::WIND_TON,     TileType::WIND_NAN,     TileType::WIND_SHA,
+    TileType::WIND_PE,      TileType::SANGEN_HAKU,  TileType::SANGEN_HATSU,
+    TileType::SANGEN_CHUN,  TileType::MANZU_1,      TileType::MANZU_2,
+    TileType::MANZU_3,      TileType::MANZU_4,      TileType::MANZU_5,
+    TileType::MANZU_6,      TileType::MANZU_7,      TileType::MANZU_8,
+    TileType::MANZU_9,      TileType::SOUZU_1,      TileType::SOUZU_2,
+    TileType::SOUZU_3,      TileType::SOUZU_4,      TileType::SOUZU_5,
+    TileType::SOUZU_6,      TileType::SOUZU_7,      TileType::SOUZU_8,
+    TileType::SOUZU_9,      TileType::PINZU_1,      TileType::PINZU_2,
+    TileType::PINZU_3,      TileType::PINZU_4,      TileType::PINZU_5,
+    TileType::PINZU_6,      TileType::PINZU_7,      TileType::PINZU_8,
+    TileType::PINZU_9,
+};
+
 bool ContainsRequiredTileState(const TileState required_state,
                                const Tile& tile) {
   return std::find_if(tile.state().begin(), tile.state().end(),
@@ -65,6 +80,47 @@ bool IsTileTypeMatched(TileType required, TileType tile, TileType mask) {
   return IsMatched(required, tile, mask);
 }
 
+int GetTileIndex(TileType tile) {
+  const int number = tile & TileType::MASK_TILE_NUMBER;
+  int index;
+  switch (tile & TileType::MASK_TILE_KIND) {
+    case TileType::WIND_TILE:
+      index = number - 1;
+      break;
+    case TileType::SANGEN_TILE:
+      index = 4 + number - 1;
+      break;
+    case TileType::MANZU_TILE:
+      index = 7 + number - 1;
+      break;
+    case TileType::SOUZU_TILE:
+      index = 16 + number - 1;
+      break;
+    case TileType::PINZU_TILE:
+      index = 25 + number - 1;
+      break;
+    default:
+      return -1;
+  }
+  if (index < 0 || index >= kNumTileIndices || kTileTypes[index] != tile) {
+    return -1;
+  }
+  return index;
+}
+
+TileType GetTileTypeFromIndex(int index) {
+  if (index < 0 || index >= kNumTileIndices) {
+    return TileType::UNKNOWN_TILE;
+  }
+  return kTileTypes[index];
+}
+
+bool CanStartShuntsu(int index) {
+  const TileType tile = GetTileTypeFromIndex(index);
+  return IsSequentialTileType(tile) &&
+         (tile & TileType::MASK_TILE_NUMBER) <= 7;
+}
+
 bool IsTileStateMatched(TileState required, TileState actual) {
   return IsMatchedForHierarchalData(required, actual);
 }
@@ -22,11 +22,25 @@
 namespace ycraft {
 namespace mahjong {
 
+// The number of distinct tile types.
+const int kNumTileIndices = 34;
+
 // Utilities for TileType.
 bool IsSequentialTileType(TileType tile);
 bool IsTileTypeMatched(TileType required, TileType tile);
 bool IsTileTypeMatched(TileType required, TileType tile, TileType mask);
 
+// Utilities for tile index. A tile index is a dense number in
+// [0, kNumTileIndices) assigned to each concrete tile type. Indices are ordered
+// in the same way as TileType values, i.e. winds, sangen tiles, manzu, souzu
+// and then pinzu. GetTileIndex returns -1 for non-concrete tile types.
+int GetTileIndex(TileType tile);
+TileType GetTileTypeFromIndex(int index);
+
+// Returns true if a shuntsu can start at the tile of the given index, i.e. the
+// tile is a suit tile of 1 to 7.
+bool CanStartShuntsu(int index);
+
 // Utilities for TileState.
 bool IsTileStateMatched(TileState required, TileState actual);
 
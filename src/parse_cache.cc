@@ -0,0 +1,265 @@
+// Copyright 2016 Yuki Hamada
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/parse_cache.h"
+
+#include "src/hand_parser.h"
+#include "src/mahjong_common_util.h"
+
+using std::lock_guard;
+using std::mutex;
+using std::vector;
+
+namespace ycraft {
+namespace mahjong {
+
+namespace {
+const int kCountBits = 3;
+const int kMaxCount = (1 << kCountBits) - 1;
+const int kNumTilesPerWord = 17;
+
+// AgariState values fit in these bits of CompactHand::agari_states.
+const int kNumAgariStateBits = 6;
+
+// Memory used by the index for each entry in addition to the entry itself: a
+// key, a slot and roughly 2 pointers of a hash node.
+const size_t kIndexOverheadBytes = 48;
+
+// Returns a 2-bit code of the given meld type, or -1 if it isn't a meld.
+int GetMeldCode(HandElementType type) {
+  switch (type) {
+    case HandElementType::MINSHUNTSU:
+      return 0;
+    case HandElementType::MINKOUTSU:
+      return 1;
+    case HandElementType::MINKANTSU:
+      return 2;
+    case HandElementType::ANKANTSU:
+      return 3;
+    default:
+      return -1;
+  }
+}
+}  // namespace
+
+ParseCache::ParseCache(size_t max_num_bytes, bool shares_suit_permutations)
+    : max_num_bytes_(max_num_bytes),
+      shares_suit_permutations_(shares_suit_permutations),
+      clock_hand_(0),
+      stats_() {}
+
+HandValidatorResult::Type ParseCache::Parse(
+    const HandParser& hand_parser, const CompactHand& hand,
+    vector<CompactParsedHand>* result) {
+  // Parse and cache the representative of the hand, and map its parsed hands
+  // back with the inverse permutation.
+  CompactHand canonical_hand;
+  const CompactHand* key_hand = &hand;
+  SuitPermutation inverse = SuitPermutation::Identity();
+  if (shares_suit_permutations_) {
+    canonical_hand = hand;
+    inverse = CanonicalizeSuits(&canonical_hand).Inverse();
+    key_hand = &canonical_hand;
+  }
+
+  Key key;
+  const bool is_cacheable = GetKey(*key_hand, &key);
+  if (is_cacheable) {
+    lock_guard<mutex> lock(mutex_);
+    ++stats_.num_lookups;
+    const auto found = index_.find(key);
+    if (found != index_.end()) {
+      ++stats_.num_hits;
+      Entry* entry = &entries_[found->second];
+      entry->is_referenced = true;
+      AppendParsedHands(hand_parser, hand, entry->parsed_hands, inverse,
+                        result);
+      return HandValidatorResult::OK;
+    }
+  }
+
+  // Parse without holding the lock, so that other threads aren't blocked by
+  // the search.
+  HandParser::Generator generator(hand_parser, *key_hand);
+  const HandValidatorResult::Type validator_result =
+      generator.GetValidatorResult();
+  if (validator_result != HandValidatorResult::OK) {
+    return validator_result;
+  }
+  vector<CompactParsedHand> parsed_hands;
+  CompactParsedHand parsed_hand;
+  while (generator.Next(&parsed_hand)) {
+    // The open melds live in the generator, so copy them into the parsed hand.
+    parsed_hand.MergeOpenMelds();
+    parsed_hands.push_back(parsed_hand);
+  }
+
+  if (is_cacheable) {
+    lock_guard<mutex> lock(mutex_);
+    Insert(key, parsed_hands);
+  }
+  AppendParsedHands(hand_parser, hand, parsed_hands, inverse, result);
+  return HandValidatorResult::OK;
+}
+
+void ParseCache::AppendParsedHands(
+    const HandParser& hand_parser, const CompactHand& hand,
+    const vector<CompactParsedHand>& parsed_hands,
+    const SuitPermutation& permutation, vector<CompactParsedHand>* result) {
+  const size_t begin = result->size();
+  result->insert(result->end(), parsed_hands.begin(), parsed_hands.end());
+  if (!permutation.IsIdentity()) {
+    hand_parser.PermuteParsedHands(permutation, hand, result->data() + begin,
+                                   parsed_hands.size());
+  }
+}
+
+ParseCacheStats ParseCache::GetStats() const {
+  lock_guard<mutex> lock(mutex_);
+  return stats_;
+}
+
+void ParseCache::Clear() {
+  lock_guard<mutex> lock(mutex_);
+  entries_.clear();
+  index_.clear();
+  free_entries_.clear();
+  clock_hand_ = 0;
+  stats_.num_entries = 0;
+  stats_.num_bytes = 0;
+}
+
+size_t ParseCache::KeyHash::operator()(const Key& key) const {
+  // Mix the words with the 64-bit FNV prime, which is enough to spread tile
+  // counts that differ in a few bits.
+  uint64_t hash = key.word[0];
+  hash = hash * 0x100000001b3ULL ^ key.word[1];
+  hash = hash * 0x100000001b3ULL ^ key.word[2];
+  return static_cast<size_t>(hash ^ (hash >> 29));
+}
+
+bool ParseCache::GetKey(const CompactHand& hand, Key* key) {
+  if (hand.num_closed_tiles < 0 ||
+      hand.num_closed_tiles > CompactHand::kMaxNumClosedTiles ||
+      hand.num_melds < 0 || hand.num_melds > CompactHand::kMaxNumMelds ||
+      (hand.agari_states >> kNumAgariStateBits) != 0) {
+    return false;
+  }
+
+  int counts[kNumTileIndices] = {};
+  for (int i = 0; i < hand.num_closed_tiles; ++i) {
+    const int index = hand.closed_tile[i];
+    if (index >= kNumTileIndices || counts[index] == kMaxCount) {
+      return false;
+    }
+    ++counts[index];
+  }
+  key->word[0] = 0;
+  key->word[1] = 0;
+  for (int index = 0; index < kNumTileIndices; ++index) {
+    key->word[index / kNumTilesPerWord] |=
+        static_cast<uint64_t>(counts[index])
+        << (index % kNumTilesPerWord * kCountBits);
+  }
+
+  uint64_t word = hand.num_melds;
+  for (int i = 0; i < hand.num_melds; ++i) {
+    const int meld_code = GetMeldCode(hand.meld[i].type);
+    if (meld_code < 0 || hand.meld[i].tile >= kNumTileIndices) {
+      return false;
+    }
+    word = word << 8 | meld_code << 6 | hand.meld[i].tile;
+  }
+  switch (hand.agari_type) {
+    case AgariType::UNKNOWN_AGARI_TYPE:
+    case AgariType::RON:
+    case AgariType::TSUMO:
+      break;
+    default:
+      return false;
+  }
+  word = word << 8 | hand.agari_tile;
+  word = word << 2 | hand.agari_type;
+  word = word << kNumAgariStateBits | hand.agari_states;
+  key->word[2] = word;
+  return true;
+}
+
+void ParseCache::Insert(const Key& key,
+                        const vector<CompactParsedHand>& parsed_hands) {
+  // Another thread may have cached the same hand while this one parsed it.
+  if (index_.count(key) > 0) {
+    return;
+  }
+  const size_t num_bytes = sizeof(Entry) + kIndexOverheadBytes +
+                           sizeof(CompactParsedHand) * parsed_hands.size();
+  if (num_bytes > max_num_bytes_) {
+    return;
+  }
+  while (stats_.num_bytes + num_bytes > max_num_bytes_ && EvictNext()) {
+  }
+
+  int slot;
+  if (!free_entries_.empty()) {
+    slot = free_entries_.back();
+    free_entries_.pop_back();
+  } else {
+    slot = entries_.size();
+    entries_.emplace_back();
+  }
+  Entry* entry = &entries_[slot];
+  entry->key = key;
+  entry->is_occupied = true;
+  entry->is_referenced = false;
+  entry->num_bytes = num_bytes;
+  entry->parsed_hands = parsed_hands;
+  index_[key] = slot;
+  ++stats_.num_entries;
+  stats_.num_bytes += num_bytes;
+}
+
+bool ParseCache::EvictNext() {
+  if (stats_.num_entries == 0) {
+    return false;
+  }
+  // Each referenced entry is skipped at most once, so this stops within 2
+  // sweeps.
+  while (true) {
+    if (clock_hand_ >= entries_.size()) {
+      clock_hand_ = 0;
+    }
+    const int slot = clock_hand_++;
+    Entry* entry = &entries_[slot];
+    if (!entry->is_occupied) {
+      continue;
+    }
+    if (entry->is_referenced) {
+      entry->is_referenced = false;
+      continue;
+    }
+
+    index_.erase(entry->key);
+    free_entries_.push_back(slot);
+    entry->is_occupied = false;
+    // Release the memory of the parsed hands, which the budget counts.
+    vector<CompactParsedHand>().swap(entry->parsed_hands);
+    --stats_.num_entries;
+    stats_.num_bytes -= entry->num_bytes;
+    ++stats_.num_evictions;
+    return true;
+  }
+}
+
+}  // namespace mahjong
+}  // namespace ycraft
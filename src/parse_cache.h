@@ -0,0 +1,147 @@
+// Copyright 2016 Yuki Hamada
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_PARSE_CACHE_H_
+#define SRC_PARSE_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "proto/mahjong_scorecalculator.pb.h"
+#include "src/compact_hand.h"
+#include "src/compact_parsed_hand.h"
+#include "src/suit_permutation.h"
+
+namespace ycraft {
+namespace mahjong {
+
+class HandParser;
+
+// ParseCacheStats holds counters of a ParseCache since it was created.
+struct ParseCacheStats {
+  // Lookups of hands that can be cached, and the ones found in the cache.
+  uint64_t num_lookups;
+  uint64_t num_hits;
+
+  uint64_t num_evictions;
+
+  // The current number of cached hands and the bytes they use.
+  int num_entries;
+  size_t num_bytes;
+};
+
+// ParseCache keeps parsed hands of recently parsed hands, so that hands that
+// come up repeatedly, e.g. in replays and simulations, are parsed once. Hands
+// are keyed by a fingerprint of the tile counts of closed tiles, melds, the
+// agari tile, the agari type and agari states, which is all HandParser
+// depends on. The order of closed tiles doesn't matter. Optionally, hands
+// that differ only in suits share an entry, since permuting suits doesn't
+// change how a hand is decomposed (see CanonicalizeSuits).
+//
+// The memory used by cached parsed hands is bounded by the given budget, and
+// entries are evicted by the CLOCK algorithm: each hit marks its entry, and
+// eviction skips marked entries once while clearing their marks. All the
+// methods are thread-safe.
+class ParseCache {
+ public:
+  // If shares_suit_permutations is true, parsed hands are stored for the
+  // representative of suit permutations of each hand, and mapped back on each
+  // lookup by HandParser::PermuteParsedHands. Parsed hands are then the same
+  // as HandParser::Parse generates, in the same order, except that tiles of a
+  // kokushi-musou element may follow the order of another hand's closed
+  // tiles.
+  ParseCache(size_t max_num_bytes, bool shares_suit_permutations);
+
+  /**
+   * Appends parsed hands of the given hand to the given vector, same as
+   * HandParser::Parse, and returns the result of validating the hand. Parsed
+   * hands never refer to open melds. Invalid hands aren't cached.
+   */
+  HandValidatorResult::Type Parse(const HandParser& hand_parser,
+                                  const CompactHand& hand,
+                                  std::vector<CompactParsedHand>* result);
+
+  ParseCacheStats GetStats() const;
+
+  // Removes all the cached hands. Counters other than the sizes are kept.
+  void Clear();
+
+ private:
+  struct Key {
+    // 3 bits of each tile count of closed tiles, 17 tiles in each of the
+    // first 2 words. The last word holds melds, the agari tile,
+    // the agari type and agari states.
+    uint64_t word[3];
+
+    bool operator==(const Key& other) const {
+      return word[0] == other.word[0] && word[1] == other.word[1] &&
+             word[2] == other.word[2];
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key& key) const;
+  };
+
+  struct Entry {
+    Key key;
+    bool is_occupied;
+    bool is_referenced;
+    size_t num_bytes;
+    std::vector<CompactParsedHand> parsed_hands;
+  };
+
+  // Builds the key of the given hand. Returns false if the hand can't be
+  // represented by a key, which is only possible for invalid hands.
+  static bool GetKey(const CompactHand& hand, Key* key);
+
+  // Appends the given parsed hands to the result, mapping their suits with
+  // the given permutation back to the given hand.
+  static void AppendParsedHands(
+      const HandParser& hand_parser, const CompactHand& hand,
+      const std::vector<CompactParsedHand>& parsed_hands,
+      const SuitPermutation& permutation,
+      std::vector<CompactParsedHand>* result);
+
+  // Caches the given parsed hands. Evicts entries until they fit in the
+  // budget.
+  void Insert(const Key& key,
+              const std::vector<CompactParsedHand>& parsed_hands);
+
+  // Evicts the entry of the clock hand, skipping referenced entries. Returns
+  // false if there's no entry.
+  bool EvictNext();
+
+  const size_t max_num_bytes_;
+  const bool shares_suit_permutations_;
+
+  mutable std::mutex mutex_;
+
+  // Entries are kept in a vector that the clock hand sweeps. Slots of
+  // evicted entries are reused before the vector grows.
+  std::vector<Entry> entries_;
+  std::unordered_map<Key, int, KeyHash> index_;
+  std::vector<int> free_entries_;
+  size_t clock_hand_;
+
+  ParseCacheStats stats_;
+};
+
+}  // namespace mahjong
+}  // namespace ycraft
+
+#endif  // SRC_PARSE_CACHE_H_
@@ -16,38 +16,366 @@
 
 #include <algorithm>
 #include <iostream>
+#include <string>
 #include <utility>
+#include <vector>
 
 #include "src/hand_parser.h"
 #include "src/mahjong_common_util.h"
+#include "src/suit_permutation.h"
 #include "src/yaku_applier.h"
 
+using google::protobuf::Arena;
+using google::protobuf::ArenaOptions;
 using std::unique_ptr;
+using std::vector;
 
 namespace ycraft {
 namespace mahjong {
 
+namespace {
+// Counts tiles of the hand including melds.
+void CountTiles(const CompactHand& hand, int* counts) {
+  std::fill(counts, counts + kNumTileIndices, 0);
+  for (int i = 0; i < hand.num_closed_tiles; ++i) {
+    ++counts[hand.closed_tile[i]];
+  }
+  if (hand.agari_tile < kNumTileIndices) {
+    ++counts[hand.agari_tile];
+  }
+  for (int i = 0; i < hand.num_melds; ++i) {
+    const CompactHand::Meld& meld = hand.meld[i];
+    switch (meld.type) {
+      case HandElementType::MINSHUNTSU:
+        for (int j = 0; j < 3; ++j) {
+          ++counts[meld.tile + j];
+        }
+        break;
+      case HandElementType::MINKOUTSU:
+        counts[meld.tile] += 3;
+        break;
+      default:
+        counts[meld.tile] += 4;
+        break;
+    }
+  }
+}
+
+// Counts tiles of the given counts that are any of the given dora.
+int CountDora(const int* counts, const uint8_t* dora, int num_dora) {
+  int num_dora_tiles = 0;
+  for (int i = 0; i < num_dora; ++i) {
+    if (dora[i] < kNumTileIndices) {
+      num_dora_tiles += counts[dora[i]];
+    }
+  }
+  return num_dora_tiles;
+}
+
+// StackArena is an arena whose first block is a buffer of the given size in
+// the instance, so that an instance on the stack serves most calls without
+// the global allocator.
+template <int kInitialBlockSize>
+class StackArena {
+ public:
+  StackArena() : arena_(GetOptions(initial_block_)) {}
+
+  Arena* get() { return &arena_; }
+
+ private:
+  static ArenaOptions GetOptions(char* initial_block) {
+    ArenaOptions options;
+    options.initial_block = initial_block;
+    options.initial_block_size = kInitialBlockSize;
+    return options;
+  }
+
+  // Arena expects the initial block to be aligned to 8 bytes.
+  alignas(8) char initial_block_[kInitialBlockSize];
+  Arena arena_;
+};
+}  // namespace
+
 ScoreCalculator::ScoreCalculator(unique_ptr<Rule> rule)
     : rule_(move(rule)),
       hand_parser_(new HandParser),
       yaku_applier_(new YakuApplier(*rule_)) {}
 
 void ScoreCalculator::Calculate(const Field& field, const Player& player,
-                                ScoreCalculatorResult* result) {
-  HandParserResult hand_parser_result;
-  hand_parser_->Parse(player.hand(), &hand_parser_result);
-
-  for (const ParsedHand& parsed_hand : hand_parser_result.parsed_hand()) {
-    ScoreCalculatorResult current_result;
-    Calculate(field, player, parsed_hand, &current_result);
-    if (Compare(*result, current_result) > 0) {
-      *result = current_result;
+                                ScoreCalculatorResult* result) const {
+  CompactField compact_field;
+  CompactHand compact_hand;
+  if (!ToCompactField(field, &compact_field) ||
+      ToCompactHand(player.hand(), &compact_hand) != HandValidatorResult::OK) {
+    return;
+  }
+  Calculate(compact_field, player.wind(), compact_hand, result);
+}
+
+void ScoreCalculator::Calculate(const Field& field, const Player& player,
+                                ScoreCalculatorResult* result,
+                                Arena* arena) const {
+  CompactField compact_field;
+  CompactHand compact_hand;
+  if (!ToCompactField(field, &compact_field) ||
+      ToCompactHand(player.hand(), &compact_hand) != HandValidatorResult::OK) {
+    return;
+  }
+  Calculate(compact_field, player.wind(), compact_hand, result, arena);
+}
+
+void ScoreCalculator::Calculate(const CompactField& field,
+                                TileType player_wind, const CompactHand& hand,
+                                ScoreCalculatorResult* result) const {
+  StackArena<kArenaInitialBlockSize> arena;
+  Calculate(field, player_wind, hand, result, arena.get());
+}
+
+void ScoreCalculator::Calculate(const CompactField& field,
+                                TileType player_wind, const CompactHand& hand,
+                                ScoreCalculatorResult* result,
+                                Arena* arena) const {
+  if (parse_cache_ != nullptr) {
+    vector<CompactParsedHand> parsed_hands;
+    if (parse_cache_->Parse(*hand_parser_, hand, &parsed_hands) ==
+        HandValidatorResult::OK) {
+      CalculateParsedHands(field, player_wind, hand, nullptr, parsed_hands,
+                           result, arena);
+    }
+    return;
+  }
+
+  HandParser::Generator generator(*hand_parser_, hand);
+  if (generator.GetValidatorResult() != HandValidatorResult::OK) {
+    return;
+  }
+  CalculateParsedHands(field, player_wind, hand, &generator,
+                       vector<CompactParsedHand>(), result, arena);
+}
+
+void ScoreCalculator::CalculateParsedHands(
+    const CompactField& field, TileType player_wind, const CompactHand& hand,
+    HandParser::Generator* generator,
+    const vector<CompactParsedHand>& parsed_hands,
+    ScoreCalculatorResult* result, Arena* arena) const {
+  // These are cleared and reused for each parsed hand. Clear keeps memory of
+  // repeated fields, so the arena doesn't grow with the number of parsed
+  // hands.
+  YakuApplierResult* yaku_applier_result =
+      Arena::CreateMessage<YakuApplierResult>(arena);
+  ScoreCalculatorResult* current_result =
+      Arena::CreateMessage<ScoreCalculatorResult>(arena);
+
+  int counts[kNumTileIndices];
+  CountTiles(hand, counts);
+  const int dora = CountDora(counts, field.dora, field.num_dora);
+  const int uradora =
+      IsRichiTypeMatched(RichiType::RICHI, hand.richi_type)
+          ? CountDora(counts, field.uradora, field.num_uradora)
+          : 0;
+
+  CompactParsedHand parsed_hand;
+  size_t next_parsed_hand = 0;
+  while (generator != nullptr ? generator->Next(&parsed_hand)
+                              : next_parsed_hand < parsed_hands.size()) {
+    const CompactParsedHand& current_parsed_hand =
+        generator != nullptr ? parsed_hand : parsed_hands[next_parsed_hand++];
+    yaku_applier_result->Clear();
+    current_result->Clear();
+    Calculate(field, player_wind, hand, current_parsed_hand, dora, uradora,
+              yaku_applier_result, current_result);
+    if (Compare(*result, *current_result) > 0) {
+      result->CopyFrom(*current_result);
+    }
+  }
+}
+
+void ScoreCalculator::AnalyzeDiscards(const Field& field, const Player& player,
+                                      DiscardAnalyzerResult* result) const {
+  CompactField compact_field;
+  if (!ToCompactField(field, &compact_field)) {
+    result->set_validator_result(HandValidatorResult::ERROR_INVALID_FIELD);
+    return;
+  }
+  CompactHand compact_hand;
+  const HandValidatorResult::Type validator_result =
+      ToCompactHand(player.hand(), &compact_hand);
+  if (validator_result != HandValidatorResult::OK) {
+    result->set_validator_result(validator_result);
+    return;
+  }
+  AnalyzeDiscards(compact_field, player.wind(), compact_hand, result);
+}
+
+void ScoreCalculator::AnalyzeDiscards(const CompactField& field,
+                                      TileType player_wind,
+                                      const CompactHand& hand,
+                                      DiscardAnalyzerResult* result) const {
+  const HandValidatorResult::Type validator_result =
+      hand_parser_->Validate(hand);
+  result->set_validator_result(validator_result);
+  if (validator_result != HandValidatorResult::OK) {
+    return;
+  }
+
+  StackArena<kArenaInitialBlockSize> arena;
+  YakuApplierResult* yaku_applier_result =
+      Arena::CreateMessage<YakuApplierResult>(arena.get());
+  ScoreCalculatorResult* current_result =
+      Arena::CreateMessage<ScoreCalculatorResult>(arena.get());
+
+  uint8_t free_tile_counts[kNumTileIndices] = {};
+  for (int i = 0; i < hand.num_closed_tiles; ++i) {
+    ++free_tile_counts[hand.closed_tile[i]];
+  }
+  ++free_tile_counts[hand.agari_tile];
+
+  // Tile counts of the hand after a discard, which give dora of each winning
+  // tile without counting the whole hand again.
+  int counts[kNumTileIndices];
+  CountTiles(hand, counts);
+
+  CompactHand waiting_hand = hand;
+  for (int discard = 0; discard < kNumTileIndices; ++discard) {
+    if (free_tile_counts[discard] == 0) {
+      continue;
+    }
+    --free_tile_counts[discard];
+    waiting_hand.SetClosedTiles(free_tile_counts);
+    ++free_tile_counts[discard];
+
+    HandParser::WaitParser wait_parser(*hand_parser_, waiting_hand);
+    if (wait_parser.GetValidatorResult() != HandValidatorResult::OK) {
+      continue;
+    }
+    DiscardAnalyzerResult::TenpaiDiscard* tenpai_discard =
+        result->add_tenpai_discard();
+    --counts[discard];
+    AnalyzeWaits(field, player_wind, waiting_hand, &wait_parser, counts,
+                 yaku_applier_result, current_result,
+                 tenpai_discard->mutable_winning_tile());
+    ++counts[discard];
+    if (tenpai_discard->winning_tile_size() == 0) {
+      result->mutable_tenpai_discard()->RemoveLast();
+      continue;
+    }
+
+    const TileType discard_tile = GetTileTypeFromIndex(discard);
+    tenpai_discard->set_discard(discard_tile);
+    for (const DiscardAnalyzerResult::WinningTile& winning_tile :
+         tenpai_discard->winning_tile()) {
+      if (winning_tile.tile() == discard_tile) {
+        tenpai_discard->set_is_furiten(true);
+      }
     }
   }
 }
 
+void ScoreCalculator::AnalyzeWaits(const Field& field, const Player& player,
+                                   WaitAnalyzerResult* result) const {
+  CompactField compact_field;
+  if (!ToCompactField(field, &compact_field)) {
+    result->set_validator_result(HandValidatorResult::ERROR_INVALID_FIELD);
+    return;
+  }
+  CompactHand compact_hand;
+  const HandValidatorResult::Type validator_result =
+      ToCompactHand(player.hand(), &compact_hand);
+  if (validator_result != HandValidatorResult::OK) {
+    result->set_validator_result(validator_result);
+    return;
+  }
+  AnalyzeWaits(compact_field, player.wind(), compact_hand, result);
+}
+
+void ScoreCalculator::AnalyzeWaits(const CompactField& field,
+                                   TileType player_wind,
+                                   const CompactHand& hand,
+                                   WaitAnalyzerResult* result) const {
+  HandParser::WaitParser wait_parser(*hand_parser_, hand);
+  result->set_validator_result(wait_parser.GetValidatorResult());
+  if (wait_parser.GetValidatorResult() != HandValidatorResult::OK) {
+    return;
+  }
+
+  StackArena<kArenaInitialBlockSize> arena;
+  YakuApplierResult* yaku_applier_result =
+      Arena::CreateMessage<YakuApplierResult>(arena.get());
+  ScoreCalculatorResult* current_result =
+      Arena::CreateMessage<ScoreCalculatorResult>(arena.get());
+
+  CompactHand waiting_hand = hand;
+  waiting_hand.agari_tile = CompactParsedHand::kUnknownTileCode;
+  int counts[kNumTileIndices];
+  CountTiles(waiting_hand, counts);
+  AnalyzeWaits(field, player_wind, waiting_hand, &wait_parser, counts,
+               yaku_applier_result, current_result,
+               result->mutable_winning_tile());
+}
+
+void ScoreCalculator::AnalyzeWaits(
+    const CompactField& field, TileType player_wind, const CompactHand& hand,
+    HandParser::WaitParser* wait_parser, int* counts,
+    YakuApplierResult* yaku_applier_result,
+    ScoreCalculatorResult* current_result,
+    google::protobuf::RepeatedPtrField<DiscardAnalyzerResult::WinningTile>*
+        winning_tiles) const {
+  const bool has_uradora =
+      IsRichiTypeMatched(RichiType::RICHI, hand.richi_type);
+  for (int tile = 0; tile < kNumTileIndices; ++tile) {
+    // Parse the hand once as ron, and score each parsed hand for tsumo by
+    // changing its agari type.
+    if (!wait_parser->Start(tile, AgariType::RON)) {
+      continue;
+    }
+    DiscardAnalyzerResult::WinningTile* winning_tile = winning_tiles->Add();
+    winning_tile->set_tile(GetTileTypeFromIndex(tile));
+
+    ++counts[tile];
+    const int dora = CountDora(counts, field.dora, field.num_dora);
+    const int uradora =
+        has_uradora ? CountDora(counts, field.uradora, field.num_uradora) : 0;
+    --counts[tile];
+
+    CompactParsedHand parsed_hand;
+    while (wait_parser->Next(&parsed_hand)) {
+      yaku_applier_result->Clear();
+      current_result->Clear();
+      Calculate(field, player_wind, hand, parsed_hand, dora, uradora,
+                yaku_applier_result, current_result);
+      if (Compare(winning_tile->ron(), *current_result) > 0) {
+        winning_tile->mutable_ron()->CopyFrom(*current_result);
+      }
+
+      SetAgariType(AgariType::TSUMO, &parsed_hand);
+      yaku_applier_result->Clear();
+      current_result->Clear();
+      Calculate(field, player_wind, hand, parsed_hand, dora, uradora,
+                yaku_applier_result, current_result);
+      if (Compare(winning_tile->tsumo(), *current_result) > 0) {
+        winning_tile->mutable_tsumo()->CopyFrom(*current_result);
+      }
+    }
+  }
+}
+
+void ScoreCalculator::EnableParseCache(size_t max_num_bytes) {
+  // Parsed hands of hands that differ only in suits are the same up to
+  // suits, so they're shared unless a yaku names specific suits.
+  std::vector<std::string> asymmetric_yaku;
+  GetSuitAsymmetricYaku(*rule_, &asymmetric_yaku);
+  parse_cache_.reset(new ParseCache(max_num_bytes, asymmetric_yaku.empty()));
+}
+
+ParseCacheStats ScoreCalculator::GetParseCacheStats() const {
+  if (parse_cache_ == nullptr) {
+    return ParseCacheStats();
+  }
+  return parse_cache_->GetStats();
+}
+
 int ScoreCalculator::Compare(const ScoreCalculatorResult& left,
-                             const ScoreCalculatorResult& right) {
+                             const ScoreCalculatorResult& right) const {
   if (left.yakuman() > 0 || right.yakuman() > 0) {
     if (left.yakuman() > right.yakuman()) {
       return -1;
@@ -86,21 +414,23 @@ int ScoreCalculator::Compare(const ScoreCalculatorResult& left,
   return 0;
 }
 
-void ScoreCalculator::Calculate(const Field& field, const Player& player,
-                                const ParsedHand& parsed_hand,
-                                ScoreCalculatorResult* result) {
-  YakuApplierResult yaku_applier_result;
-  yaku_applier_->Apply(player.hand().richi_type(), field.wind(), player.wind(),
-                       parsed_hand, &yaku_applier_result);
+void ScoreCalculator::Calculate(const CompactField& field,
+                                TileType player_wind, const CompactHand& hand,
+                                const CompactParsedHand& parsed_hand, int dora,
+                                int uradora,
+                                YakuApplierResult* yaku_applier_result,
+                                ScoreCalculatorResult* result) const {
+  yaku_applier_->Apply(hand.richi_type, field.wind, player_wind, parsed_hand,
+                       yaku_applier_result);
 
-  if (yaku_applier_result.yaku_size() == 0) {
+  if (yaku_applier_result->yaku_size() == 0) {
     return;
   }
 
   int han = 0;
   int yakuman = 0;
   bool is_menzen = IsMenzen(parsed_hand);
-  for (const Yaku& yaku : yaku_applier_result.yaku()) {
+  for (const Yaku& yaku : yaku_applier_result->yaku()) {
     if (is_menzen) {
       han += yaku.menzen_han();
     } else {
@@ -109,38 +439,14 @@ void ScoreCalculator::Calculate(const Field& field, const Player& player,
     yakuman += yaku.yakuman();
   }
 
-  int dora = 0;
-  for (const Element& element : parsed_hand.element()) {
-    for (const Tile& tile : element.tile()) {
-      for (int dora_tile : field.dora()) {
-        if (tile.type() == static_cast<TileType>(dora_tile)) {
-          ++dora;
-        }
-      }
-    }
-  }
-
-  int uradora = 0;
-  if (IsRichiTypeMatched(RichiType::RICHI, player.hand().richi_type())) {
-    for (const Element& element : parsed_hand.element()) {
-      for (const Tile& tile : element.tile()) {
-        for (int uradora_tile : field.uradora()) {
-          if (tile.type() == static_cast<TileType>(uradora_tile)) {
-            ++uradora;
-          }
-        }
-      }
-    }
-  }
-
   result->set_dora(dora);
   result->set_uradora(uradora);
   result->set_han(han + dora + uradora);
   result->set_yakuman(yakuman);
-  *result->mutable_yaku() = yaku_applier_result.yaku();
+  *result->mutable_yaku() = yaku_applier_result->yaku();
 
-  result->set_fu(FuCalculator(field.wind(), player.wind())
-                     .Calculate(parsed_hand, yaku_applier_result));
+  result->set_fu(FuCalculator(field.wind, player_wind)
+                     .Calculate(parsed_hand, *yaku_applier_result));
 }
 
 FuCalculator::FuCalculator(TileType field_wind, TileType player_wind)
@@ -149,11 +455,22 @@ FuCalculator::FuCalculator(TileType field_wind, TileType player_wind)
 int FuCalculator::Calculate(
     const ParsedHand& parsed_hand,
     const YakuApplierResult& yaku_applier_result) const {
+  CompactParsedHand compact_parsed_hand;
+  if (!ToCompactParsedHand(parsed_hand, &compact_parsed_hand)) {
+    std::cerr << "Failed to convert the parsed hand." << std::endl;
+    return 0;
+  }
+  return Calculate(compact_parsed_hand, yaku_applier_result);
+}
+
+int FuCalculator::Calculate(
+    const CompactParsedHand& parsed_hand,
+    const YakuApplierResult& yaku_applier_result) const {
   for (const Yaku& yaku : yaku_applier_result.yaku()) {
-    if (parsed_hand.agari().type() == AgariType::TSUMO &&
+    if (parsed_hand.agari_type == AgariType::TSUMO &&
         yaku.fu_override_tsumo() > 0) {
       return yaku.fu_override_tsumo();
-    } else if (parsed_hand.agari().type() == AgariType::RON &&
+    } else if (parsed_hand.agari_type == AgariType::RON &&
                yaku.fu_override_ron() > 0) {
       return yaku.fu_override_ron();
     }
@@ -164,13 +481,17 @@ int FuCalculator::Calculate(
   // futei is 20.
   int fu = 20;
 
-  fu += GetAgariFu(parsed_hand.agari().type(), is_menzen);
+  fu += GetAgariFu(parsed_hand.agari_type, is_menzen);
 
-  for (const Element& element : parsed_hand.element()) {
-    fu += GetElementFu(element);
+  for (int i = 0; i < parsed_hand.GetNumElements(); ++i) {
+    const int tile_begin = parsed_hand.GetElementBegin(i);
+    if (tile_begin != parsed_hand.GetElementEnd(i)) {
+      fu += GetElementFu(parsed_hand.GetElementType(i),
+                         parsed_hand.GetTileType(tile_begin));
+    }
   }
 
-  fu += GetMachiFu(parsed_hand.machi_type());
+  fu += GetMachiFu(parsed_hand.machi_type);
 
   return ((fu + 9) / 10) * 10;
 }
@@ -185,23 +506,23 @@ int FuCalculator::GetAgariFu(AgariType agari_type, bool is_menzen) const {
   return 0;
 }
 
-int FuCalculator::GetElementFu(const Element& element) const {
-  switch (element.type()) {
+int FuCalculator::GetElementFu(HandElementType element_type,
+                               TileType tile) const {
+  switch (element_type) {
     case HandElementType::ANKOUTSU:
-      return IsYaochuhai(element.tile(0).type()) ? 8 : 4;
+      return IsYaochuhai(tile) ? 8 : 4;
     case HandElementType::MINKOUTSU:
-      return IsYaochuhai(element.tile(0).type()) ? 4 : 2;
+      return IsYaochuhai(tile) ? 4 : 2;
     case HandElementType::ANKANTSU:
-      return IsYaochuhai(element.tile(0).type()) ? 32 : 16;
+      return IsYaochuhai(tile) ? 32 : 16;
     case HandElementType::MINKANTSU:
-      return IsYaochuhai(element.tile(0).type()) ? 16 : 8;
+      return IsYaochuhai(tile) ? 16 : 8;
     case HandElementType::ANTOITSU:
     case HandElementType::MINTOITSU:
-      return (element.tile(0).type() == field_wind_ ? 2 : 0) +
-             (element.tile(0).type() == player_wind_ ? 2 : 0) +
-             (element.tile(0).type() == TileType::SANGEN_HAKU ? 2 : 0) +
-             (element.tile(0).type() == TileType::SANGEN_HATSU ? 2 : 0) +
-             (element.tile(0).type() == TileType::SANGEN_CHUN ? 2 : 0);
+      return (tile == field_wind_ ? 2 : 0) + (tile == player_wind_ ? 2 : 0) +
+             (tile == TileType::SANGEN_HAKU ? 2 : 0) +
+             (tile == TileType::SANGEN_HATSU ? 2 : 0) +
+             (tile == TileType::SANGEN_CHUN ? 2 : 0);
     default:
       return 0;
   }
@@ -16,36 +16,124 @@
 #define SRC_SCORE_CALCULATOR_H_
 
 #include <memory>
+#include <vector>
 
+#include "google/protobuf/arena.h"
 #include "proto/mahjong_scorecalculator.pb.h"
+#include "src/compact_hand.h"
+#include "src/compact_parsed_hand.h"
+#include "src/hand_parser.h"
+#include "src/parse_cache.h"
 
 namespace ycraft {
 namespace mahjong {
 
-class HandParser;
 class YakuApplier;
 
 class ScoreCalculator {
  public:
   explicit ScoreCalculator(std::unique_ptr<Rule> rule);
 
+  // Calculates the score of the given player's hand. This method is
+  // thread-safe, so one instance can serve multiple threads.
   void Calculate(const Field& field, const Player& player,
-                 ScoreCalculatorResult* result);
+                 ScoreCalculatorResult* result) const;
 
- private:
+  // Same as above, but allocates all the intermediate messages on the given
+  // arena. The arena isn't reset by this method, so callers can reuse one
+  // arena for many calls and free everything at once with Arena::Reset.
   void Calculate(const Field& field, const Player& player,
-                 const ParsedHand& parsed_hand, ScoreCalculatorResult* result);
+                 ScoreCalculatorResult* result,
+                 google::protobuf::Arena* arena) const;
+
+  // Same as the above two, but take the field and the player's hand as plain
+  // structs. The overloads taking protos convert them and call these, so
+  // callers holding tiles in their own arrays don't need to build protos.
+  void Calculate(const CompactField& field, TileType player_wind,
+                 const CompactHand& hand, ScoreCalculatorResult* result) const;
+  void Calculate(const CompactField& field, TileType player_wind,
+                 const CompactHand& hand, ScoreCalculatorResult* result,
+                 google::protobuf::Arena* arena) const;
+
+  // Finds discards of the player's 14-tile hand, i.e. its closed tiles and the
+  // agari tile, that leave the hand tenpai, and calculates the score of each
+  // winning tile by ron and by tsumo. Melds, the richi type and agari states
+  // of the hand apply to every winning tile. The 13 tiles left by each
+  // discard are parsed once by HandParser::WaitParser, and each winning tile
+  // only completes the parse of its own group and is parsed once for both
+  // agari types.
+  void AnalyzeDiscards(const Field& field, const Player& player,
+                       DiscardAnalyzerResult* result) const;
+  void AnalyzeDiscards(const CompactField& field, TileType player_wind,
+                       const CompactHand& hand,
+                       DiscardAnalyzerResult* result) const;
+
+  // Calculates the score of each tile that completes the player's hand by
+  // ron and by tsumo. The agari tile of the hand is ignored, so the hand has
+  // 13 tiles counting a kantsu as 3 tiles. The 13 tiles are parsed once by
+  // HandParser::WaitParser, and each winning tile only completes the parse of
+  // its own group and is parsed once for both agari types.
+  void AnalyzeWaits(const Field& field, const Player& player,
+                    WaitAnalyzerResult* result) const;
+  void AnalyzeWaits(const CompactField& field, TileType player_wind,
+                    const CompactHand& hand, WaitAnalyzerResult* result) const;
+
+  // Makes Calculate look up parsed hands in a ParseCache using at most the
+  // given bytes, replacing the current cache if any. The cache is
+  // thread-safe, but this method isn't, so call it before sharing the
+  // calculator among threads. Hands that differ only in suits share cached
+  // parsed hands if every yaku of the rule is symmetric in suits.
+  void EnableParseCache(size_t max_num_bytes);
+
+  // Returns counters of the parse cache, or zeros if it isn't enabled.
+  ParseCacheStats GetParseCacheStats() const;
+
+ private:
+  // The size of the stack buffer used as the first block of the arena when
+  // the caller doesn't give one. Most calls fit in this block, so they don't
+  // touch the global allocator for intermediate messages.
+  static const int kArenaInitialBlockSize = 16 * 1024;
+
+  // Calculates the score of a single parsed hand. Dora don't depend on how
+  // the hand is parsed, so they are counted once by the caller.
+  void Calculate(const CompactField& field, TileType player_wind,
+                 const CompactHand& hand, const CompactParsedHand& parsed_hand,
+                 int dora, int uradora, YakuApplierResult* yaku_applier_result,
+                 ScoreCalculatorResult* result) const;
+
+  // Scores parsed hands of the given hand and keeps the best result. Parsed
+  // hands come from the generator, or from the given vector if the generator
+  // is nullptr.
+  void CalculateParsedHands(const CompactField& field, TileType player_wind,
+                            const CompactHand& hand,
+                            HandParser::Generator* generator,
+                            const std::vector<CompactParsedHand>& parsed_hands,
+                            ScoreCalculatorResult* result,
+                            google::protobuf::Arena* arena) const;
+
+  // Scores each tile that completes the waiting hand of the given parser and
+  // appends it to winning_tiles. counts are tile counts of the waiting hand
+  // including melds, which give dora of each completed hand. The given
+  // messages are cleared and reused for each parsed hand.
+  void AnalyzeWaits(
+      const CompactField& field, TileType player_wind, const CompactHand& hand,
+      HandParser::WaitParser* wait_parser, int* counts,
+      YakuApplierResult* yaku_applier_result,
+      ScoreCalculatorResult* current_result,
+      google::protobuf::RepeatedPtrField<DiscardAnalyzerResult::WinningTile>*
+          winning_tiles) const;
 
   // Compares two results. It returns -1 if the first one has greater points,
   // 1 if the second one is greater, or 0 if they are the same.
   // If both results are the same level of yakuman, han is used for comparison.
   // If han is also the same, the basic points is used.
   int Compare(const ScoreCalculatorResult& left,
-              const ScoreCalculatorResult& right);
+              const ScoreCalculatorResult& right) const;
 
-  std::unique_ptr<Rule> rule_;
-  std::unique_ptr<HandParser> hand_parser_;
-  std::unique_ptr<YakuApplier> yaku_applier_;
+  const std::unique_ptr<Rule> rule_;
+  const std::unique_ptr<HandParser> hand_parser_;
+  const std::unique_ptr<YakuApplier> yaku_applier_;
+  std::unique_ptr<ParseCache> parse_cache_;
 };
 
 class FuCalculator {
@@ -54,10 +142,12 @@ class FuCalculator {
 
   int Calculate(const ParsedHand& parsed_hand,
                 const YakuApplierResult& yaku_applier_result) const;
+  int Calculate(const CompactParsedHand& parsed_hand,
+                const YakuApplierResult& yaku_applier_result) const;
 
  private:
   int GetAgariFu(AgariType agari_type, bool is_menzen) const;
-  int GetElementFu(const Element& element) const;
+  int GetElementFu(HandElementType element_type, TileType tile) const;
   int GetMachiFu(MachiType machi_type) const;
 
   const TileType field_wind_;
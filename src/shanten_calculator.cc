@@ -0,0 +1,576 @@
+// Copyright 2016 Yuki Hamada
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/shanten_calculator.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "src/compact_parsed_hand.h"
+#include "src/hand_parser.h"
+#include "src/mahjong_common_util.h"
+#include "src/suit_decomposition_table.h"
+
+using std::max;
+using std::min;
+using std::vector;
+
+namespace ycraft {
+namespace mahjong {
+
+namespace {
+const int kNumJihaiTiles = 7;
+const int kNumSuits = 3;
+const int kNumTilesInSuit = SuitDecompositionTable::kNumTilesInSuit;
+const int kMaxNumMentsu = 4;
+
+// Distances of a shape are the numbers of tiles to add to it so that it
+// contains m mentsu (entry m), or m mentsu and a jantou (entry
+// kWithJantou + m). Tiles the shape doesn't need are simply ignored.
+const int kWithJantou = kMaxNumMentsu + 1;
+const int kNumDistances = 2 * kWithJantou;
+
+// Each distance is stored in 4 bits. Every target is reachable from any
+// shape, so distances never exceed 14.
+const int kDistanceBits = 4;
+const uint64_t kDistanceMask = (1 << kDistanceBits) - 1;
+const uint8_t kInfiniteDistance = 0xff;
+
+// Tiles are split into groups of jihai tiles and each suit, and each group
+// has its own distances.
+const int kNumGroups = kNumSuits + 1;
+
+// Bit i is set if the tile of index i is yaochuhai.
+const uint64_t kYaochuhaiMask =
+    ((static_cast<uint64_t>(1) << kNumJihaiTiles) - 1) |
+    (static_cast<uint64_t>(1) << 7) | (static_cast<uint64_t>(1) << 15) |
+    (static_cast<uint64_t>(1) << 16) |
+    (static_cast<uint64_t>(1) << 24) | (static_cast<uint64_t>(1) << 25) |
+    (static_cast<uint64_t>(1) << 33);
+
+// DistanceTable holds distances of every shape of a group of tiles, i.e. a
+// suit or jihai tiles. A shape is encoded as a base-5 number of its tile
+// counts in the same way as SuitDecompositionTable, so the table is a plain
+// array indexed by the key.
+class DistanceTable {
+ public:
+  // Returns the shared tables. Each table is built on the first call.
+  static const DistanceTable& GetSuitTable();
+  static const DistanceTable& GetJihaiTable();
+
+  // Stores kNumDistances distances of the shape of the given counts.
+  void Find(const int* counts, int* distances) const;
+
+ private:
+  DistanceTable(int num_tiles, bool has_shuntsu);
+  DistanceTable(const DistanceTable&) = delete;
+  DistanceTable& operator=(const DistanceTable&) = delete;
+
+  // Marks keys of all shapes that consist of num_mentsu more mentsu whose
+  // kinds are not smaller than the given kind, added to the given counts.
+  void MarkTargets(int kind, int num_mentsu, int* counts,
+                   vector<uint8_t>* distances) const;
+
+  // Makes each entry of distances the minimum number of tiles to add to the
+  // shape so that it contains a marked shape.
+  void Propagate(vector<uint8_t>* distances) const;
+
+  int Encode(const int* counts) const;
+
+  const int num_tiles_;
+  const int num_mentsu_kinds_;
+  int num_keys_;
+  vector<uint64_t> distances_;
+};
+
+const DistanceTable& DistanceTable::GetSuitTable() {
+  static const DistanceTable* const table =
+      new DistanceTable(kNumTilesInSuit, true);
+  return *table;
+}
+
+const DistanceTable& DistanceTable::GetJihaiTable() {
+  static const DistanceTable* const table =
+      new DistanceTable(kNumJihaiTiles, false);
+  return *table;
+}
+
+DistanceTable::DistanceTable(int num_tiles, bool has_shuntsu)
+    : num_tiles_(num_tiles),
+      num_mentsu_kinds_(has_shuntsu ? 2 * num_tiles - 2 : num_tiles),
+      num_keys_(1) {
+  for (int i = 0; i < num_tiles_; ++i) {
+    num_keys_ *= 5;
+  }
+
+  distances_.assign(num_keys_, 0);
+  vector<uint8_t> distances(num_keys_);
+  int counts[kNumTilesInSuit] = {};
+  for (int num_mentsu = 0; num_mentsu <= kMaxNumMentsu; ++num_mentsu) {
+    std::fill(distances.begin(), distances.end(), kInfiniteDistance);
+    MarkTargets(0, num_mentsu, counts, &distances);
+    Propagate(&distances);
+    for (int key = 0; key < num_keys_; ++key) {
+      distances_[key] |= static_cast<uint64_t>(distances[key])
+                         << (kDistanceBits * num_mentsu);
+    }
+
+    std::fill(distances.begin(), distances.end(), kInfiniteDistance);
+    for (int jantou = 0; jantou < num_tiles_; ++jantou) {
+      counts[jantou] += 2;
+      MarkTargets(0, num_mentsu, counts, &distances);
+      counts[jantou] -= 2;
+    }
+    Propagate(&distances);
+    for (int key = 0; key < num_keys_; ++key) {
+      distances_[key] |= static_cast<uint64_t>(distances[key])
+                         << (kDistanceBits * (kWithJantou + num_mentsu));
+    }
+  }
+}
+
+void DistanceTable::MarkTargets(int kind, int num_mentsu, int* counts,
+                                vector<uint8_t>* distances) const {
+  if (num_mentsu == 0) {
+    (*distances)[Encode(counts)] = 0;
+    return;
+  }
+  // Kinds in [0, num_tiles_) are koutsu, and the rest are shuntsu.
+  for (int k = kind; k < num_mentsu_kinds_; ++k) {
+    const int begin = k < num_tiles_ ? k : k - num_tiles_;
+    const int end = k < num_tiles_ ? k + 1 : begin + 3;
+    const int num_tiles = k < num_tiles_ ? 3 : 1;
+    bool valid = true;
+    for (int i = begin; i < end; ++i) {
+      counts[i] += num_tiles;
+      valid &= counts[i] <= 4;
+    }
+    if (valid) {
+      MarkTargets(k, num_mentsu - 1, counts, distances);
+    }
+    for (int i = begin; i < end; ++i) {
+      counts[i] -= num_tiles;
+    }
+  }
+}
+
+void DistanceTable::Propagate(vector<uint8_t>* distances) const {
+  // The distance is the sum of distances of each tile, so it is minimized one
+  // tile at a time. For a tile of count c, a target having fewer tiles costs
+  // nothing and a target having t > c tiles costs t - c.
+  uint8_t* const d = distances->data();
+  for (int i = 0, stride = 1; i < num_tiles_; ++i, stride *= 5) {
+    for (int base = 0; base < num_keys_; base += 5 * stride) {
+      for (int count = 1; count <= 4; ++count) {
+        uint8_t* const current = d + base + count * stride;
+        const uint8_t* const fewer = current - stride;
+        for (int j = 0; j < stride; ++j) {
+          current[j] = min(current[j], fewer[j]);
+        }
+      }
+      for (int count = 3; count >= 0; --count) {
+        uint8_t* const current = d + base + count * stride;
+        const uint8_t* const more = current + stride;
+        for (int j = 0; j < stride; ++j) {
+          if (more[j] != kInfiniteDistance) {
+            current[j] = min<uint8_t>(current[j], more[j] + 1);
+          }
+        }
+      }
+    }
+  }
+}
+
+int DistanceTable::Encode(const int* counts) const {
+  int key = 0;
+  for (int i = num_tiles_ - 1; i >= 0; --i) {
+    key = key * 5 + counts[i];
+  }
+  return key;
+}
+
+void DistanceTable::Find(const int* counts, int* distances) const {
+  const uint64_t packed = distances_[Encode(counts)];
+  for (int i = 0; i < kNumDistances; ++i) {
+    distances[i] = (packed >> (kDistanceBits * i)) & kDistanceMask;
+  }
+}
+
+// Combines distances of another group into the given distances, keeping
+// entries up to num_mentsu mentsu.
+inline void CombineDistances(const int* other, int num_mentsu,
+                             int* distances) {
+  int combined[kNumDistances];
+  for (int m = 0; m <= num_mentsu; ++m) {
+    int without_jantou = distances[m] + other[0];
+    int with_jantou = min(distances[kWithJantou + m] + other[0],
+                          distances[m] + other[kWithJantou]);
+    for (int i = 1; i <= m; ++i) {
+      without_jantou = min(without_jantou, distances[m - i] + other[i]);
+      with_jantou = min(with_jantou,
+                        min(distances[kWithJantou + m - i] + other[i],
+                            distances[m - i] + other[kWithJantou + i]));
+    }
+    combined[m] = without_jantou;
+    combined[kWithJantou + m] = with_jantou;
+  }
+  for (int m = 0; m <= num_mentsu; ++m) {
+    distances[m] = combined[m];
+    distances[kWithJantou + m] = combined[kWithJantou + m];
+  }
+}
+
+// Returns the number of tiles to add to complete num_mentsu mentsu and a
+// jantou with tiles of both of the given distances. This is the single entry
+// of CombineDistances that the shanten number needs.
+inline int GetCompleteDistance(const int* left, const int* right,
+                               int num_mentsu) {
+  int distance = left[kWithJantou + num_mentsu] + right[0];
+  for (int m = 0; m <= num_mentsu; ++m) {
+    distance = min(distance, left[m] + right[kWithJantou + num_mentsu - m]);
+    distance = min(distance, left[kWithJantou + m] + right[num_mentsu - m]);
+  }
+  return distance;
+}
+
+inline int GetGroup(int index) {
+  return index < kNumJihaiTiles
+             ? 0
+             : 1 + (index - kNumJihaiTiles) / kNumTilesInSuit;
+}
+
+inline const int* GetGroupCounts(const int* counts, int group) {
+  return group == 0 ? counts
+                    : counts + kNumJihaiTiles + (group - 1) * kNumTilesInSuit;
+}
+
+inline const DistanceTable& GetGroupTable(int group) {
+  return group == 0 ? DistanceTable::GetJihaiTable()
+                    : DistanceTable::GetSuitTable();
+}
+
+// Counts tiles of melds of the hand.
+void CountMeldTiles(const CompactHand& hand, int* counts) {
+  std::fill(counts, counts + kNumTileIndices, 0);
+  for (int i = 0; i < hand.num_melds; ++i) {
+    const CompactHand::Meld& meld = hand.meld[i];
+    switch (meld.type) {
+      case HandElementType::MINSHUNTSU:
+        for (int j = 0; j < 3; ++j) {
+          ++counts[meld.tile + j];
+        }
+        break;
+      case HandElementType::MINKOUTSU:
+        counts[meld.tile] += 3;
+        break;
+      default:
+        counts[meld.tile] += 4;
+        break;
+    }
+  }
+}
+}  // namespace
+
+static_assert(ShantenState::kNumGroups == kNumGroups,
+              "ShantenState::kNumGroups must match the groups of tiles");
+static_assert(ShantenState::kNumDistances == kNumDistances,
+              "ShantenState::kNumDistances must match DistanceTable");
+
+const int ShantenResult::kNotApplicable;
+const int UkeireResult::kMaxNumEntries;
+const int ShantenState::kNumGroups;
+const int ShantenState::kNumDistances;
+
+void ShantenState::IrregularCounts::Clear() {
+  num_kinds = 0;
+  num_toitsu = 0;
+  num_yaochuhai_kinds = 0;
+  num_yaochuhai_toitsu = 0;
+}
+
+void ShantenState::IrregularCounts::Update(int index, int old_count,
+                                           int new_count) {
+  const int kinds = (new_count > 0) - (old_count > 0);
+  const int toitsu = (new_count >= 2) - (old_count >= 2);
+  num_kinds += kinds;
+  num_toitsu += toitsu;
+  if ((kYaochuhaiMask >> index) & 1) {
+    num_yaochuhai_kinds += kinds;
+    num_yaochuhai_toitsu += toitsu;
+  }
+}
+
+int ShantenState::IrregularCounts::GetChiiToitsuShanten() const {
+  // Chiitoitsu needs 7 distinct kinds of toitsu.
+  return 6 - num_toitsu + max(0, 7 - num_kinds);
+}
+
+int ShantenState::IrregularCounts::GetKokushiShanten() const {
+  // Kokushi needs every kind of yaochuhai and a toitsu of one of them.
+  return 13 - num_yaochuhai_kinds - (num_yaochuhai_toitsu > 0 ? 1 : 0);
+}
+
+void ShantenState::Setup(const int* counts, int num_melds) {
+  std::copy(counts, counts + kNumTileIndices, counts_);
+  std::fill(meld_counts_, meld_counts_ + kNumTileIndices, 0);
+  for (int group = 0; group < kNumGroups; ++group) {
+    UpdateGroup(group);
+  }
+  irregular_counts_.Clear();
+  for (int index = 0; index < kNumTileIndices; ++index) {
+    irregular_counts_.Update(index, 0, counts_[index]);
+  }
+  SetNumMelds(num_melds);
+}
+
+void ShantenState::SetNumMelds(int num_melds) {
+  num_mentsu_ = kMaxNumMentsu - num_melds;
+}
+
+void ShantenState::SetMeldCounts(const int* meld_counts) {
+  std::copy(meld_counts, meld_counts + kNumTileIndices, meld_counts_);
+}
+
+void ShantenState::AddTile(int index) {
+  irregular_counts_.Update(index, counts_[index], counts_[index] + 1);
+  ++counts_[index];
+  UpdateGroup(GetGroup(index));
+}
+
+void ShantenState::RemoveTile(int index) {
+  irregular_counts_.Update(index, counts_[index], counts_[index] - 1);
+  --counts_[index];
+  UpdateGroup(GetGroup(index));
+}
+
+void ShantenState::UpdateGroup(int group) {
+  GetGroupTable(group).Find(GetGroupCounts(counts_, group),
+                            group_distances_[group]);
+}
+
+void ShantenState::Calculate(ShantenResult* result) const {
+  // The hand needs the remaining mentsu and a jantou, and the last tile to add
+  // completes it, so the shanten number is one less than the distance.
+  int distances[kNumDistances];
+  std::copy(group_distances_[0], group_distances_[0] + kNumDistances,
+            distances);
+  for (int group = 1; group < kNumGroups; ++group) {
+    CombineDistances(group_distances_[group], num_mentsu_, distances);
+  }
+  result->regular_shanten = distances[kWithJantou + num_mentsu_] - 1;
+
+  // Chiitoitsu and kokushi are possible only if the hand has no melds.
+  if (num_mentsu_ == kMaxNumMentsu) {
+    result->chiitoitsu_shanten = irregular_counts_.GetChiiToitsuShanten();
+    result->kokushi_shanten = irregular_counts_.GetKokushiShanten();
+  } else {
+    result->chiitoitsu_shanten = ShantenResult::kNotApplicable;
+    result->kokushi_shanten = ShantenResult::kNotApplicable;
+  }
+  result->shanten =
+      min(result->regular_shanten,
+          min(result->chiitoitsu_shanten, result->kokushi_shanten));
+}
+
+void ShantenState::CalculateUkeire(const uint8_t* visible_counts,
+                                   Ukeire* ukeire) const {
+  ShantenResult result;
+  Calculate(&result);
+  ukeire->shanten = result.shanten;
+  ukeire->tiles = 0;
+  std::fill(ukeire->num_live_tiles, ukeire->num_live_tiles + kNumTileIndices,
+            0);
+  ukeire->total_num_live_tiles = 0;
+
+  // Distances of all the groups other than each group. Each candidate tile
+  // then costs a single table lookup of its group.
+  int other_distances[kNumGroups][kNumDistances];
+  for (int group = 0; group < kNumGroups; ++group) {
+    int* const distances = other_distances[group];
+    const int first = group == 0 ? 1 : 0;
+    std::copy(group_distances_[first], group_distances_[first] + kNumDistances,
+              distances);
+    for (int other = first + 1; other < kNumGroups; ++other) {
+      if (other != group) {
+        CombineDistances(group_distances_[other], num_mentsu_, distances);
+      }
+    }
+  }
+
+  const bool is_menzen = num_mentsu_ == kMaxNumMentsu;
+  int counts[kNumTileIndices];
+  std::copy(counts_, counts_ + kNumTileIndices, counts);
+  for (int index = 0; index < kNumTileIndices; ++index) {
+    // Copies in melds can't be drawn either.
+    const int count = counts[index];
+    const int num_used_tiles = count + meld_counts_[index];
+    if (num_used_tiles >= 4) {
+      continue;
+    }
+
+    const int group = GetGroup(index);
+    int distances[kNumDistances];
+    ++counts[index];
+    GetGroupTable(group).Find(GetGroupCounts(counts, group), distances);
+    --counts[index];
+    int shanten =
+        GetCompleteDistance(distances, other_distances[group], num_mentsu_) -
+        1;
+    if (is_menzen) {
+      IrregularCounts irregular_counts = irregular_counts_;
+      irregular_counts.Update(index, count, count + 1);
+      shanten = min(shanten, min(irregular_counts.GetChiiToitsuShanten(),
+                                 irregular_counts.GetKokushiShanten()));
+    }
+    if (shanten >= ukeire->shanten) {
+      continue;
+    }
+
+    const int num_visible_tiles = visible_counts ? visible_counts[index] : 0;
+    const int num_live_tiles =
+        max(0, 4 - num_used_tiles - num_visible_tiles);
+    ukeire->tiles |= static_cast<uint64_t>(1) << index;
+    ukeire->num_live_tiles[index] = num_live_tiles;
+    ukeire->total_num_live_tiles += num_live_tiles;
+  }
+}
+
+ShantenCalculator::ShantenCalculator() : hand_parser_(new HandParser()) {
+  // Build the shared tables up front so that the first Calculate call doesn't
+  // pay for them.
+  DistanceTable::GetSuitTable();
+  DistanceTable::GetJihaiTable();
+}
+
+ShantenCalculator::~ShantenCalculator() {}
+
+HandValidatorResult::Type ShantenCalculator::Calculate(
+    const Hand& hand, ShantenResult* result) const {
+  CompactHand compact_hand;
+  const HandValidatorResult::Type validator_result =
+      ToCompactHand(hand, &compact_hand);
+  if (validator_result != HandValidatorResult::OK) {
+    return validator_result;
+  }
+  return Calculate(compact_hand, result);
+}
+
+HandValidatorResult::Type ShantenCalculator::Calculate(
+    const CompactHand& hand, ShantenResult* result) const {
+  int counts[kNumTileIndices];
+  const HandValidatorResult::Type validator_result =
+      CountFreeTiles(hand, counts);
+  if (validator_result != HandValidatorResult::OK) {
+    return validator_result;
+  }
+
+  ShantenState state;
+  state.Setup(counts, hand.num_melds);
+  state.Calculate(result);
+  return HandValidatorResult::OK;
+}
+
+bool ShantenCalculator::Calculate(const TileType* tiles, int num_tiles,
+                                  ShantenResult* result) const {
+  if (num_tiles <= 0 || num_tiles > 14 || num_tiles % 3 == 0) {
+    return false;
+  }
+  int counts[kNumTileIndices] = {};
+  for (int i = 0; i < num_tiles; ++i) {
+    const int index = GetTileIndex(tiles[i]);
+    if (index < 0 || counts[index] == 4) {
+      return false;
+    }
+    ++counts[index];
+  }
+
+  ShantenState state;
+  state.Setup(counts, kMaxNumMentsu - (num_tiles - 1) / 3);
+  state.Calculate(result);
+  return true;
+}
+
+HandValidatorResult::Type ShantenCalculator::CalculateUkeire(
+    const Hand& hand, const uint8_t* visible_counts,
+    UkeireResult* result) const {
+  CompactHand compact_hand;
+  const HandValidatorResult::Type validator_result =
+      ToCompactHand(hand, &compact_hand);
+  if (validator_result != HandValidatorResult::OK) {
+    return validator_result;
+  }
+  return CalculateUkeire(compact_hand, visible_counts, result);
+}
+
+HandValidatorResult::Type ShantenCalculator::CalculateUkeire(
+    const CompactHand& hand, const uint8_t* visible_counts,
+    UkeireResult* result) const {
+  int counts[kNumTileIndices];
+  const HandValidatorResult::Type validator_result =
+      CountFreeTiles(hand, counts);
+  if (validator_result != HandValidatorResult::OK) {
+    return validator_result;
+  }
+
+  int meld_counts[kNumTileIndices];
+  CountMeldTiles(hand, meld_counts);
+  ShantenState state;
+  state.Setup(counts, hand.num_melds);
+  state.SetMeldCounts(meld_counts);
+  result->num_entries = 0;
+  if (hand.agari_tile == CompactParsedHand::kUnknownTileCode) {
+    Ukeire* ukeire = &result->entry[result->num_entries++];
+    ukeire->discard = -1;
+    state.CalculateUkeire(visible_counts, ukeire);
+    return HandValidatorResult::OK;
+  }
+
+  // Remove each kind of tile in turn. Only the group of the discarded tile is
+  // looked up again.
+  for (int index = 0; index < kNumTileIndices; ++index) {
+    if (counts[index] == 0) {
+      continue;
+    }
+    state.RemoveTile(index);
+    Ukeire* ukeire = &result->entry[result->num_entries++];
+    ukeire->discard = index;
+    state.CalculateUkeire(visible_counts, ukeire);
+    state.AddTile(index);
+  }
+  return HandValidatorResult::OK;
+}
+
+HandValidatorResult::Type ShantenCalculator::CountFreeTiles(
+    const CompactHand& hand, int* counts) const {
+  const bool has_agari_tile =
+      hand.agari_tile != CompactParsedHand::kUnknownTileCode;
+  const HandValidatorResult::Type validator_result =
+      hand_parser_->Validate(hand, has_agari_tile);
+  if (validator_result != HandValidatorResult::OK) {
+    return validator_result;
+  }
+
+  std::fill(counts, counts + kNumTileIndices, 0);
+  for (int i = 0; i < hand.num_closed_tiles; ++i) {
+    ++counts[hand.closed_tile[i]];
+  }
+  if (has_agari_tile) {
+    ++counts[hand.agari_tile];
+  }
+  return HandValidatorResult::OK;
+}
+
+}  // namespace mahjong
+}  // namespace ycraft
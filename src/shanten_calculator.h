@@ -0,0 +1,206 @@
+// Copyright 2016 Yuki Hamada
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_SHANTEN_CALCULATOR_H_
+#define SRC_SHANTEN_CALCULATOR_H_
+
+#include <cstdint>
+#include <memory>
+
+#include "proto/mahjong_scorecalculator.pb.h"
+#include "src/compact_hand.h"
+#include "src/mahjong_common_util.h"
+
+namespace ycraft {
+namespace mahjong {
+
+class HandParser;
+
+// ShantenResult holds shanten numbers of a hand, i.e. how many more tiles it
+// needs to be tenpai. 0 means tenpai and -1 means the hand is complete.
+struct ShantenResult {
+  // Shanten number of a format that the hand can't form, e.g. chiitoitsu of a
+  // hand with melds. This is larger than any valid shanten number.
+  static const int kNotApplicable = 100;
+
+  // The minimum of the formats below.
+  int shanten;
+
+  int regular_shanten;
+  int chiitoitsu_shanten;
+  int kokushi_shanten;
+};
+
+// Ukeire holds the tiles that reduce the shanten number of a 13-tile hand when
+// drawn, i.e. its effective tiles.
+struct Ukeire {
+  // Tile index of the tile discarded from a 14-tile hand to get the 13-tile
+  // hand, or -1 if the hand is given as 13 tiles.
+  int discard;
+
+  // Shanten number of the 13-tile hand.
+  int shanten;
+
+  // Bit i is set if drawing the tile of index i reduces the shanten number.
+  uint64_t tiles;
+
+  // The number of copies of each effective tile that are neither in the hand
+  // nor visible. Entries of other tiles are 0.
+  uint8_t num_live_tiles[kNumTileIndices];
+  int total_num_live_tiles;
+};
+
+// UkeireResult holds ukeire of a 13-tile hand, or of each discard of a 14-tile
+// hand.
+struct UkeireResult {
+  // A 14-tile hand has at most 14 kinds of tiles to discard.
+  static const int kMaxNumEntries = 14;
+
+  int num_entries;
+  Ukeire entry[kMaxNumEntries];
+};
+
+// ShantenState holds tile counts of free tiles of a hand and the data their
+// shanten numbers are computed from. Adding or removing a tile only looks up
+// the table of its own suit again, so callers changing a hand one tile at a
+// time can keep its shanten numbers up to date cheaply. The tables shared with
+// ShantenCalculator are built on first use.
+class ShantenState {
+ public:
+  // Tiles are split into groups of jihai tiles and each suit.
+  static const int kNumGroups = 4;
+
+  // Entries of each group: the number of tiles to add to complete m mentsu
+  // (m in [0, 4]), without or with a jantou.
+  static const int kNumDistances = 10;
+
+  // Sets up the state with the given counts of free tiles, which has
+  // kNumTileIndices entries, and the number of melds.
+  void Setup(const int* counts, int num_melds);
+
+  // Adds or removes a free tile of the given index. The count of the tile has
+  // to stay in [0, 4].
+  void AddTile(int index);
+  void RemoveTile(int index);
+
+  // Changes the number of melds, e.g. after a call converts free tiles into a
+  // meld.
+  void SetNumMelds(int num_melds);
+
+  // Sets counts of tiles in melds, which has kNumTileIndices entries. Tiles of
+  // which the hand holds all 4 including melds are never effective, and meld
+  // tiles aren't live. Setup clears the counts.
+  void SetMeldCounts(const int* meld_counts);
+
+  int count(int index) const { return counts_[index]; }
+
+  // Calculates shanten numbers of the free tiles.
+  void Calculate(ShantenResult* result) const;
+
+  // Finds tiles that reduce the shanten number when added. See
+  // ShantenCalculator::CalculateUkeire for visible_counts.
+  void CalculateUkeire(const uint8_t* visible_counts, Ukeire* ukeire) const;
+
+ private:
+  // Tile counts that shanten numbers of chiitoitsu and kokushi depend on.
+  // These are updated in constant time when a tile is added or removed.
+  struct IrregularCounts {
+    int num_kinds;
+    int num_toitsu;
+    int num_yaochuhai_kinds;
+    int num_yaochuhai_toitsu;
+
+    void Clear();
+
+    // Updates the counts for the tile of the given index whose count changes
+    // from old_count to new_count.
+    void Update(int index, int old_count, int new_count);
+
+    int GetChiiToitsuShanten() const;
+    int GetKokushiShanten() const;
+  };
+
+  void UpdateGroup(int group);
+
+  int counts_[kNumTileIndices];
+  int meld_counts_[kNumTileIndices];
+
+  // The number of mentsu free tiles have to form.
+  int num_mentsu_;
+
+  int group_distances_[kNumGroups][kNumDistances];
+  IrregularCounts irregular_counts_;
+};
+
+// ShantenCalculator calculates shanten numbers of the regular, chiitoitsu and
+// kokushi formats. The regular format is computed from shared tables that
+// hold, for every shape of a suit, the number of tiles needed to complete m
+// mentsu with or without a jantou, so each call only looks up 4 tables and
+// combines them.
+class ShantenCalculator {
+ public:
+  ShantenCalculator();
+  ~ShantenCalculator();
+
+  /**
+   * Calculates shanten numbers of the given hand. Melds count as completed
+   * mentsu. The agari tile is counted only if it's concrete, so the hand has
+   * either 13 or 14 tiles counting a kantsu as 3 tiles. Returns an error
+   * without touching the result if the hand fails HandParser::Validate.
+   */
+  HandValidatorResult::Type Calculate(const Hand& hand,
+                                      ShantenResult* result) const;
+  HandValidatorResult::Type Calculate(const CompactHand& hand,
+                                      ShantenResult* result) const;
+
+  /**
+   * Same as above, but takes free tiles (closed tiles and the agari tile) of a
+   * hand. The number of melds is derived from num_tiles, which has to be
+   * 3n + 1 or 3n + 2 and at most 14. Returns false if the tiles are invalid.
+   */
+  bool Calculate(const TileType* tiles, int num_tiles,
+                 ShantenResult* result) const;
+
+  /**
+   * Finds the effective tiles of the given hand, and counts their copies
+   * still live given the counts of visible tiles, which has kNumTileIndices
+   * entries or is nullptr. Visible tiles are the ones the player can see
+   * outside of their own hand: discards, melds of the other players and dora
+   * indicators. Tiles in melds of the hand are counted from the hand. A hand
+   * with a concrete agari tile has 14 tiles, and this stores an entry for
+   * each kind of tile to discard in the order of tile indices. Otherwise this
+   * stores a single entry for the hand.
+   * The shared state of the hand is computed once, and each discard and each
+   * candidate tile only looks up its own suit again.
+   */
+  HandValidatorResult::Type CalculateUkeire(const Hand& hand,
+                                            const uint8_t* visible_counts,
+                                            UkeireResult* result) const;
+  HandValidatorResult::Type CalculateUkeire(const CompactHand& hand,
+                                            const uint8_t* visible_counts,
+                                            UkeireResult* result) const;
+
+ private:
+  // Validates the given hand, and counts its closed tiles and the agari tile
+  // if it's concrete.
+  HandValidatorResult::Type CountFreeTiles(const CompactHand& hand,
+                                           int* counts) const;
+
+  const std::unique_ptr<HandParser> hand_parser_;
+};
+
+}  // namespace mahjong
+}  // namespace ycraft
+
+#endif  // SRC_SHANTEN_CALCULATOR_H_
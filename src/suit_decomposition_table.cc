@@ -0,0 +1,414 @@
+// Copyright 2016 Yuki Hamada
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/suit_decomposition_table.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <set>
+#include <utility>
+
+using std::ofstream;
+using std::ostream;
+using std::pair;
+using std::set;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace ycraft {
+namespace mahjong {
+
+namespace {
+const int kNumTilesInSuit = SuitDecompositionTable::kNumTilesInSuit;
+const int kMaxNumMentsu = 4;
+
+// There are 9 koutsu kinds and 7 shuntsu kinds in a suit.
+const int kNumMentsuKinds = 16;
+
+// "MJSD" in little endian.
+const uint32_t kMagic = 0x44534a4d;
+
+// Bump this whenever the image layout or the order of decompositions
+// changes.
+const uint32_t kVersion = 1;
+
+// The average number of keys in a bucket of the perfect hash. Larger buckets
+// make the displacement array smaller but the build slower.
+const int kNumKeysPerBucket = 4;
+
+// Hashes a key with the given seed. Seed 0 picks the bucket of a key, and the
+// displacement of the bucket picks the slot.
+inline uint32_t Hash(uint32_t key, uint32_t seed) {
+  uint32_t hash = key ^ (seed * 0x9e3779b9u);
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bu;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35u;
+  hash ^= hash >> 16;
+  return hash;
+}
+
+// Finds displacements of a minimal perfect hash of the given keys by hash and
+// displace: buckets are placed from the largest, each with the first
+// displacement that sends all its keys to distinct free slots. Stores the
+// slot of each key into slots.
+void BuildPerfectHash(const vector<uint32_t>& keys, int num_buckets,
+                      vector<uint32_t>* displacements, vector<int>* slots) {
+  const int num_slots = keys.size();
+  vector<vector<int>> buckets(num_buckets);
+  for (int i = 0; i < num_slots; ++i) {
+    buckets[Hash(keys[i], 0) % num_buckets].push_back(i);
+  }
+  vector<pair<int, int>> order;
+  for (int b = 0; b < num_buckets; ++b) {
+    order.push_back(std::make_pair(buckets[b].size(), b));
+  }
+  std::sort(order.begin(), order.end(), std::greater<pair<int, int>>());
+
+  displacements->assign(num_buckets, 0);
+  slots->assign(num_slots, -1);
+  vector<bool> is_used(num_slots, false);
+  vector<int> candidates;
+  for (const pair<int, int>& size_and_bucket : order) {
+    const vector<int>& bucket = buckets[size_and_bucket.second];
+    if (bucket.empty()) {
+      break;
+    }
+    for (uint32_t displacement = 1;; ++displacement) {
+      candidates.clear();
+      for (const int i : bucket) {
+        const int slot = Hash(keys[i], displacement) % num_slots;
+        if (is_used[slot] || std::find(candidates.begin(), candidates.end(),
+                                       slot) != candidates.end()) {
+          break;
+        }
+        candidates.push_back(slot);
+      }
+      if (candidates.size() == bucket.size()) {
+        (*displacements)[size_and_bucket.second] = displacement;
+        for (size_t j = 0; j < bucket.size(); ++j) {
+          is_used[candidates[j]] = true;
+          (*slots)[bucket[j]] = candidates[j];
+        }
+        break;
+      }
+    }
+  }
+}
+
+bool AddMentsu(int kind, int diff, int* counts) {
+  if (kind < kNumTilesInSuit) {
+    counts[kind] += 3 * diff;
+    return counts[kind] <= 4;
+  }
+  bool valid = true;
+  for (int i = 0; i < 3; ++i) {
+    counts[kind - kNumTilesInSuit + i] += diff;
+    valid &= counts[kind - kNumTilesInSuit + i] <= 4;
+  }
+  return valid;
+}
+
+// Collects keys of all shapes that consist of the given counts and up to
+// kMaxNumMentsu mentsu whose kinds are not smaller than the given kind.
+void CollectKeys(int kind, int num_mentsu, int* counts, set<int>* keys) {
+  keys->insert(SuitDecompositionTable::Encode(counts));
+  if (num_mentsu == kMaxNumMentsu) {
+    return;
+  }
+  for (int k = kind; k < kNumMentsuKinds; ++k) {
+    if (AddMentsu(k, 1, counts)) {
+      CollectKeys(k, num_mentsu + 1, counts, keys);
+    }
+    AddMentsu(k, -1, counts);
+  }
+}
+
+void Enumerate(int index, bool has_jantou, int* counts,
+               SuitDecomposition* current,
+               vector<SuitDecomposition>* decompositions) {
+  while (index < kNumTilesInSuit && counts[index] == 0) {
+    ++index;
+  }
+
+  if (index == kNumTilesInSuit) {
+    current->has_jantou = has_jantou;
+    decompositions->push_back(*current);
+    return;
+  }
+
+  const int count = counts[index];
+  for (int num_toitsu = has_jantou ? 0 : 1; num_toitsu >= 0; --num_toitsu) {
+    for (int num_koutsu = 1; num_koutsu >= 0; --num_koutsu) {
+      const int num_shuntsu = count - 2 * num_toitsu - 3 * num_koutsu;
+      if (num_shuntsu < 0) {
+        continue;
+      }
+      if (num_shuntsu > 0 &&
+          (index + 2 >= kNumTilesInSuit || counts[index + 1] < num_shuntsu ||
+           counts[index + 2] < num_shuntsu)) {
+        continue;
+      }
+
+      const int saved_num_elements = current->num_elements;
+      for (int i = 0; i < num_toitsu; ++i) {
+        current->element_type[current->num_elements] = HandElementType::TOITSU;
+        current->element_offset[current->num_elements++] = index;
+      }
+      for (int i = 0; i < num_koutsu; ++i) {
+        current->element_type[current->num_elements] = HandElementType::KOUTSU;
+        current->element_offset[current->num_elements++] = index;
+      }
+      for (int i = 0; i < num_shuntsu; ++i) {
+        current->element_type[current->num_elements] =
+            HandElementType::SHUNTSU;
+        current->element_offset[current->num_elements++] = index;
+      }
+
+      counts[index] = 0;
+      if (num_shuntsu > 0) {
+        counts[index + 1] -= num_shuntsu;
+        counts[index + 2] -= num_shuntsu;
+      }
+
+      Enumerate(index + 1, has_jantou || num_toitsu > 0, counts, current,
+                decompositions);
+
+      counts[index] = count;
+      if (num_shuntsu > 0) {
+        counts[index + 1] += num_shuntsu;
+        counts[index + 2] += num_shuntsu;
+      }
+      current->num_elements = saved_num_elements;
+    }
+  }
+}
+}  // namespace
+
+SuitDecompositionTable::~SuitDecompositionTable() {
+  if (mapped_image_ != nullptr) {
+    munmap(mapped_image_, mapped_size_);
+  }
+}
+
+const SuitDecompositionTable& SuitDecompositionTable::GetInstance() {
+  static const SuitDecompositionTable* const table =
+      new SuitDecompositionTable();
+  return *table;
+}
+
+unique_ptr<SuitDecompositionTable> SuitDecompositionTable::Load(
+    const string& path) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat file_stat;
+  void* image = MAP_FAILED;
+  size_t size = 0;
+  if (fstat(fd, &file_stat) == 0 &&
+      static_cast<size_t>(file_stat.st_size) >= sizeof(Header)) {
+    size = file_stat.st_size;
+    image = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  // The mapping stays valid after the file is closed.
+  close(fd);
+  if (image == MAP_FAILED) {
+    return nullptr;
+  }
+  if (GetImageSize(*static_cast<const Header*>(image)) != size) {
+    munmap(image, size);
+    return nullptr;
+  }
+  unique_ptr<SuitDecompositionTable> table(
+      new SuitDecompositionTable(image, size));
+  if (!table->IsValid()) {
+    return nullptr;
+  }
+  return table;
+}
+
+bool SuitDecompositionTable::Save(const string& path) const {
+  ofstream os;
+  os.open(path, ostream::out | ostream::binary);
+  os.write(reinterpret_cast<const char*>(header_), GetImageSize(*header_));
+  os.close();
+  return !os.fail();
+}
+
+int SuitDecompositionTable::Encode(const int* counts) {
+  int key = 0;
+  for (int i = kNumTilesInSuit - 1; i >= 0; --i) {
+    key = key * 5 + counts[i];
+  }
+  return key;
+}
+
+void SuitDecompositionTable::Decode(int key, int* counts) {
+  for (int i = 0; i < kNumTilesInSuit; ++i) {
+    counts[i] = key % 5;
+    key /= 5;
+  }
+}
+
+bool SuitDecompositionTable::Find(int key, const SuitDecomposition** begin,
+                                  const SuitDecomposition** end) const {
+  const uint32_t displacement =
+      displacements_[Hash(key, 0) % header_->num_buckets];
+  const Slot& slot = slots_[Hash(key, displacement) % header_->num_slots];
+  if (slot.key != static_cast<uint32_t>(key)) {
+    return false;
+  }
+  *begin = decompositions_ + slot.begin;
+  *end = decompositions_ + slot.end;
+  return true;
+}
+
+SuitDecompositionTable::SuitDecompositionTable()
+    : mapped_image_(nullptr), mapped_size_(0) {
+  set<int> key_set;
+  int counts[kNumTilesInSuit] = {};
+  CollectKeys(0, 0, counts, &key_set);
+  for (int jantou = 0; jantou < kNumTilesInSuit; ++jantou) {
+    counts[jantou] += 2;
+    CollectKeys(0, 0, counts, &key_set);
+    counts[jantou] -= 2;
+  }
+
+  const vector<uint32_t> keys(key_set.begin(), key_set.end());
+  vector<Slot> key_slots;
+  vector<SuitDecomposition> decompositions;
+  for (const uint32_t key : keys) {
+    Decode(key, counts);
+
+    Slot slot;
+    slot.key = key;
+    slot.begin = decompositions.size();
+    SuitDecomposition current = {};
+    Enumerate(0, false, counts, &current, &decompositions);
+    slot.end = decompositions.size();
+    key_slots.push_back(slot);
+  }
+
+  Header header;
+  header.magic = kMagic;
+  header.version = kVersion;
+  header.decomposition_size = sizeof(SuitDecomposition);
+  header.num_buckets = (keys.size() + kNumKeysPerBucket - 1) /
+                       kNumKeysPerBucket;
+  header.num_slots = keys.size();
+  header.num_decompositions = decompositions.size();
+  vector<uint32_t> displacements;
+  vector<int> slot_indices;
+  BuildPerfectHash(keys, header.num_buckets, &displacements, &slot_indices);
+
+  // Lay out the sections in a single image, the same as saved files.
+  built_image_.resize(GetImageSize(header) / sizeof(uint32_t));
+  char* image = reinterpret_cast<char*>(built_image_.data());
+  std::memcpy(image, &header, sizeof(header));
+  SetImage(image);
+  std::memcpy(const_cast<uint32_t*>(displacements_), displacements.data(),
+              displacements.size() * sizeof(uint32_t));
+  Slot* slots = const_cast<Slot*>(slots_);
+  for (size_t i = 0; i < keys.size(); ++i) {
+    slots[slot_indices[i]] = key_slots[i];
+  }
+  std::memcpy(const_cast<SuitDecomposition*>(decompositions_),
+              decompositions.data(),
+              decompositions.size() * sizeof(SuitDecomposition));
+}
+
+SuitDecompositionTable::SuitDecompositionTable(void* mapped_image,
+                                               size_t mapped_size)
+    : mapped_image_(mapped_image), mapped_size_(mapped_size) {
+  SetImage(mapped_image);
+}
+
+size_t SuitDecompositionTable::GetImageSize(const Header& header) {
+  if (header.magic != kMagic || header.version != kVersion ||
+      header.decomposition_size != sizeof(SuitDecomposition) ||
+      header.num_buckets == 0 || header.num_slots == 0) {
+    return 0;
+  }
+  return sizeof(Header) + header.num_buckets * sizeof(uint32_t) +
+         header.num_slots * sizeof(Slot) +
+         header.num_decompositions * sizeof(SuitDecomposition);
+}
+
+void SuitDecompositionTable::SetImage(const void* image) {
+  static_assert(alignof(SuitDecomposition) <= alignof(uint32_t),
+                "Sections of the image are aligned to words.");
+  static_assert(sizeof(Header) % sizeof(uint32_t) == 0 &&
+                    sizeof(Slot) % sizeof(uint32_t) == 0,
+                "Sections of the image have to be aligned.");
+  const char* section = static_cast<const char*>(image);
+  header_ = reinterpret_cast<const Header*>(section);
+  section += sizeof(Header);
+  displacements_ = reinterpret_cast<const uint32_t*>(section);
+  section += header_->num_buckets * sizeof(uint32_t);
+  slots_ = reinterpret_cast<const Slot*>(section);
+  section += header_->num_slots * sizeof(Slot);
+  decompositions_ = reinterpret_cast<const SuitDecomposition*>(section);
+}
+
+bool SuitDecompositionTable::IsValid() const {
+  for (uint32_t i = 0; i < header_->num_slots; ++i) {
+    const Slot& slot = slots_[i];
+    if (slot.begin > slot.end || slot.end > header_->num_decompositions) {
+      return false;
+    }
+  }
+  for (uint32_t i = 0; i < header_->num_decompositions; ++i) {
+    const SuitDecomposition& decomposition = decompositions_[i];
+    // Read the byte of has_jantou as is, since a bool of another value is
+    // undefined.
+    uint8_t has_jantou;
+    std::memcpy(&has_jantou, &decomposition.has_jantou, sizeof(has_jantou));
+    if (has_jantou > 1 || decomposition.num_elements < 0 ||
+        decomposition.num_elements > SuitDecomposition::kMaxNumElements) {
+      return false;
+    }
+    for (int j = 0; j < decomposition.num_elements; ++j) {
+      // The last tile of the element has to be in the suit.
+      int num_following_tiles;
+      switch (decomposition.element_type[j]) {
+        case HandElementType::TOITSU:
+        case HandElementType::KOUTSU:
+          num_following_tiles = 0;
+          break;
+        case HandElementType::SHUNTSU:
+          num_following_tiles = 2;
+          break;
+        default:
+          return false;
+      }
+      const int offset = decomposition.element_offset[j];
+      if (offset < 0 || offset + num_following_tiles >= kNumTilesInSuit) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+}  // namespace mahjong
+}  // namespace ycraft
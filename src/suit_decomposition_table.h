@@ -0,0 +1,143 @@
+// Copyright 2016 Yuki Hamada
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_SUIT_DECOMPOSITION_TABLE_H_
+#define SRC_SUIT_DECOMPOSITION_TABLE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "proto/mahjong_common.pb.h"
+
+namespace ycraft {
+namespace mahjong {
+
+// SuitDecomposition is a way to split tiles of a single suit into mentsu and
+// at most one toitsu.
+struct SuitDecomposition {
+  // A suit holds at most 14 tiles in a hand, i.e. 4 mentsu and 1 toitsu.
+  static const int kMaxNumElements = 5;
+
+  int num_elements;
+  bool has_jantou;
+
+  // Base type (TOITSU, KOUTSU or SHUNTSU) of each element.
+  HandElementType element_type[kMaxNumElements];
+
+  // Offset in the suit ([0, 9)) of the first tile of each element.
+  int element_offset[kMaxNumElements];
+};
+
+// SuitDecompositionTable holds all decompositions of every complete suit
+// shape. A suit shape is encoded as a base-5 number of its 9 tile counts.
+// Decompositions of each shape are stored in the order that a depth first
+// search trying toitsu, koutsu and then shuntsu at the smallest tile would
+// find them.
+//
+// The whole table is a single flat image: a header, a perfect hash of the
+// keys and the decompositions. Looking up a key probes a single slot, and
+// the image can be saved by the generate_suit_table tool and mapped into
+// memory by Load instead of being built at startup. An image can only be
+// loaded by a build with the same layout of SuitDecomposition.
+class SuitDecompositionTable {
+ public:
+  static const int kNumTilesInSuit = 9;
+
+  ~SuitDecompositionTable();
+
+  // Returns the shared table. The table is built on the first call.
+  static const SuitDecompositionTable& GetInstance();
+
+  // Maps the image saved at the given path into memory. Returns nullptr if
+  // the file can't be mapped, it isn't an image of this build or its slots
+  // or decompositions are corrupt.
+  static std::unique_ptr<SuitDecompositionTable> Load(const std::string& path);
+
+  // Writes the image of the table to the given path. Returns false on I/O
+  // errors.
+  bool Save(const std::string& path) const;
+
+  // Encodes kNumTilesInSuit tile counts into a key.
+  static int Encode(const int* counts);
+  static void Decode(int key, int* counts);
+
+  // Finds decompositions of the given key. Returns false if tiles of the key
+  // can't be split into mentsu and at most one toitsu.
+  bool Find(int key, const SuitDecomposition** begin,
+            const SuitDecomposition** end) const;
+
+  int num_keys() const { return header_->num_slots; }
+  int num_decompositions() const { return header_->num_decompositions; }
+
+ private:
+  struct Header {
+    // kMagic, which also tells images of another byte order.
+    uint32_t magic;
+    uint32_t version;
+    uint32_t decomposition_size;
+    uint32_t num_buckets;
+    uint32_t num_slots;
+    uint32_t num_decompositions;
+  };
+
+  // A slot of the perfect hash holds a key and the range of its
+  // decompositions.
+  struct Slot {
+    uint32_t key;
+    uint32_t begin;
+    uint32_t end;
+  };
+
+  // Builds the table.
+  SuitDecompositionTable();
+
+  // Refers to the given mapped image, which has been checked by
+  // GetImageSize, and unmaps it on destruction.
+  SuitDecompositionTable(void* mapped_image, size_t mapped_size);
+
+  SuitDecompositionTable(const SuitDecompositionTable&) = delete;
+  SuitDecompositionTable& operator=(const SuitDecompositionTable&) = delete;
+
+  // Returns the size of the image that the given header describes, or 0 if
+  // the header doesn't belong to an image of this build.
+  static size_t GetImageSize(const Header& header);
+
+  // Points the sections of the table into the given image.
+  void SetImage(const void* image);
+
+  // Returns true if the range of every slot lies within the decompositions,
+  // and every decomposition has at most kMaxNumElements elements of a base
+  // type whose tiles are all in the suit. A loaded image has to be checked
+  // before it's trusted.
+  bool IsValid() const;
+
+  // Storage of a built table. Words keep the sections aligned.
+  std::vector<uint32_t> built_image_;
+
+  void* mapped_image_;
+  size_t mapped_size_;
+
+  const Header* header_;
+  const uint32_t* displacements_;
+  const Slot* slots_;
+  const SuitDecomposition* decompositions_;
+};
+
+}  // namespace mahjong
+}  // namespace ycraft
+
+#endif  // SRC_SUIT_DECOMPOSITION_TABLE_H_
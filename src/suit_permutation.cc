@@ -0,0 +1,306 @@
+// Copyright 2016 Yuki Hamada
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/suit_permutation.h"
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "src/mahjong_common_util.h"
+
+using google::protobuf::Descriptor;
+using google::protobuf::FieldDescriptor;
+using google::protobuf::Message;
+using google::protobuf::Reflection;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace ycraft {
+namespace mahjong {
+
+namespace {
+const int kNumJihaiTiles = 7;
+const int kNumTilesInSuit = 9;
+
+// Kind of TileType (see MASK_TILE_KIND) of the first suit. Kinds of suits are
+// in the same order as their tile indices.
+const int kFirstSuitKind = (TileType::MANZU_TILE >> 8);
+
+int GetSuit(int tile_index) {
+  return tile_index < kNumJihaiTiles || tile_index >= kNumTileIndices
+             ? -1
+             : (tile_index - kNumJihaiTiles) / kNumTilesInSuit;
+}
+
+// Returns a 2-bit code of the given meld type.
+int GetMeldCode(HandElementType type) {
+  switch (type) {
+    case HandElementType::MINSHUNTSU:
+      return 0;
+    case HandElementType::MINKOUTSU:
+      return 1;
+    case HandElementType::MINKANTSU:
+      return 2;
+    default:
+      return 3;
+  }
+}
+
+// Maps every TileType value in the given message and its sub-messages.
+void PermuteTileTypes(const SuitPermutation& permutation, Message* message) {
+  const Descriptor* descriptor = message->GetDescriptor();
+  const Reflection* reflection = message->GetReflection();
+  for (int i = 0; i < descriptor->field_count(); ++i) {
+    const FieldDescriptor* field = descriptor->field(i);
+    if (field->type() == FieldDescriptor::TYPE_ENUM &&
+        field->enum_type() == TileType_descriptor()) {
+      if (field->is_repeated()) {
+        for (int j = 0; j < reflection->FieldSize(*message, field); ++j) {
+          reflection->SetRepeatedEnumValue(
+              message, field, j,
+              permutation.Apply(static_cast<TileType>(
+                  reflection->GetRepeatedEnumValue(*message, field, j))));
+        }
+      } else {
+        reflection->SetEnumValue(
+            message, field,
+            permutation.Apply(static_cast<TileType>(
+                reflection->GetEnumValue(*message, field))));
+      }
+    } else if (field->type() == FieldDescriptor::TYPE_MESSAGE) {
+      if (field->is_repeated()) {
+        for (int j = 0; j < reflection->FieldSize(*message, field); ++j) {
+          Message* element =
+              reflection->MutableRepeatedMessage(message, field, j);
+          PermuteTileTypes(permutation, element);
+        }
+      } else if (reflection->HasField(*message, field)) {
+        PermuteTileTypes(permutation,
+                         reflection->MutableMessage(message, field));
+      }
+    }
+  }
+}
+
+// Sorts every repeated field of the given message and its sub-messages, so
+// that messages that differ only in the order of repeated fields become
+// identical.
+void SortRepeatedFields(Message* message) {
+  const Descriptor* descriptor = message->GetDescriptor();
+  const Reflection* reflection = message->GetReflection();
+  for (int i = 0; i < descriptor->field_count(); ++i) {
+    const FieldDescriptor* field = descriptor->field(i);
+    if (field->type() == FieldDescriptor::TYPE_MESSAGE) {
+      if (field->is_repeated()) {
+        for (int j = 0; j < reflection->FieldSize(*message, field); ++j) {
+          SortRepeatedFields(
+              reflection->MutableRepeatedMessage(message, field, j));
+        }
+      } else if (reflection->HasField(*message, field)) {
+        SortRepeatedFields(reflection->MutableMessage(message, field));
+      }
+    }
+    // Scalars other than enums don't appear in repeated fields of rules, so
+    // only messages and enums are sorted.
+    if (!field->is_repeated() ||
+        (field->type() != FieldDescriptor::TYPE_MESSAGE &&
+         field->type() != FieldDescriptor::TYPE_ENUM)) {
+      continue;
+    }
+
+    // Selection sort by the serialized elements. Lists in rules are short.
+    const int size = reflection->FieldSize(*message, field);
+    vector<string> keys(size);
+    for (int j = 0; j < size; ++j) {
+      keys[j] = field->type() == FieldDescriptor::TYPE_MESSAGE
+                    ? reflection->GetRepeatedMessage(*message, field, j)
+                          .SerializeAsString()
+                    : std::to_string(reflection->GetRepeatedEnumValue(
+                          *message, field, j));
+    }
+    for (int j = 0; j < size; ++j) {
+      const int min = std::min_element(keys.begin() + j, keys.end()) -
+                      keys.begin();
+      if (min != j) {
+        reflection->SwapElements(message, field, j, min);
+        std::swap(keys[j], keys[min]);
+      }
+    }
+  }
+}
+
+string GetCanonicalString(const Message& message) {
+  unique_ptr<Message> copy(message.New());
+  copy->CopyFrom(message);
+  SortRepeatedFields(copy.get());
+  return copy->SerializeAsString();
+}
+}  // namespace
+
+const int SuitPermutation::kNumSuits;
+
+SuitPermutation SuitPermutation::Identity() {
+  SuitPermutation permutation;
+  for (int s = 0; s < kNumSuits; ++s) {
+    permutation.suit[s] = s;
+  }
+  return permutation;
+}
+
+SuitPermutation SuitPermutation::Inverse() const {
+  SuitPermutation inverse;
+  for (int s = 0; s < kNumSuits; ++s) {
+    inverse.suit[suit[s]] = s;
+  }
+  return inverse;
+}
+
+bool SuitPermutation::IsIdentity() const {
+  return suit[0] == 0 && suit[1] == 1 && suit[2] == 2;
+}
+
+int SuitPermutation::Apply(int tile_index) const {
+  const int s = GetSuit(tile_index);
+  if (s < 0) {
+    return tile_index;
+  }
+  return tile_index + (suit[s] - s) * kNumTilesInSuit;
+}
+
+TileType SuitPermutation::Apply(TileType tile) const {
+  const int s = ((tile & TileType::MASK_TILE_KIND) >> 8) - kFirstSuitKind;
+  if (s < 0 || s >= kNumSuits) {
+    return tile;
+  }
+  return static_cast<TileType>(tile + ((suit[s] - s) << 8));
+}
+
+void PermuteSuits(const SuitPermutation& permutation, CompactHand* hand) {
+  for (int i = 0; i < hand->num_closed_tiles; ++i) {
+    hand->closed_tile[i] = permutation.Apply(hand->closed_tile[i]);
+  }
+  hand->agari_tile = permutation.Apply(hand->agari_tile);
+  for (int i = 0; i < hand->num_melds; ++i) {
+    hand->meld[i].tile = permutation.Apply(hand->meld[i].tile);
+  }
+}
+
+void PermuteSuits(const SuitPermutation& permutation,
+                  CompactParsedHand* parsed_hand) {
+  for (int i = 0; i < parsed_hand->num_tiles(); ++i) {
+    parsed_hand->tile[i] = permutation.Apply(parsed_hand->tile[i]);
+  }
+}
+
+SuitPermutation CanonicalizeSuits(CompactHand* hand) {
+  // Describe each suit by a key of 64 bits:
+  //   [28, 64): 4 bits of the count of each closed tile, the smallest tile at
+  //             the top, so that suits with smaller tiles come first
+  //   [24, 28): the number of the agari tile plus 1, or 0
+  //   [0, 24):  6-bit codes of melds, sorted
+  // Counts of invalid hands may overflow, which only makes sharing less
+  // likely.
+  uint64_t counts[SuitPermutation::kNumSuits] = {};
+  uint64_t melds[SuitPermutation::kNumSuits] = {};
+  int num_melds[SuitPermutation::kNumSuits] = {};
+  uint8_t meld_codes[SuitPermutation::kNumSuits][CompactHand::kMaxNumMelds];
+  int first_melds[SuitPermutation::kNumSuits] = {
+      CompactHand::kMaxNumMelds, CompactHand::kMaxNumMelds,
+      CompactHand::kMaxNumMelds};
+  for (int i = 0; i < hand->num_closed_tiles; ++i) {
+    const int s = GetSuit(hand->closed_tile[i]);
+    if (s >= 0) {
+      const int number =
+          (hand->closed_tile[i] - kNumJihaiTiles) % kNumTilesInSuit;
+      counts[s] += static_cast<uint64_t>(1) << (4 * (8 - number));
+    }
+  }
+  for (int i = 0; i < hand->num_melds; ++i) {
+    const int s = GetSuit(hand->meld[i].tile);
+    if (s >= 0) {
+      const int number =
+          (hand->meld[i].tile - kNumJihaiTiles) % kNumTilesInSuit;
+      meld_codes[s][num_melds[s]++] =
+          GetMeldCode(hand->meld[i].type) << 4 | number;
+      first_melds[s] = std::min(first_melds[s], i);
+    }
+  }
+  uint64_t keys[SuitPermutation::kNumSuits];
+  const int agari_suit = GetSuit(hand->agari_tile);
+  for (int s = 0; s < SuitPermutation::kNumSuits; ++s) {
+    std::sort(meld_codes[s], meld_codes[s] + num_melds[s],
+              std::greater<uint8_t>());
+    for (int i = 0; i < num_melds[s]; ++i) {
+      melds[s] = melds[s] << 6 | meld_codes[s][i];
+    }
+    const uint64_t agari =
+        s == agari_suit
+            ? (hand->agari_tile - kNumJihaiTiles) % kNumTilesInSuit + 1
+            : 0;
+    keys[s] = counts[s] << 28 | agari << 24 | melds[s];
+  }
+
+  // The suit of the largest key becomes the first suit, and so on. Suits of
+  // the same key hold the same tiles but their melds may come in another
+  // order, so the suit of the first meld comes first.
+  int order[SuitPermutation::kNumSuits];
+  for (int s = 0; s < SuitPermutation::kNumSuits; ++s) {
+    // Insertion sort.
+    int rank = s;
+    for (; rank > 0 && (keys[order[rank - 1]] < keys[s] ||
+                        (keys[order[rank - 1]] == keys[s] &&
+                         first_melds[order[rank - 1]] > first_melds[s]));
+         --rank) {
+      order[rank] = order[rank - 1];
+    }
+    order[rank] = s;
+  }
+  SuitPermutation permutation;
+  for (int rank = 0; rank < SuitPermutation::kNumSuits; ++rank) {
+    permutation.suit[order[rank]] = rank;
+  }
+  if (!permutation.IsIdentity()) {
+    PermuteSuits(permutation, hand);
+  }
+  return permutation;
+}
+
+bool IsSuitSymmetric(const Yaku& yaku) {
+  // A swap of 2 suits and a rotation of all 3 generate every permutation.
+  static const SuitPermutation kGenerators[] = {{{1, 0, 2}}, {{1, 2, 0}}};
+  const string canonical_string =
+      GetCanonicalString(yaku.required_hand_condition());
+  for (const SuitPermutation& permutation : kGenerators) {
+    HandCondition condition = yaku.required_hand_condition();
+    PermuteTileTypes(permutation, &condition);
+    if (GetCanonicalString(condition) != canonical_string) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void GetSuitAsymmetricYaku(const Rule& rule, vector<string>* names) {
+  for (const Yaku& yaku : rule.yaku()) {
+    if (!IsSuitSymmetric(yaku)) {
+      names->push_back(yaku.name());
+    }
+  }
+}
+
+}  // namespace mahjong
+}  // namespace ycraft
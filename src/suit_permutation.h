@@ -0,0 +1,87 @@
+// Copyright 2016 Yuki Hamada
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_SUIT_PERMUTATION_H_
+#define SRC_SUIT_PERMUTATION_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "proto/mahjong_scorecalculator.pb.h"
+#include "src/compact_hand.h"
+#include "src/compact_parsed_hand.h"
+
+namespace ycraft {
+namespace mahjong {
+
+// SuitPermutation maps each suit to another suit. Suits are numbered in the
+// order of tile indices: manzu, souzu and pinzu. Jihai tiles are never
+// changed.
+//
+// Decompositions of a hand don't change when its suits are permuted, so
+// HandParser results of a hand can be shared with all the hands that differ
+// only in suits. Yaku may name specific suits, so scores can be shared only
+// if every yaku of the rule is symmetric. See GetSuitAsymmetricYaku.
+struct SuitPermutation {
+  static const int kNumSuits = 3;
+
+  // suit[s] is the suit that suit s maps to.
+  uint8_t suit[kNumSuits];
+
+  static SuitPermutation Identity();
+
+  SuitPermutation Inverse() const;
+  bool IsIdentity() const;
+
+  // Maps a tile index or a tile code. Indices of jihai tiles and codes that
+  // aren't tile indices are returned as is.
+  int Apply(int tile_index) const;
+
+  // Maps a tile type, including the masks of suits such as MANZU_TILE.
+  TileType Apply(TileType tile) const;
+};
+
+// Permutes suits of all the tiles of the given hand.
+void PermuteSuits(const SuitPermutation& permutation, CompactHand* hand);
+
+// Permutes suits of the tiles owned by the given parsed hand. Open melds it
+// refers to aren't changed, so merge them first. The signature is kept, so it
+// stays unique among parsed hands of the permuted hand.
+void PermuteSuits(const SuitPermutation& permutation,
+                  CompactParsedHand* parsed_hand);
+
+// Permutes suits of the given hand into the representative of the up to 6
+// hands that differ only in suits, and returns the permutation applied. Its
+// inverse maps the representative, or parsed hands of it, back. The
+// representative orders suits by their closed tiles, melds and the agari
+// tile, so the order of closed tiles doesn't matter, while the order of
+// melds is kept.
+SuitPermutation CanonicalizeSuits(CompactHand* hand);
+
+// Returns true if the given yaku's condition is unchanged by every
+// permutation of suits, i.e. the yaku applies to a hand if and only if it
+// applies to the hand with suits permuted. Conditions are compared treating
+// repeated fields as sets, since lists of conditions are either all required
+// or all allowed.
+bool IsSuitSymmetric(const Yaku& yaku);
+
+// Appends names of the yaku of the given rule that aren't symmetric under
+// permutations of suits, e.g. ryuuiisou that names souzu tiles.
+void GetSuitAsymmetricYaku(const Rule& rule, std::vector<std::string>* names);
+
+}  // namespace mahjong
+}  // namespace ycraft
+
+#endif  // SRC_SUIT_PERMUTATION_H_
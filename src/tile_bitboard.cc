@@ -0,0 +1,336 @@
+// Copyright 2016 Yuki Hamada
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/tile_bitboard.h"
+
+#include <algorithm>
+#include <bitset>
+
+#ifdef __SSE4_1__
+#include <smmintrin.h>
+#endif
+
+#include "src/mahjong_common_util.h"
+
+namespace ycraft {
+namespace mahjong {
+
+namespace {
+const int kNumJihaiTiles = 7;
+const int kNumTilesInSuit = 9;
+
+// The lowest bit of each of the 9 fields of a lane.
+const uint32_t kFieldLsbs = 0x01249249;
+
+// The lowest bits of the fields that hold a tile, per lane.
+const uint32_t kValidFields[TileBitboard::kNumLanes] = {0x00049249, kFieldLsbs,
+                                                        kFieldLsbs, kFieldLsbs};
+
+// The lowest bits of the fields from which a shuntsu can start, i.e. 1 to 7
+// of each suit.
+const uint32_t kSequenceStarts[TileBitboard::kNumLanes] = {
+    0, 0x00049249, 0x00049249, 0x00049249};
+
+// The lowest bits of yaochuhai fields: all jihai tiles, and 1 and 9 of each
+// suit.
+const uint32_t kYaochuhai[TileBitboard::kNumLanes] = {
+    0x00049249, 0x01000001, 0x01000001, 0x01000001};
+
+// Even fields of a lane, which the odd fields are added to when counting.
+const uint32_t kEvenFields = 0x071c71c7;
+
+// Sums the 6-bit slots of a lane into bits [24, 30).
+const uint32_t kSlotSum = 0x01041041;
+
+inline void GetLaneAndShift(int tile_index, int* lane, int* shift) {
+  if (tile_index < kNumJihaiTiles) {
+    *lane = 0;
+    *shift = TileBitboard::kBitsPerTile * tile_index;
+  } else {
+    const int offset = tile_index - kNumJihaiTiles;
+    *lane = 1 + offset / kNumTilesInSuit;
+    *shift = TileBitboard::kBitsPerTile * (offset % kNumTilesInSuit);
+  }
+}
+
+// Sets every bit of the fields selected by a mask.
+inline uint32_t ExpandFields(uint32_t mask) {
+  return mask | mask << 1 | mask << 2;
+}
+
+inline TileBitboard MakeBoard(const uint32_t* lanes) {
+  TileBitboard board;
+  for (int i = 0; i < TileBitboard::kNumLanes; ++i) {
+    board.lane[i] = lanes[i];
+  }
+  return board;
+}
+
+#ifdef __SSE4_1__
+inline __m128i Load(const TileBitboard& board) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(board.lane));
+}
+
+inline __m128i Load(const uint32_t* lanes) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes));
+}
+
+inline TileBitboard Store(__m128i value) {
+  TileBitboard board;
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(board.lane), value);
+  return board;
+}
+
+inline __m128i GetOccupiedFields(__m128i board) {
+  return _mm_and_si128(
+      _mm_or_si128(board, _mm_or_si128(_mm_srli_epi32(board, 1),
+                                       _mm_srli_epi32(board, 2))),
+      _mm_set1_epi32(kFieldLsbs));
+}
+#endif
+}  // namespace
+
+const int TileBitboard::kNumLanes;
+const int TileBitboard::kBitsPerTile;
+
+TileBitboard TileBitboard::Empty() {
+  const uint32_t lanes[kNumLanes] = {};
+  return MakeBoard(lanes);
+}
+
+TileBitboard TileBitboard::FromCounts(const int* counts) {
+  TileBitboard board = Empty();
+  for (int index = 0; index < kNumTileIndices; ++index) {
+    int lane;
+    int shift;
+    GetLaneAndShift(index, &lane, &shift);
+    const int count = std::min(counts[index], (1 << kBitsPerTile) - 1);
+    board.lane[lane] |= static_cast<uint32_t>(count) << shift;
+  }
+  return board;
+}
+
+TileBitboard TileBitboard::FromParsedHand(
+    const CompactParsedHand& parsed_hand) {
+  TileBitboard board = Empty();
+  for (const CompactParsedHand* hand = &parsed_hand; hand != nullptr;
+       hand = hand->open_melds) {
+    for (int i = 0; i < hand->num_tiles(); ++i) {
+      if (hand->tile[i] < kNumTileIndices) {
+        board.Add(hand->tile[i]);
+      }
+    }
+  }
+  return board;
+}
+
+TileBitboard TileBitboard::FromTileType(TileType tile) {
+  TileBitboard board = Empty();
+  for (int index = 0; index < kNumTileIndices; ++index) {
+    if (IsTileTypeMatched(tile, GetTileTypeFromIndex(index))) {
+      board.Add(index);
+    }
+  }
+  return board;
+}
+
+void TileBitboard::Add(int tile_index) {
+  int lane_index;
+  int shift;
+  GetLaneAndShift(tile_index, &lane_index, &shift);
+  lane[lane_index] += static_cast<uint32_t>(1) << shift;
+}
+
+int TileBitboard::count(int tile_index) const {
+  int lane_index;
+  int shift;
+  GetLaneAndShift(tile_index, &lane_index, &shift);
+  return (lane[lane_index] >> shift) & ((1 << kBitsPerTile) - 1);
+}
+
+bool TileBitboard::operator==(const TileBitboard& other) const {
+  for (int i = 0; i < kNumLanes; ++i) {
+    if (lane[i] != other.lane[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+TileBitboard operator&(const TileBitboard& lhs, const TileBitboard& rhs) {
+  TileBitboard board;
+  for (int i = 0; i < TileBitboard::kNumLanes; ++i) {
+    board.lane[i] = lhs.lane[i] & rhs.lane[i];
+  }
+  return board;
+}
+
+TileBitboard operator|(const TileBitboard& lhs, const TileBitboard& rhs) {
+  TileBitboard board;
+  for (int i = 0; i < TileBitboard::kNumLanes; ++i) {
+    board.lane[i] = lhs.lane[i] | rhs.lane[i];
+  }
+  return board;
+}
+
+TileBitboard GetAllTilesMask() { return MakeBoard(kValidFields); }
+
+TileBitboard GetYaochuhaiMask() { return MakeBoard(kYaochuhai); }
+
+int CountKinds(const TileBitboard& mask) {
+  int num_kinds = 0;
+  for (int i = 0; i < TileBitboard::kNumLanes; ++i) {
+    num_kinds += std::bitset<32>(mask.lane[i]).count();
+  }
+  return num_kinds;
+}
+
+#ifdef __SSE4_1__
+TileBitboard GetOccupiedMask(const TileBitboard& board) {
+  return Store(GetOccupiedFields(Load(board)));
+}
+
+TileBitboard GetPairMask(const TileBitboard& board) {
+  // Fields of 2 turn into 0.
+  const __m128i diff =
+      _mm_xor_si128(Load(board), _mm_set1_epi32(kFieldLsbs << 1));
+  const __m128i nonzero = _mm_or_si128(
+      diff, _mm_or_si128(_mm_srli_epi32(diff, 1), _mm_srli_epi32(diff, 2)));
+  return Store(_mm_andnot_si128(nonzero, Load(kValidFields)));
+}
+
+TileBitboard GetSequenceMask(const TileBitboard& board) {
+  const __m128i occupied = GetOccupiedFields(Load(board));
+  return Store(_mm_and_si128(
+      _mm_and_si128(occupied, _mm_srli_epi32(occupied, 3)),
+      _mm_and_si128(_mm_srli_epi32(occupied, 6), Load(kSequenceStarts))));
+}
+
+int CountTiles(const TileBitboard& board, const TileBitboard& mask) {
+  const __m128i fields = Load(mask);
+  const __m128i masked = _mm_and_si128(
+      Load(board),
+      _mm_or_si128(fields, _mm_or_si128(_mm_slli_epi32(fields, 1),
+                                        _mm_slli_epi32(fields, 2))));
+  const __m128i even_fields = _mm_set1_epi32(kEvenFields);
+  const __m128i slots =
+      _mm_add_epi32(_mm_and_si128(masked, even_fields),
+                    _mm_and_si128(_mm_srli_epi32(masked, 3), even_fields));
+  __m128i sums = _mm_and_si128(
+      _mm_srli_epi32(_mm_mullo_epi32(slots, _mm_set1_epi32(kSlotSum)), 24),
+      _mm_set1_epi32(0x3f));
+  sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, 0x4e));
+  sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, 0xb1));
+  return _mm_cvtsi128_si32(sums);
+}
+
+bool IsSubset(const TileBitboard& board, const TileBitboard& mask) {
+  return _mm_testc_si128(Load(mask), GetOccupiedFields(Load(board)));
+}
+
+int GetLaneBits(const TileBitboard& board) {
+  const __m128i is_empty =
+      _mm_cmpeq_epi32(Load(board), _mm_setzero_si128());
+  return ~_mm_movemask_ps(_mm_castsi128_ps(is_empty)) & 0xf;
+}
+#else
+TileBitboard GetOccupiedMask(const TileBitboard& board) {
+  return scalar::GetOccupiedMask(board);
+}
+
+TileBitboard GetPairMask(const TileBitboard& board) {
+  return scalar::GetPairMask(board);
+}
+
+TileBitboard GetSequenceMask(const TileBitboard& board) {
+  return scalar::GetSequenceMask(board);
+}
+
+int CountTiles(const TileBitboard& board, const TileBitboard& mask) {
+  return scalar::CountTiles(board, mask);
+}
+
+bool IsSubset(const TileBitboard& board, const TileBitboard& mask) {
+  return scalar::IsSubset(board, mask);
+}
+
+int GetLaneBits(const TileBitboard& board) {
+  return scalar::GetLaneBits(board);
+}
+#endif
+
+namespace scalar {
+TileBitboard GetOccupiedMask(const TileBitboard& board) {
+  TileBitboard mask;
+  for (int i = 0; i < TileBitboard::kNumLanes; ++i) {
+    const uint32_t lane = board.lane[i];
+    mask.lane[i] = (lane | lane >> 1 | lane >> 2) & kFieldLsbs;
+  }
+  return mask;
+}
+
+TileBitboard GetPairMask(const TileBitboard& board) {
+  TileBitboard mask;
+  for (int i = 0; i < TileBitboard::kNumLanes; ++i) {
+    // Fields of 2 turn into 0.
+    const uint32_t diff = board.lane[i] ^ (kFieldLsbs << 1);
+    mask.lane[i] = ~(diff | diff >> 1 | diff >> 2) & kValidFields[i];
+  }
+  return mask;
+}
+
+TileBitboard GetSequenceMask(const TileBitboard& board) {
+  TileBitboard mask = scalar::GetOccupiedMask(board);
+  for (int i = 0; i < TileBitboard::kNumLanes; ++i) {
+    const uint32_t occupied = mask.lane[i];
+    mask.lane[i] =
+        occupied & occupied >> 3 & occupied >> 6 & kSequenceStarts[i];
+  }
+  return mask;
+}
+
+int CountTiles(const TileBitboard& board, const TileBitboard& mask) {
+  int num_tiles = 0;
+  for (int i = 0; i < TileBitboard::kNumLanes; ++i) {
+    const uint32_t masked = board.lane[i] & ExpandFields(mask.lane[i]);
+    // Add odd fields to even fields, which leaves 5 slots of 6 bits, and sum
+    // the slots up by a multiplication.
+    const uint32_t slots =
+        (masked & kEvenFields) + ((masked >> 3) & kEvenFields);
+    num_tiles += ((slots * kSlotSum) >> 24) & 0x3f;
+  }
+  return num_tiles;
+}
+
+bool IsSubset(const TileBitboard& board, const TileBitboard& mask) {
+  const TileBitboard occupied = scalar::GetOccupiedMask(board);
+  for (int i = 0; i < TileBitboard::kNumLanes; ++i) {
+    if (occupied.lane[i] & ~mask.lane[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int GetLaneBits(const TileBitboard& board) {
+  int bits = 0;
+  for (int i = 0; i < TileBitboard::kNumLanes; ++i) {
+    bits |= (board.lane[i] != 0) << i;
+  }
+  return bits;
+}
+}  // namespace scalar
+
+}  // namespace mahjong
+}  // namespace ycraft
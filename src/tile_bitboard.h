@@ -0,0 +1,112 @@
+// Copyright 2016 Yuki Hamada
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_TILE_BITBOARD_H_
+#define SRC_TILE_BITBOARD_H_
+
+#include <cstdint>
+
+#include "proto/mahjong_scorecalculator.pb.h"
+#include "src/compact_parsed_hand.h"
+
+namespace ycraft {
+namespace mahjong {
+
+// TileBitboard packs the counts of the 34 kinds of tiles into 128 bits, 3 bits
+// per kind. Jihai tiles and each suit take a 32-bit lane of their own, in the
+// order of tile indices, so a board fits a single SSE register and no kernel
+// carries bits across suits. The field of the tile at offset i in its lane is
+// bits [3i, 3i + 3).
+//
+// A mask is a board with a count of 1 for every selected kind. Kernels below
+// take boards and masks and answer whole-hand questions with a few word
+// operations. They use SSE4.1 if the compiler targets it, and the functions
+// in namespace scalar otherwise, which give the same results.
+struct TileBitboard {
+  static const int kNumLanes = 4;
+  static const int kBitsPerTile = 3;
+
+  uint32_t lane[kNumLanes];
+
+  static TileBitboard Empty();
+
+  // Builds a board of kNumTileIndices counts. Counts above 7 are saturated,
+  // which only changes the results of CountTiles.
+  static TileBitboard FromCounts(const int* counts);
+
+  // Builds a board of the tiles of the given parsed hand including its open
+  // melds.
+  static TileBitboard FromParsedHand(const CompactParsedHand& parsed_hand);
+
+  // Builds the mask of tile kinds that the given tile type matches (see
+  // IsTileTypeMatched), e.g. all the 1 and 9 tiles for TILE_1 | TILE_9.
+  static TileBitboard FromTileType(TileType tile);
+
+  // Adds a tile of the given index. The count of the tile has to stay below
+  // 8.
+  void Add(int tile_index);
+
+  int count(int tile_index) const;
+
+  bool operator==(const TileBitboard& other) const;
+  bool operator!=(const TileBitboard& other) const { return !(*this == other); }
+};
+
+TileBitboard operator&(const TileBitboard& lhs, const TileBitboard& rhs);
+TileBitboard operator|(const TileBitboard& lhs, const TileBitboard& rhs);
+
+// Returns the mask of all the 34 kinds of tiles.
+TileBitboard GetAllTilesMask();
+
+// Returns the mask of yaochuhai, i.e. jihai tiles and terminal tiles.
+TileBitboard GetYaochuhaiMask();
+
+// Returns the mask of the kinds that the given board holds.
+TileBitboard GetOccupiedMask(const TileBitboard& board);
+
+// Returns the mask of the kinds of which the given board holds exactly 2.
+TileBitboard GetPairMask(const TileBitboard& board);
+
+// Returns the mask of suit tiles from which the given board can take a
+// shuntsu, i.e. the tile and the next 2 tiles of the same suit are held.
+TileBitboard GetSequenceMask(const TileBitboard& board);
+
+// Returns the number of tiles of the given board in the given mask.
+int CountTiles(const TileBitboard& board, const TileBitboard& mask);
+
+// Returns the number of kinds in the given mask.
+int CountKinds(const TileBitboard& mask);
+
+// Returns true if every tile of the given board is in the given mask.
+bool IsSubset(const TileBitboard& board, const TileBitboard& mask);
+
+// Returns bits of the lanes that hold any tile: bit 0 for jihai tiles, and
+// bits 1, 2 and 3 for manzu, souzu and pinzu. A single-suit hand has exactly
+// one of bits 1 to 3.
+int GetLaneBits(const TileBitboard& board);
+
+// Portable implementations of the kernels above.
+namespace scalar {
+TileBitboard GetOccupiedMask(const TileBitboard& board);
+TileBitboard GetPairMask(const TileBitboard& board);
+TileBitboard GetSequenceMask(const TileBitboard& board);
+int CountTiles(const TileBitboard& board, const TileBitboard& mask);
+bool IsSubset(const TileBitboard& board, const TileBitboard& mask);
+int GetLaneBits(const TileBitboard& board);
+}  // namespace scalar
+
+}  // namespace mahjong
+}  // namespace ycraft
+
+#endif  // SRC_TILE_BITBOARD_H_
@@ -26,7 +26,6 @@ using std::make_pair;
 using std::move;
 using std::set;
 using std::string;
-using std::unique_ptr;
 using std::vector;
 
 using google::protobuf::RepeatedField;
@@ -35,10 +34,67 @@ using google::protobuf::RepeatedPtrField;
 namespace ycraft {
 namespace mahjong {
 
+namespace {
+// The number of tile states that CompactParsedHand can represent.
+const int kNumTileStates = 3;
+
+// Stores the tile states of the given tile flags into states, and returns the
+// number of them.
+int GetTileStates(uint8_t flags, TileState* states) {
+  int num_states = 0;
+  if (flags & CompactParsedHand::kAgariHai) {
+    states[num_states++] = TileState::AGARI_HAI;
+  }
+  if (flags & CompactParsedHand::kAgariHaiTsumo) {
+    states[num_states++] = TileState::AGARI_HAI_TSUMO;
+  }
+  if (flags & CompactParsedHand::kAgariHaiRon) {
+    states[num_states++] = TileState::AGARI_HAI_RON;
+  }
+  return num_states;
+}
+
+// Returns true if the given tile condition only checks the tile type, i.e.
+// the mask of tiles it matches doesn't depend on tile states or variables.
+bool IsTileTypeOnlyCondition(const TileCondition& condition) {
+  return condition.required_state_size() == 0 &&
+         condition.deny_state_size() == 0 &&
+         condition.required_variable_tile_type() ==
+             TileCondition::UNKNOWN_VARIABLE_TILE_TYPE;
+}
+
+// Returns the mask of tiles that the given tile-type-only condition matches.
+TileBitboard GetMatchedTiles(const TileCondition& condition) {
+  if (condition.allowed_tile_type_size() == 0) {
+    return GetAllTilesMask();
+  }
+  TileBitboard tiles = TileBitboard::Empty();
+  for (const int allowed_type : condition.allowed_tile_type()) {
+    tiles = tiles | TileBitboard::FromTileType(
+                        static_cast<TileType>(allowed_type));
+  }
+  return tiles;
+}
+
+// Returns true if the given tile condition only requires a tile of the color
+// variable of the given type.
+bool IsColorOnlyCondition(const TileCondition& condition,
+                          TileCondition::VariableTileType type) {
+  return condition.required_state_size() == 0 &&
+         condition.deny_state_size() == 0 &&
+         condition.allowed_tile_type_size() == 0 &&
+         condition.required_variable_tile_type() == type;
+}
+}  // namespace
+
 /**
  * Implementations for Yaku Applier.
  */
 YakuApplier::YakuApplier(const Rule& rule) : rule_(rule) {
+  for (const Yaku& yaku : rule_.yaku()) {
+    yaku_filters_.push_back(BuildYakuFilter(yaku.required_hand_condition()));
+  }
+
   for (const Yaku& yaku : rule_.yaku()) {
     if (!yaku_lookup_table_.insert(make_pair(yaku.name(), &yaku)).second) {
       std::cerr << "Duplicated yaku definition found." << std::endl;
@@ -71,18 +127,92 @@ YakuApplier::YakuApplier(const Rule& rule) : rule_(rule) {
 
 YakuApplier::~YakuApplier() {}
 
+YakuApplier::YakuFilter YakuApplier::BuildYakuFilter(
+    const HandCondition& condition) {
+  YakuFilter filter;
+  filter.allowed_tiles = GetAllTilesMask();
+  filter.denied_tiles = TileBitboard::Empty();
+  filter.is_single_suit = false;
+  filter.allows_jihai = true;
+
+  // Every tile has to match any of the allowed tile conditions. Variables make
+  // the matched tiles depend on the hand, but a single condition requiring a
+  // color still limits the hand to a single suit.
+  const RepeatedPtrField<TileCondition>& allowed_conditions =
+      condition.allowed_tile_condition();
+  bool is_tile_type_only = allowed_conditions.size() > 0;
+  TileBitboard allowed_tiles = TileBitboard::Empty();
+  for (const TileCondition& tile_condition : allowed_conditions) {
+    is_tile_type_only &= IsTileTypeOnlyCondition(tile_condition);
+    if (is_tile_type_only) {
+      allowed_tiles = allowed_tiles | GetMatchedTiles(tile_condition);
+    }
+  }
+  if (is_tile_type_only) {
+    filter.allowed_tiles = allowed_tiles;
+  } else if (allowed_conditions.size() == 1) {
+    if (IsColorOnlyCondition(allowed_conditions.Get(0),
+                             TileCondition::VARIABLE_COLOR_A)) {
+      filter.is_single_suit = true;
+      filter.allows_jihai = false;
+    } else if (IsColorOnlyCondition(
+                   allowed_conditions.Get(0),
+                   TileCondition::VARIABLE_COLOR_A_OR_JIHAI)) {
+      filter.is_single_suit = true;
+    }
+  }
+
+  // No tile may match any of the deny tile conditions.
+  for (const TileCondition& tile_condition : condition.deny_tile_condition()) {
+    if (IsTileTypeOnlyCondition(tile_condition)) {
+      filter.denied_tiles =
+          filter.denied_tiles | GetMatchedTiles(tile_condition);
+    }
+  }
+  return filter;
+}
+
+bool YakuApplier::IsAccepted(const YakuFilter& filter,
+                             const TileBitboard& tiles) {
+  if (!IsSubset(tiles, filter.allowed_tiles) ||
+      CountTiles(tiles, filter.denied_tiles) != 0) {
+    return false;
+  }
+  const int lane_bits = GetLaneBits(tiles);
+  if (!filter.allows_jihai && (lane_bits & 1)) {
+    return false;
+  }
+  // Bits of suits, which have to be a power of two.
+  const int suit_bits = lane_bits >> 1;
+  return !filter.is_single_suit || (suit_bits & (suit_bits - 1)) == 0;
+}
+
 void YakuApplier::Apply(const RichiType& richi_type, const TileType& field_wind,
                         const TileType& player_wind,
                         const ParsedHand& parsed_hand,
                         YakuApplierResult* result) const {
+  CompactParsedHand compact_parsed_hand;
+  if (!ToCompactParsedHand(parsed_hand, &compact_parsed_hand)) {
+    std::cerr << "Failed to convert the parsed hand." << std::endl;
+    return;
+  }
+  Apply(richi_type, field_wind, player_wind, compact_parsed_hand, result);
+}
+
+void YakuApplier::Apply(const RichiType& richi_type, const TileType& field_wind,
+                        const TileType& player_wind,
+                        const CompactParsedHand& parsed_hand,
+                        YakuApplierResult* result) const {
   bool is_menzen = IsMenzen(parsed_hand);
+  const TileBitboard tiles = TileBitboard::FromParsedHand(parsed_hand);
 
   set<string> applied_yaku_names;
-  for (const Yaku& yaku : rule_.yaku()) {
+  for (int i = 0; i < rule_.yaku_size(); ++i) {
+    const Yaku& yaku = rule_.yaku(i);
     // Check if hansuu is not zero.
     bool is_applicable = yaku.kuisagari_han() > 0 || yaku.yakuman() > 0 ||
                          (is_menzen && yaku.menzen_han() > 0);
-    if (!is_applicable) {
+    if (!is_applicable || !IsAccepted(yaku_filters_[i], tiles)) {
       continue;
     }
 
@@ -123,14 +253,22 @@ HandConditionValidator::HandConditionValidator(const HandCondition& condition,
       richi_type_(richi_type),
       field_wind_(field_wind),
       player_wind_(player_wind),
+      is_valid_parsed_hand_(
+          ToCompactParsedHand(parsed_hand, &converted_parsed_hand_)),
+      parsed_hand_(converted_parsed_hand_),
+      result_(nullptr) {}
+
+HandConditionValidator::HandConditionValidator(
+    const HandCondition& condition, const RichiType& richi_type,
+    const TileType& field_wind, const TileType& player_wind,
+    const CompactParsedHand& parsed_hand)
+    : condition_(condition),
+      richi_type_(richi_type),
+      field_wind_(field_wind),
+      player_wind_(player_wind),
+      is_valid_parsed_hand_(true),
       parsed_hand_(parsed_hand),
-      result_(nullptr) {
-  for (const Element& element : parsed_hand_.element()) {
-    for (const Tile& tile : element.tile()) {
-      hand_tiles_.Add()->CopyFrom(tile);
-    }
-  }
-}
+      result_(nullptr) {}
 
 HandConditionValidatorResult::Type HandConditionValidator::Validate() {
   HandConditionValidatorResult result;
@@ -141,6 +279,12 @@ HandConditionValidatorResult::Type HandConditionValidator::Validate(
     HandConditionValidatorResult* result) {
   result_ = result;
 
+  if (!is_valid_parsed_hand_) {
+    std::cerr << "Failed to convert the parsed hand." << std::endl;
+    result_->set_type(HandConditionValidatorResult::ERROR_INTERNAL_ERROR);
+    return result_->type();
+  }
+
   if (!SetValiableTile(TileCondition::VARIABLE_BAKAZE_TILE, field_wind_)) {
     std::cerr << "Failed to set bakaze variable tile." << std::endl;
     result_->set_type(HandConditionValidatorResult::ERROR_INTERNAL_ERROR);
@@ -167,7 +311,7 @@ HandConditionValidatorResult::Type HandConditionValidator::Validate(
 
   // Validate machi type.
   if (!IsMachiTypeMatched(condition_.required_machi_type(),
-                          parsed_hand_.machi_type())) {
+                          parsed_hand_.machi_type)) {
     result_->set_type(HandConditionValidatorResult::NG_REQUIRED_MACHI_TYPE);
     return result_->type();
   }
@@ -180,8 +324,7 @@ HandConditionValidatorResult::Type HandConditionValidator::Validate(
 
   // Validate agari condition.
   if (condition_.has_required_agari_condition() &&
-      !ValidateRequiredAgariCondition(condition_.required_agari_condition(),
-                                      parsed_hand_.agari())) {
+      !ValidateRequiredAgariCondition(condition_.required_agari_condition())) {
     result_->set_type(
         HandConditionValidatorResult::NG_REQUIRED_AGARI_CONDITION);
     return result_->type();
@@ -189,8 +332,8 @@ HandConditionValidatorResult::Type HandConditionValidator::Validate(
 
   // Validate allowed tile condition
   if (condition_.allowed_tile_condition_size() > 0 &&
-      !ValidateAllowedTileCondition(condition_.allowed_tile_condition(),
-                                    hand_tiles_,
+      !ValidateAllowedTileCondition(condition_.allowed_tile_condition(), 0,
+                                    parsed_hand_.GetNumTiles(),
                                     true /* allow_defining_new_variable */)) {
     result_->set_type(HandConditionValidatorResult::NG_ALLOWED_TILE_CONDITION);
     return result_->type();
@@ -198,8 +341,8 @@ HandConditionValidatorResult::Type HandConditionValidator::Validate(
 
   // Validate deny tile condition
   if (condition_.deny_tile_condition_size() > 0 &&
-      !ValidateDenyTileCondition(condition_.deny_tile_condition(),
-                                       hand_tiles_)) {
+      !ValidateDenyTileCondition(condition_.deny_tile_condition(), 0,
+                                 parsed_hand_.GetNumTiles())) {
     result_->set_type(
         HandConditionValidatorResult::NG_DENY_TILE_CONDITION);
     return result_->type();
@@ -207,8 +350,8 @@ HandConditionValidatorResult::Type HandConditionValidator::Validate(
 
   // Validate required tile condition
   if (condition_.required_tile_condition_size() > 0 &&
-      !ValidateRequiredTileCondition(condition_.required_tile_condition(),
-                                     hand_tiles_,
+      !ValidateRequiredTileCondition(condition_.required_tile_condition(), 0,
+                                     parsed_hand_.GetNumTiles(),
                                      true /* allow_defining_new_variable */)) {
     result_->set_type(HandConditionValidatorResult::NG_REQUIRED_TILE_CONDITION);
     return result_->type();
@@ -217,7 +360,7 @@ HandConditionValidatorResult::Type HandConditionValidator::Validate(
   // Validate element conditions
   if (condition_.required_element_condition_size() > 0 &&
       !ValidateRequiredElementCondition(
-          condition_.required_element_condition(), parsed_hand_.element(),
+          condition_.required_element_condition(),
           true /* allow_defining_new_variable */)) {
     result_->set_type(
         HandConditionValidatorResult::NG_REQUIRED_ELEMENT_CONDITION);
@@ -229,9 +372,9 @@ HandConditionValidatorResult::Type HandConditionValidator::Validate(
 }
 
 bool HandConditionValidator::ValidateRequiredAgariCondition(
-    const AgariCondition& condition, const Agari& agari) {
+    const AgariCondition& condition) {
   // Check type.
-  if (!IsAgariTypeMatched(condition.required_type(), agari.type())) {
+  if (!IsAgariTypeMatched(condition.required_type(), parsed_hand_.agari_type)) {
     return false;
   }
 
@@ -240,7 +383,7 @@ bool HandConditionValidator::ValidateRequiredAgariCondition(
     bool found = false;
     for (const int allowed_format_int : condition.allowed_format()) {
       AgariFormat allowed_format = static_cast<AgariFormat>(allowed_format_int);
-      if (IsAgariFormatMatched(allowed_format, agari.format())) {
+      if (IsAgariFormatMatched(allowed_format, parsed_hand_.agari_format)) {
         found = true;
         break;
       }
@@ -252,19 +395,18 @@ bool HandConditionValidator::ValidateRequiredAgariCondition(
 
   // Check state.
   if (condition.required_state_size() != 0) {
-    unique_ptr<bool[]> used(new bool[agari.state_size()]);
-    memset(used.get(), 0, sizeof(used[0]) * agari.state_size());
+    bool used[CompactParsedHand::kMaxNumAgariStates] = {};
 
     for (const int required_state_int : condition.required_state()) {
       const AgariState required_state =
           static_cast<AgariState>(required_state_int);
       bool found = false;
-      for (int i = 0; i < agari.state_size(); ++i) {
+      for (int i = 0; i < parsed_hand_.num_agari_states; ++i) {
         if (used[i]) {
           continue;
         }
 
-        if (!IsAgariStateMatched(required_state, agari.state(i))) {
+        if (!IsAgariStateMatched(required_state, parsed_hand_.agari_state[i])) {
           continue;
         }
 
@@ -301,7 +443,6 @@ bool HandConditionValidator::ValidateAllowedHandElementType(
 
 bool HandConditionValidator::ValidateRequiredElementCondition(
     const RepeatedPtrField<ElementCondition>& conditions,
-    const RepeatedPtrField<Element>& elements,
     bool allow_defining_new_variable) {
   // If the number of the given conditions is zero, this method construes as
   // there's no restrictions. So it will always return true.
@@ -309,8 +450,7 @@ bool HandConditionValidator::ValidateRequiredElementCondition(
     return true;
   }
 
-  unique_ptr<bool[]> used(new bool[elements.size()]);
-  memset(used.get(), 0, sizeof(used[0]) * elements.size());
+  bool used[CompactParsedHand::kMaxNumElements] = {};
 
   // Search applicable condition without defining a new variable first.
   // If there are no applicable condition, we will allow to define a new
@@ -320,12 +460,11 @@ bool HandConditionValidator::ValidateRequiredElementCondition(
     for (int new_variable = 0;
          new_variable <= (allow_defining_new_variable ? 1 : 0);
          ++new_variable) {
-      for (int i = 0; i < elements.size(); ++i) {
+      for (int i = 0; i < parsed_hand_.GetNumElements(); ++i) {
         if (used[i]) {
           continue;
         }
-        if (!ValidateElementCondition(condition, elements.Get(i),
-                                      new_variable)) {
+        if (!ValidateElementCondition(condition, i, new_variable)) {
           continue;
         }
 
@@ -346,24 +485,27 @@ bool HandConditionValidator::ValidateRequiredElementCondition(
 }
 
 bool HandConditionValidator::ValidateElementCondition(
-    const ElementCondition& condition, const Element& element,
+    const ElementCondition& condition, int element,
     bool allow_defining_new_variable) {
   // Check Hand Element Type
   if (!ValidateAllowedHandElementType(condition.allowed_element_type(),
-                                      element.type())) {
+                                      parsed_hand_.GetElementType(element))) {
     return false;
   }
 
+  const int tile_begin = parsed_hand_.GetElementBegin(element);
+  const int tile_end = parsed_hand_.GetElementEnd(element);
+
   // Validate allowed_tile_condition.
   if (!ValidateAllowedTileCondition(condition.allowed_tile_condition(),
-                                    element.tile(),
+                                    tile_begin, tile_end,
                                     allow_defining_new_variable)) {
     return false;
   }
 
   // Validate required_tile_condition.
   if (!ValidateRequiredTileCondition(condition.required_tile_condition(),
-                                     element.tile(),
+                                     tile_begin, tile_end,
                                      allow_defining_new_variable)) {
     return false;
   }
@@ -372,8 +514,8 @@ bool HandConditionValidator::ValidateElementCondition(
 }
 
 bool HandConditionValidator::ValidateAllowedTileCondition(
-    const RepeatedPtrField<TileCondition>& conditions,
-    const RepeatedPtrField<Tile>& tiles, bool allow_defining_new_variable) {
+    const RepeatedPtrField<TileCondition>& conditions, int tile_begin,
+    int tile_end, bool allow_defining_new_variable) {
   // If the number of the given conditions is zero, this method construes as
   // there's no restrictions. So it will always return true.
   if (conditions.size() == 0) {
@@ -383,7 +525,7 @@ bool HandConditionValidator::ValidateAllowedTileCondition(
   // Search applicable condition without defining a new variable first.
   // If there are no applicable condition, we will allow to define a new
   // variable.
-  for (const Tile& tile : tiles) {
+  for (int tile = tile_begin; tile < tile_end; ++tile) {
     bool found = false;
     for (int new_variable = 0;
          new_variable <= (allow_defining_new_variable ? 1 : 0);
@@ -407,15 +549,15 @@ bool HandConditionValidator::ValidateAllowedTileCondition(
 }
 
 bool HandConditionValidator::ValidateDenyTileCondition(
-    const RepeatedPtrField<TileCondition>& conditions,
-    const RepeatedPtrField<Tile>& tiles) {
+    const RepeatedPtrField<TileCondition>& conditions, int tile_begin,
+    int tile_end) {
   // If the number of the given conditions is zero, this method construes as
   // there's no restrictions. So it will always return true.
   if (conditions.size() == 0) {
     return true;
   }
 
-  for (const Tile& tile : tiles) {
+  for (int tile = tile_begin; tile < tile_end; ++tile) {
     for (const TileCondition& condition : conditions) {
       if (ValidateTileCondition(condition, tile,
                                 /*allow_defining_new_variable=*/false)) {
@@ -428,16 +570,15 @@ bool HandConditionValidator::ValidateDenyTileCondition(
 }
 
 bool HandConditionValidator::ValidateRequiredTileCondition(
-    const RepeatedPtrField<TileCondition>& conditions,
-    const RepeatedPtrField<Tile>& tiles, bool allow_defining_new_variable) {
+    const RepeatedPtrField<TileCondition>& conditions, int tile_begin,
+    int tile_end, bool allow_defining_new_variable) {
   // If the number of the given conditions is zero, this method construes as
   // there's no restrictions. So it will always return true.
   if (conditions.size() == 0) {
     return true;
   }
 
-  unique_ptr<bool[]> used(new bool[tiles.size()]);
-  memset(used.get(), 0, sizeof(used[0]) * tiles.size());
+  bool used[CompactParsedHand::kMaxNumTiles] = {};
 
   // Search applicable condition without defining a new variable first.
   // If there are no applicable condition, we will allow to define a new
@@ -447,11 +588,11 @@ bool HandConditionValidator::ValidateRequiredTileCondition(
     for (int new_variable = 0;
          new_variable <= (allow_defining_new_variable ? 1 : 0);
          ++new_variable) {
-      for (int i = 0; i < tiles.size(); ++i) {
+      for (int i = tile_begin; i < tile_end; ++i) {
         if (used[i]) {
           continue;
         }
-        if (!ValidateTileCondition(condition, tiles.Get(i), new_variable)) {
+        if (!ValidateTileCondition(condition, i, new_variable)) {
           continue;
         }
 
@@ -471,20 +612,25 @@ bool HandConditionValidator::ValidateRequiredTileCondition(
 }
 
 bool HandConditionValidator::ValidateTileCondition(
-    const TileCondition& condition, const Tile& tile,
+    const TileCondition& condition, int tile,
     bool allow_defining_new_variable) {
+  const TileType tile_type = parsed_hand_.GetTileType(tile);
+  TileState tile_states[kNumTileStates];
+  const int num_tile_states =
+      GetTileStates(parsed_hand_.GetTileFlags(tile), tile_states);
+
   // Check required tile state.
   {
-    vector<bool> used(tile.state_size(), false);
+    bool used[kNumTileStates] = {};
     for (const int required_state_int : condition.required_state()) {
       TileState required_state = static_cast<TileState>(required_state_int);
       bool found = false;
-      for (int i = 0; i < tile.state_size(); ++i) {
+      for (int i = 0; i < num_tile_states; ++i) {
         if (used[i]) {
           continue;
         }
 
-        if (!IsTileStateMatched(required_state, tile.state(i))) {
+        if (!IsTileStateMatched(required_state, tile_states[i])) {
           continue;
         }
 
@@ -501,9 +647,8 @@ bool HandConditionValidator::ValidateTileCondition(
   // Check deny tile state.
   for (const int deny_state_int : condition.deny_state()) {
     TileState deny_state = static_cast<TileState>(deny_state_int);
-    for (const int state_int : tile.state()) {
-      TileState state = static_cast<TileState>(state_int);
-      if (IsTileStateMatched(deny_state, state)) {
+    for (int i = 0; i < num_tile_states; ++i) {
+      if (IsTileStateMatched(deny_state, tile_states[i])) {
         return false;
       }
     }
@@ -513,7 +658,7 @@ bool HandConditionValidator::ValidateTileCondition(
   if (condition.allowed_tile_type_size() > 0) {
     bool found = false;
     for (const int allowed_type : condition.allowed_tile_type()) {
-      if (IsTileTypeMatched(static_cast<TileType>(allowed_type), tile.type())) {
+      if (IsTileTypeMatched(static_cast<TileType>(allowed_type), tile_type)) {
         found = true;
         break;
       }
@@ -537,14 +682,14 @@ bool HandConditionValidator::ValidateTileCondition(
     if (iter == variable_tiles_.end()) {
       if (allow_defining_new_variable) {
         return SetValiableTile(condition.required_variable_tile_type(),
-                               tile.type());
+                               tile_type);
       } else {
         return false;
       }
     }
 
     return ValidateVariableTile(condition.required_variable_tile_type(),
-                                iter->second, tile.type());
+                                iter->second, tile_type);
   } else {
     return true;
   }
@@ -24,6 +24,8 @@
 #include "proto/mahjong_common.pb.h"
 #include "proto/mahjong_rule.pb.h"
 #include "proto/mahjong_scorecalculator.pb.h"
+#include "src/compact_parsed_hand.h"
+#include "src/tile_bitboard.h"
 
 namespace ycraft {
 namespace mahjong {
@@ -36,9 +38,35 @@ class YakuApplier {
   void Apply(const RichiType& richi_type, const TileType& field_wind,
              const TileType& player_wind, const ParsedHand& parsed_hand,
              YakuApplierResult* result) const;
+  void Apply(const RichiType& richi_type, const TileType& field_wind,
+             const TileType& player_wind, const CompactParsedHand& parsed_hand,
+             YakuApplierResult* result) const;
 
  private:
+  // YakuFilter holds conditions on the tiles of a whole hand that a hand
+  // condition implies, so that most yaku that don't apply are rejected by a
+  // few bitboard operations before running HandConditionValidator. A filter
+  // never rejects a hand that the validator would accept.
+  struct YakuFilter {
+    // Every tile of the hand has to be in allowed_tiles, and none of them in
+    // denied_tiles.
+    TileBitboard allowed_tiles;
+    TileBitboard denied_tiles;
+
+    // Whether all the suit tiles have to be of a single suit, and whether
+    // jihai tiles are allowed.
+    bool is_single_suit;
+    bool allows_jihai;
+  };
+
+  static YakuFilter BuildYakuFilter(const HandCondition& condition);
+  static bool IsAccepted(const YakuFilter& filter, const TileBitboard& tiles);
+
   const Rule& rule_;
+
+  // Filters of the yaku of the rule, in the same order.
+  std::vector<YakuFilter> yaku_filters_;
+
   std::map<std::string, const Yaku*> yaku_lookup_table_;
   std::map<std::string, std::vector<std::string>> upper_yaku_lookup_table_;
 };
@@ -50,6 +78,11 @@ class HandConditionValidator {
                          const TileType& field_wind,
                          const TileType& player_wind,
                          const ParsedHand& parsed_hand);
+  HandConditionValidator(const HandCondition& condition,
+                         const RichiType& richi_type,
+                         const TileType& field_wind,
+                         const TileType& player_wind,
+                         const CompactParsedHand& parsed_hand);
 
   HandConditionValidatorResult::Type Validate();
   HandConditionValidatorResult::Type Validate(
@@ -57,8 +90,7 @@ class HandConditionValidator {
 
  private:
   // Agari conditions.
-  bool ValidateRequiredAgariCondition(const AgariCondition& condition,
-                                      const Agari& agari);
+  bool ValidateRequiredAgariCondition(const AgariCondition& condition);
 
   // Hand Element Type
   bool ValidateAllowedHandElementType(
@@ -68,29 +100,26 @@ class HandConditionValidator {
   // Element Conditions
   bool ValidateRequiredElementCondition(
       const google::protobuf::RepeatedPtrField<ElementCondition>& conditions,
-      const google::protobuf::RepeatedPtrField<Element>& elements,
       bool allow_defining_new_variable);
 
   bool ValidateElementCondition(const ElementCondition& condition,
-                                const Element& element,
-                                bool allow_defining_new_variable);
+                                int element, bool allow_defining_new_variable);
 
-  // TileConditions
+  // TileConditions. Tiles are given as a range [tile_begin, tile_end) of tiles
+  // of the parsed hand.
   bool ValidateAllowedTileCondition(
       const google::protobuf::RepeatedPtrField<TileCondition>& conditions,
-      const google::protobuf::RepeatedPtrField<Tile>& tiles,
-      bool allow_defining_new_variable);
+      int tile_begin, int tile_end, bool allow_defining_new_variable);
 
   bool ValidateDenyTileCondition(
       const google::protobuf::RepeatedPtrField<TileCondition>& conditions,
-      const google::protobuf::RepeatedPtrField<Tile>& tiles);
+      int tile_begin, int tile_end);
 
   bool ValidateRequiredTileCondition(
       const google::protobuf::RepeatedPtrField<TileCondition>& conditions,
-      const google::protobuf::RepeatedPtrField<Tile>& tiles,
-      bool allow_defining_new_variable);
+      int tile_begin, int tile_end, bool allow_defining_new_variable);
 
-  bool ValidateTileCondition(const TileCondition& condition, const Tile& tile,
+  bool ValidateTileCondition(const TileCondition& condition, int tile,
                              bool allow_defining_new_variable);
 
   bool SetValiableTile(const TileCondition::VariableTileType& type,
@@ -103,11 +132,15 @@ class HandConditionValidator {
   const RichiType& richi_type_;
   const TileType& field_wind_;
   const TileType& player_wind_;
-  const ParsedHand& parsed_hand_;
+
+  // Holds the given ParsedHand converted into CompactParsedHand. This is
+  // unused if a CompactParsedHand is given.
+  CompactParsedHand converted_parsed_hand_;
+  bool is_valid_parsed_hand_;
+  const CompactParsedHand& parsed_hand_;
 
   HandConditionValidatorResult* result_;
 
-  google::protobuf::RepeatedPtrField<Tile> hand_tiles_;
   std::map<TileCondition::VariableTileType, TileType> variable_tiles_;
   std::map<TileCondition::VariableTileType, std::set<TileType>> defined_tiles_;
 };
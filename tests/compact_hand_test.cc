@@ -0,0 +1,139 @@
+// Copyright 2016 Yuki Hamada
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gtest/gtest.h"
+
+#include "src/compact_hand.h"
+#include "src/compact_parsed_hand.h"
+#include "src/mahjong_common_util.h"
+
+namespace ycraft {
+namespace mahjong {
+
+class CompactHandTest : public testing::Test {};
+
+TEST_F(CompactHandTest, ConvertTest) {
+  Hand hand;
+  hand.add_closed_tile(TileType::PINZU_1);
+  hand.add_closed_tile(TileType::PINZU_1);
+  hand.add_closed_tile(TileType::WIND_TON);
+  hand.add_closed_tile(TileType::WIND_TON);
+  hand.set_agari_tile(TileType::WIND_TON);
+  Hand_Chii* chii = hand.add_chiied_tile();
+  chii->add_tile(TileType::SOUZU_3);
+  chii->add_tile(TileType::SOUZU_1);
+  chii->add_tile(TileType::SOUZU_2);
+  hand.add_ponned_tile()->set_tile(TileType::SANGEN_HAKU);
+  Hand_Kan* kan = hand.add_kanned_tile();
+  kan->set_tile(TileType::MANZU_5);
+  kan->set_is_closed(true);
+  hand.mutable_agari()->set_type(AgariType::TSUMO);
+  hand.mutable_agari()->add_state(AgariState::RINSHAN);
+  hand.set_richi_type(RichiType::NO_RICHI);
+
+  CompactHand compact_hand;
+  ASSERT_EQ(HandValidatorResult::OK, ToCompactHand(hand, &compact_hand));
+  EXPECT_EQ(4, compact_hand.num_closed_tiles);
+  EXPECT_EQ(GetTileIndex(TileType::WIND_TON), compact_hand.closed_tile[3]);
+  EXPECT_EQ(GetTileIndex(TileType::WIND_TON), compact_hand.agari_tile);
+  ASSERT_EQ(3, compact_hand.num_melds);
+  EXPECT_EQ(HandElementType::MINSHUNTSU, compact_hand.meld[0].type);
+  EXPECT_EQ(GetTileIndex(TileType::SOUZU_1), compact_hand.meld[0].tile);
+  EXPECT_EQ(HandElementType::MINKOUTSU, compact_hand.meld[1].type);
+  EXPECT_EQ(HandElementType::ANKANTSU, compact_hand.meld[2].type);
+  EXPECT_EQ(GetTileIndex(TileType::MANZU_5), compact_hand.meld[2].tile);
+  EXPECT_EQ(AgariType::TSUMO, compact_hand.agari_type);
+  EXPECT_TRUE(compact_hand.HasAgariState(AgariState::RINSHAN));
+  EXPECT_FALSE(compact_hand.HasAgariState(AgariState::HAITEI));
+  EXPECT_EQ(RichiType::NO_RICHI, compact_hand.richi_type);
+}
+
+TEST_F(CompactHandTest, ConvertTest_Error) {
+  CompactHand compact_hand;
+  Hand hand;
+  for (int i = 0; i < CompactHand::kMaxNumClosedTiles + 1; ++i) {
+    hand.add_closed_tile(TileType::PINZU_1);
+  }
+  EXPECT_EQ(HandValidatorResult::ERROR_WRONG_NUM_TILES,
+            ToCompactHand(hand, &compact_hand));
+
+  hand.Clear();
+  hand.add_closed_tile(TileType::TILE_1);
+  hand.set_agari_tile(TileType::PINZU_1);
+  EXPECT_EQ(HandValidatorResult::ERROR_UNKNOWN_TILE,
+            ToCompactHand(hand, &compact_hand));
+
+  hand.Clear();
+  hand.set_agari_tile(TileType::PINZU_1);
+  Hand_Chii* chii = hand.add_chiied_tile();
+  chii->add_tile(TileType::PINZU_8);
+  chii->add_tile(TileType::PINZU_9);
+  chii->add_tile(TileType::SOUZU_1);
+  EXPECT_EQ(HandValidatorResult::ERROR_INVALID_CHII,
+            ToCompactHand(hand, &compact_hand));
+}
+
+TEST_F(CompactHandTest, ClearTest) {
+  CompactHand compact_hand;
+  compact_hand.Clear();
+  EXPECT_EQ(0, compact_hand.num_closed_tiles);
+  EXPECT_EQ(0, compact_hand.num_melds);
+  // The agari tile is unknown rather than the tile of code 0, i.e. ton.
+  EXPECT_EQ(CompactParsedHand::kUnknownTileCode, compact_hand.agari_tile);
+  EXPECT_EQ(AgariType::UNKNOWN_AGARI_TYPE, compact_hand.agari_type);
+  EXPECT_EQ(0u, compact_hand.agari_states);
+}
+
+TEST_F(CompactHandTest, SetClosedTilesTest) {
+  uint8_t counts[kNumTileIndices] = {};
+  counts[GetTileIndex(TileType::SANGEN_CHUN)] = 2;
+  counts[GetTileIndex(TileType::MANZU_1)] = 1;
+
+  CompactHand compact_hand;
+  compact_hand.Clear();
+  ASSERT_TRUE(compact_hand.SetClosedTiles(counts));
+  ASSERT_EQ(3, compact_hand.num_closed_tiles);
+  EXPECT_EQ(GetTileIndex(TileType::SANGEN_CHUN), compact_hand.closed_tile[0]);
+  EXPECT_EQ(GetTileIndex(TileType::SANGEN_CHUN), compact_hand.closed_tile[1]);
+  EXPECT_EQ(GetTileIndex(TileType::MANZU_1), compact_hand.closed_tile[2]);
+
+  counts[GetTileIndex(TileType::PINZU_9)] = 11;
+  EXPECT_FALSE(compact_hand.SetClosedTiles(counts));
+}
+
+TEST_F(CompactHandTest, ConvertFieldTest) {
+  Field field;
+  field.set_wind(TileType::WIND_NAN);
+  field.add_dora(TileType::PINZU_5);
+  field.add_uradora(TileType::SANGEN_HAKU);
+  field.add_uradora(TileType::SOUZU_9);
+  field.set_honba(2);
+
+  CompactField compact_field;
+  ASSERT_TRUE(ToCompactField(field, &compact_field));
+  EXPECT_EQ(TileType::WIND_NAN, compact_field.wind);
+  ASSERT_EQ(1, compact_field.num_dora);
+  EXPECT_EQ(GetTileIndex(TileType::PINZU_5), compact_field.dora[0]);
+  ASSERT_EQ(2, compact_field.num_uradora);
+  EXPECT_EQ(GetTileIndex(TileType::SOUZU_9), compact_field.uradora[1]);
+  EXPECT_EQ(2, compact_field.honba);
+
+  for (int i = 0; i < CompactField::kMaxNumDora; ++i) {
+    field.add_dora(TileType::PINZU_5);
+  }
+  EXPECT_FALSE(ToCompactField(field, &compact_field));
+}
+
+}  // namespace mahjong
+}  // namespace ycraft
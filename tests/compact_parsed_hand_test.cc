@@ -0,0 +1,257 @@
+// Copyright 2016 Yuki Hamada
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "src/compact_parsed_hand.h"
+#include "src/hand_parser.h"
+#include "tests/common_test_util.h"
+
+using std::vector;
+
+namespace ycraft {
+namespace mahjong {
+
+class CompactParsedHandTest : public testing::Test {};
+
+TEST_F(CompactParsedHandTest, ConvertTest) {
+  ParsedHand parsed_hand;
+  CommonTestUtil::CreateAnkoutsu(parsed_hand.add_element(),
+                                 TileType::SANGEN_CHUN);
+  CommonTestUtil::CreateMinshuntsu(parsed_hand.add_element(),
+                                   TileType::MANZU_1, 1);
+  CommonTestUtil::CreateMinkantsu(parsed_hand.add_element(),
+                                  TileType::PINZU_9);
+  CommonTestUtil::CreateAntoitsu(parsed_hand.add_element(), TileType::WIND_TON);
+  parsed_hand.set_machi_type(MachiType::KANCHAN);
+  parsed_hand.mutable_agari()->set_type(AgariType::RON);
+  parsed_hand.mutable_agari()->add_state(AgariState::HAITEI);
+  parsed_hand.mutable_agari()->set_format(AgariFormat::REGULAR_AGARI);
+  parsed_hand.set_signature(12345);
+
+  CompactParsedHand compact_parsed_hand;
+  ASSERT_TRUE(ToCompactParsedHand(parsed_hand, &compact_parsed_hand));
+  EXPECT_EQ(4, compact_parsed_hand.num_elements);
+  EXPECT_EQ(12, compact_parsed_hand.num_tiles());
+  EXPECT_EQ(HandElementType::MINKANTSU, compact_parsed_hand.element_type[2]);
+  EXPECT_EQ(TileType::PINZU_9, compact_parsed_hand.tile_type(6));
+  EXPECT_EQ(CompactParsedHand::kAgariHaiRon,
+            compact_parsed_hand.tile_flags[4]);
+  EXPECT_TRUE(IsMenzen(compact_parsed_hand) == IsMenzen(parsed_hand));
+
+  ParsedHand converted;
+  ToParsedHand(compact_parsed_hand, &converted);
+  EXPECT_EQ(parsed_hand.SerializeAsString(), converted.SerializeAsString());
+}
+
+TEST_F(CompactParsedHandTest, ConvertTest_TooManyElements) {
+  ParsedHand parsed_hand;
+  for (int i = 0; i < CompactParsedHand::kMaxNumElements + 1; ++i) {
+    parsed_hand.add_element()->set_type(HandElementType::ANTOITSU);
+  }
+
+  CompactParsedHand compact_parsed_hand;
+  EXPECT_FALSE(ToCompactParsedHand(parsed_hand, &compact_parsed_hand));
+}
+
+TEST_F(CompactParsedHandTest, ConvertTest_TooManyTiles) {
+  ParsedHand parsed_hand;
+  for (int i = 0; i < 5; ++i) {
+    CommonTestUtil::CreateAnkantsu(parsed_hand.add_element(),
+                                   TileType::SOUZU_1);
+  }
+
+  CompactParsedHand compact_parsed_hand;
+  EXPECT_FALSE(ToCompactParsedHand(parsed_hand, &compact_parsed_hand));
+}
+
+TEST_F(CompactParsedHandTest, ParseTest) {
+  // Parsing into CompactParsedHand gives the same parsed hands as parsing
+  // into the proto.
+  Hand hand;
+  hand.add_closed_tile(TileType::MANZU_1);
+  hand.add_closed_tile(TileType::MANZU_1);
+  hand.add_closed_tile(TileType::MANZU_1);
+  hand.add_closed_tile(TileType::MANZU_2);
+  hand.add_closed_tile(TileType::MANZU_2);
+  hand.add_closed_tile(TileType::MANZU_2);
+  hand.add_closed_tile(TileType::MANZU_3);
+  hand.add_closed_tile(TileType::MANZU_3);
+  hand.add_closed_tile(TileType::MANZU_3);
+  hand.add_closed_tile(TileType::SOUZU_5);
+  hand.set_agari_tile(TileType::SOUZU_5);
+  hand.mutable_agari()->set_type(AgariType::TSUMO);
+  hand.add_kanned_tile()->set_tile(TileType::SANGEN_HAKU);
+
+  HandParser hand_parser;
+  HandParserResult result;
+  hand_parser.Parse(hand, &result);
+  vector<CompactParsedHand> compact_parsed_hands;
+  hand_parser.Parse(hand, &compact_parsed_hands);
+
+  ASSERT_EQ(2, result.parsed_hand_size());
+  ASSERT_EQ(result.parsed_hand_size(), compact_parsed_hands.size());
+  for (int i = 0; i < result.parsed_hand_size(); ++i) {
+    ParsedHand converted;
+    ToParsedHand(compact_parsed_hands[i], &converted);
+    EXPECT_EQ(result.parsed_hand(i).SerializeAsString(),
+              converted.SerializeAsString());
+    EXPECT_EQ(5, compact_parsed_hands[i].num_elements);
+  }
+}
+
+TEST_F(CompactParsedHandTest, OpenMeldsTest) {
+  CompactParsedHand open_melds;
+  open_melds.Clear();
+  open_melds.AddElement(HandElementType::MINKOUTSU);
+  for (int i = 0; i < 3; ++i) {
+    open_melds.AddTile(CompactParsedHand::GetTileCode(TileType::SANGEN_HAKU),
+                       0);
+  }
+
+  CompactParsedHand parsed_hand;
+  parsed_hand.Clear();
+  parsed_hand.AddElement(HandElementType::ANTOITSU);
+  parsed_hand.AddTile(CompactParsedHand::GetTileCode(TileType::MANZU_1), 0);
+  parsed_hand.AddTile(CompactParsedHand::GetTileCode(TileType::MANZU_1),
+                      CompactParsedHand::kAgariHaiTsumo);
+  parsed_hand.open_melds = &open_melds;
+
+  EXPECT_EQ(2, parsed_hand.GetNumElements());
+  EXPECT_EQ(5, parsed_hand.GetNumTiles());
+  EXPECT_EQ(HandElementType::MINKOUTSU, parsed_hand.GetElementType(1));
+  EXPECT_EQ(2, parsed_hand.GetElementBegin(1));
+  EXPECT_EQ(5, parsed_hand.GetElementEnd(1));
+  EXPECT_EQ(TileType::SANGEN_HAKU, parsed_hand.GetTileType(4));
+  EXPECT_EQ(CompactParsedHand::kAgariHaiTsumo, parsed_hand.GetTileFlags(1));
+  EXPECT_FALSE(IsMenzen(parsed_hand));
+
+  ParsedHand shared;
+  ToParsedHand(parsed_hand, &shared);
+
+  ASSERT_TRUE(parsed_hand.MergeOpenMelds());
+  EXPECT_EQ(nullptr, parsed_hand.open_melds);
+  EXPECT_EQ(2, parsed_hand.num_elements);
+  EXPECT_EQ(5, parsed_hand.num_tiles());
+
+  ParsedHand merged;
+  ToParsedHand(parsed_hand, &merged);
+  EXPECT_EQ(shared.SerializeAsString(), merged.SerializeAsString());
+}
+
+TEST_F(CompactParsedHandTest, GeneratorTest_SharedOpenMelds) {
+  Hand hand;
+  hand.add_closed_tile(TileType::MANZU_1);
+  hand.add_closed_tile(TileType::MANZU_1);
+  hand.add_closed_tile(TileType::MANZU_1);
+  hand.add_closed_tile(TileType::MANZU_2);
+  hand.add_closed_tile(TileType::MANZU_2);
+  hand.add_closed_tile(TileType::MANZU_2);
+  hand.add_closed_tile(TileType::MANZU_3);
+  hand.add_closed_tile(TileType::MANZU_3);
+  hand.add_closed_tile(TileType::MANZU_3);
+  hand.add_closed_tile(TileType::SOUZU_5);
+  hand.set_agari_tile(TileType::SOUZU_5);
+  hand.mutable_agari()->set_type(AgariType::TSUMO);
+  hand.add_kanned_tile()->set_tile(TileType::SANGEN_HAKU);
+
+  HandParser hand_parser;
+  HandParserResult result;
+  hand_parser.Parse(hand, &result);
+  ASSERT_EQ(2, result.parsed_hand_size());
+
+  // All parsed hands of the generator refer to the same open melds.
+  HandParser::Generator generator(hand_parser, hand);
+  CompactParsedHand parsed_hand;
+  const CompactParsedHand* open_melds = nullptr;
+  for (int i = 0; i < result.parsed_hand_size(); ++i) {
+    ASSERT_TRUE(generator.Next(&parsed_hand));
+    ASSERT_NE(nullptr, parsed_hand.open_melds);
+    if (open_melds != nullptr) {
+      EXPECT_EQ(open_melds, parsed_hand.open_melds);
+    }
+    open_melds = parsed_hand.open_melds;
+    EXPECT_EQ(4, parsed_hand.num_elements);
+    EXPECT_EQ(5, parsed_hand.GetNumElements());
+
+    ParsedHand converted;
+    ToParsedHand(parsed_hand, &converted);
+    EXPECT_EQ(result.parsed_hand(i).SerializeAsString(),
+              converted.SerializeAsString());
+  }
+  EXPECT_FALSE(generator.Next(&parsed_hand));
+}
+
+TEST_F(CompactParsedHandTest, SetAgariTypeTest) {
+  // The last tile of each hand is the agari tile. It completes a koutsu of a
+  // hand also parsed as sanrenkou, a toitsu of chiitoitsu, and kokushi-musou.
+  const vector<vector<TileType>> hands = {
+      {TileType::MANZU_1, TileType::MANZU_1, TileType::MANZU_1,
+       TileType::MANZU_2, TileType::MANZU_2, TileType::MANZU_2,
+       TileType::MANZU_3, TileType::MANZU_3, TileType::MANZU_3,
+       TileType::SOUZU_5, TileType::SOUZU_5, TileType::SOUZU_7,
+       TileType::SOUZU_7, TileType::SOUZU_7},
+      {TileType::MANZU_1, TileType::MANZU_1, TileType::PINZU_2,
+       TileType::PINZU_2, TileType::SOUZU_3, TileType::SOUZU_3,
+       TileType::SOUZU_7, TileType::SOUZU_7, TileType::WIND_NAN,
+       TileType::WIND_NAN, TileType::SANGEN_HAKU, TileType::SANGEN_HAKU,
+       TileType::MANZU_9, TileType::MANZU_9},
+      {TileType::MANZU_1, TileType::MANZU_9, TileType::PINZU_1,
+       TileType::PINZU_9, TileType::SOUZU_1, TileType::SOUZU_9,
+       TileType::WIND_TON, TileType::WIND_NAN, TileType::WIND_SHA,
+       TileType::WIND_PE, TileType::SANGEN_HAKU, TileType::SANGEN_HATSU,
+       TileType::SANGEN_CHUN, TileType::SANGEN_CHUN},
+  };
+
+  HandParser hand_parser;
+  for (const vector<TileType>& tiles : hands) {
+    Hand hand;
+    for (int i = 0; i < 13; ++i) {
+      hand.add_closed_tile(tiles[i]);
+    }
+    hand.set_agari_tile(tiles[13]);
+
+    hand.mutable_agari()->set_type(AgariType::RON);
+    vector<CompactParsedHand> ron_parsed_hands;
+    hand_parser.Parse(hand, &ron_parsed_hands);
+    hand.mutable_agari()->set_type(AgariType::TSUMO);
+    vector<CompactParsedHand> tsumo_parsed_hands;
+    hand_parser.Parse(hand, &tsumo_parsed_hands);
+
+    ASSERT_FALSE(ron_parsed_hands.empty());
+    ASSERT_EQ(ron_parsed_hands.size(), tsumo_parsed_hands.size());
+    for (size_t i = 0; i < ron_parsed_hands.size(); ++i) {
+      ParsedHand expected;
+      ToParsedHand(tsumo_parsed_hands[i], &expected);
+      CompactParsedHand parsed_hand = ron_parsed_hands[i];
+      SetAgariType(AgariType::TSUMO, &parsed_hand);
+      ParsedHand converted;
+      ToParsedHand(parsed_hand, &converted);
+      EXPECT_EQ(expected.SerializeAsString(), converted.SerializeAsString());
+
+      // And back to ron.
+      SetAgariType(AgariType::RON, &parsed_hand);
+      expected.Clear();
+      converted.Clear();
+      ToParsedHand(ron_parsed_hands[i], &expected);
+      ToParsedHand(parsed_hand, &converted);
+      EXPECT_EQ(expected.SerializeAsString(), converted.SerializeAsString());
+    }
+  }
+}
+
+}  // namespace mahjong
+}  // namespace ycraft
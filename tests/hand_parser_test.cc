@@ -14,18 +14,22 @@
 
 #include <algorithm>
 #include <iostream>
+#include <memory>
 #include <stdexcept>
+#include <thread>
 
 #include "google/protobuf/text_format.h"
 #include "gtest/gtest.h"
 
 #include "src/hand_parser.h"
 #include "src/mahjong_common_util.h"
+#include "src/suit_decomposition_table.h"
 #include "tests/common_test_util.h"
 
 using google::protobuf::TextFormat;
 using std::endl;
 using std::string;
+using std::thread;
 using std::vector;
 
 namespace ycraft {
@@ -124,7 +128,8 @@ class HandParserTest : public testing::Test {
   }
 
   void VerifyParsedHandForIrregularAgariFormat(
-      const Hand& input_hand, const vector<AgariState>& expected_agari_state,
+      const Hand& input_hand, const MachiType& expected_machi_type,
+      const vector<AgariState>& expected_agari_state,
       const ParsedHand& actual_parsed_hand) {
     Element element;
     element.set_type(HandElementType::UNKNOWN_HAND_ELEMENT_TYPE);
@@ -142,7 +147,7 @@ class HandParserTest : public testing::Test {
                           : TileState::AGARI_HAI_TSUMO);
     }
     ASSERT_NO_FATAL_FAILURE(VerifyParsedHand(
-        {element}, MachiType::UNKNOWN_MACHI_TYPE, input_hand.agari().type(),
+        {element}, expected_machi_type, input_hand.agari().type(),
         AgariFormat::IRREGULAR_AGARI, expected_agari_state,
         actual_parsed_hand));
   }
@@ -173,7 +178,7 @@ TEST_F(HandParserTest, ParseTest_1) {
 
   SCOPED_TRACE(GetDebugString(result));
 
-  ASSERT_EQ(4, result.parsed_hand_size());
+  ASSERT_EQ(3, result.parsed_hand_size());
   ASSERT_NO_FATAL_FAILURE(VerifyParsedHand(
       {CommonTestUtil::CreateAntoitsu(TileType::PINZU_1),
        CommonTestUtil::CreateAnshuntsu(TileType::PINZU_1),
@@ -198,8 +203,6 @@ TEST_F(HandParserTest, ParseTest_1) {
        CommonTestUtil::CreateAntoitsu(TileType::PINZU_4, true)},
       MachiType::TANKI, AgariType::TSUMO, AgariFormat::REGULAR_AGARI,
       {} /* expected_agari_state */, result.parsed_hand(2)));
-  ASSERT_NO_FATAL_FAILURE(VerifyParsedHandForIrregularAgariFormat(
-      hand, {} /* expected_agari_state */, result.parsed_hand(3)));
 }
 
 TEST_F(HandParserTest, ParseTest_2) {
@@ -226,7 +229,7 @@ TEST_F(HandParserTest, ParseTest_2) {
 
   SCOPED_TRACE(GetDebugString(result));
 
-  ASSERT_EQ(6, result.parsed_hand_size());
+  ASSERT_EQ(5, result.parsed_hand_size());
   ASSERT_NO_FATAL_FAILURE(VerifyParsedHand(
       {CommonTestUtil::CreateMintoitsu(TileType::PINZU_1, true),
        CommonTestUtil::CreateAnshuntsu(TileType::PINZU_1),
@@ -267,8 +270,6 @@ TEST_F(HandParserTest, ParseTest_2) {
        CommonTestUtil::CreateAntoitsu(TileType::PINZU_4)},
       MachiType::RYANMEN, AgariType::RON, AgariFormat::REGULAR_AGARI,
       {AgariState::SOKU}, result.parsed_hand(4)));
-  ASSERT_NO_FATAL_FAILURE(VerifyParsedHandForIrregularAgariFormat(
-      hand, {AgariState::SOKU}, result.parsed_hand(5)));
 }
 
 TEST_F(HandParserTest, ParseTest_3) {
@@ -294,7 +295,7 @@ TEST_F(HandParserTest, ParseTest_3) {
 
   SCOPED_TRACE(GetDebugString(result));
 
-  ASSERT_EQ(2, result.parsed_hand_size());
+  ASSERT_EQ(1, result.parsed_hand_size());
   ASSERT_NO_FATAL_FAILURE(VerifyParsedHand(
       {CommonTestUtil::CreateAnshuntsu(TileType::PINZU_1),
        CommonTestUtil::CreateAnshuntsu(TileType::PINZU_5),
@@ -303,8 +304,6 @@ TEST_F(HandParserTest, ParseTest_3) {
        CommonTestUtil::CreateAntoitsu(TileType::MANZU_9, true)},
       MachiType::TANKI, AgariType::TSUMO, AgariFormat::REGULAR_AGARI,
       {} /* expected_agari_state */, result.parsed_hand(0)));
-  ASSERT_NO_FATAL_FAILURE(VerifyParsedHandForIrregularAgariFormat(
-      hand, {} /* expected_agari_state */, result.parsed_hand(1)));
 }
 
 TEST_F(HandParserTest, ParseTest_4) {
@@ -330,9 +329,7 @@ TEST_F(HandParserTest, ParseTest_4) {
 
   SCOPED_TRACE(GetDebugString(result));
 
-  ASSERT_EQ(1, result.parsed_hand_size());
-  ASSERT_NO_FATAL_FAILURE(VerifyParsedHandForIrregularAgariFormat(
-      hand, {} /* expected_agari_state */, result.parsed_hand(0)));
+  ASSERT_EQ(0, result.parsed_hand_size());
 }
 
 TEST_F(HandParserTest, ParseTest_5) {
@@ -358,9 +355,7 @@ TEST_F(HandParserTest, ParseTest_5) {
 
   SCOPED_TRACE(GetDebugString(result));
 
-  ASSERT_EQ(1, result.parsed_hand_size());
-  ASSERT_NO_FATAL_FAILURE(VerifyParsedHandForIrregularAgariFormat(
-      hand, {} /* expected_agari_state */, result.parsed_hand(0)));
+  ASSERT_EQ(0, result.parsed_hand_size());
 }
 
 TEST_F(HandParserTest, ParseTest_6) {
@@ -386,9 +381,7 @@ TEST_F(HandParserTest, ParseTest_6) {
 
   SCOPED_TRACE(GetDebugString(result));
 
-  ASSERT_EQ(1, result.parsed_hand_size());
-  ASSERT_NO_FATAL_FAILURE(VerifyParsedHandForIrregularAgariFormat(
-      hand, {} /* expected_agari_state */, result.parsed_hand(0)));
+  ASSERT_EQ(0, result.parsed_hand_size());
 }
 
 TEST_F(HandParserTest, ParseTest_7) {
@@ -425,6 +418,95 @@ TEST_F(HandParserTest, ParseTest_7) {
       {} /* expected_agari_state */, result.parsed_hand(0)));
 }
 
+TEST_F(HandParserTest, ParseTest_IdenticalShuntsu) {
+  Hand hand;
+  hand.add_closed_tile(TileType::MANZU_1);
+  hand.add_closed_tile(TileType::MANZU_1);
+  hand.add_closed_tile(TileType::MANZU_1);
+  hand.add_closed_tile(TileType::MANZU_2);
+  hand.add_closed_tile(TileType::MANZU_2);
+  hand.add_closed_tile(TileType::MANZU_3);
+  hand.add_closed_tile(TileType::MANZU_3);
+  hand.add_closed_tile(TileType::MANZU_3);
+  hand.add_closed_tile(TileType::MANZU_5);
+  hand.add_closed_tile(TileType::MANZU_5);
+  hand.add_closed_tile(TileType::MANZU_7);
+  hand.add_closed_tile(TileType::MANZU_8);
+  hand.add_closed_tile(TileType::MANZU_9);
+  hand.set_agari_tile(TileType::MANZU_2);
+  hand.mutable_agari()->set_type(AgariType::TSUMO);
+
+  HandParserResult result;
+  handParser_.Parse(hand, &result);
+
+  SCOPED_TRACE(GetDebugString(result));
+
+  ASSERT_EQ(2, result.parsed_hand_size());
+  ASSERT_NO_FATAL_FAILURE(VerifyParsedHand(
+      {CommonTestUtil::CreateAnkoutsu(TileType::MANZU_1),
+       CommonTestUtil::CreateAnkoutsu(TileType::MANZU_2, true),
+       CommonTestUtil::CreateAnkoutsu(TileType::MANZU_3),
+       CommonTestUtil::CreateAntoitsu(TileType::MANZU_5),
+       CommonTestUtil::CreateAnshuntsu(TileType::MANZU_7)},
+      MachiType::SHABO, AgariType::TSUMO, AgariFormat::REGULAR_AGARI,
+      {} /* expected_agari_state */, result.parsed_hand(0)));
+  ASSERT_NO_FATAL_FAILURE(VerifyParsedHand(
+      {CommonTestUtil::CreateAnshuntsu(TileType::MANZU_1, 1),
+       CommonTestUtil::CreateAnshuntsu(TileType::MANZU_1),
+       CommonTestUtil::CreateAnshuntsu(TileType::MANZU_1),
+       CommonTestUtil::CreateAntoitsu(TileType::MANZU_5),
+       CommonTestUtil::CreateAnshuntsu(TileType::MANZU_7)},
+      MachiType::KANCHAN, AgariType::TSUMO, AgariFormat::REGULAR_AGARI,
+      {} /* expected_agari_state */, result.parsed_hand(1)));
+}
+
+TEST_F(HandParserTest, ParseTest_Signature) {
+  // 111 222 333 can be read as three koutsu or three identical shuntsu.
+  Hand hand;
+  hand.add_closed_tile(TileType::MANZU_1);
+  hand.add_closed_tile(TileType::MANZU_1);
+  hand.add_closed_tile(TileType::MANZU_1);
+  hand.add_closed_tile(TileType::MANZU_2);
+  hand.add_closed_tile(TileType::MANZU_2);
+  hand.add_closed_tile(TileType::MANZU_2);
+  hand.add_closed_tile(TileType::MANZU_3);
+  hand.add_closed_tile(TileType::MANZU_3);
+  hand.add_closed_tile(TileType::MANZU_3);
+  hand.add_closed_tile(TileType::MANZU_5);
+  hand.add_closed_tile(TileType::MANZU_6);
+  hand.add_closed_tile(TileType::MANZU_7);
+  hand.add_closed_tile(TileType::MANZU_9);
+  hand.set_agari_tile(TileType::MANZU_9);
+  hand.mutable_agari()->set_type(AgariType::RON);
+
+  HandParserResult result;
+  handParser_.Parse(hand, &result);
+
+  SCOPED_TRACE(GetDebugString(result));
+
+  // 111 222 333 567 99 and 123 123 123 567 99.
+  ASSERT_EQ(2, result.parsed_hand_size());
+  for (int i = 0; i < result.parsed_hand_size(); ++i) {
+    EXPECT_NE(0u, result.parsed_hand(i).signature());
+    for (int j = 0; j < i; ++j) {
+      EXPECT_NE(result.parsed_hand(j).signature(),
+                result.parsed_hand(i).signature());
+    }
+  }
+
+  // Signatures don't depend on the order of tiles in the hand.
+  Hand reversed_hand = hand;
+  std::reverse(reversed_hand.mutable_closed_tile()->begin(),
+               reversed_hand.mutable_closed_tile()->end());
+  HandParserResult reversed_result;
+  handParser_.Parse(reversed_hand, &reversed_result);
+  ASSERT_EQ(result.parsed_hand_size(), reversed_result.parsed_hand_size());
+  for (int i = 0; i < result.parsed_hand_size(); ++i) {
+    EXPECT_EQ(result.parsed_hand(i).signature(),
+              reversed_result.parsed_hand(i).signature());
+  }
+}
+
 TEST_F(HandParserTest, ParseTest_Churen) {
   Hand hand;
   hand.add_closed_tile(TileType::PINZU_1);
@@ -448,7 +530,7 @@ TEST_F(HandParserTest, ParseTest_Churen) {
 
   SCOPED_TRACE(GetDebugString(result));
 
-  ASSERT_EQ(3, result.parsed_hand_size());
+  ASSERT_EQ(2, result.parsed_hand_size());
   ASSERT_NO_FATAL_FAILURE(VerifyParsedHand(
       {CommonTestUtil::CreateAntoitsu(TileType::PINZU_1),
        CommonTestUtil::CreateAnshuntsu(TileType::PINZU_1),
@@ -465,8 +547,6 @@ TEST_F(HandParserTest, ParseTest_Churen) {
        CommonTestUtil::CreateMinkoutsu(TileType::PINZU_9, true)},
       MachiType::SHABO, AgariType::RON, AgariFormat::REGULAR_AGARI,
       {} /* expected_agari_state */, result.parsed_hand(1)));
-  ASSERT_NO_FATAL_FAILURE(VerifyParsedHandForIrregularAgariFormat(
-      hand, {} /* expected_agari_state */, result.parsed_hand(2)));
 }
 
 TEST_F(HandParserTest, ParseTest_Chitoitsu) {
@@ -492,14 +572,15 @@ TEST_F(HandParserTest, ParseTest_Chitoitsu) {
 
   SCOPED_TRACE(GetDebugString(result));
 
-  ASSERT_EQ(5, result.parsed_hand_size());
+  ASSERT_EQ(4, result.parsed_hand_size());
+  EXPECT_TRUE(result.is_ryanpeikou_chiitoitsu());
   ASSERT_NO_FATAL_FAILURE(VerifyParsedHand(
       {CommonTestUtil::CreateAntoitsu(TileType::PINZU_1),
        CommonTestUtil::CreateAnshuntsu(TileType::PINZU_2),
        CommonTestUtil::CreateAnshuntsu(TileType::PINZU_2),
        CommonTestUtil::CreateAnshuntsu(TileType::PINZU_5),
        CommonTestUtil::CreateAnshuntsu(TileType::PINZU_5, 2)},
-      MachiType::PENCHAN, AgariType::TSUMO, AgariFormat::REGULAR_AGARI,
+      MachiType::RYANMEN, AgariType::TSUMO, AgariFormat::REGULAR_AGARI,
       {} /* expected_agari_state */, result.parsed_hand(0)));
   ASSERT_NO_FATAL_FAILURE(VerifyParsedHand(
       {CommonTestUtil::CreateAnshuntsu(TileType::PINZU_1),
@@ -507,7 +588,7 @@ TEST_F(HandParserTest, ParseTest_Chitoitsu) {
        CommonTestUtil::CreateAntoitsu(TileType::PINZU_4),
        CommonTestUtil::CreateAnshuntsu(TileType::PINZU_5),
        CommonTestUtil::CreateAnshuntsu(TileType::PINZU_5, 2)},
-      MachiType::PENCHAN, AgariType::TSUMO, AgariFormat::REGULAR_AGARI,
+      MachiType::RYANMEN, AgariType::TSUMO, AgariFormat::REGULAR_AGARI,
       {} /* expected_agari_state */, result.parsed_hand(1)));
   ASSERT_NO_FATAL_FAILURE(VerifyParsedHand(
       {CommonTestUtil::CreateAnshuntsu(TileType::PINZU_1),
@@ -527,8 +608,6 @@ TEST_F(HandParserTest, ParseTest_Chitoitsu) {
        CommonTestUtil::CreateAntoitsu(TileType::PINZU_7, true)},
       MachiType::TANKI, AgariType::TSUMO, AgariFormat::CHITOITSU_AGARI,
       {} /* expected_agari_state */, result.parsed_hand(3)));
-  ASSERT_NO_FATAL_FAILURE(VerifyParsedHandForIrregularAgariFormat(
-      hand, {} /* expected_agari_state */, result.parsed_hand(4)));
 }
 
 TEST_F(HandParserTest, ParseTest_Chitoitsu_2) {
@@ -554,7 +633,8 @@ TEST_F(HandParserTest, ParseTest_Chitoitsu_2) {
 
   SCOPED_TRACE(GetDebugString(result));
 
-  ASSERT_EQ(2, result.parsed_hand_size());
+  ASSERT_EQ(1, result.parsed_hand_size());
+  EXPECT_FALSE(result.is_ryanpeikou_chiitoitsu());
   ASSERT_NO_FATAL_FAILURE(VerifyParsedHand(
       {CommonTestUtil::CreateAntoitsu(TileType::PINZU_1),
        CommonTestUtil::CreateAntoitsu(TileType::PINZU_2),
@@ -565,8 +645,6 @@ TEST_F(HandParserTest, ParseTest_Chitoitsu_2) {
        CommonTestUtil::CreateMintoitsu(TileType::WIND_NAN, true)},
       MachiType::TANKI, AgariType::RON, AgariFormat::CHITOITSU_AGARI,
       {} /* expected_agari_state */, result.parsed_hand(0)));
-  ASSERT_NO_FATAL_FAILURE(VerifyParsedHandForIrregularAgariFormat(
-      hand, {} /* expected_agari_state */, result.parsed_hand(1)));
 }
 
 TEST_F(HandParserTest, ParseTest_NotChitoitsu) {
@@ -592,9 +670,7 @@ TEST_F(HandParserTest, ParseTest_NotChitoitsu) {
 
   SCOPED_TRACE(GetDebugString(result));
 
-  ASSERT_EQ(1, result.parsed_hand_size());
-  ASSERT_NO_FATAL_FAILURE(VerifyParsedHandForIrregularAgariFormat(
-      hand, {} /* expected_agari_state */, result.parsed_hand(0)));
+  ASSERT_EQ(0, result.parsed_hand_size());
 }
 
 TEST_F(HandParserTest, ParseTest_Ryanmen) {
@@ -620,7 +696,7 @@ TEST_F(HandParserTest, ParseTest_Ryanmen) {
 
   SCOPED_TRACE(GetDebugString(result));
 
-  ASSERT_EQ(2, result.parsed_hand_size());
+  ASSERT_EQ(1, result.parsed_hand_size());
   ASSERT_NO_FATAL_FAILURE(VerifyParsedHand(
       {CommonTestUtil::CreateAntoitsu(TileType::PINZU_1),
        CommonTestUtil::CreateAnkoutsu(TileType::SANGEN_HAKU),
@@ -629,8 +705,6 @@ TEST_F(HandParserTest, ParseTest_Ryanmen) {
        CommonTestUtil::CreateMinshuntsu(TileType::SOUZU_1, 0)},
       MachiType::RYANMEN, AgariType::RON, AgariFormat::REGULAR_AGARI,
       {} /* expected_agari_state */, result.parsed_hand(0)));
-  ASSERT_NO_FATAL_FAILURE(VerifyParsedHandForIrregularAgariFormat(
-      hand, {} /* expected_agari_state */, result.parsed_hand(1)));
 }
 
 TEST_F(HandParserTest, ParseTest_Penchan_1) {
@@ -656,7 +730,7 @@ TEST_F(HandParserTest, ParseTest_Penchan_1) {
 
   SCOPED_TRACE(GetDebugString(result));
 
-  ASSERT_EQ(2, result.parsed_hand_size());
+  ASSERT_EQ(1, result.parsed_hand_size());
   ASSERT_NO_FATAL_FAILURE(VerifyParsedHand(
       {CommonTestUtil::CreateAntoitsu(TileType::PINZU_1),
        CommonTestUtil::CreateAnkoutsu(TileType::SANGEN_HAKU),
@@ -665,8 +739,6 @@ TEST_F(HandParserTest, ParseTest_Penchan_1) {
        CommonTestUtil::CreateMinshuntsu(TileType::SOUZU_1, 2)},
       MachiType::PENCHAN, AgariType::RON, AgariFormat::REGULAR_AGARI,
       {} /* expected_agari_state */, result.parsed_hand(0)));
-  ASSERT_NO_FATAL_FAILURE(VerifyParsedHandForIrregularAgariFormat(
-      hand, {} /* expected_agari_state */, result.parsed_hand(1)));
 }
 
 TEST_F(HandParserTest, ParseTest_Penchan_2) {
@@ -692,7 +764,7 @@ TEST_F(HandParserTest, ParseTest_Penchan_2) {
 
   SCOPED_TRACE(GetDebugString(result));
 
-  ASSERT_EQ(2, result.parsed_hand_size());
+  ASSERT_EQ(1, result.parsed_hand_size());
   ASSERT_NO_FATAL_FAILURE(VerifyParsedHand(
       {CommonTestUtil::CreateAntoitsu(TileType::PINZU_1),
        CommonTestUtil::CreateAnkoutsu(TileType::SANGEN_HAKU),
@@ -701,8 +773,6 @@ TEST_F(HandParserTest, ParseTest_Penchan_2) {
        CommonTestUtil::CreateMinshuntsu(TileType::SOUZU_7, 0)},
       MachiType::PENCHAN, AgariType::RON, AgariFormat::REGULAR_AGARI,
       {} /* expected_agari_state */, result.parsed_hand(0)));
-  ASSERT_NO_FATAL_FAILURE(VerifyParsedHandForIrregularAgariFormat(
-      hand, {} /* expected_agari_state */, result.parsed_hand(1)));
 }
 
 TEST_F(HandParserTest, ParseTest_Kanchan) {
@@ -728,7 +798,7 @@ TEST_F(HandParserTest, ParseTest_Kanchan) {
 
   SCOPED_TRACE(GetDebugString(result));
 
-  ASSERT_EQ(2, result.parsed_hand_size());
+  ASSERT_EQ(1, result.parsed_hand_size());
   ASSERT_NO_FATAL_FAILURE(VerifyParsedHand(
       {CommonTestUtil::CreateAntoitsu(TileType::PINZU_1),
        CommonTestUtil::CreateAnkoutsu(TileType::SANGEN_HAKU),
@@ -737,8 +807,6 @@ TEST_F(HandParserTest, ParseTest_Kanchan) {
        CommonTestUtil::CreateMinshuntsu(TileType::SOUZU_2, 1)},
       MachiType::KANCHAN, AgariType::RON, AgariFormat::REGULAR_AGARI,
       {} /* expected_agari_state */, result.parsed_hand(0)));
-  ASSERT_NO_FATAL_FAILURE(VerifyParsedHandForIrregularAgariFormat(
-      hand, {} /* expected_agari_state */, result.parsed_hand(1)));
 }
 
 TEST_F(HandParserTest, ParseTest_Shabo) {
@@ -764,7 +832,7 @@ TEST_F(HandParserTest, ParseTest_Shabo) {
 
   SCOPED_TRACE(GetDebugString(result));
 
-  ASSERT_EQ(2, result.parsed_hand_size());
+  ASSERT_EQ(1, result.parsed_hand_size());
   ASSERT_NO_FATAL_FAILURE(VerifyParsedHand(
       {CommonTestUtil::CreateAntoitsu(TileType::PINZU_1),
        CommonTestUtil::CreateAnkoutsu(TileType::SANGEN_HAKU),
@@ -773,8 +841,6 @@ TEST_F(HandParserTest, ParseTest_Shabo) {
        CommonTestUtil::CreateMinkoutsu(TileType::SOUZU_1, true)},
       MachiType::SHABO, AgariType::RON, AgariFormat::REGULAR_AGARI,
       {} /* expected_agari_state */, result.parsed_hand(0)));
-  ASSERT_NO_FATAL_FAILURE(VerifyParsedHandForIrregularAgariFormat(
-      hand, {} /* expected_agari_state */, result.parsed_hand(1)));
 }
 
 TEST_F(HandParserTest, ParseTest_Tanki_1) {
@@ -800,7 +866,7 @@ TEST_F(HandParserTest, ParseTest_Tanki_1) {
 
   SCOPED_TRACE(GetDebugString(result));
 
-  ASSERT_EQ(2, result.parsed_hand_size());
+  ASSERT_EQ(1, result.parsed_hand_size());
   ASSERT_NO_FATAL_FAILURE(VerifyParsedHand(
       {CommonTestUtil::CreateAnkoutsu(TileType::PINZU_1),
        CommonTestUtil::CreateAnkoutsu(TileType::SANGEN_HAKU),
@@ -809,8 +875,6 @@ TEST_F(HandParserTest, ParseTest_Tanki_1) {
        CommonTestUtil::CreateMintoitsu(TileType::SOUZU_1, true)},
       MachiType::TANKI, AgariType::RON, AgariFormat::REGULAR_AGARI,
       {} /* expected_agari_state */, result.parsed_hand(0)));
-  ASSERT_NO_FATAL_FAILURE(VerifyParsedHandForIrregularAgariFormat(
-      hand, {} /* expected_agari_state */, result.parsed_hand(1)));
 }
 
 TEST_F(HandParserTest, ParseTest_Tanki_2_Chitoitsu) {
@@ -836,7 +900,7 @@ TEST_F(HandParserTest, ParseTest_Tanki_2_Chitoitsu) {
 
   SCOPED_TRACE(GetDebugString(result));
 
-  ASSERT_EQ(2, result.parsed_hand_size());
+  ASSERT_EQ(1, result.parsed_hand_size());
   ASSERT_NO_FATAL_FAILURE(VerifyParsedHand(
       {CommonTestUtil::CreateAntoitsu(TileType::PINZU_1),
        CommonTestUtil::CreateAntoitsu(TileType::SANGEN_HAKU),
@@ -847,8 +911,6 @@ TEST_F(HandParserTest, ParseTest_Tanki_2_Chitoitsu) {
        CommonTestUtil::CreateMintoitsu(TileType::SOUZU_1, true)},
       MachiType::TANKI, AgariType::RON, AgariFormat::CHITOITSU_AGARI,
       {} /* expected_agari_state */, result.parsed_hand(0)));
-  ASSERT_NO_FATAL_FAILURE(VerifyParsedHandForIrregularAgariFormat(
-      hand, {} /* expected_agari_state */, result.parsed_hand(1)));
 }
 
 TEST_F(HandParserTest, ParseTest_Kokushimusou) {
@@ -876,7 +938,37 @@ TEST_F(HandParserTest, ParseTest_Kokushimusou) {
 
   ASSERT_EQ(1, result.parsed_hand_size());
   ASSERT_NO_FATAL_FAILURE(VerifyParsedHandForIrregularAgariFormat(
-      hand, {} /* expected_agari_state */, result.parsed_hand(0)));
+      hand, MachiType::JUSANMEN, {} /* expected_agari_state */,
+      result.parsed_hand(0)));
+}
+
+TEST_F(HandParserTest, ParseTest_Kokushimusou_Tanki) {
+  Hand hand;
+  hand.add_closed_tile(TileType::MANZU_1);
+  hand.add_closed_tile(TileType::MANZU_9);
+  hand.add_closed_tile(TileType::SOUZU_1);
+  hand.add_closed_tile(TileType::SOUZU_9);
+  hand.add_closed_tile(TileType::PINZU_1);
+  hand.add_closed_tile(TileType::PINZU_9);
+  hand.add_closed_tile(TileType::WIND_TON);
+  hand.add_closed_tile(TileType::WIND_NAN);
+  hand.add_closed_tile(TileType::WIND_SHA);
+  hand.add_closed_tile(TileType::WIND_PE);
+  hand.add_closed_tile(TileType::SANGEN_HAKU);
+  hand.add_closed_tile(TileType::SANGEN_HAKU);
+  hand.add_closed_tile(TileType::SANGEN_HATSU);
+  hand.set_agari_tile(TileType::SANGEN_CHUN);
+  hand.mutable_agari()->set_type(AgariType::TSUMO);
+
+  HandParserResult result;
+  handParser_.Parse(hand, &result);
+
+  SCOPED_TRACE(GetDebugString(result));
+
+  ASSERT_EQ(1, result.parsed_hand_size());
+  ASSERT_NO_FATAL_FAILURE(VerifyParsedHandForIrregularAgariFormat(
+      hand, MachiType::TANKI, {} /* expected_agari_state */,
+      result.parsed_hand(0)));
 }
 
 TEST_F(HandParserTest, ParseTest_parseTwoHandsWithSingleInstance) {
@@ -904,7 +996,7 @@ TEST_F(HandParserTest, ParseTest_parseTwoHandsWithSingleInstance) {
 
     SCOPED_TRACE(GetDebugString(result));
 
-    ASSERT_EQ(2, result.parsed_hand_size());
+    ASSERT_EQ(1, result.parsed_hand_size());
     ASSERT_NO_FATAL_FAILURE(VerifyParsedHand(
         {CommonTestUtil::CreateAntoitsu(TileType::PINZU_1),
          CommonTestUtil::CreateAntoitsu(TileType::SANGEN_HAKU),
@@ -915,8 +1007,6 @@ TEST_F(HandParserTest, ParseTest_parseTwoHandsWithSingleInstance) {
          CommonTestUtil::CreateMintoitsu(TileType::SOUZU_1, true)},
         MachiType::TANKI, AgariType::RON, AgariFormat::CHITOITSU_AGARI,
         {} /* expected_agari_state */, result.parsed_hand(0)));
-    ASSERT_NO_FATAL_FAILURE(VerifyParsedHandForIrregularAgariFormat(
-        hand, {} /* expected_agari_state */, result.parsed_hand(1)));
   }
 
   {
@@ -945,9 +1035,834 @@ TEST_F(HandParserTest, ParseTest_parseTwoHandsWithSingleInstance) {
 
     ASSERT_EQ(1, result2.parsed_hand_size());
     ASSERT_NO_FATAL_FAILURE(VerifyParsedHandForIrregularAgariFormat(
-        hand2, {} /* expected_agari_state */, result2.parsed_hand(0)));
+        hand2, MachiType::JUSANMEN, {} /* expected_agari_state */,
+        result2.parsed_hand(0)));
   }
 }
 
+TEST_F(HandParserTest, IsAgariTest_Regular) {
+  Hand hand;
+  hand.add_closed_tile(TileType::PINZU_1);
+  hand.add_closed_tile(TileType::PINZU_1);
+  hand.add_closed_tile(TileType::SANGEN_HAKU);
+  hand.add_closed_tile(TileType::SANGEN_HAKU);
+  hand.add_closed_tile(TileType::SANGEN_HAKU);
+  hand.add_closed_tile(TileType::MANZU_2);
+  hand.add_closed_tile(TileType::MANZU_3);
+  hand.add_closed_tile(TileType::MANZU_4);
+  hand.add_closed_tile(TileType::SOUZU_7);
+  hand.add_closed_tile(TileType::SOUZU_8);
+  hand.add_closed_tile(TileType::SOUZU_9);
+  hand.add_closed_tile(TileType::SOUZU_2);
+  hand.add_closed_tile(TileType::SOUZU_3);
+  hand.set_agari_tile(TileType::SOUZU_1);
+  hand.mutable_agari()->set_type(AgariType::RON);
+  EXPECT_TRUE(handParser_.IsAgari(hand));
+
+  hand.set_agari_tile(TileType::SOUZU_4);
+  EXPECT_TRUE(handParser_.IsAgari(hand));
+
+  hand.set_agari_tile(TileType::SOUZU_5);
+  EXPECT_FALSE(handParser_.IsAgari(hand));
+
+  hand.set_agari_tile(TileType::UNKNOWN_TILE);
+  EXPECT_FALSE(handParser_.IsAgari(hand));
+}
+
+TEST_F(HandParserTest, IsAgariTest_Naki) {
+  Hand hand;
+  hand.add_closed_tile(TileType::PINZU_1);
+  hand.add_closed_tile(TileType::PINZU_1);
+  hand.add_closed_tile(TileType::WIND_TON);
+  hand.add_closed_tile(TileType::WIND_TON);
+  hand.set_agari_tile(TileType::WIND_TON);
+  hand.add_ponned_tile()->set_tile(TileType::SANGEN_HAKU);
+  hand.add_ponned_tile()->set_tile(TileType::SANGEN_CHUN);
+  Hand_Chii* chii = hand.add_chiied_tile();
+  chii->add_tile(TileType::SOUZU_1);
+  chii->add_tile(TileType::SOUZU_2);
+  chii->add_tile(TileType::SOUZU_3);
+  EXPECT_TRUE(handParser_.IsAgari(hand));
+
+  hand.set_agari_tile(TileType::PINZU_2);
+  EXPECT_FALSE(handParser_.IsAgari(hand));
+}
+
+TEST_F(HandParserTest, ValidateTest) {
+  Hand hand;
+  hand.add_closed_tile(TileType::PINZU_1);
+  hand.add_closed_tile(TileType::PINZU_1);
+  hand.add_closed_tile(TileType::WIND_TON);
+  hand.add_closed_tile(TileType::WIND_TON);
+  hand.set_agari_tile(TileType::WIND_TON);
+  hand.add_ponned_tile()->set_tile(TileType::SANGEN_HAKU);
+  hand.add_kanned_tile()->set_tile(TileType::PINZU_1);
+  Hand_Chii* chii = hand.add_chiied_tile();
+  chii->add_tile(TileType::SOUZU_3);
+  chii->add_tile(TileType::SOUZU_1);
+  chii->add_tile(TileType::SOUZU_2);
+  hand.mutable_agari()->set_type(AgariType::RON);
+  EXPECT_EQ(HandValidatorResult::ERROR_TOO_MANY_SAME_TILES,
+            handParser_.Validate(hand));
+
+  hand.mutable_kanned_tile(0)->set_tile(TileType::PINZU_9);
+  EXPECT_EQ(HandValidatorResult::OK, handParser_.Validate(hand));
+
+  // Chii of non-consecutive tiles.
+  chii->set_tile(0, TileType::SOUZU_4);
+  EXPECT_EQ(HandValidatorResult::ERROR_INVALID_CHII,
+            handParser_.Validate(hand));
+
+  // Chii across suits.
+  chii->set_tile(0, TileType::SOUZU_9);
+  chii->set_tile(1, TileType::PINZU_1);
+  chii->set_tile(2, TileType::PINZU_2);
+  EXPECT_EQ(HandValidatorResult::ERROR_INVALID_CHII,
+            handParser_.Validate(hand));
+
+  chii->set_tile(0, TileType::SOUZU_1);
+  chii->set_tile(1, TileType::SOUZU_2);
+  chii->set_tile(2, TileType::SOUZU_3);
+  chii->add_tile(TileType::SOUZU_4);
+  EXPECT_EQ(HandValidatorResult::ERROR_INVALID_CHII,
+            handParser_.Validate(hand));
+  chii->mutable_tile()->RemoveLast();
+
+  hand.set_agari_tile(TileType::UNKNOWN_TILE);
+  EXPECT_EQ(HandValidatorResult::ERROR_UNKNOWN_TILE,
+            handParser_.Validate(hand));
+  hand.set_agari_tile(TileType::WIND_TON);
+
+  hand.add_closed_tile(TileType::WIND_NAN);
+  EXPECT_EQ(HandValidatorResult::ERROR_WRONG_NUM_TILES,
+            handParser_.Validate(hand));
+
+  HandParserResult result;
+  handParser_.Parse(hand, &result);
+  EXPECT_EQ(HandValidatorResult::ERROR_WRONG_NUM_TILES,
+            result.validator_result());
+  EXPECT_EQ(0, result.parsed_hand_size());
+  EXPECT_FALSE(handParser_.IsAgari(hand));
+
+  HandParser::Generator generator(handParser_, hand);
+  EXPECT_EQ(HandValidatorResult::ERROR_WRONG_NUM_TILES,
+            generator.GetValidatorResult());
+}
+
+TEST_F(HandParserTest, ParseTest_CompactHand) {
+  // 111222333m 567m 9m with 9m ron, built from tile counts.
+  uint8_t counts[kNumTileIndices] = {};
+  counts[GetTileIndex(TileType::MANZU_1)] = 3;
+  counts[GetTileIndex(TileType::MANZU_2)] = 3;
+  counts[GetTileIndex(TileType::MANZU_3)] = 3;
+  counts[GetTileIndex(TileType::MANZU_5)] = 1;
+  counts[GetTileIndex(TileType::MANZU_6)] = 1;
+  counts[GetTileIndex(TileType::MANZU_7)] = 1;
+  counts[GetTileIndex(TileType::MANZU_9)] = 1;
+
+  CompactHand compact_hand;
+  compact_hand.Clear();
+  ASSERT_TRUE(compact_hand.SetClosedTiles(counts));
+  compact_hand.agari_tile = GetTileIndex(TileType::MANZU_9);
+  compact_hand.agari_type = AgariType::RON;
+  compact_hand.AddAgariState(AgariState::HAITEI);
+  EXPECT_EQ(HandValidatorResult::OK, handParser_.Validate(compact_hand));
+  EXPECT_TRUE(handParser_.IsAgari(compact_hand));
+
+  Hand hand;
+  for (int i = 0; i < compact_hand.num_closed_tiles; ++i) {
+    hand.add_closed_tile(GetTileTypeFromIndex(compact_hand.closed_tile[i]));
+  }
+  hand.set_agari_tile(TileType::MANZU_9);
+  hand.mutable_agari()->set_type(AgariType::RON);
+  hand.mutable_agari()->add_state(AgariState::HAITEI);
+
+  // Both entry points give the same result.
+  HandParserResult expected;
+  handParser_.Parse(hand, &expected);
+  HandParserResult actual;
+  handParser_.Parse(compact_hand, &actual);
+  ASSERT_EQ(2, actual.parsed_hand_size());
+  EXPECT_EQ(expected.SerializeAsString(), actual.SerializeAsString());
+
+  vector<CompactParsedHand> parsed_hands;
+  handParser_.Parse(compact_hand, &parsed_hands);
+  EXPECT_EQ(2, parsed_hands.size());
+
+  // A kind can't have 5 tiles.
+  compact_hand.AddMeld(HandElementType::MINKOUTSU,
+                       GetTileIndex(TileType::MANZU_1));
+  compact_hand.num_closed_tiles -= 3;
+  EXPECT_EQ(HandValidatorResult::ERROR_TOO_MANY_SAME_TILES,
+            handParser_.Validate(compact_hand));
+
+  // Chii must start at a suit tile of 1 to 7.
+  compact_hand.meld[0].type = HandElementType::MINSHUNTSU;
+  compact_hand.meld[0].tile = GetTileIndex(TileType::SOUZU_8);
+  EXPECT_EQ(HandValidatorResult::ERROR_INVALID_CHII,
+            handParser_.Validate(compact_hand));
+}
+
+TEST_F(HandParserTest, IsAgariTest_Chitoitsu) {
+  const TileType tiles[] = {
+      TileType::PINZU_1,     TileType::PINZU_1,      TileType::SANGEN_HAKU,
+      TileType::SANGEN_HAKU, TileType::SANGEN_HATSU, TileType::SANGEN_HATSU,
+      TileType::SANGEN_CHUN, TileType::SANGEN_CHUN,  TileType::WIND_NAN,
+      TileType::WIND_NAN,    TileType::WIND_PE,      TileType::WIND_PE,
+      TileType::SOUZU_1,     TileType::SOUZU_1};
+  EXPECT_TRUE(handParser_.IsAgari(tiles, 14));
+
+  // Four same tiles can't be two toitsu.
+  const TileType not_chitoitsu_tiles[] = {
+      TileType::PINZU_1,     TileType::PINZU_1,      TileType::SANGEN_HAKU,
+      TileType::SANGEN_HAKU, TileType::SANGEN_HATSU, TileType::SANGEN_HATSU,
+      TileType::SANGEN_CHUN, TileType::SANGEN_CHUN,  TileType::WIND_NAN,
+      TileType::WIND_NAN,    TileType::PINZU_1,      TileType::PINZU_1,
+      TileType::SOUZU_1,     TileType::SOUZU_1};
+  EXPECT_FALSE(handParser_.IsAgari(not_chitoitsu_tiles, 14));
+}
+
+TEST_F(HandParserTest, IsAgariTest_Kokushimusou) {
+  TileType tiles[] = {
+      TileType::MANZU_1,     TileType::MANZU_9,      TileType::SOUZU_1,
+      TileType::SOUZU_9,     TileType::PINZU_1,      TileType::PINZU_9,
+      TileType::WIND_TON,    TileType::WIND_NAN,     TileType::WIND_SHA,
+      TileType::WIND_PE,     TileType::SANGEN_HAKU,  TileType::SANGEN_HATSU,
+      TileType::SANGEN_CHUN, TileType::SANGEN_CHUN};
+  EXPECT_TRUE(handParser_.IsAgari(tiles, 14));
+
+  tiles[13] = TileType::PINZU_8;
+  EXPECT_FALSE(handParser_.IsAgari(tiles, 14));
+
+  // Only 13 tiles.
+  EXPECT_FALSE(handParser_.IsAgari(tiles, 13));
+}
+
+TEST_F(HandParserTest, ParseTest_SharedAcrossThreads) {
+  Hand hand;
+  hand.add_closed_tile(TileType::PINZU_1);
+  hand.add_closed_tile(TileType::PINZU_1);
+  hand.add_closed_tile(TileType::PINZU_1);
+  hand.add_closed_tile(TileType::PINZU_1);
+  hand.add_closed_tile(TileType::PINZU_2);
+  hand.add_closed_tile(TileType::PINZU_2);
+  hand.add_closed_tile(TileType::PINZU_2);
+  hand.add_closed_tile(TileType::PINZU_2);
+  hand.add_closed_tile(TileType::PINZU_3);
+  hand.add_closed_tile(TileType::PINZU_3);
+  hand.add_closed_tile(TileType::PINZU_3);
+  hand.add_closed_tile(TileType::PINZU_3);
+  hand.add_closed_tile(TileType::PINZU_4);
+  hand.set_agari_tile(TileType::PINZU_4);
+  hand.mutable_agari()->set_type(AgariType::TSUMO);
+
+  HandParserResult expected;
+  handParser_.Parse(hand, &expected);
+  const string expected_string = GetDebugString(expected);
+
+  const int kNumThreads = 4;
+  const int kNumIterations = 50;
+  const HandParser& shared_parser = handParser_;
+  vector<string> actual_strings(kNumThreads * kNumIterations);
+  vector<thread> threads;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads.push_back(thread([&, i]() {
+      for (int j = 0; j < kNumIterations; ++j) {
+        HandParserResult result;
+        shared_parser.Parse(hand, &result);
+        actual_strings[i * kNumIterations + j] = GetDebugString(result);
+      }
+    }));
+  }
+  for (thread& t : threads) {
+    t.join();
+  }
+
+  for (const string& actual_string : actual_strings) {
+    EXPECT_EQ(expected_string, actual_string);
+  }
+}
+
+TEST_F(HandParserTest, ParseTest_LoadedSuitTable) {
+  const std::unique_ptr<SuitDecompositionTable> suit_table =
+      SuitDecompositionTable::Load("data/suit_decomposition_table.bin");
+  ASSERT_NE(nullptr, suit_table);
+  const HandParser loaded_parser(*suit_table);
+
+  // 111222333m 456p 77s parses into sanankou or 3 shuntsu.
+  Hand hand;
+  for (const TileType tile :
+       {TileType::MANZU_1, TileType::MANZU_1, TileType::MANZU_1,
+        TileType::MANZU_2, TileType::MANZU_2, TileType::MANZU_2,
+        TileType::MANZU_3, TileType::MANZU_3, TileType::MANZU_3,
+        TileType::PINZU_4, TileType::PINZU_5, TileType::SOUZU_7,
+        TileType::SOUZU_7}) {
+    hand.add_closed_tile(tile);
+  }
+  hand.set_agari_tile(TileType::PINZU_6);
+  hand.mutable_agari()->set_type(AgariType::TSUMO);
+
+  HandParserResult expected;
+  handParser_.Parse(hand, &expected);
+  HandParserResult actual;
+  loaded_parser.Parse(hand, &actual);
+  EXPECT_LT(1, actual.parsed_hand_size());
+  EXPECT_EQ(GetDebugString(expected), GetDebugString(actual));
+  EXPECT_TRUE(loaded_parser.IsAgari(hand));
+}
+
+TEST_F(HandParserTest, GetMachiTest_Ryanmen) {
+  Hand hand;
+  hand.add_closed_tile(TileType::MANZU_2);
+  hand.add_closed_tile(TileType::MANZU_3);
+  hand.add_closed_tile(TileType::PINZU_4);
+  hand.add_closed_tile(TileType::PINZU_5);
+  hand.add_closed_tile(TileType::PINZU_6);
+  hand.add_closed_tile(TileType::SOUZU_5);
+  hand.add_closed_tile(TileType::SOUZU_5);
+  hand.add_closed_tile(TileType::WIND_TON);
+  hand.add_closed_tile(TileType::WIND_TON);
+  hand.add_closed_tile(TileType::WIND_TON);
+  Hand_Chii* chii = hand.add_chiied_tile();
+  chii->add_tile(TileType::SOUZU_7);
+  chii->add_tile(TileType::SOUZU_8);
+  chii->add_tile(TileType::SOUZU_9);
+
+  MachiSet machi_set;
+  ASSERT_EQ(HandValidatorResult::OK, handParser_.GetMachi(hand, &machi_set));
+  const int manzu_1 = GetTileIndex(TileType::MANZU_1);
+  const int manzu_4 = GetTileIndex(TileType::MANZU_4);
+  EXPECT_EQ((static_cast<uint64_t>(1) << manzu_1) |
+                (static_cast<uint64_t>(1) << manzu_4),
+            machi_set.tiles);
+  EXPECT_TRUE(machi_set.HasMachiType(manzu_1, MachiType::RYANMEN));
+  EXPECT_FALSE(machi_set.HasMachiType(manzu_1, MachiType::PENCHAN));
+  EXPECT_TRUE(machi_set.HasMachiType(manzu_4, MachiType::RYANMEN));
+}
+
+TEST_F(HandParserTest, GetMachiTest_RyanmenOn3And7) {
+  // 45m waits for 3m and 6m, and 56m waits for 4m and 7m. Neither 3m nor 7m
+  // is penchan.
+  const TileType waits[][2] = {{TileType::MANZU_4, TileType::MANZU_5},
+                               {TileType::MANZU_5, TileType::MANZU_6}};
+  for (const auto& wait : waits) {
+    Hand hand;
+    hand.add_closed_tile(wait[0]);
+    hand.add_closed_tile(wait[1]);
+    hand.add_closed_tile(TileType::PINZU_4);
+    hand.add_closed_tile(TileType::PINZU_5);
+    hand.add_closed_tile(TileType::PINZU_6);
+    hand.add_closed_tile(TileType::SOUZU_2);
+    hand.add_closed_tile(TileType::SOUZU_2);
+    hand.add_closed_tile(TileType::WIND_TON);
+    hand.add_closed_tile(TileType::WIND_TON);
+    hand.add_closed_tile(TileType::WIND_TON);
+    Hand_Chii* chii = hand.add_chiied_tile();
+    chii->add_tile(TileType::SOUZU_7);
+    chii->add_tile(TileType::SOUZU_8);
+    chii->add_tile(TileType::SOUZU_9);
+
+    MachiSet machi_set;
+    ASSERT_EQ(HandValidatorResult::OK,
+              handParser_.GetMachi(hand, &machi_set));
+    const int lower = GetTileIndex(wait[0]) - 1;
+    const int upper = GetTileIndex(wait[1]) + 1;
+    EXPECT_EQ((static_cast<uint64_t>(1) << lower) |
+                  (static_cast<uint64_t>(1) << upper),
+              machi_set.tiles);
+    for (const int index : {lower, upper}) {
+      EXPECT_TRUE(machi_set.HasMachiType(index, MachiType::RYANMEN));
+      EXPECT_FALSE(machi_set.HasMachiType(index, MachiType::PENCHAN));
+    }
+  }
+}
+
+TEST_F(HandParserTest, GetMachiTest_Penchan) {
+  // 12m waits only for 3m, and 89m waits only for 7m.
+  const TileType waits[][2] = {{TileType::MANZU_1, TileType::MANZU_2},
+                               {TileType::MANZU_8, TileType::MANZU_9}};
+  const TileType machi[] = {TileType::MANZU_3, TileType::MANZU_7};
+  for (int i = 0; i < 2; ++i) {
+    Hand hand;
+    hand.add_closed_tile(waits[i][0]);
+    hand.add_closed_tile(waits[i][1]);
+    hand.add_closed_tile(TileType::PINZU_4);
+    hand.add_closed_tile(TileType::PINZU_5);
+    hand.add_closed_tile(TileType::PINZU_6);
+    hand.add_closed_tile(TileType::SOUZU_2);
+    hand.add_closed_tile(TileType::SOUZU_2);
+    hand.add_closed_tile(TileType::WIND_TON);
+    hand.add_closed_tile(TileType::WIND_TON);
+    hand.add_closed_tile(TileType::WIND_TON);
+    Hand_Chii* chii = hand.add_chiied_tile();
+    chii->add_tile(TileType::SOUZU_7);
+    chii->add_tile(TileType::SOUZU_8);
+    chii->add_tile(TileType::SOUZU_9);
+
+    MachiSet machi_set;
+    ASSERT_EQ(HandValidatorResult::OK,
+              handParser_.GetMachi(hand, &machi_set));
+    const int index = GetTileIndex(machi[i]);
+    EXPECT_EQ(static_cast<uint64_t>(1) << index, machi_set.tiles);
+    EXPECT_TRUE(machi_set.HasMachiType(index, MachiType::PENCHAN));
+    EXPECT_FALSE(machi_set.HasMachiType(index, MachiType::RYANMEN));
+  }
+}
+
+TEST_F(HandParserTest, GetMachiTest_Shabo) {
+  Hand hand;
+  hand.add_closed_tile(TileType::PINZU_1);
+  hand.add_closed_tile(TileType::PINZU_2);
+  hand.add_closed_tile(TileType::PINZU_3);
+  hand.add_closed_tile(TileType::SANGEN_HAKU);
+  hand.add_closed_tile(TileType::SANGEN_HAKU);
+  hand.add_closed_tile(TileType::SANGEN_CHUN);
+  hand.add_closed_tile(TileType::SANGEN_CHUN);
+  hand.add_ponned_tile()->set_tile(TileType::WIND_PE);
+  hand.add_ponned_tile()->set_tile(TileType::WIND_SHA);
+
+  MachiSet machi_set;
+  ASSERT_EQ(HandValidatorResult::OK, handParser_.GetMachi(hand, &machi_set));
+  const int haku = GetTileIndex(TileType::SANGEN_HAKU);
+  const int chun = GetTileIndex(TileType::SANGEN_CHUN);
+  EXPECT_EQ((static_cast<uint64_t>(1) << haku) |
+                (static_cast<uint64_t>(1) << chun),
+            machi_set.tiles);
+  EXPECT_TRUE(machi_set.HasMachiType(haku, MachiType::SHABO));
+  EXPECT_FALSE(machi_set.HasMachiType(haku, MachiType::TANKI));
+}
+
+TEST_F(HandParserTest, GetMachiTest_Tanki) {
+  Hand hand;
+  hand.add_closed_tile(TileType::PINZU_1);
+  hand.add_closed_tile(TileType::PINZU_1);
+  hand.add_closed_tile(TileType::PINZU_1);
+  hand.add_closed_tile(TileType::PINZU_2);
+  hand.add_ponned_tile()->set_tile(TileType::WIND_PE);
+  hand.add_ponned_tile()->set_tile(TileType::WIND_SHA);
+  hand.add_ponned_tile()->set_tile(TileType::WIND_NAN);
+
+  // 1112p waits for 2p as tanki, and 3p completing 12p of 11p + 12p.
+  MachiSet machi_set;
+  ASSERT_EQ(HandValidatorResult::OK, handParser_.GetMachi(hand, &machi_set));
+  const int pinzu_2 = GetTileIndex(TileType::PINZU_2);
+  const int pinzu_3 = GetTileIndex(TileType::PINZU_3);
+  EXPECT_EQ((static_cast<uint64_t>(1) << pinzu_2) |
+                (static_cast<uint64_t>(1) << pinzu_3),
+            machi_set.tiles);
+  EXPECT_TRUE(machi_set.HasMachiType(pinzu_2, MachiType::TANKI));
+  EXPECT_TRUE(machi_set.HasMachiType(pinzu_3, MachiType::PENCHAN));
+}
+
+TEST_F(HandParserTest, GetMachiTest_Kokushimusou) {
+  CompactHand hand;
+  hand.Clear();
+  for (const TileType tile :
+       {TileType::MANZU_1, TileType::MANZU_9, TileType::SOUZU_1,
+        TileType::SOUZU_9, TileType::PINZU_1, TileType::PINZU_9,
+        TileType::WIND_TON, TileType::WIND_NAN, TileType::WIND_SHA,
+        TileType::WIND_PE, TileType::SANGEN_HAKU, TileType::SANGEN_HATSU,
+        TileType::SANGEN_CHUN}) {
+    hand.AddClosedTile(GetTileIndex(tile));
+  }
+
+  MachiSet machi_set;
+  ASSERT_EQ(HandValidatorResult::OK, handParser_.GetMachi(hand, &machi_set));
+  for (int index = 0; index < kNumTileIndices; ++index) {
+    EXPECT_EQ(IsYaochuhai(GetTileTypeFromIndex(index)),
+              machi_set.HasMachiType(index, MachiType::JUSANMEN));
+  }
+
+  hand.closed_tile[12] = GetTileIndex(TileType::SANGEN_HATSU);
+  ASSERT_EQ(HandValidatorResult::OK, handParser_.GetMachi(hand, &machi_set));
+  EXPECT_EQ(static_cast<uint64_t>(1) << GetTileIndex(TileType::SANGEN_CHUN),
+            machi_set.tiles);
+}
+
+TEST_F(HandParserTest, GetMachiTest_Exhausted) {
+  Hand hand;
+  hand.add_closed_tile(TileType::MANZU_4);
+  hand.add_closed_tile(TileType::MANZU_6);
+  hand.add_closed_tile(TileType::PINZU_1);
+  hand.add_closed_tile(TileType::PINZU_2);
+  hand.add_closed_tile(TileType::PINZU_3);
+  hand.add_closed_tile(TileType::SOUZU_7);
+  hand.add_closed_tile(TileType::SOUZU_8);
+  hand.add_closed_tile(TileType::SOUZU_9);
+  hand.add_closed_tile(TileType::WIND_TON);
+  hand.add_closed_tile(TileType::WIND_TON);
+  hand.add_kanned_tile()->set_tile(TileType::MANZU_5);
+
+  // The hand holds all 4 of 5m, which is the only wait.
+  MachiSet machi_set;
+  ASSERT_EQ(HandValidatorResult::OK, handParser_.GetMachi(hand, &machi_set));
+  EXPECT_EQ(0, machi_set.tiles);
+
+  hand.add_closed_tile(TileType::WIND_TON);
+  EXPECT_EQ(HandValidatorResult::ERROR_WRONG_NUM_TILES,
+            handParser_.GetMachi(hand, &machi_set));
+}
+
+TEST_F(HandParserTest, GetMachiTest_SameAsParse) {
+  const vector<vector<TileType>> hands = {
+      // Chuuren-poutou waits for all manzu.
+      {TileType::MANZU_1, TileType::MANZU_1, TileType::MANZU_1,
+       TileType::MANZU_2, TileType::MANZU_3, TileType::MANZU_4,
+       TileType::MANZU_5, TileType::MANZU_6, TileType::MANZU_7,
+       TileType::MANZU_8, TileType::MANZU_9, TileType::MANZU_9,
+       TileType::MANZU_9},
+      // Chiitoitsu and ryanpeikou.
+      {TileType::PINZU_1, TileType::PINZU_1, TileType::PINZU_2,
+       TileType::PINZU_2, TileType::PINZU_3, TileType::PINZU_3,
+       TileType::SOUZU_4, TileType::SOUZU_4, TileType::SOUZU_5,
+       TileType::SOUZU_5, TileType::SOUZU_6, TileType::WIND_PE,
+       TileType::WIND_PE},
+      {TileType::SOUZU_2, TileType::SOUZU_3, TileType::SOUZU_4,
+       TileType::SOUZU_4, TileType::SOUZU_4, TileType::SOUZU_5,
+       TileType::SOUZU_6, TileType::SOUZU_6, TileType::SOUZU_6,
+       TileType::SOUZU_7, TileType::SOUZU_8, TileType::PINZU_3,
+       TileType::PINZU_3},
+  };
+
+  for (const vector<TileType>& tiles : hands) {
+    Hand hand;
+    for (const TileType tile : tiles) {
+      hand.add_closed_tile(tile);
+    }
+    hand.mutable_agari()->set_type(AgariType::RON);
+
+    MachiSet machi_set;
+    ASSERT_EQ(HandValidatorResult::OK,
+              handParser_.GetMachi(hand, &machi_set));
+
+    // Compare with parsing the hand with each tile.
+    for (int index = 0; index < kNumTileIndices; ++index) {
+      hand.set_agari_tile(GetTileTypeFromIndex(index));
+      vector<CompactParsedHand> parsed_hands;
+      handParser_.Parse(hand, &parsed_hands);
+      SCOPED_TRACE(index);
+      EXPECT_EQ(!parsed_hands.empty(), machi_set.Contains(index));
+
+      uint8_t machi_kinds = 0;
+      for (const CompactParsedHand& parsed_hand : parsed_hands) {
+        machi_kinds |= 1 << (parsed_hand.machi_type &
+                             MachiType::MASK_MACHI_KIND);
+      }
+      EXPECT_EQ(machi_kinds, machi_set.machi_kinds[index]);
+    }
+  }
+}
+
+TEST_F(HandParserTest, GeneratorTest) {
+  Hand hand;
+  hand.add_closed_tile(TileType::MANZU_1);
+  hand.add_closed_tile(TileType::MANZU_1);
+  hand.add_closed_tile(TileType::MANZU_1);
+  hand.add_closed_tile(TileType::MANZU_2);
+  hand.add_closed_tile(TileType::MANZU_2);
+  hand.add_closed_tile(TileType::MANZU_2);
+  hand.add_closed_tile(TileType::MANZU_3);
+  hand.add_closed_tile(TileType::MANZU_3);
+  hand.add_closed_tile(TileType::MANZU_3);
+  hand.add_closed_tile(TileType::MANZU_5);
+  hand.add_closed_tile(TileType::MANZU_6);
+  hand.add_closed_tile(TileType::MANZU_7);
+  hand.add_closed_tile(TileType::MANZU_9);
+  hand.set_agari_tile(TileType::MANZU_9);
+  hand.mutable_agari()->set_type(AgariType::RON);
+
+  vector<CompactParsedHand> parsed_hands;
+  handParser_.Parse(hand, &parsed_hands);
+  ASSERT_EQ(2, parsed_hands.size());
+
+  // The generator yields the same parsed hands in the same order.
+  {
+    HandParser::Generator generator(handParser_, hand);
+    CompactParsedHand parsed_hand;
+    for (const CompactParsedHand& expected : parsed_hands) {
+      ASSERT_TRUE(generator.Next(&parsed_hand));
+      EXPECT_EQ(expected.signature, parsed_hand.signature);
+    }
+    EXPECT_FALSE(generator.Next(&parsed_hand));
+    EXPECT_FALSE(generator.Next(&parsed_hand));
+  }
+
+  // Consumers can stop at any point.
+  {
+    HandParser::Generator generator(handParser_, hand);
+    CompactParsedHand parsed_hand;
+    ASSERT_TRUE(generator.Next(&parsed_hand));
+    EXPECT_EQ(AgariFormat::REGULAR_AGARI, parsed_hand.agari_format);
+  }
+}
+
+TEST_F(HandParserTest, StatsTest) {
+  // 11223m 456p 789s 東東 + 3m. Both 123m contain the agari tile, so the
+  // second one makes a duplicate.
+  CompactHand hand;
+  hand.Clear();
+  for (const TileType tile :
+       {TileType::MANZU_1, TileType::MANZU_1, TileType::MANZU_2,
+        TileType::MANZU_2, TileType::MANZU_3, TileType::PINZU_4,
+        TileType::PINZU_5, TileType::PINZU_6, TileType::SOUZU_7,
+        TileType::SOUZU_8, TileType::SOUZU_9, TileType::WIND_TON,
+        TileType::WIND_TON}) {
+    hand.AddClosedTile(GetTileIndex(tile));
+  }
+  hand.agari_tile = GetTileIndex(TileType::MANZU_3);
+  hand.agari_type = AgariType::TSUMO;
+
+  HandParserStats stats;
+  vector<CompactParsedHand> parsed_hands;
+  handParser_.Parse(hand, &parsed_hands, &stats);
+  ASSERT_EQ(1, parsed_hands.size());
+  EXPECT_EQ(1u, stats.num_hands);
+  EXPECT_EQ(3u, stats.num_suit_lookups);
+  EXPECT_EQ(1u, stats.num_decompositions);
+  EXPECT_EQ(1u, stats.num_parsed_hands);
+  EXPECT_EQ(1u, stats.num_duplicates);
+  EXPECT_LT(0u, stats.setup_nanos);
+
+  // Counters of another call are added, and the generator counts the same.
+  HandParserStats generator_stats;
+  {
+    HandParser::Generator generator(handParser_, hand, &generator_stats);
+    CompactParsedHand parsed_hand;
+    while (generator.Next(&parsed_hand)) {
+    }
+  }
+  EXPECT_EQ(stats.num_parsed_hands, generator_stats.num_parsed_hands);
+  EXPECT_EQ(stats.num_duplicates, generator_stats.num_duplicates);
+  stats.Add(generator_stats);
+  EXPECT_EQ(2u, stats.num_hands);
+  EXPECT_EQ(2u, stats.num_duplicates);
+
+  // Chiitoitsu and kokushi are decompositions of their own.
+  stats.Clear();
+  hand.Clear();
+  for (const TileType tile :
+       {TileType::WIND_TON, TileType::WIND_NAN, TileType::WIND_SHA,
+        TileType::WIND_PE, TileType::SANGEN_HAKU, TileType::SANGEN_HATSU,
+        TileType::SANGEN_CHUN, TileType::MANZU_1, TileType::MANZU_9,
+        TileType::SOUZU_1, TileType::SOUZU_9, TileType::PINZU_1,
+        TileType::PINZU_9}) {
+    hand.AddClosedTile(GetTileIndex(tile));
+  }
+  hand.agari_tile = GetTileIndex(TileType::PINZU_9);
+  hand.agari_type = AgariType::RON;
+  parsed_hands.clear();
+  handParser_.Parse(hand, &parsed_hands, &stats);
+  ASSERT_EQ(1, parsed_hands.size());
+  EXPECT_EQ(1u, stats.num_decompositions);
+  EXPECT_EQ(1u, stats.num_parsed_hands);
+  EXPECT_EQ(0u, stats.num_duplicates);
+}
+
+TEST_F(HandParserTest, ParseBatchTest) {
+  // 111222333m 456p 77s + 6p parses in several ways, 123m 789m 123s 東東東
+  // waits on a single tile, and a hand with 5 東 is invalid.
+  vector<CompactHand> hands(3);
+  for (CompactHand& hand : hands) {
+    hand.Clear();
+  }
+  for (const TileType tile :
+       {TileType::MANZU_1, TileType::MANZU_1, TileType::MANZU_1,
+        TileType::MANZU_2, TileType::MANZU_2, TileType::MANZU_2,
+        TileType::MANZU_3, TileType::MANZU_3, TileType::MANZU_3,
+        TileType::PINZU_4, TileType::PINZU_5, TileType::SOUZU_7,
+        TileType::SOUZU_7}) {
+    hands[0].AddClosedTile(GetTileIndex(tile));
+  }
+  hands[0].agari_tile = GetTileIndex(TileType::PINZU_6);
+  hands[0].agari_type = AgariType::TSUMO;
+  for (const TileType tile :
+       {TileType::MANZU_1, TileType::MANZU_2, TileType::MANZU_3,
+        TileType::MANZU_7, TileType::MANZU_8, TileType::MANZU_9,
+        TileType::SOUZU_1, TileType::SOUZU_2, TileType::SOUZU_3,
+        TileType::WIND_TON, TileType::WIND_TON, TileType::WIND_TON,
+        TileType::PINZU_1}) {
+    hands[1].AddClosedTile(GetTileIndex(tile));
+  }
+  hands[1].agari_tile = GetTileIndex(TileType::PINZU_1);
+  hands[1].agari_type = AgariType::RON;
+  hands[2] = hands[1];
+  hands[2].closed_tile[12] = GetTileIndex(TileType::WIND_TON);
+  hands[2].agari_tile = GetTileIndex(TileType::WIND_TON);
+
+  HandParserBatchResult result;
+  handParser_.ParseBatch(hands.data(), hands.size(), &result);
+  ASSERT_EQ(3, result.num_hands());
+  for (int i = 0; i < result.num_hands(); ++i) {
+    SCOPED_TRACE(i);
+    vector<CompactParsedHand> expected;
+    handParser_.Parse(hands[i], &expected);
+    EXPECT_EQ(handParser_.Validate(hands[i]), result.validator_result(i));
+    ASSERT_EQ(static_cast<int>(expected.size()), result.num_parsed_hands(i));
+    for (int j = 0; j < result.num_parsed_hands(i); ++j) {
+      const CompactParsedHand& actual = result.begin(i)[j];
+      EXPECT_EQ(expected[j].signature, actual.signature);
+      EXPECT_EQ(expected[j].machi_type, actual.machi_type);
+      EXPECT_EQ(nullptr, actual.open_melds);
+    }
+  }
+  EXPECT_LT(1, result.num_parsed_hands(0));
+  EXPECT_EQ(1, result.num_parsed_hands(1));
+  EXPECT_NE(HandValidatorResult::OK, result.validator_result(2));
+  EXPECT_EQ(result.end(1), result.begin(2));
+
+  // Slices parsed separately and appended match the whole batch.
+  HandParserBatchResult first;
+  HandParserBatchResult second;
+  handParser_.ParseBatch(hands.data(), 1, &first);
+  handParser_.ParseBatch(hands.data() + 1, 2, &second);
+  first.Append(second);
+  ASSERT_EQ(result.num_hands(), first.num_hands());
+  for (int i = 0; i < result.num_hands(); ++i) {
+    EXPECT_EQ(result.num_parsed_hands(i), first.num_parsed_hands(i));
+    EXPECT_EQ(result.validator_result(i), first.validator_result(i));
+  }
+
+  // Parsing the batch again after clearing reuses the storage.
+  const CompactParsedHand* storage = result.begin(0);
+  result.Clear();
+  EXPECT_EQ(0, result.num_hands());
+  handParser_.ParseBatch(hands.data(), hands.size(), &result);
+  EXPECT_EQ(storage, result.begin(0));
+  EXPECT_EQ(first.num_parsed_hands(0), result.num_parsed_hands(0));
+}
+
+TEST_F(HandParserTest, WaitParserTest) {
+  // Chuuren-poutou waiting for every manzu, chiitoitsu and kokushi-musou
+  // waits, shabo waits with a pon, and a hand holding all 4 of 9m.
+  const vector<vector<TileType>> closed_tiles = {
+      {TileType::MANZU_1, TileType::MANZU_1, TileType::MANZU_1,
+       TileType::MANZU_2, TileType::MANZU_3, TileType::MANZU_4,
+       TileType::MANZU_5, TileType::MANZU_6, TileType::MANZU_7,
+       TileType::MANZU_8, TileType::MANZU_9, TileType::MANZU_9,
+       TileType::MANZU_9},
+      {TileType::MANZU_1, TileType::MANZU_1, TileType::MANZU_2,
+       TileType::MANZU_2, TileType::MANZU_3, TileType::MANZU_3,
+       TileType::SOUZU_4, TileType::SOUZU_4, TileType::SOUZU_5,
+       TileType::SOUZU_5, TileType::SOUZU_6, TileType::SOUZU_6,
+       TileType::WIND_PE},
+      {TileType::WIND_TON, TileType::WIND_NAN, TileType::WIND_SHA,
+       TileType::WIND_PE, TileType::SANGEN_HAKU, TileType::SANGEN_HATSU,
+       TileType::SANGEN_CHUN, TileType::MANZU_1, TileType::MANZU_9,
+       TileType::SOUZU_1, TileType::SOUZU_9, TileType::PINZU_1,
+       TileType::PINZU_9},
+      {TileType::PINZU_2, TileType::PINZU_3, TileType::PINZU_4,
+       TileType::PINZU_5, TileType::PINZU_6, TileType::PINZU_7,
+       TileType::PINZU_6, TileType::PINZU_6, TileType::SANGEN_HAKU,
+       TileType::SANGEN_HAKU},
+      {TileType::MANZU_6, TileType::MANZU_7, TileType::MANZU_8,
+       TileType::MANZU_9, TileType::MANZU_9, TileType::MANZU_9,
+       TileType::MANZU_9, TileType::PINZU_1, TileType::PINZU_2,
+       TileType::PINZU_3, TileType::SOUZU_5, TileType::SOUZU_5,
+       TileType::SOUZU_5}};
+  for (const vector<TileType>& tiles : closed_tiles) {
+    CompactHand hand;
+    hand.Clear();
+    for (const TileType tile : tiles) {
+      hand.AddClosedTile(GetTileIndex(tile));
+    }
+    if (hand.num_closed_tiles == 10) {
+      hand.AddMeld(HandElementType::MINKOUTSU,
+                   GetTileIndex(TileType::WIND_TON));
+    }
+    SCOPED_TRACE(hand.num_closed_tiles);
+
+    MachiSet machi_set;
+    ASSERT_EQ(HandValidatorResult::OK, handParser_.GetMachi(hand, &machi_set));
+    ASSERT_NE(0u, machi_set.tiles);
+    HandParser::WaitParser wait_parser(handParser_, hand);
+    ASSERT_EQ(HandValidatorResult::OK, wait_parser.GetValidatorResult());
+    for (int index = 0; index < kNumTileIndices; ++index) {
+      SCOPED_TRACE(index);
+      for (const AgariType agari_type : {AgariType::RON, AgariType::TSUMO}) {
+        ASSERT_EQ(machi_set.Contains(index),
+                  wait_parser.Start(index, agari_type));
+        hand.agari_tile = index;
+        hand.agari_type = agari_type;
+        HandParser::Generator generator(handParser_, hand);
+        CompactParsedHand expected;
+        CompactParsedHand actual;
+        while (generator.Next(&expected)) {
+          ASSERT_TRUE(wait_parser.Next(&actual));
+          EXPECT_EQ(expected.signature, actual.signature);
+          EXPECT_EQ(expected.machi_type, actual.machi_type);
+          EXPECT_EQ(expected.agari_type, actual.agari_type);
+          EXPECT_EQ(expected.num_tiles(), actual.num_tiles());
+        }
+        EXPECT_FALSE(wait_parser.Next(&actual));
+        EXPECT_EQ(generator.IsRyanpeikouChiiToitsu(),
+                  wait_parser.IsRyanpeikouChiiToitsu());
+      }
+    }
+  }
+
+  // A hand of 16 tiles isn't waiting for a tile.
+  CompactHand hand;
+  hand.Clear();
+  for (int i = 0; i < 13; ++i) {
+    hand.AddClosedTile(GetTileIndex(TileType::MANZU_1) + i % 9);
+  }
+  hand.AddMeld(HandElementType::MINKOUTSU, GetTileIndex(TileType::WIND_TON));
+  HandParser::WaitParser wait_parser(handParser_, hand);
+  EXPECT_EQ(HandValidatorResult::ERROR_WRONG_NUM_TILES,
+            wait_parser.GetValidatorResult());
+  EXPECT_FALSE(wait_parser.Start(GetTileIndex(TileType::MANZU_1),
+                                 AgariType::RON));
+  CompactParsedHand parsed_hand;
+  EXPECT_FALSE(wait_parser.Next(&parsed_hand));
+}
+
+TEST_F(HandParserTest, GeneratorTest_RyanpeikouChiiToitsu) {
+  Hand hand;
+  hand.add_closed_tile(TileType::MANZU_1);
+  hand.add_closed_tile(TileType::MANZU_1);
+  hand.add_closed_tile(TileType::MANZU_2);
+  hand.add_closed_tile(TileType::MANZU_2);
+  hand.add_closed_tile(TileType::MANZU_3);
+  hand.add_closed_tile(TileType::MANZU_3);
+  hand.add_closed_tile(TileType::SOUZU_4);
+  hand.add_closed_tile(TileType::SOUZU_4);
+  hand.add_closed_tile(TileType::SOUZU_5);
+  hand.add_closed_tile(TileType::SOUZU_5);
+  hand.add_closed_tile(TileType::SOUZU_6);
+  hand.add_closed_tile(TileType::SOUZU_6);
+  hand.add_closed_tile(TileType::WIND_PE);
+  hand.set_agari_tile(TileType::WIND_PE);
+  hand.mutable_agari()->set_type(AgariType::RON);
+
+  HandParser::Generator generator(handParser_, hand);
+  EXPECT_TRUE(generator.IsRyanpeikouChiiToitsu());
+
+  CompactParsedHand parsed_hand;
+  ASSERT_TRUE(generator.Next(&parsed_hand));
+  EXPECT_EQ(AgariFormat::REGULAR_AGARI, parsed_hand.agari_format);
+  ASSERT_TRUE(generator.Next(&parsed_hand));
+  EXPECT_EQ(AgariFormat::CHITOITSU_AGARI, parsed_hand.agari_format);
+  EXPECT_FALSE(generator.Next(&parsed_hand));
+
+  // Four of a kind isn't two toitsu, so this is only a regular hand.
+  hand.set_closed_tile(12, TileType::MANZU_1);
+  hand.set_agari_tile(TileType::MANZU_1);
+  HandParser::Generator generator2(handParser_, hand);
+  EXPECT_FALSE(generator2.IsRyanpeikouChiiToitsu());
+  ASSERT_TRUE(generator2.Next(&parsed_hand));
+  EXPECT_EQ(AgariFormat::REGULAR_AGARI, parsed_hand.agari_format);
+}
+
+TEST_F(HandParserTest, GeneratorTest_NotAgari) {
+  Hand hand;
+  hand.add_closed_tile(TileType::MANZU_1);
+  hand.set_agari_tile(TileType::MANZU_2);
+  hand.mutable_agari()->set_type(AgariType::TSUMO);
+
+  HandParser::Generator generator(handParser_, hand);
+  CompactParsedHand parsed_hand;
+  EXPECT_FALSE(generator.Next(&parsed_hand));
+}
+
 }  // namespace mahjong
 }  // namespace ycraft
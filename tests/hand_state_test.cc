@@ -0,0 +1,318 @@
+// Copyright 2016 Yuki Hamada
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "src/hand_parser.h"
+#include "src/hand_state.h"
+#include "src/mahjong_common_util.h"
+#include "src/shanten_calculator.h"
+
+using std::vector;
+
+namespace ycraft {
+namespace mahjong {
+
+class HandStateTest : public testing::Test {
+ protected:
+  HandStateTest() : handState_(handParser_) {}
+
+  bool Reset(const vector<TileType>& closed_tiles) {
+    Hand hand;
+    for (const TileType tile : closed_tiles) {
+      hand.add_closed_tile(tile);
+    }
+    hand.set_richi_type(RichiType::NO_RICHI);
+    return handState_.Reset(hand);
+  }
+
+  // Checks the state against ShantenCalculator and HandParser run on the
+  // exported hand, which has an agari tile whenever it has 14 tiles.
+  void ExpectConsistent() {
+    Hand hand;
+    handState_.ToHand(&hand);
+    EXPECT_EQ(handState_.NeedsDiscard(),
+              hand.agari_tile() != TileType::UNKNOWN_TILE);
+    ShantenResult result;
+    ASSERT_EQ(HandValidatorResult::OK,
+              shantenCalculator_.Calculate(hand, &result));
+    EXPECT_EQ(result.shanten, handState_.shanten().shanten);
+    UkeireResult ukeire;
+    ASSERT_EQ(HandValidatorResult::OK,
+              shantenCalculator_.CalculateUkeire(hand, nullptr, &ukeire));
+
+    vector<TileType> tiles;
+    for (const int tile : hand.closed_tile()) {
+      tiles.push_back(static_cast<TileType>(tile));
+    }
+    if (hand.agari_tile() != TileType::UNKNOWN_TILE) {
+      tiles.push_back(hand.agari_tile());
+    }
+    ShantenResult expected;
+    ASSERT_TRUE(
+        shantenCalculator_.Calculate(tiles.data(), tiles.size(), &expected));
+    EXPECT_EQ(expected.shanten, handState_.shanten().shanten);
+    EXPECT_EQ(expected.regular_shanten, handState_.shanten().regular_shanten);
+    EXPECT_EQ(expected.chiitoitsu_shanten,
+              handState_.shanten().chiitoitsu_shanten);
+    EXPECT_EQ(expected.kokushi_shanten, handState_.shanten().kokushi_shanten);
+
+    if (handState_.NeedsDiscard()) {
+      EXPECT_EQ(handParser_.IsAgari(tiles.data(), tiles.size()),
+                handState_.IsAgari());
+      EXPECT_EQ(0u, handState_.machi().tiles);
+    } else {
+      MachiSet machi;
+      ASSERT_EQ(HandValidatorResult::OK, handParser_.GetMachi(hand, &machi));
+      EXPECT_EQ(machi.tiles, handState_.machi().tiles);
+      EXPECT_EQ(machi.tiles != 0, handState_.IsTenpai());
+    }
+  }
+
+  HandParser handParser_;
+  ShantenCalculator shantenCalculator_;
+  HandState handState_;
+};
+
+TEST_F(HandStateTest, DrawAndDiscardTest) {
+  // 123m 456p 789s 11z 55z, missing 2 tiles of a mentsu.
+  ASSERT_TRUE(Reset({TileType::MANZU_1, TileType::MANZU_2, TileType::MANZU_3,
+                     TileType::PINZU_4, TileType::PINZU_5, TileType::PINZU_6,
+                     TileType::SOUZU_7, TileType::SOUZU_8, TileType::SOUZU_9,
+                     TileType::WIND_TON, TileType::WIND_TON,
+                     TileType::SANGEN_HAKU, TileType::SANGEN_CHUN}));
+  EXPECT_FALSE(handState_.NeedsDiscard());
+  EXPECT_EQ(1, handState_.shanten().shanten);
+  EXPECT_FALSE(handState_.IsTenpai());
+  ExpectConsistent();
+
+  // A hand of 13 tiles can't discard.
+  EXPECT_FALSE(handState_.Discard(TileType::MANZU_1));
+
+  ASSERT_TRUE(handState_.Draw(TileType::SANGEN_HAKU));
+  EXPECT_TRUE(handState_.NeedsDiscard());
+  EXPECT_FALSE(handState_.Draw(TileType::MANZU_1));
+  EXPECT_FALSE(handState_.Discard(TileType::MANZU_9));
+  ExpectConsistent();
+
+  // Shanpon of ton and haku.
+  ASSERT_TRUE(handState_.Discard(TileType::SANGEN_CHUN));
+  EXPECT_EQ(0, handState_.shanten().shanten);
+  EXPECT_TRUE(handState_.IsTenpai());
+  EXPECT_TRUE(handState_.machi().Contains(GetTileIndex(TileType::WIND_TON)));
+  EXPECT_TRUE(
+      handState_.machi().HasMachiType(GetTileIndex(TileType::SANGEN_HAKU),
+                                      MachiType::SHABO));
+  ExpectConsistent();
+
+  ASSERT_TRUE(handState_.Draw(TileType::WIND_TON));
+  EXPECT_TRUE(handState_.IsAgari());
+  EXPECT_FALSE(handState_.IsTenpai());
+  ExpectConsistent();
+
+  Player player;
+  handState_.ToPlayer(TileType::WIND_NAN, &player);
+  EXPECT_EQ(TileType::WIND_NAN, player.wind());
+  EXPECT_EQ(13, player.hand().closed_tile_size());
+  EXPECT_EQ(TileType::WIND_TON, player.hand().agari_tile());
+  EXPECT_EQ(AgariType::TSUMO, player.hand().agari().type());
+  EXPECT_EQ(RichiType::NO_RICHI, player.hand().richi_type());
+  EXPECT_TRUE(handParser_.IsAgari(player.hand()));
+}
+
+TEST_F(HandStateTest, CallTest) {
+  // 23m 567m 55p 77p 99s 11z.
+  ASSERT_TRUE(Reset({TileType::MANZU_2, TileType::MANZU_3, TileType::MANZU_5,
+                     TileType::MANZU_6, TileType::MANZU_7, TileType::PINZU_5,
+                     TileType::PINZU_5, TileType::PINZU_7, TileType::PINZU_7,
+                     TileType::SOUZU_9, TileType::SOUZU_9, TileType::WIND_TON,
+                     TileType::WIND_TON}));
+  ExpectConsistent();
+
+  // Chii needs the other 2 tiles of the shuntsu, which can't be jihai.
+  EXPECT_FALSE(handState_.Chii(TileType::SOUZU_8, TileType::SOUZU_7));
+  EXPECT_FALSE(handState_.Chii(TileType::MANZU_4, TileType::MANZU_5));
+  EXPECT_FALSE(handState_.Chii(TileType::WIND_NAN, TileType::WIND_TON));
+  ASSERT_TRUE(handState_.Chii(TileType::MANZU_4, TileType::MANZU_2));
+  EXPECT_TRUE(handState_.NeedsDiscard());
+  EXPECT_EQ(ShantenResult::kNotApplicable,
+            handState_.shanten().chiitoitsu_shanten);
+  ExpectConsistent();
+
+  // Only discards are allowed until the hand has 13 tiles again.
+  EXPECT_FALSE(handState_.Pon(TileType::WIND_TON));
+  ASSERT_TRUE(handState_.Discard(TileType::SOUZU_9));
+  ExpectConsistent();
+
+  ASSERT_TRUE(handState_.Pon(TileType::PINZU_5));
+  ASSERT_TRUE(handState_.Discard(TileType::SOUZU_9));
+  EXPECT_TRUE(handState_.IsTenpai());
+  ExpectConsistent();
+
+  // Daiminkan needs 3 closed tiles.
+  EXPECT_FALSE(handState_.Kan(TileType::PINZU_7));
+  ASSERT_TRUE(handState_.Draw(TileType::PINZU_5));
+  // Kakan of the pon.
+  ASSERT_TRUE(handState_.Kan(TileType::PINZU_5));
+  EXPECT_FALSE(handState_.NeedsDiscard());
+  ExpectConsistent();
+
+  // The replacement tile completes the hand.
+  ASSERT_TRUE(handState_.Draw(TileType::PINZU_7));
+  EXPECT_TRUE(handState_.IsAgari());
+  ExpectConsistent();
+
+  Hand hand;
+  handState_.ToHand(&hand);
+  ASSERT_EQ(1, hand.chiied_tile_size());
+  EXPECT_EQ(TileType::MANZU_2, hand.chiied_tile(0).tile(0));
+  ASSERT_EQ(1, hand.kanned_tile_size());
+  EXPECT_EQ(TileType::PINZU_5, hand.kanned_tile(0).tile());
+  EXPECT_FALSE(hand.kanned_tile(0).is_closed());
+  EXPECT_EQ(0, hand.ponned_tile_size());
+  ASSERT_EQ(1, hand.agari().state_size());
+  EXPECT_EQ(AgariState::RINSHAN, hand.agari().state(0));
+  EXPECT_TRUE(handParser_.IsAgari(hand));
+}
+
+TEST_F(HandStateTest, CallExportTest) {
+  // 123m 456m 78p 99p 11z 22z.
+  ASSERT_TRUE(Reset({TileType::MANZU_1, TileType::MANZU_2, TileType::MANZU_3,
+                     TileType::MANZU_4, TileType::MANZU_5, TileType::MANZU_6,
+                     TileType::PINZU_7, TileType::PINZU_8, TileType::PINZU_9,
+                     TileType::PINZU_9, TileType::WIND_TON, TileType::WIND_TON,
+                     TileType::WIND_NAN}));
+  ASSERT_TRUE(handState_.Pon(TileType::WIND_TON));
+
+  // The last closed tile, 9p, stands in as the agari tile of a hand that
+  // isn't a win.
+  CompactHand compact_hand;
+  handState_.ToCompactHand(&compact_hand);
+  EXPECT_EQ(HandValidatorResult::OK, handParser_.Validate(compact_hand));
+  EXPECT_EQ(10, compact_hand.num_closed_tiles);
+  EXPECT_EQ(GetTileIndex(TileType::PINZU_9), compact_hand.agari_tile);
+  EXPECT_EQ(AgariType::UNKNOWN_AGARI_TYPE, compact_hand.agari_type);
+
+  // Discarding nan leaves a tenpai hand waiting on 6p or 9p.
+  UkeireResult ukeire;
+  ASSERT_EQ(HandValidatorResult::OK,
+            shantenCalculator_.CalculateUkeire(compact_hand, nullptr,
+                                               &ukeire));
+  bool found_nan = false;
+  for (int i = 0; i < ukeire.num_entries; ++i) {
+    if (ukeire.entry[i].discard == GetTileIndex(TileType::WIND_NAN)) {
+      found_nan = true;
+      EXPECT_EQ(0, ukeire.entry[i].shanten);
+    }
+  }
+  EXPECT_TRUE(found_nan);
+  ExpectConsistent();
+}
+
+TEST_F(HandStateTest, InvalidTest) {
+  // A hand starts with no tiles.
+  EXPECT_FALSE(handState_.Draw(TileType::MANZU_1));
+
+  // Too few tiles.
+  EXPECT_FALSE(Reset({TileType::MANZU_1}));
+
+  // 4 copies of 1m can't be drawn again.
+  ASSERT_TRUE(Reset({TileType::MANZU_1, TileType::MANZU_1, TileType::MANZU_1,
+                     TileType::MANZU_1, TileType::MANZU_2, TileType::MANZU_3,
+                     TileType::MANZU_4, TileType::MANZU_5, TileType::MANZU_6,
+                     TileType::MANZU_7, TileType::MANZU_8, TileType::MANZU_9,
+                     TileType::MANZU_9}));
+  EXPECT_FALSE(handState_.Draw(TileType::MANZU_1));
+  EXPECT_FALSE(handState_.Draw(TileType::UNKNOWN_TILE));
+
+  // Ankan after drawing, and rinshan is cleared by the next discard.
+  ASSERT_TRUE(handState_.Draw(TileType::MANZU_9));
+  ASSERT_TRUE(handState_.Kan(TileType::MANZU_1));
+  ASSERT_TRUE(handState_.Draw(TileType::SOUZU_1));
+  ASSERT_TRUE(handState_.Discard(TileType::SOUZU_1));
+  ASSERT_TRUE(handState_.Draw(TileType::SOUZU_2));
+  Hand hand;
+  handState_.ToHand(&hand);
+  EXPECT_EQ(0, hand.agari().state_size());
+  ASSERT_EQ(1, hand.kanned_tile_size());
+  EXPECT_TRUE(hand.kanned_tile(0).is_closed());
+  ExpectConsistent();
+
+  // Calls can't take a 5th copy either, counting the ones in melds.
+  // 34m 34m 55m 678p 11s 2s 3z, chii of 5m twice.
+  ASSERT_TRUE(Reset({TileType::MANZU_3, TileType::MANZU_4, TileType::MANZU_3,
+                     TileType::MANZU_4, TileType::MANZU_5, TileType::MANZU_5,
+                     TileType::PINZU_6, TileType::PINZU_7, TileType::PINZU_8,
+                     TileType::SOUZU_1, TileType::SOUZU_1, TileType::SOUZU_2,
+                     TileType::WIND_SHA}));
+  ASSERT_TRUE(handState_.Chii(TileType::MANZU_5, TileType::MANZU_3));
+  ASSERT_TRUE(handState_.Discard(TileType::WIND_SHA));
+  ASSERT_TRUE(handState_.Chii(TileType::MANZU_5, TileType::MANZU_3));
+  ASSERT_TRUE(handState_.Discard(TileType::SOUZU_2));
+  EXPECT_FALSE(handState_.Pon(TileType::MANZU_5));
+
+  // 555m 46m 678p 11s 22s 3z, pon of 5m.
+  ASSERT_TRUE(Reset({TileType::MANZU_5, TileType::MANZU_5, TileType::MANZU_5,
+                     TileType::MANZU_4, TileType::MANZU_6, TileType::PINZU_6,
+                     TileType::PINZU_7, TileType::PINZU_8, TileType::SOUZU_1,
+                     TileType::SOUZU_1, TileType::SOUZU_2, TileType::SOUZU_2,
+                     TileType::WIND_SHA}));
+  ASSERT_TRUE(handState_.Pon(TileType::MANZU_5));
+  ASSERT_TRUE(handState_.Discard(TileType::WIND_SHA));
+  EXPECT_FALSE(handState_.Chii(TileType::MANZU_5, TileType::MANZU_4));
+
+  // 555m 34m 678p 11s 22s 3z, chii of 5m.
+  ASSERT_TRUE(Reset({TileType::MANZU_5, TileType::MANZU_5, TileType::MANZU_5,
+                     TileType::MANZU_3, TileType::MANZU_4, TileType::PINZU_6,
+                     TileType::PINZU_7, TileType::PINZU_8, TileType::SOUZU_1,
+                     TileType::SOUZU_1, TileType::SOUZU_2, TileType::SOUZU_2,
+                     TileType::WIND_SHA}));
+  ASSERT_TRUE(handState_.Chii(TileType::MANZU_5, TileType::MANZU_3));
+  ASSERT_TRUE(handState_.Discard(TileType::WIND_SHA));
+  EXPECT_FALSE(handState_.Kan(TileType::MANZU_5));
+}
+
+TEST_F(HandStateTest, RandomTest) {
+  // Plays random draws and discards, and checks the state after each event.
+  std::mt19937 random(20161203);
+  for (int round = 0; round < 20; ++round) {
+    vector<TileType> wall;
+    for (int index = 0; index < kNumTileIndices; ++index) {
+      for (int i = 0; i < 4; ++i) {
+        wall.push_back(GetTileTypeFromIndex(index));
+      }
+    }
+    std::shuffle(wall.begin(), wall.end(), random);
+    ASSERT_TRUE(Reset(vector<TileType>(wall.begin(), wall.begin() + 13)));
+    for (int turn = 0; turn < 30; ++turn) {
+      ASSERT_TRUE(handState_.Draw(wall[13 + turn]));
+      ExpectConsistent();
+
+      Hand hand;
+      handState_.ToHand(&hand);
+      const int discard =
+          std::uniform_int_distribution<int>(0, 13)(random);
+      const TileType tile =
+          discard < 13 ? hand.closed_tile(discard) : hand.agari_tile();
+      ASSERT_TRUE(handState_.Discard(tile));
+      ExpectConsistent();
+    }
+  }
+}
+
+}  // namespace mahjong
+}  // namespace ycraft
@@ -0,0 +1,310 @@
+// Copyright 2016 Yuki Hamada
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "src/compact_hand.h"
+#include "src/hand_parser.h"
+#include "src/mahjong_common_util.h"
+#include "src/parse_cache.h"
+#include "src/suit_permutation.h"
+
+using std::vector;
+
+namespace ycraft {
+namespace mahjong {
+
+class ParseCacheTest : public testing::Test {
+ protected:
+  // Builds a menzen hand of the given closed tiles and agari tile.
+  CompactHand MakeHand(const vector<TileType>& closed_tiles,
+                       TileType agari_tile, AgariType agari_type) {
+    CompactHand hand;
+    hand.Clear();
+    for (const TileType tile : closed_tiles) {
+      hand.AddClosedTile(GetTileIndex(tile));
+    }
+    hand.agari_tile = GetTileIndex(agari_tile);
+    hand.agari_type = agari_type;
+    hand.richi_type = RichiType::NO_RICHI;
+    return hand;
+  }
+
+  // Builds a hand of a single parsed hand, a tanki wait on the given tile.
+  CompactHand MakeTankiHand(TileType agari_tile) {
+    return MakeHand({TileType::MANZU_1, TileType::MANZU_2, TileType::MANZU_3,
+                     TileType::MANZU_7, TileType::MANZU_8, TileType::MANZU_9,
+                     TileType::SOUZU_1, TileType::SOUZU_2, TileType::SOUZU_3,
+                     TileType::WIND_TON, TileType::WIND_TON,
+                     TileType::WIND_TON, agari_tile},
+                    agari_tile, AgariType::RON);
+  }
+
+  // Expects the same parsed hands in the same order, with the same elements
+  // and tiles in the same order.
+  void ExpectSameParsedHands(const vector<CompactParsedHand>& expected,
+                             const vector<CompactParsedHand>& actual) {
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+      SCOPED_TRACE(i);
+      EXPECT_EQ(expected[i].signature, actual[i].signature);
+      EXPECT_EQ(expected[i].machi_type, actual[i].machi_type);
+      EXPECT_EQ(expected[i].agari_format, actual[i].agari_format);
+      EXPECT_EQ(nullptr, actual[i].open_melds);
+      ASSERT_EQ(expected[i].GetNumElements(), actual[i].GetNumElements());
+      for (int j = 0; j < expected[i].GetNumElements(); ++j) {
+        EXPECT_EQ(expected[i].GetElementType(j), actual[i].GetElementType(j));
+        EXPECT_EQ(expected[i].GetElementBegin(j), actual[i].GetElementBegin(j));
+      }
+      ASSERT_EQ(expected[i].GetNumTiles(), actual[i].GetNumTiles());
+      for (int j = 0; j < expected[i].GetNumTiles(); ++j) {
+        EXPECT_EQ(expected[i].GetTileType(j), actual[i].GetTileType(j));
+        EXPECT_EQ(expected[i].GetTileFlags(j), actual[i].GetTileFlags(j));
+      }
+    }
+  }
+
+  HandParser handParser_;
+};
+
+TEST_F(ParseCacheTest, HitTest) {
+  // 111222333m 456p 77s parses into sanankou or 3 shuntsu.
+  CompactHand hand = MakeHand(
+      {TileType::MANZU_1, TileType::MANZU_1, TileType::MANZU_1,
+       TileType::MANZU_2, TileType::MANZU_2, TileType::MANZU_2,
+       TileType::MANZU_3, TileType::MANZU_3, TileType::MANZU_3,
+       TileType::PINZU_4, TileType::PINZU_5, TileType::SOUZU_7,
+       TileType::SOUZU_7},
+      TileType::PINZU_6, AgariType::TSUMO);
+  vector<CompactParsedHand> expected;
+  handParser_.Parse(hand, &expected);
+  ASSERT_LT(1u, expected.size());
+
+  ParseCache cache(1 << 20, false);
+  vector<CompactParsedHand> actual;
+  ASSERT_EQ(HandValidatorResult::OK, cache.Parse(handParser_, hand, &actual));
+  ExpectSameParsedHands(expected, actual);
+
+  // The order of closed tiles doesn't matter.
+  std::reverse(hand.closed_tile, hand.closed_tile + hand.num_closed_tiles);
+  actual.clear();
+  ASSERT_EQ(HandValidatorResult::OK, cache.Parse(handParser_, hand, &actual));
+  ExpectSameParsedHands(expected, actual);
+
+  ParseCacheStats stats = cache.GetStats();
+  EXPECT_EQ(2u, stats.num_lookups);
+  EXPECT_EQ(1u, stats.num_hits);
+  EXPECT_EQ(1, stats.num_entries);
+  EXPECT_LT(0u, stats.num_bytes);
+
+  // The agari type is part of the key.
+  hand.agari_type = AgariType::RON;
+  expected.clear();
+  handParser_.Parse(hand, &expected);
+  actual.clear();
+  ASSERT_EQ(HandValidatorResult::OK, cache.Parse(handParser_, hand, &actual));
+  ExpectSameParsedHands(expected, actual);
+  stats = cache.GetStats();
+  EXPECT_EQ(1u, stats.num_hits);
+  EXPECT_EQ(2, stats.num_entries);
+
+  cache.Clear();
+  stats = cache.GetStats();
+  EXPECT_EQ(0, stats.num_entries);
+  EXPECT_EQ(0u, stats.num_bytes);
+  EXPECT_EQ(3u, stats.num_lookups);
+}
+
+TEST_F(ParseCacheTest, MeldTest) {
+  CompactHand hand = MakeHand(
+      {TileType::MANZU_1, TileType::MANZU_2, TileType::MANZU_3,
+       TileType::PINZU_4, TileType::PINZU_5, TileType::PINZU_6,
+       TileType::SOUZU_7, TileType::SOUZU_7, TileType::SOUZU_7,
+       TileType::WIND_NAN},
+      TileType::WIND_NAN, AgariType::RON);
+  hand.AddMeld(HandElementType::MINKOUTSU, GetTileIndex(TileType::WIND_TON));
+
+  ParseCache cache(1 << 20, false);
+  vector<CompactParsedHand> expected;
+  handParser_.Parse(hand, &expected);
+  vector<CompactParsedHand> actual;
+  ASSERT_EQ(HandValidatorResult::OK, cache.Parse(handParser_, hand, &actual));
+  ExpectSameParsedHands(expected, actual);
+
+  // A pon and a kan of the same tile are different hands.
+  hand.meld[0].type = HandElementType::MINKANTSU;
+  expected.clear();
+  handParser_.Parse(hand, &expected);
+  actual.clear();
+  ASSERT_EQ(HandValidatorResult::OK, cache.Parse(handParser_, hand, &actual));
+  ExpectSameParsedHands(expected, actual);
+  EXPECT_EQ(0u, cache.GetStats().num_hits);
+}
+
+TEST_F(ParseCacheTest, SuitPermutationTest) {
+  // 111234m 345p 99s with a chii of 789s, and the same hand with manzu and
+  // souzu swapped.
+  CompactHand hand = MakeHand(
+      {TileType::MANZU_1, TileType::MANZU_1, TileType::MANZU_1,
+       TileType::MANZU_2, TileType::MANZU_3, TileType::MANZU_4,
+       TileType::PINZU_3, TileType::PINZU_4, TileType::SOUZU_9,
+       TileType::SOUZU_9},
+      TileType::PINZU_5, AgariType::TSUMO);
+  hand.AddMeld(HandElementType::MINSHUNTSU, GetTileIndex(TileType::SOUZU_7));
+  CompactHand swapped_hand = hand;
+  PermuteSuits({{1, 0, 2}}, &swapped_hand);
+
+  ParseCache cache(1 << 20, true);
+  for (const CompactHand& current_hand : {hand, swapped_hand, hand}) {
+    vector<CompactParsedHand> expected;
+    handParser_.Parse(current_hand, &expected);
+    ASSERT_FALSE(expected.empty());
+    vector<CompactParsedHand> actual;
+    ASSERT_EQ(HandValidatorResult::OK,
+              cache.Parse(handParser_, current_hand, &actual));
+    ExpectSameParsedHands(expected, actual);
+  }
+  const ParseCacheStats stats = cache.GetStats();
+  EXPECT_EQ(2u, stats.num_hits);
+  EXPECT_EQ(1, stats.num_entries);
+}
+
+TEST_F(ParseCacheTest, SuitPermutationTest_Random) {
+  // Random winning hands, some of whose mentsu are melds, come back from the
+  // cache in the order of HandParser::Parse under every permutation of suits.
+  const int kNumJihaiTiles = 7;
+  const vector<SuitPermutation> permutations = {
+      {{0, 1, 2}}, {{0, 2, 1}}, {{1, 0, 2}},
+      {{1, 2, 0}}, {{2, 0, 1}}, {{2, 1, 0}}};
+  std::mt19937 random(20161219);
+  ParseCache cache(1 << 20, true);
+  int num_hands = 0;
+  while (num_hands < 200) {
+    int counts[kNumTileIndices] = {};
+    bool is_valid = true;
+    CompactHand hand;
+    hand.Clear();
+    vector<int> closed_tiles;
+    // 4 mentsu and a jantou.
+    for (int i = 0; i < 5; ++i) {
+      const int index =
+          std::uniform_int_distribution<int>(0, kNumTileIndices - 1)(random);
+      const bool is_shuntsu = i < 4 && index >= kNumJihaiTiles &&
+                              (index - kNumJihaiTiles) % 9 < 7 &&
+                              random() % 3 != 0;
+      for (int j = 0; j < (i < 4 ? 3 : 2); ++j) {
+        is_valid = is_valid && ++counts[is_shuntsu ? index + j : index] <= 4;
+      }
+      if (i < 4 && random() % 4 == 0) {
+        hand.AddMeld(is_shuntsu ? HandElementType::MINSHUNTSU
+                                : HandElementType::MINKOUTSU,
+                     index);
+        continue;
+      }
+      for (int j = 0; j < (i < 4 ? 3 : 2); ++j) {
+        closed_tiles.push_back(is_shuntsu ? index + j : index);
+      }
+    }
+    if (!is_valid) {
+      continue;
+    }
+    ++num_hands;
+    std::shuffle(closed_tiles.begin(), closed_tiles.end(), random);
+    for (size_t i = 0; i + 1 < closed_tiles.size(); ++i) {
+      hand.AddClosedTile(closed_tiles[i]);
+    }
+    hand.agari_tile = closed_tiles.back();
+    hand.agari_type = random() % 2 == 0 ? AgariType::RON : AgariType::TSUMO;
+    hand.richi_type = RichiType::NO_RICHI;
+
+    for (const SuitPermutation& permutation : permutations) {
+      CompactHand permuted_hand = hand;
+      PermuteSuits(permutation, &permuted_hand);
+      vector<CompactParsedHand> expected;
+      handParser_.Parse(permuted_hand, &expected);
+      ASSERT_FALSE(expected.empty());
+      vector<CompactParsedHand> actual;
+      ASSERT_EQ(HandValidatorResult::OK,
+                cache.Parse(handParser_, permuted_hand, &actual));
+      ASSERT_NO_FATAL_FAILURE(ExpectSameParsedHands(expected, actual));
+    }
+  }
+  EXPECT_LE(200u * 5, cache.GetStats().num_hits);
+}
+
+TEST_F(ParseCacheTest, InvalidTest) {
+  ParseCache cache(1 << 20, false);
+  CompactHand hand = MakeTankiHand(TileType::PINZU_1);
+  hand.closed_tile[0] = CompactParsedHand::kUnknownTileCode;
+  vector<CompactParsedHand> actual;
+  EXPECT_EQ(HandValidatorResult::ERROR_UNKNOWN_TILE,
+            cache.Parse(handParser_, hand, &actual));
+
+  // 5 copies of a tile.
+  hand = MakeTankiHand(TileType::WIND_TON);
+  hand.closed_tile[0] = GetTileIndex(TileType::WIND_TON);
+  EXPECT_NE(HandValidatorResult::OK, cache.Parse(handParser_, hand, &actual));
+  EXPECT_TRUE(actual.empty());
+  EXPECT_EQ(0, cache.GetStats().num_entries);
+}
+
+TEST_F(ParseCacheTest, EvictionTest) {
+  const CompactHand hand_1p = MakeTankiHand(TileType::PINZU_1);
+  const CompactHand hand_2p = MakeTankiHand(TileType::PINZU_2);
+  const CompactHand hand_3p = MakeTankiHand(TileType::PINZU_3);
+
+  // Each hand uses the same bytes, so the budget fits 2 of them.
+  size_t entry_bytes;
+  {
+    ParseCache cache(1 << 20, false);
+    vector<CompactParsedHand> actual;
+    cache.Parse(handParser_, hand_1p, &actual);
+    ASSERT_EQ(1u, actual.size());
+    entry_bytes = cache.GetStats().num_bytes;
+  }
+  ParseCache cache(entry_bytes * 2, false);
+  vector<CompactParsedHand> actual;
+  cache.Parse(handParser_, hand_1p, &actual);
+  cache.Parse(handParser_, hand_2p, &actual);
+  // Referencing 1p makes the clock skip it once, so 2p is evicted.
+  cache.Parse(handParser_, hand_1p, &actual);
+  cache.Parse(handParser_, hand_3p, &actual);
+  ParseCacheStats stats = cache.GetStats();
+  EXPECT_EQ(1u, stats.num_evictions);
+  EXPECT_EQ(2, stats.num_entries);
+  EXPECT_GE(entry_bytes * 2, stats.num_bytes);
+
+  cache.Parse(handParser_, hand_1p, &actual);
+  cache.Parse(handParser_, hand_3p, &actual);
+  EXPECT_EQ(3u, cache.GetStats().num_hits);
+  cache.Parse(handParser_, hand_2p, &actual);
+  stats = cache.GetStats();
+  EXPECT_EQ(3u, stats.num_hits);
+  EXPECT_EQ(2u, stats.num_evictions);
+
+  // Nothing fits in a cache without a budget, but it still parses hands.
+  ParseCache empty_cache(0, false);
+  actual.clear();
+  ASSERT_EQ(HandValidatorResult::OK,
+            empty_cache.Parse(handParser_, hand_1p, &actual));
+  EXPECT_EQ(1u, actual.size());
+  EXPECT_EQ(0, empty_cache.GetStats().num_entries);
+}
+
+}  // namespace mahjong
+}  // namespace ycraft
@@ -15,11 +15,16 @@
 #include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <random>
+#include <thread>
+#include <utility>
 
 #include "gtest/gtest.h"
 
 #include "src/hand_parser.h"
+#include "src/mahjong_common_util.h"
 #include "src/score_calculator.h"
+#include "src/suit_permutation.h"
 #include "src/yaku_applier.h"
 
 using std::copy;
@@ -28,6 +33,7 @@ using std::istream;
 using std::ostream_iterator;
 using std::string;
 using std::stringstream;
+using std::thread;
 using std::unique_ptr;
 using std::vector;
 
@@ -35,6 +41,8 @@ namespace ycraft {
 namespace mahjong {
 
 namespace {
+const int kNumJihaiTiles = 7;
+
 string ConcatStrings(const vector<string>& strings) {
   stringstream ss;
   copy(strings.begin(), strings.end(), ostream_iterator<string>(ss, ", "));
@@ -82,10 +90,8 @@ class ScoreCalculatorTest : public testing::Test {
     ASSERT_EQ(expected_uradora, actual.uradora());
   }
 
-  ScoreCalculator score_calculator_;
-
- private:
   static Rule rule_;
+  ScoreCalculator score_calculator_;
 };
 
 Rule ScoreCalculatorTest::rule_;
@@ -161,6 +167,49 @@ TEST_F(ScoreCalculatorTest, TestCalculate_2) {
                                  3 /* dora */, 3 /* uradora */, result));
 }
 
+TEST_F(ScoreCalculatorTest, TestCalculate_CompactHand) {
+  Field field;
+  field.set_wind(TileType::WIND_TON);
+  field.add_dora(TileType::WIND_NAN);
+  field.add_uradora(TileType::WIND_SHA);
+  field.set_honba(0);
+
+  Player player;
+  player.set_wind(TileType::WIND_TON);
+
+  Hand* hand = player.mutable_hand();
+  hand->add_closed_tile(TileType::WIND_TON);
+  hand->add_closed_tile(TileType::WIND_TON);
+  hand->add_closed_tile(TileType::WIND_TON);
+  hand->add_closed_tile(TileType::WIND_NAN);
+  hand->add_closed_tile(TileType::WIND_NAN);
+  hand->add_closed_tile(TileType::WIND_NAN);
+  hand->add_closed_tile(TileType::PINZU_2);
+  hand->add_closed_tile(TileType::PINZU_3);
+  hand->add_closed_tile(TileType::PINZU_4);
+  hand->add_closed_tile(TileType::SOUZU_8);
+  hand->set_agari_tile(TileType::SOUZU_8);
+  hand->add_ponned_tile()->set_tile(TileType::WIND_SHA);
+  hand->mutable_agari()->set_type(AgariType::RON);
+
+  ScoreCalculatorResult expected;
+  score_calculator_.Calculate(field, player, &expected);
+
+  CompactField compact_field;
+  ASSERT_TRUE(ToCompactField(field, &compact_field));
+  CompactHand compact_hand;
+  ASSERT_EQ(HandValidatorResult::OK, ToCompactHand(*hand, &compact_hand));
+
+  ScoreCalculatorResult result;
+  score_calculator_.Calculate(compact_field, player.wind(), compact_hand,
+                              &result);
+
+  ASSERT_NO_FATAL_FAILURE(Verify({"場風牌 東", "自風牌 東"}, 50 /* fu */,
+                                 5 /* han */, 0 /* yakuman */, 3 /* dora */,
+                                 0 /* uradora */, result));
+  EXPECT_EQ(expected.SerializeAsString(), result.SerializeAsString());
+}
+
 TEST_F(ScoreCalculatorTest, TestCalculate_3) {
   Field field;
   field.set_wind(TileType::WIND_TON);
@@ -200,5 +249,513 @@ TEST_F(ScoreCalculatorTest, TestCalculate_3) {
                                  result));
 }
 
+TEST_F(ScoreCalculatorTest, TestCalculate_Kokushimusou) {
+  Field field;
+  field.set_wind(TileType::WIND_TON);
+  field.set_honba(0);
+
+  Player player;
+  player.set_wind(TileType::WIND_NAN);
+
+  Hand* hand = player.mutable_hand();
+  hand->add_closed_tile(TileType::MANZU_1);
+  hand->add_closed_tile(TileType::MANZU_9);
+  hand->add_closed_tile(TileType::SOUZU_1);
+  hand->add_closed_tile(TileType::SOUZU_9);
+  hand->add_closed_tile(TileType::PINZU_1);
+  hand->add_closed_tile(TileType::PINZU_9);
+  hand->add_closed_tile(TileType::WIND_TON);
+  hand->add_closed_tile(TileType::WIND_NAN);
+  hand->add_closed_tile(TileType::WIND_SHA);
+  hand->add_closed_tile(TileType::WIND_PE);
+  hand->add_closed_tile(TileType::SANGEN_HAKU);
+  hand->add_closed_tile(TileType::SANGEN_HAKU);
+  hand->add_closed_tile(TileType::SANGEN_HATSU);
+  hand->set_agari_tile(TileType::SANGEN_CHUN);
+  hand->mutable_agari()->set_type(AgariType::RON);
+
+  ScoreCalculatorResult result;
+  score_calculator_.Calculate(field, player, &result);
+
+  ASSERT_NO_FATAL_FAILURE(Verify({"国士無双"}, 40 /* fu */, 0 /* han */,
+                                 1 /* yakuman */, 0 /* dora */,
+                                 0 /* uradora */, result));
+}
+
+TEST_F(ScoreCalculatorTest, TestCalculate_KokushimusouJusanmen) {
+  Field field;
+  field.set_wind(TileType::WIND_TON);
+  field.set_honba(0);
+
+  Player player;
+  player.set_wind(TileType::WIND_NAN);
+
+  Hand* hand = player.mutable_hand();
+  hand->add_closed_tile(TileType::MANZU_1);
+  hand->add_closed_tile(TileType::MANZU_9);
+  hand->add_closed_tile(TileType::SOUZU_1);
+  hand->add_closed_tile(TileType::SOUZU_9);
+  hand->add_closed_tile(TileType::PINZU_1);
+  hand->add_closed_tile(TileType::PINZU_9);
+  hand->add_closed_tile(TileType::WIND_TON);
+  hand->add_closed_tile(TileType::WIND_NAN);
+  hand->add_closed_tile(TileType::WIND_SHA);
+  hand->add_closed_tile(TileType::WIND_PE);
+  hand->add_closed_tile(TileType::SANGEN_HAKU);
+  hand->add_closed_tile(TileType::SANGEN_HATSU);
+  hand->add_closed_tile(TileType::SANGEN_CHUN);
+  hand->set_agari_tile(TileType::MANZU_1);
+  hand->mutable_agari()->set_type(AgariType::RON);
+
+  ScoreCalculatorResult result;
+  score_calculator_.Calculate(field, player, &result);
+
+  ASSERT_NO_FATAL_FAILURE(Verify({"国士無双十三面待ち"}, 30 /* fu */, 0 /* han */,
+                                 2 /* yakuman */, 0 /* dora */,
+                                 0 /* uradora */, result));
+}
+
+TEST_F(ScoreCalculatorTest, TestCalculate_SharedAcrossThreads) {
+  Field field;
+  field.set_wind(TileType::WIND_TON);
+  field.add_dora(TileType::WIND_NAN);
+  field.add_uradora(TileType::WIND_SHA);
+  field.set_honba(0);
+
+  Player player;
+  player.set_wind(TileType::WIND_TON);
+
+  Hand* hand = player.mutable_hand();
+  hand->add_closed_tile(TileType::WIND_TON);
+  hand->add_closed_tile(TileType::WIND_TON);
+  hand->add_closed_tile(TileType::WIND_TON);
+  hand->add_closed_tile(TileType::WIND_NAN);
+  hand->add_closed_tile(TileType::WIND_NAN);
+  hand->add_closed_tile(TileType::WIND_NAN);
+  hand->add_closed_tile(TileType::WIND_SHA);
+  hand->add_closed_tile(TileType::WIND_SHA);
+  hand->add_closed_tile(TileType::WIND_SHA);
+  hand->add_closed_tile(TileType::PINZU_2);
+  hand->add_closed_tile(TileType::PINZU_3);
+  hand->add_closed_tile(TileType::PINZU_4);
+  hand->add_closed_tile(TileType::SOUZU_8);
+  hand->set_agari_tile(TileType::SOUZU_8);
+  hand->mutable_agari()->set_type(AgariType::RON);
+  hand->set_richi_type(RichiType::NORMAL_RICHI);
+
+  const int kNumThreads = 4;
+  const int kNumIterations = 50;
+  vector<ScoreCalculatorResult> results(kNumThreads * kNumIterations);
+  vector<thread> threads;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads.push_back(thread([&, i]() {
+      for (int j = 0; j < kNumIterations; ++j) {
+        score_calculator_.Calculate(field, player,
+                                    &results[i * kNumIterations + j]);
+      }
+    }));
+  }
+  for (thread& t : threads) {
+    t.join();
+  }
+
+  for (const ScoreCalculatorResult& result : results) {
+    ASSERT_NO_FATAL_FAILURE(
+        Verify({"立直", "三暗刻", "場風牌 東", "自風牌 東"}, 60 /* fu */,
+               11 /* han */, 0 /* yakuman */, 3 /* dora */, 3 /* uradora */,
+               result));
+  }
+}
+
+TEST_F(ScoreCalculatorTest, TestCalculate_Arena) {
+  Field field;
+  field.set_wind(TileType::WIND_TON);
+  field.add_dora(TileType::WIND_NAN);
+  field.add_uradora(TileType::WIND_SHA);
+  field.set_honba(0);
+
+  Player player;
+  player.set_wind(TileType::WIND_TON);
+
+  Hand* hand = player.mutable_hand();
+  hand->add_closed_tile(TileType::WIND_TON);
+  hand->add_closed_tile(TileType::WIND_TON);
+  hand->add_closed_tile(TileType::WIND_TON);
+  hand->add_closed_tile(TileType::WIND_NAN);
+  hand->add_closed_tile(TileType::WIND_NAN);
+  hand->add_closed_tile(TileType::WIND_NAN);
+  hand->add_closed_tile(TileType::WIND_SHA);
+  hand->add_closed_tile(TileType::WIND_SHA);
+  hand->add_closed_tile(TileType::WIND_SHA);
+  hand->add_closed_tile(TileType::PINZU_2);
+  hand->add_closed_tile(TileType::PINZU_3);
+  hand->add_closed_tile(TileType::PINZU_4);
+  hand->add_closed_tile(TileType::SOUZU_8);
+  hand->set_agari_tile(TileType::SOUZU_8);
+  hand->mutable_agari()->set_type(AgariType::RON);
+  hand->set_richi_type(RichiType::NORMAL_RICHI);
+
+  // One arena can be reused for many calls, and the result can live on the
+  // arena as well.
+  google::protobuf::Arena arena;
+  for (int i = 0; i < 3; ++i) {
+    ScoreCalculatorResult* result =
+        google::protobuf::Arena::CreateMessage<ScoreCalculatorResult>(&arena);
+    score_calculator_.Calculate(field, player, result, &arena);
+    ASSERT_NO_FATAL_FAILURE(
+        Verify({"立直", "三暗刻", "場風牌 東", "自風牌 東"}, 60 /* fu */,
+               11 /* han */, 0 /* yakuman */, 3 /* dora */, 3 /* uradora */,
+               *result));
+    EXPECT_LT(0, arena.SpaceUsed());
+    arena.Reset();
+  }
+}
+
+TEST_F(ScoreCalculatorTest, TestCalculate_ParseCache) {
+  Field field;
+  field.set_wind(TileType::WIND_TON);
+  field.add_dora(TileType::WIND_NAN);
+  field.add_uradora(TileType::WIND_SHA);
+
+  Player player;
+  player.set_wind(TileType::WIND_TON);
+
+  Hand* hand = player.mutable_hand();
+  for (const TileType tile :
+       {TileType::WIND_TON, TileType::WIND_TON, TileType::WIND_TON,
+        TileType::WIND_NAN, TileType::WIND_NAN, TileType::WIND_NAN,
+        TileType::WIND_SHA, TileType::WIND_SHA, TileType::WIND_SHA,
+        TileType::PINZU_2, TileType::PINZU_3, TileType::PINZU_4,
+        TileType::SOUZU_8}) {
+    hand->add_closed_tile(tile);
+  }
+  hand->set_agari_tile(TileType::SOUZU_8);
+  hand->mutable_agari()->set_type(AgariType::RON);
+  hand->set_richi_type(RichiType::NORMAL_RICHI);
+
+  EXPECT_EQ(0u, score_calculator_.GetParseCacheStats().num_lookups);
+  score_calculator_.EnableParseCache(1 << 20);
+
+  // The second call hits the cache and gives the same result.
+  for (int i = 0; i < 2; ++i) {
+    ScoreCalculatorResult result;
+    score_calculator_.Calculate(field, player, &result);
+    ASSERT_NO_FATAL_FAILURE(
+        Verify({"立直", "三暗刻", "場風牌 東", "自風牌 東"}, 60 /* fu */,
+               11 /* han */, 0 /* yakuman */, 3 /* dora */, 3 /* uradora */,
+               result));
+  }
+  const ParseCacheStats stats = score_calculator_.GetParseCacheStats();
+  EXPECT_EQ(2u, stats.num_lookups);
+  EXPECT_EQ(1u, stats.num_hits);
+  EXPECT_EQ(1, stats.num_entries);
+
+  // Dora aren't part of the cached parse, so they still follow the field.
+  field.clear_dora();
+  ScoreCalculatorResult result;
+  score_calculator_.Calculate(field, player, &result);
+  EXPECT_EQ(0, result.dora());
+  EXPECT_EQ(2u, score_calculator_.GetParseCacheStats().num_hits);
+}
+
+TEST_F(ScoreCalculatorTest, TestCalculate_ParseCacheRandom) {
+  Field field;
+  field.set_wind(TileType::WIND_TON);
+  field.add_dora(TileType::MANZU_5);
+  field.add_uradora(TileType::PINZU_1);
+
+  // 778899m 11123p 55z with 5z agari, where the cached parse has to match
+  // iipeikou the same way, plus random winning hands. Each hand comes with
+  // a copy whose suits are rotated.
+  vector<Player> players;
+  Player player;
+  player.set_wind(TileType::WIND_NAN);
+  Hand* hand = player.mutable_hand();
+  for (const TileType tile :
+       {TileType::MANZU_7, TileType::MANZU_7, TileType::MANZU_8,
+        TileType::MANZU_8, TileType::MANZU_9, TileType::MANZU_9,
+        TileType::PINZU_1, TileType::PINZU_1, TileType::PINZU_1,
+        TileType::PINZU_2, TileType::PINZU_3, TileType::SANGEN_HATSU,
+        TileType::SANGEN_HATSU}) {
+    hand->add_closed_tile(tile);
+  }
+  hand->set_agari_tile(TileType::SANGEN_HATSU);
+  hand->mutable_agari()->set_type(AgariType::RON);
+  hand->set_richi_type(RichiType::NO_RICHI);
+  players.push_back(player);
+
+  std::mt19937 random(20161218);
+  while (players.size() < 400) {
+    int counts[kNumTileIndices] = {};
+    vector<int> tiles;
+    bool is_valid = true;
+    // 4 mentsu and a jantou.
+    for (int i = 0; i < 5; ++i) {
+      const int index =
+          std::uniform_int_distribution<int>(0, kNumTileIndices - 1)(random);
+      const bool is_shuntsu = i < 4 && index >= kNumJihaiTiles &&
+                              (index - kNumJihaiTiles) % 9 < 7 &&
+                              random() % 3 != 0;
+      for (int j = 0; j < (i < 4 ? 3 : 2); ++j) {
+        const int tile = is_shuntsu ? index + j : index;
+        is_valid = is_valid && ++counts[tile] <= 4;
+        tiles.push_back(tile);
+      }
+    }
+    if (!is_valid) {
+      continue;
+    }
+    std::shuffle(tiles.begin(), tiles.end(), random);
+
+    const AgariType agari_type =
+        random() % 2 == 0 ? AgariType::RON : AgariType::TSUMO;
+    for (int rotation = 0; rotation < 2; ++rotation) {
+      hand->Clear();
+      for (size_t i = 0; i < tiles.size(); ++i) {
+        int index = tiles[i];
+        if (rotation == 1 && index >= kNumJihaiTiles) {
+          index = kNumJihaiTiles + (index - kNumJihaiTiles + 9) % 27;
+        }
+        if (i + 1 < tiles.size()) {
+          hand->add_closed_tile(GetTileTypeFromIndex(index));
+        } else {
+          hand->set_agari_tile(GetTileTypeFromIndex(index));
+        }
+      }
+      hand->mutable_agari()->set_type(agari_type);
+      hand->set_richi_type(RichiType::NO_RICHI);
+      players.push_back(player);
+    }
+  }
+
+  // Rotated hands share parsed hands only if every yaku is symmetric in
+  // suits, so drop the ones that aren't, e.g. ryuuiisou.
+  vector<string> asymmetric_yaku;
+  GetSuitAsymmetricYaku(rule_, &asymmetric_yaku);
+  ASSERT_FALSE(asymmetric_yaku.empty());
+  unique_ptr<Rule> symmetric_rule(new Rule);
+  for (const Yaku& yaku : rule_.yaku()) {
+    if (std::find(asymmetric_yaku.begin(), asymmetric_yaku.end(),
+                  yaku.name()) == asymmetric_yaku.end()) {
+      *symmetric_rule->add_yaku() = yaku;
+    }
+  }
+  ScoreCalculator score_calculator(std::move(symmetric_rule));
+
+  vector<string> expected;
+  for (const Player& player : players) {
+    ScoreCalculatorResult result;
+    score_calculator.Calculate(field, player, &result);
+    expected.push_back(result.SerializeAsString());
+  }
+
+  // Each hand scores the same with the cache, whether it's a hit or not.
+  score_calculator.EnableParseCache(1 << 20);
+  for (int round = 0; round < 2; ++round) {
+    for (size_t i = 0; i < players.size(); ++i) {
+      ScoreCalculatorResult result;
+      score_calculator.Calculate(field, players[i], &result);
+      ASSERT_EQ(expected[i], result.SerializeAsString())
+          << players[i].Utf8DebugString();
+    }
+    if (round == 0) {
+      // Each rotated hand hits the entry of the hand before it.
+      EXPECT_LE((players.size() - 1) / 2,
+                score_calculator.GetParseCacheStats().num_hits);
+    }
+  }
+
+  // With ryuuiisou in the rule, a rotated hand is parsed again.
+  score_calculator_.EnableParseCache(1 << 20);
+  for (size_t i = players.size() - 2; i < players.size(); ++i) {
+    ScoreCalculatorResult result;
+    score_calculator_.Calculate(field, players[i], &result);
+  }
+  EXPECT_EQ(0u, score_calculator_.GetParseCacheStats().num_hits);
+}
+
+TEST_F(ScoreCalculatorTest, TestAnalyzeDiscards) {
+  Field field;
+  field.set_wind(TileType::WIND_TON);
+  field.add_dora(TileType::SOUZU_9);
+  field.add_uradora(TileType::PINZU_2);
+
+  Player player;
+  player.set_wind(TileType::WIND_NAN);
+
+  Hand* hand = player.mutable_hand();
+  for (const TileType tile :
+       {TileType::MANZU_2, TileType::MANZU_3, TileType::MANZU_4,
+        TileType::PINZU_2, TileType::PINZU_3, TileType::PINZU_4,
+        TileType::PINZU_9, TileType::PINZU_9, TileType::SOUZU_5,
+        TileType::SOUZU_6, TileType::SOUZU_7, TileType::SOUZU_7,
+        TileType::SANGEN_CHUN}) {
+    hand->add_closed_tile(tile);
+  }
+  hand->set_agari_tile(TileType::SOUZU_8);
+  hand->set_richi_type(RichiType::NORMAL_RICHI);
+
+  DiscardAnalyzerResult result;
+  score_calculator_.AnalyzeDiscards(field, player, &result);
+  ASSERT_EQ(HandValidatorResult::OK, result.validator_result());
+
+  // Compare with scoring every discard and winning tile one by one.
+  HandParser hand_parser;
+  vector<TileType> tiles;
+  for (const int tile : hand->closed_tile()) {
+    tiles.push_back(static_cast<TileType>(tile));
+  }
+  tiles.push_back(hand->agari_tile());
+  sort(tiles.begin(), tiles.end());
+  tiles.erase(unique(tiles.begin(), tiles.end()), tiles.end());
+  int next_tenpai_discard = 0;
+  for (const TileType discard : tiles) {
+    SCOPED_TRACE(TileType_Name(discard));
+    Player waiting_player = player;
+    Hand* waiting_hand = waiting_player.mutable_hand();
+    waiting_hand->clear_closed_tile();
+    bool is_discarded = false;
+    for (const int tile : hand->closed_tile()) {
+      if (tile == discard && !is_discarded) {
+        is_discarded = true;
+      } else {
+        waiting_hand->add_closed_tile(static_cast<TileType>(tile));
+      }
+    }
+    if (is_discarded) {
+      waiting_hand->add_closed_tile(hand->agari_tile());
+    }
+
+    vector<TileType> winning_tiles;
+    for (int index = 0; index < kNumTileIndices; ++index) {
+      waiting_hand->set_agari_tile(GetTileTypeFromIndex(index));
+      if (hand_parser.IsAgari(*waiting_hand)) {
+        winning_tiles.push_back(GetTileTypeFromIndex(index));
+      }
+    }
+    if (winning_tiles.empty()) {
+      continue;
+    }
+
+    ASSERT_LT(next_tenpai_discard, result.tenpai_discard_size());
+    const DiscardAnalyzerResult::TenpaiDiscard& tenpai_discard =
+        result.tenpai_discard(next_tenpai_discard++);
+    EXPECT_EQ(discard, tenpai_discard.discard());
+    EXPECT_EQ(find(winning_tiles.begin(), winning_tiles.end(), discard) !=
+                  winning_tiles.end(),
+              tenpai_discard.is_furiten());
+    ASSERT_EQ(winning_tiles.size(), tenpai_discard.winning_tile_size());
+    for (size_t i = 0; i < winning_tiles.size(); ++i) {
+      const DiscardAnalyzerResult::WinningTile& winning_tile =
+          tenpai_discard.winning_tile(i);
+      EXPECT_EQ(winning_tiles[i], winning_tile.tile());
+
+      waiting_hand->set_agari_tile(winning_tiles[i]);
+      waiting_hand->mutable_agari()->set_type(AgariType::RON);
+      ScoreCalculatorResult ron;
+      score_calculator_.Calculate(field, waiting_player, &ron);
+      EXPECT_EQ(ron.SerializeAsString(),
+                winning_tile.ron().SerializeAsString());
+
+      waiting_hand->mutable_agari()->set_type(AgariType::TSUMO);
+      ScoreCalculatorResult tsumo;
+      score_calculator_.Calculate(field, waiting_player, &tsumo);
+      EXPECT_EQ(tsumo.SerializeAsString(),
+                winning_tile.tsumo().SerializeAsString());
+    }
+  }
+  EXPECT_EQ(next_tenpai_discard, result.tenpai_discard_size());
+
+  // A field with too many dora indicators is an error.
+  Field invalid_field = field;
+  for (int i = 0; i <= CompactField::kMaxNumDora; ++i) {
+    invalid_field.add_dora(TileType::SOUZU_9);
+  }
+  DiscardAnalyzerResult invalid_result;
+  score_calculator_.AnalyzeDiscards(invalid_field, player, &invalid_result);
+  EXPECT_EQ(HandValidatorResult::ERROR_INVALID_FIELD,
+            invalid_result.validator_result());
+  EXPECT_EQ(0, invalid_result.tenpai_discard_size());
+
+  // Discarding chun leaves a pinfu hand waiting for 6s and 9s.
+  ASSERT_LT(0, result.tenpai_discard_size());
+  const DiscardAnalyzerResult::TenpaiDiscard& chun =
+      result.tenpai_discard(result.tenpai_discard_size() - 1);
+  ASSERT_EQ(TileType::SANGEN_CHUN, chun.discard());
+  ASSERT_EQ(2, chun.winning_tile_size());
+  EXPECT_EQ(TileType::SOUZU_6, chun.winning_tile(0).tile());
+  ASSERT_NO_FATAL_FAILURE(Verify({"立直", "平和"}, 30 /* fu */, 3 /* han */,
+                                 0 /* yakuman */, 0 /* dora */,
+                                 1 /* uradora */, chun.winning_tile(0).ron()));
+}
+
+TEST_F(ScoreCalculatorTest, TestAnalyzeWaits) {
+  Field field;
+  field.set_wind(TileType::WIND_TON);
+  field.add_dora(TileType::MANZU_4);
+
+  // 1112345678999m with a tsumo flag ignored.
+  Player player;
+  player.set_wind(TileType::WIND_NAN);
+  Hand* hand = player.mutable_hand();
+  for (const TileType tile :
+       {TileType::MANZU_1, TileType::MANZU_1, TileType::MANZU_1,
+        TileType::MANZU_2, TileType::MANZU_3, TileType::MANZU_4,
+        TileType::MANZU_5, TileType::MANZU_6, TileType::MANZU_7,
+        TileType::MANZU_8, TileType::MANZU_9, TileType::MANZU_9,
+        TileType::MANZU_9}) {
+    hand->add_closed_tile(tile);
+  }
+  hand->mutable_agari()->set_type(AgariType::TSUMO);
+
+  WaitAnalyzerResult result;
+  score_calculator_.AnalyzeWaits(field, player, &result);
+  ASSERT_EQ(HandValidatorResult::OK, result.validator_result());
+  ASSERT_EQ(9, result.winning_tile_size());
+  for (int i = 0; i < result.winning_tile_size(); ++i) {
+    const DiscardAnalyzerResult::WinningTile& winning_tile =
+        result.winning_tile(i);
+    SCOPED_TRACE(TileType_Name(winning_tile.tile()));
+    EXPECT_EQ(GetTileTypeFromIndex(GetTileIndex(TileType::MANZU_1) + i),
+              winning_tile.tile());
+
+    hand->set_agari_tile(winning_tile.tile());
+    hand->mutable_agari()->set_type(AgariType::RON);
+    ScoreCalculatorResult ron;
+    score_calculator_.Calculate(field, player, &ron);
+    EXPECT_EQ(ron.SerializeAsString(), winning_tile.ron().SerializeAsString());
+
+    hand->mutable_agari()->set_type(AgariType::TSUMO);
+    ScoreCalculatorResult tsumo;
+    score_calculator_.Calculate(field, player, &tsumo);
+    EXPECT_EQ(tsumo.SerializeAsString(),
+              winning_tile.tsumo().SerializeAsString());
+    EXPECT_LT(0, winning_tile.ron().yakuman());
+  }
+
+  // A hand that isn't tenpai has no winning tiles.
+  hand->set_closed_tile(0, TileType::WIND_TON);
+  result.Clear();
+  score_calculator_.AnalyzeWaits(field, player, &result);
+  EXPECT_EQ(HandValidatorResult::OK, result.validator_result());
+  EXPECT_EQ(0, result.winning_tile_size());
+
+  hand->add_closed_tile(TileType::WIND_TON);
+  result.Clear();
+  score_calculator_.AnalyzeWaits(field, player, &result);
+  EXPECT_EQ(HandValidatorResult::ERROR_WRONG_NUM_TILES,
+            result.validator_result());
+
+  // A field with too many dora indicators is an error.
+  for (int i = 0; i <= CompactField::kMaxNumDora; ++i) {
+    field.add_dora(TileType::SOUZU_9);
+  }
+  result.Clear();
+  score_calculator_.AnalyzeWaits(field, player, &result);
+  EXPECT_EQ(HandValidatorResult::ERROR_INVALID_FIELD,
+            result.validator_result());
+  EXPECT_EQ(0, result.winning_tile_size());
+}
+
 }  // namespace mahjong
 }  // namespace ycraft
@@ -0,0 +1,374 @@
+// Copyright 2016 Yuki Hamada
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "src/hand_parser.h"
+#include "src/mahjong_common_util.h"
+#include "src/shanten_calculator.h"
+
+using std::vector;
+
+namespace ycraft {
+namespace mahjong {
+
+class ShantenCalculatorTest : public testing::Test {
+ protected:
+  ShantenResult Calculate(const vector<TileType>& tiles) {
+    ShantenResult result;
+    EXPECT_TRUE(shantenCalculator_.Calculate(tiles.data(), tiles.size(),
+                                             &result));
+    return result;
+  }
+
+  ShantenCalculator shantenCalculator_;
+  HandParser handParser_;
+};
+
+TEST_F(ShantenCalculatorTest, RegularTest) {
+  // Complete.
+  ShantenResult result = Calculate(
+      {TileType::MANZU_1, TileType::MANZU_2, TileType::MANZU_3,
+       TileType::PINZU_4, TileType::PINZU_5, TileType::PINZU_6,
+       TileType::SOUZU_7, TileType::SOUZU_8, TileType::SOUZU_9,
+       TileType::WIND_TON, TileType::WIND_TON, TileType::WIND_TON,
+       TileType::SANGEN_HAKU, TileType::SANGEN_HAKU});
+  EXPECT_EQ(-1, result.shanten);
+  EXPECT_EQ(-1, result.regular_shanten);
+
+  // Tenpai waiting for 1m or 4m.
+  result = Calculate({TileType::MANZU_2, TileType::MANZU_3,
+                      TileType::PINZU_4, TileType::PINZU_5, TileType::PINZU_6,
+                      TileType::SOUZU_7, TileType::SOUZU_8, TileType::SOUZU_9,
+                      TileType::WIND_TON, TileType::WIND_TON,
+                      TileType::WIND_TON, TileType::SANGEN_HAKU,
+                      TileType::SANGEN_HAKU});
+  EXPECT_EQ(0, result.shanten);
+
+  // Iishanten: 2 mentsu, 2 taatsu and a jantou.
+  result = Calculate({TileType::MANZU_2, TileType::MANZU_3,
+                      TileType::PINZU_4, TileType::PINZU_6,
+                      TileType::SOUZU_7, TileType::SOUZU_8, TileType::SOUZU_9,
+                      TileType::WIND_TON, TileType::WIND_TON,
+                      TileType::WIND_TON, TileType::SANGEN_HAKU,
+                      TileType::SANGEN_HAKU, TileType::SANGEN_CHUN});
+  EXPECT_EQ(1, result.shanten);
+
+  // Isolated tiles only.
+  result = Calculate({TileType::MANZU_1, TileType::MANZU_4, TileType::MANZU_7,
+                      TileType::PINZU_2, TileType::PINZU_5, TileType::PINZU_8,
+                      TileType::SOUZU_3, TileType::SOUZU_6, TileType::SOUZU_9,
+                      TileType::WIND_TON, TileType::WIND_NAN,
+                      TileType::WIND_SHA, TileType::WIND_PE});
+  EXPECT_EQ(8, result.regular_shanten);
+}
+
+TEST_F(ShantenCalculatorTest, ChiiToitsuTest) {
+  ShantenResult result = Calculate(
+      {TileType::MANZU_1, TileType::MANZU_1, TileType::MANZU_5,
+       TileType::MANZU_5, TileType::PINZU_9, TileType::PINZU_9,
+       TileType::SOUZU_2, TileType::SOUZU_2, TileType::WIND_NAN,
+       TileType::WIND_NAN, TileType::SANGEN_HATSU, TileType::SANGEN_HATSU,
+       TileType::SANGEN_CHUN});
+  EXPECT_EQ(0, result.chiitoitsu_shanten);
+  EXPECT_EQ(0, result.shanten);
+  EXPECT_LT(0, result.regular_shanten);
+
+  // A koutsu counts as a single toitsu.
+  result = Calculate(
+      {TileType::MANZU_1, TileType::MANZU_1, TileType::MANZU_1,
+       TileType::MANZU_5, TileType::MANZU_5, TileType::PINZU_9,
+       TileType::PINZU_9, TileType::SOUZU_2, TileType::SOUZU_2,
+       TileType::WIND_NAN, TileType::WIND_NAN, TileType::SANGEN_HATSU,
+       TileType::SANGEN_HATSU});
+  EXPECT_EQ(1, result.chiitoitsu_shanten);
+}
+
+TEST_F(ShantenCalculatorTest, KokushiTest) {
+  ShantenResult result = Calculate(
+      {TileType::MANZU_1, TileType::MANZU_9, TileType::PINZU_1,
+       TileType::PINZU_9, TileType::SOUZU_1, TileType::SOUZU_9,
+       TileType::WIND_TON, TileType::WIND_NAN, TileType::WIND_SHA,
+       TileType::WIND_PE, TileType::SANGEN_HAKU, TileType::SANGEN_HATSU,
+       TileType::SANGEN_CHUN, TileType::SANGEN_CHUN});
+  EXPECT_EQ(-1, result.kokushi_shanten);
+  EXPECT_EQ(-1, result.shanten);
+
+  result = Calculate(
+      {TileType::MANZU_1, TileType::MANZU_9, TileType::PINZU_1,
+       TileType::PINZU_9, TileType::SOUZU_1, TileType::SOUZU_9,
+       TileType::WIND_TON, TileType::WIND_NAN, TileType::WIND_SHA,
+       TileType::WIND_PE, TileType::SANGEN_HAKU, TileType::SANGEN_HATSU,
+       TileType::MANZU_5});
+  EXPECT_EQ(1, result.kokushi_shanten);
+}
+
+TEST_F(ShantenCalculatorTest, NakiTest) {
+  Hand hand;
+  hand.add_closed_tile(TileType::MANZU_2);
+  hand.add_closed_tile(TileType::MANZU_3);
+  hand.add_closed_tile(TileType::PINZU_5);
+  hand.add_closed_tile(TileType::PINZU_5);
+  hand.add_ponned_tile()->set_tile(TileType::SANGEN_CHUN);
+  Hand_Kan* kan = hand.add_kanned_tile();
+  kan->set_tile(TileType::SOUZU_9);
+  kan->set_is_closed(false);
+  Hand_Chii* chii = hand.add_chiied_tile();
+  chii->add_tile(TileType::PINZU_7);
+  chii->add_tile(TileType::PINZU_8);
+  chii->add_tile(TileType::PINZU_9);
+
+  ShantenResult result;
+  ASSERT_EQ(HandValidatorResult::OK,
+            shantenCalculator_.Calculate(hand, &result));
+  EXPECT_EQ(0, result.shanten);
+  EXPECT_EQ(ShantenResult::kNotApplicable, result.chiitoitsu_shanten);
+  EXPECT_EQ(ShantenResult::kNotApplicable, result.kokushi_shanten);
+
+  hand.set_agari_tile(TileType::MANZU_4);
+  ASSERT_EQ(HandValidatorResult::OK,
+            shantenCalculator_.Calculate(hand, &result));
+  EXPECT_EQ(-1, result.shanten);
+
+  hand.add_closed_tile(TileType::MANZU_4);
+  EXPECT_EQ(HandValidatorResult::ERROR_WRONG_NUM_TILES,
+            shantenCalculator_.Calculate(hand, &result));
+}
+
+TEST_F(ShantenCalculatorTest, InvalidTilesTest) {
+  ShantenResult result;
+  const TileType five_tiles[] = {TileType::MANZU_1, TileType::MANZU_1,
+                                 TileType::MANZU_1, TileType::MANZU_1,
+                                 TileType::MANZU_1};
+  EXPECT_FALSE(shantenCalculator_.Calculate(five_tiles, 5, &result));
+  EXPECT_FALSE(shantenCalculator_.Calculate(five_tiles, 3, &result));
+
+  const TileType unknown_tile[] = {TileType::TILE_1};
+  EXPECT_FALSE(shantenCalculator_.Calculate(unknown_tile, 1, &result));
+}
+
+TEST_F(ShantenCalculatorTest, RandomHandTest) {
+  // For a 14-tile hand, the shanten number is -1 if and only if the hand is
+  // complete, and otherwise it's the same as the best 13-tile hand after a
+  // discard.
+  std::mt19937 engine(20160101);
+  vector<TileType> wall;
+  for (int index = 0; index < kNumTileIndices; ++index) {
+    for (int i = 0; i < 4; ++i) {
+      wall.push_back(GetTileTypeFromIndex(index));
+    }
+  }
+
+  const int pinzu_1 = GetTileIndex(TileType::PINZU_1);
+  for (int trial = 0; trial < 1000; ++trial) {
+    std::shuffle(wall.begin(), wall.end(), engine);
+    // Draw from a single suit in half of the trials so that more hands are
+    // close to complete.
+    vector<TileType> tiles;
+    for (const TileType tile : wall) {
+      if (trial % 2 == 0 || GetTileIndex(tile) >= pinzu_1) {
+        tiles.push_back(tile);
+      }
+      if (tiles.size() == 14) {
+        break;
+      }
+    }
+    SCOPED_TRACE(trial);
+
+    const ShantenResult result = Calculate(tiles);
+    EXPECT_EQ(result.shanten == -1,
+              handParser_.IsAgari(tiles.data(), tiles.size()));
+    if (result.shanten == -1) {
+      continue;
+    }
+
+    int min_shanten = ShantenResult::kNotApplicable;
+    for (int i = 0; i < 14; ++i) {
+      vector<TileType> discarded = tiles;
+      discarded.erase(discarded.begin() + i);
+      min_shanten = std::min(min_shanten, Calculate(discarded).shanten);
+    }
+    EXPECT_EQ(min_shanten, result.shanten);
+  }
+}
+
+TEST_F(ShantenCalculatorTest, UkeireTest) {
+  Hand hand;
+  for (const TileType tile :
+       {TileType::MANZU_2, TileType::MANZU_3, TileType::PINZU_4,
+        TileType::PINZU_5, TileType::PINZU_6, TileType::SOUZU_7,
+        TileType::SOUZU_8, TileType::SOUZU_9, TileType::WIND_TON,
+        TileType::WIND_TON, TileType::WIND_TON, TileType::SANGEN_HAKU,
+        TileType::SANGEN_HAKU}) {
+    hand.add_closed_tile(tile);
+  }
+  uint8_t visible_counts[kNumTileIndices] = {};
+  visible_counts[GetTileIndex(TileType::MANZU_1)] = 2;
+  visible_counts[GetTileIndex(TileType::SANGEN_HAKU)] = 1;
+
+  UkeireResult result;
+  ASSERT_EQ(HandValidatorResult::OK,
+            shantenCalculator_.CalculateUkeire(hand, visible_counts, &result));
+  ASSERT_EQ(1, result.num_entries);
+  const Ukeire& ukeire = result.entry[0];
+  EXPECT_EQ(-1, ukeire.discard);
+  EXPECT_EQ(0, ukeire.shanten);
+
+  // Waiting for 1m or 4m. Haku is the jantou, so drawing it doesn't help.
+  const int manzu_1 = GetTileIndex(TileType::MANZU_1);
+  const int manzu_4 = GetTileIndex(TileType::MANZU_4);
+  EXPECT_EQ((static_cast<uint64_t>(1) << manzu_1) |
+                (static_cast<uint64_t>(1) << manzu_4),
+            ukeire.tiles);
+  EXPECT_EQ(2, ukeire.num_live_tiles[manzu_1]);
+  EXPECT_EQ(4, ukeire.num_live_tiles[manzu_4]);
+  EXPECT_EQ(6, ukeire.total_num_live_tiles);
+}
+
+TEST_F(ShantenCalculatorTest, UkeireTest_Melds) {
+  // 55m 678p 東東 with chii of 345m and 456m. All 4 of 5m are in the hand
+  // including melds, so 5m has no copy left.
+  Hand hand;
+  for (const TileType tile :
+       {TileType::MANZU_5, TileType::MANZU_5, TileType::PINZU_6,
+        TileType::PINZU_7, TileType::PINZU_8, TileType::WIND_TON,
+        TileType::WIND_TON}) {
+    hand.add_closed_tile(tile);
+  }
+  for (const TileType first : {TileType::MANZU_3, TileType::MANZU_4}) {
+    Hand_Chii* chii = hand.add_chiied_tile();
+    for (int i = 0; i < 3; ++i) {
+      chii->add_tile(static_cast<TileType>(first + i));
+    }
+  }
+  UkeireResult result;
+  ASSERT_EQ(HandValidatorResult::OK,
+            shantenCalculator_.CalculateUkeire(hand, nullptr, &result));
+  ASSERT_EQ(1, result.num_entries);
+  const Ukeire& ukeire = result.entry[0];
+  EXPECT_EQ(0, ukeire.shanten);
+
+  // Shabo of 5m and ton, but only ton is left.
+  const int manzu_5 = GetTileIndex(TileType::MANZU_5);
+  const int ton = GetTileIndex(TileType::WIND_TON);
+  EXPECT_EQ(static_cast<uint64_t>(1) << ton, ukeire.tiles);
+  EXPECT_EQ(0, ukeire.num_live_tiles[manzu_5]);
+  EXPECT_EQ(2, ukeire.num_live_tiles[ton]);
+  EXPECT_EQ(2, ukeire.total_num_live_tiles);
+
+  // 23m 678p 東東 with chii of 456m and pon of 1m. Copies in melds of the
+  // hand aren't live.
+  hand.set_closed_tile(0, TileType::MANZU_2);
+  hand.set_closed_tile(1, TileType::MANZU_3);
+  hand.clear_chiied_tile();
+  Hand_Chii* chii = hand.add_chiied_tile();
+  for (const TileType tile :
+       {TileType::MANZU_4, TileType::MANZU_5, TileType::MANZU_6}) {
+    chii->add_tile(tile);
+  }
+  hand.add_ponned_tile()->set_tile(TileType::MANZU_1);
+  ASSERT_EQ(HandValidatorResult::OK,
+            shantenCalculator_.CalculateUkeire(hand, nullptr, &result));
+  ASSERT_EQ(1, result.num_entries);
+  const int manzu_1 = GetTileIndex(TileType::MANZU_1);
+  const int manzu_4 = GetTileIndex(TileType::MANZU_4);
+  EXPECT_EQ((static_cast<uint64_t>(1) << manzu_1) |
+                (static_cast<uint64_t>(1) << manzu_4),
+            result.entry[0].tiles);
+  EXPECT_EQ(1, result.entry[0].num_live_tiles[manzu_1]);
+  EXPECT_EQ(3, result.entry[0].num_live_tiles[manzu_4]);
+}
+
+TEST_F(ShantenCalculatorTest, UkeireTest_SameAsCalculate) {
+  // Compare ukeire of each discard with calculating shanten numbers of every
+  // hand after the discard and a draw.
+  std::mt19937 engine(20160102);
+  vector<TileType> wall;
+  for (int index = 0; index < kNumTileIndices; ++index) {
+    for (int i = 0; i < 4; ++i) {
+      wall.push_back(GetTileTypeFromIndex(index));
+    }
+  }
+  uint8_t visible_counts[kNumTileIndices] = {};
+  visible_counts[GetTileIndex(TileType::SOUZU_5)] = 3;
+
+  const int souzu_1 = GetTileIndex(TileType::SOUZU_1);
+  for (int trial = 0; trial < 100; ++trial) {
+    std::shuffle(wall.begin(), wall.end(), engine);
+    vector<TileType> tiles;
+    for (const TileType tile : wall) {
+      const int index = GetTileIndex(tile);
+      if (trial % 2 == 0 || (souzu_1 <= index && index < souzu_1 + 9)) {
+        tiles.push_back(tile);
+      }
+      if (tiles.size() == 14) {
+        break;
+      }
+    }
+    SCOPED_TRACE(trial);
+
+    Hand hand;
+    for (int i = 0; i < 13; ++i) {
+      hand.add_closed_tile(tiles[i]);
+    }
+    hand.set_agari_tile(tiles[13]);
+    UkeireResult result;
+    ASSERT_EQ(HandValidatorResult::OK,
+              shantenCalculator_.CalculateUkeire(hand, visible_counts,
+                                                 &result));
+
+    int counts[kNumTileIndices] = {};
+    for (const TileType tile : tiles) {
+      ++counts[GetTileIndex(tile)];
+    }
+    int num_kinds = 0;
+    for (int index = 0; index < kNumTileIndices; ++index) {
+      num_kinds += counts[index] > 0;
+    }
+    ASSERT_EQ(num_kinds, result.num_entries);
+
+    for (int i = 0; i < result.num_entries; ++i) {
+      const Ukeire& ukeire = result.entry[i];
+      vector<TileType> discarded = tiles;
+      discarded.erase(std::find(discarded.begin(), discarded.end(),
+                                GetTileTypeFromIndex(ukeire.discard)));
+      EXPECT_EQ(Calculate(discarded).shanten, ukeire.shanten);
+
+      int total_num_live_tiles = 0;
+      for (int index = 0; index < kNumTileIndices; ++index) {
+        SCOPED_TRACE(index);
+        const int count = counts[index] - (index == ukeire.discard);
+        bool is_effective = false;
+        if (count < 4) {
+          vector<TileType> drawn = discarded;
+          drawn.push_back(GetTileTypeFromIndex(index));
+          is_effective = Calculate(drawn).shanten < ukeire.shanten;
+        }
+        EXPECT_EQ(is_effective, (ukeire.tiles >> index) & 1);
+        const int num_live_tiles =
+            is_effective ? std::max(0, 4 - count - visible_counts[index]) : 0;
+        EXPECT_EQ(num_live_tiles, ukeire.num_live_tiles[index]);
+        total_num_live_tiles += num_live_tiles;
+      }
+      EXPECT_EQ(total_num_live_tiles, ukeire.total_num_live_tiles);
+    }
+  }
+}
+
+}  // namespace mahjong
+}  // namespace ycraft
@@ -0,0 +1,259 @@
+// Copyright 2016 Yuki Hamada
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "src/suit_decomposition_table.h"
+
+namespace ycraft {
+namespace mahjong {
+
+class SuitDecompositionTableTest : public testing::Test {
+ protected:
+  SuitDecompositionTableTest()
+      : table_(SuitDecompositionTable::GetInstance()) {}
+
+  // Loads the image generated by tools/generate_suit_table with the given
+  // bytes written at the given position.
+  std::unique_ptr<SuitDecompositionTable> LoadPatchedImage(
+      size_t position, const void* bytes, size_t num_bytes) {
+    std::string image = ReadImage();
+    image.replace(position, num_bytes, static_cast<const char*>(bytes),
+                  num_bytes);
+    const char* temp_dir = std::getenv("TEST_TMPDIR");
+    const std::string path =
+        std::string(temp_dir != nullptr ? temp_dir : "/tmp") +
+        "/corrupt_suit_decomposition_table.bin";
+    std::ofstream os(path, std::ios::out | std::ios::binary);
+    os.write(image.data(), image.size());
+    os.close();
+    EXPECT_FALSE(os.fail());
+    return SuitDecompositionTable::Load(path);
+  }
+
+  static std::string ReadImage() {
+    std::ifstream is("data/suit_decomposition_table.bin",
+                     std::ios::in | std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(is),
+                       std::istreambuf_iterator<char>());
+  }
+
+  // Returns the i-th word of the header of the image.
+  static uint32_t GetHeaderWord(const std::string& image, int i) {
+    uint32_t word;
+    std::memcpy(&word, &image[i * sizeof(word)], sizeof(word));
+    return word;
+  }
+
+  const SuitDecompositionTable& table_;
+};
+
+TEST_F(SuitDecompositionTableTest, EncodeDecodeTest) {
+  const int counts[SuitDecompositionTable::kNumTilesInSuit] = {3, 1, 1, 1, 2,
+                                                               2, 2, 0, 4};
+  const int key = SuitDecompositionTable::Encode(counts);
+
+  int decoded[SuitDecompositionTable::kNumTilesInSuit];
+  SuitDecompositionTable::Decode(key, decoded);
+  for (int i = 0; i < SuitDecompositionTable::kNumTilesInSuit; ++i) {
+    EXPECT_EQ(counts[i], decoded[i]);
+  }
+}
+
+TEST_F(SuitDecompositionTableTest, FindTest_Empty) {
+  const int counts[SuitDecompositionTable::kNumTilesInSuit] = {};
+  const SuitDecomposition* begin;
+  const SuitDecomposition* end;
+  ASSERT_TRUE(
+      table_.Find(SuitDecompositionTable::Encode(counts), &begin, &end));
+  ASSERT_EQ(1, end - begin);
+  EXPECT_EQ(0, begin->num_elements);
+  EXPECT_FALSE(begin->has_jantou);
+}
+
+TEST_F(SuitDecompositionTableTest, FindTest_Ambiguous) {
+  // 111222333
+  const int counts[SuitDecompositionTable::kNumTilesInSuit] = {3, 3, 3};
+  const SuitDecomposition* begin;
+  const SuitDecomposition* end;
+  ASSERT_TRUE(
+      table_.Find(SuitDecompositionTable::Encode(counts), &begin, &end));
+  ASSERT_EQ(2, end - begin);
+
+  EXPECT_FALSE(begin[0].has_jantou);
+  ASSERT_EQ(3, begin[0].num_elements);
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(HandElementType::KOUTSU, begin[0].element_type[i]);
+    EXPECT_EQ(i, begin[0].element_offset[i]);
+  }
+
+  EXPECT_FALSE(begin[1].has_jantou);
+  ASSERT_EQ(3, begin[1].num_elements);
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(HandElementType::SHUNTSU, begin[1].element_type[i]);
+    EXPECT_EQ(0, begin[1].element_offset[i]);
+  }
+}
+
+TEST_F(SuitDecompositionTableTest, FindTest_Jantou) {
+  // 11123
+  const int counts[SuitDecompositionTable::kNumTilesInSuit] = {3, 1, 1};
+  const SuitDecomposition* begin;
+  const SuitDecomposition* end;
+  ASSERT_TRUE(
+      table_.Find(SuitDecompositionTable::Encode(counts), &begin, &end));
+  ASSERT_EQ(1, end - begin);
+  EXPECT_TRUE(begin->has_jantou);
+  ASSERT_EQ(2, begin->num_elements);
+  EXPECT_EQ(HandElementType::TOITSU, begin->element_type[0]);
+  EXPECT_EQ(0, begin->element_offset[0]);
+  EXPECT_EQ(HandElementType::SHUNTSU, begin->element_type[1]);
+  EXPECT_EQ(0, begin->element_offset[1]);
+}
+
+TEST_F(SuitDecompositionTableTest, FindTest_NotFound) {
+  const SuitDecomposition* begin;
+  const SuitDecomposition* end;
+  {
+    // 12
+    const int counts[SuitDecompositionTable::kNumTilesInSuit] = {1, 1};
+    EXPECT_FALSE(
+        table_.Find(SuitDecompositionTable::Encode(counts), &begin, &end));
+  }
+  {
+    // 1122 has two toitsu.
+    const int counts[SuitDecompositionTable::kNumTilesInSuit] = {2, 2};
+    EXPECT_FALSE(
+        table_.Find(SuitDecompositionTable::Encode(counts), &begin, &end));
+  }
+  {
+    // 8 and 9 can't make a shuntsu without a tile beyond 9.
+    const int counts[SuitDecompositionTable::kNumTilesInSuit] = {0, 0, 0, 0,
+                                                                 0, 0, 0, 1,
+                                                                 2};
+    EXPECT_FALSE(
+        table_.Find(SuitDecompositionTable::Encode(counts), &begin, &end));
+  }
+}
+
+TEST_F(SuitDecompositionTableTest, LoadTest) {
+  // The image generated by tools/generate_suit_table.
+  const std::unique_ptr<SuitDecompositionTable> loaded_table =
+      SuitDecompositionTable::Load("data/suit_decomposition_table.bin");
+  ASSERT_NE(nullptr, loaded_table);
+  EXPECT_EQ(table_.num_keys(), loaded_table->num_keys());
+  EXPECT_EQ(table_.num_decompositions(), loaded_table->num_decompositions());
+
+  // Every key of 9 counts, complete or not, is found in both or neither.
+  int num_found_keys = 0;
+  int counts[SuitDecompositionTable::kNumTilesInSuit] = {};
+  for (int key = 0; key < 1953125; ++key) {
+    const SuitDecomposition* begin;
+    const SuitDecomposition* end;
+    const SuitDecomposition* loaded_begin;
+    const SuitDecomposition* loaded_end;
+    const bool found = table_.Find(key, &begin, &end);
+    ASSERT_EQ(found, loaded_table->Find(key, &loaded_begin, &loaded_end));
+    if (!found) {
+      continue;
+    }
+    ++num_found_keys;
+    ASSERT_EQ(end - begin, loaded_end - loaded_begin);
+    for (; begin != end; ++begin, ++loaded_begin) {
+      ASSERT_EQ(begin->num_elements, loaded_begin->num_elements);
+      ASSERT_EQ(begin->has_jantou, loaded_begin->has_jantou);
+      for (int i = 0; i < begin->num_elements; ++i) {
+        ASSERT_EQ(begin->element_type[i], loaded_begin->element_type[i]);
+        ASSERT_EQ(begin->element_offset[i], loaded_begin->element_offset[i]);
+      }
+    }
+
+    // Keys of complete shapes decode into at most 14 tiles.
+    SuitDecompositionTable::Decode(key, counts);
+    int num_tiles = 0;
+    for (int i = 0; i < SuitDecompositionTable::kNumTilesInSuit; ++i) {
+      num_tiles += counts[i];
+    }
+    EXPECT_GE(14, num_tiles);
+  }
+  EXPECT_EQ(table_.num_keys(), num_found_keys);
+}
+
+TEST_F(SuitDecompositionTableTest, LoadTest_Invalid) {
+  EXPECT_EQ(nullptr, SuitDecompositionTable::Load("data/no_such_file"));
+  // Not an image.
+  EXPECT_EQ(nullptr, SuitDecompositionTable::Load("data/rule.pb"));
+
+  // The header is 6 words: magic, version, the size of a decomposition and
+  // the numbers of buckets, slots and decompositions. The sections of
+  // buckets, slots and decompositions follow.
+  const std::string image = ReadImage();
+  ASSERT_LT(24u, image.size());
+  const size_t slots_position = 24 + GetHeaderWord(image, 3) * 4;
+  const size_t decompositions_position =
+      slots_position + GetHeaderWord(image, 4) * 12;
+  // The first decomposition is the one of the empty suit, so the last one is
+  // patched instead.
+  const size_t decomposition_position =
+      decompositions_position +
+      (GetHeaderWord(image, 5) - 1) * sizeof(SuitDecomposition);
+
+  // The first slot, whose words are its key, begin and end, refers past the
+  // end of the decompositions.
+  const uint32_t end = table_.num_decompositions() + 1;
+  EXPECT_EQ(nullptr,
+            LoadPatchedImage(slots_position + 8, &end, sizeof(end)));
+
+  // A decomposition with an element outside of the suit.
+  SuitDecomposition decomposition;
+  std::memcpy(&decomposition, &image[decomposition_position],
+              sizeof(decomposition));
+  ASSERT_LT(0, decomposition.num_elements);
+  const int offset = decomposition.element_type[0] == HandElementType::SHUNTSU
+                         ? SuitDecompositionTable::kNumTilesInSuit - 2
+                         : SuitDecompositionTable::kNumTilesInSuit;
+  EXPECT_EQ(nullptr,
+            LoadPatchedImage(decomposition_position +
+                                 offsetof(SuitDecomposition, element_offset),
+                             &offset, sizeof(offset)));
+
+  // An element type other than the base types.
+  const HandElementType type = HandElementType::MINKOUTSU;
+  EXPECT_EQ(nullptr,
+            LoadPatchedImage(decomposition_position +
+                                 offsetof(SuitDecomposition, element_type),
+                             &type, sizeof(type)));
+
+  // A byte of has_jantou other than 0 and 1.
+  const uint8_t has_jantou = 2;
+  EXPECT_EQ(nullptr,
+            LoadPatchedImage(decomposition_position +
+                                 offsetof(SuitDecomposition, has_jantou),
+                             &has_jantou, sizeof(has_jantou)));
+
+  // The image itself is valid.
+  EXPECT_NE(nullptr, LoadPatchedImage(0, image.data(), 4));
+}
+
+}  // namespace mahjong
+}  // namespace ycraft
@@ -0,0 +1,176 @@
+// Copyright 2016 Yuki Hamada
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "src/compact_hand.h"
+#include "src/mahjong_common_util.h"
+#include "src/suit_permutation.h"
+
+using std::ifstream;
+using std::istream;
+using std::string;
+using std::vector;
+
+namespace ycraft {
+namespace mahjong {
+
+namespace {
+// All 6 permutations of suits.
+const SuitPermutation kPermutations[] = {{{0, 1, 2}}, {{0, 2, 1}},
+                                         {{1, 0, 2}}, {{1, 2, 0}},
+                                         {{2, 0, 1}}, {{2, 1, 0}}};
+
+// Returns a string that identifies the given hand regardless of the order of
+// closed tiles.
+string Describe(const CompactHand& hand) {
+  vector<int> closed_tiles(hand.closed_tile,
+                           hand.closed_tile + hand.num_closed_tiles);
+  std::sort(closed_tiles.begin(), closed_tiles.end());
+  string description;
+  for (const int tile : closed_tiles) {
+    description += std::to_string(tile) + " ";
+  }
+  description += "| " + std::to_string(hand.agari_tile) + " |";
+  for (int i = 0; i < hand.num_melds; ++i) {
+    description += " " + std::to_string(hand.meld[i].type) + ":" +
+                   std::to_string(hand.meld[i].tile);
+  }
+  return description;
+}
+}  // namespace
+
+class SuitPermutationTest : public testing::Test {};
+
+TEST_F(SuitPermutationTest, ApplyTest) {
+  const SuitPermutation permutation = {{2, 0, 1}};
+  EXPECT_FALSE(permutation.IsIdentity());
+  EXPECT_TRUE(SuitPermutation::Identity().IsIdentity());
+
+  // Manzu to pinzu, souzu to manzu and pinzu to souzu.
+  EXPECT_EQ(GetTileIndex(TileType::PINZU_3),
+            permutation.Apply(GetTileIndex(TileType::MANZU_3)));
+  EXPECT_EQ(GetTileIndex(TileType::MANZU_9),
+            permutation.Apply(GetTileIndex(TileType::SOUZU_9)));
+  EXPECT_EQ(GetTileIndex(TileType::SOUZU_1),
+            permutation.Apply(GetTileIndex(TileType::PINZU_1)));
+  EXPECT_EQ(GetTileIndex(TileType::WIND_TON),
+            permutation.Apply(GetTileIndex(TileType::WIND_TON)));
+  EXPECT_EQ(CompactParsedHand::kUnknownTileCode,
+            permutation.Apply(CompactParsedHand::kUnknownTileCode));
+
+  EXPECT_EQ(TileType::PINZU_3, permutation.Apply(TileType::MANZU_3));
+  EXPECT_EQ(TileType::MANZU_TILE, permutation.Apply(TileType::SOUZU_TILE));
+  EXPECT_EQ(TileType::SANGEN_HATSU, permutation.Apply(TileType::SANGEN_HATSU));
+  EXPECT_EQ(TileType::TILE_5, permutation.Apply(TileType::TILE_5));
+  EXPECT_EQ(TileType::JIHAI_TILE, permutation.Apply(TileType::JIHAI_TILE));
+
+  const SuitPermutation inverse = permutation.Inverse();
+  for (int index = 0; index < kNumTileIndices; ++index) {
+    EXPECT_EQ(index, inverse.Apply(permutation.Apply(index)));
+  }
+}
+
+TEST_F(SuitPermutationTest, CanonicalizeTest) {
+  std::mt19937 random(20161210);
+  for (int round = 0; round < 200; ++round) {
+    vector<int> wall;
+    for (int index = 0; index < kNumTileIndices; ++index) {
+      for (int i = 0; i < 4; ++i) {
+        wall.push_back(index);
+      }
+    }
+    std::shuffle(wall.begin(), wall.end(), random);
+
+    // A hand with a pon and a chii of random tiles.
+    CompactHand hand;
+    hand.Clear();
+    for (int i = 0; i < 7; ++i) {
+      hand.AddClosedTile(wall[i]);
+    }
+    hand.agari_tile = wall[7];
+    hand.AddMeld(HandElementType::MINKOUTSU, wall[8]);
+    const int chii = 7 + wall[9] % 7;
+    hand.AddMeld(HandElementType::MINSHUNTSU, chii);
+
+    CompactHand canonical_hand = hand;
+    const SuitPermutation permutation = CanonicalizeSuits(&canonical_hand);
+    CompactHand restored_hand = canonical_hand;
+    PermuteSuits(permutation.Inverse(), &restored_hand);
+    ASSERT_EQ(Describe(hand), Describe(restored_hand));
+
+    // Every permutation of the hand has the same representative.
+    for (const SuitPermutation& other : kPermutations) {
+      CompactHand permuted_hand = hand;
+      PermuteSuits(other, &permuted_hand);
+      std::shuffle(permuted_hand.closed_tile,
+                   permuted_hand.closed_tile + permuted_hand.num_closed_tiles,
+                   random);
+      CanonicalizeSuits(&permuted_hand);
+      ASSERT_EQ(Describe(canonical_hand), Describe(permuted_hand));
+    }
+  }
+
+  // Suits of the same tiles are ordered by their melds in the hand, a pon of
+  // 9m and then a pon of 9s here.
+  CompactHand hand;
+  hand.Clear();
+  hand.AddClosedTile(GetTileIndex(TileType::PINZU_1));
+  hand.agari_tile = GetTileIndex(TileType::PINZU_1);
+  hand.AddMeld(HandElementType::MINKOUTSU, GetTileIndex(TileType::MANZU_9));
+  hand.AddMeld(HandElementType::MINKOUTSU, GetTileIndex(TileType::SOUZU_9));
+  CompactHand canonical_hand = hand;
+  CanonicalizeSuits(&canonical_hand);
+  for (const SuitPermutation& other : kPermutations) {
+    CompactHand permuted_hand = hand;
+    PermuteSuits(other, &permuted_hand);
+    CanonicalizeSuits(&permuted_hand);
+    EXPECT_EQ(Describe(canonical_hand), Describe(permuted_hand));
+  }
+}
+
+TEST_F(SuitPermutationTest, RuleTest) {
+  Rule rule;
+  ifstream rule_file;
+  rule_file.open("data/rule.pb", istream::in | istream::binary);
+  ASSERT_TRUE(rule.ParseFromIstream(&rule_file));
+  rule_file.close();
+
+  // Sanshoku and kokushi name every suit, so only ryuuiisou breaks the
+  // symmetry.
+  vector<string> names;
+  GetSuitAsymmetricYaku(rule, &names);
+  EXPECT_EQ(vector<string>({"緑一色"}), names);
+
+  // A yaku that requires a manzu element.
+  Yaku yaku;
+  TileCondition* condition = yaku.mutable_required_hand_condition()
+                                 ->add_required_element_condition()
+                                 ->add_required_tile_condition();
+  condition->add_allowed_tile_type(TileType::MANZU_TILE);
+  EXPECT_FALSE(IsSuitSymmetric(yaku));
+  condition->add_allowed_tile_type(TileType::SOUZU_TILE);
+  EXPECT_FALSE(IsSuitSymmetric(yaku));
+  condition->add_allowed_tile_type(TileType::PINZU_TILE);
+  EXPECT_TRUE(IsSuitSymmetric(yaku));
+}
+
+}  // namespace mahjong
+}  // namespace ycraft
@@ -0,0 +1,127 @@
+// Copyright 2016 Yuki Hamada
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <random>
+
+#include "gtest/gtest.h"
+
+#include "src/mahjong_common_util.h"
+#include "src/tile_bitboard.h"
+
+namespace ycraft {
+namespace mahjong {
+
+class TileBitboardTest : public testing::Test {
+ protected:
+  TileBitboard MakeBoard(const std::initializer_list<TileType>& tiles) {
+    TileBitboard board = TileBitboard::Empty();
+    for (const TileType tile : tiles) {
+      board.Add(GetTileIndex(tile));
+    }
+    return board;
+  }
+};
+
+TEST_F(TileBitboardTest, CountTest) {
+  int counts[kNumTileIndices] = {};
+  for (int index = 0; index < kNumTileIndices; ++index) {
+    counts[index] = index % 5;
+  }
+  const TileBitboard board = TileBitboard::FromCounts(counts);
+  for (int index = 0; index < kNumTileIndices; ++index) {
+    EXPECT_EQ(counts[index], board.count(index));
+  }
+
+  TileBitboard added = TileBitboard::Empty();
+  for (int index = 0; index < kNumTileIndices; ++index) {
+    for (int i = 0; i < counts[index]; ++i) {
+      added.Add(index);
+    }
+  }
+  EXPECT_EQ(board, added);
+
+  EXPECT_EQ(kNumTileIndices, CountKinds(GetAllTilesMask()));
+  EXPECT_EQ(13, CountKinds(GetYaochuhaiMask()));
+  EXPECT_EQ(4, CountKinds(TileBitboard::FromTileType(TileType::WIND_TILE)));
+  EXPECT_EQ(3, CountKinds(TileBitboard::FromTileType(TileType::TILE_1)));
+  EXPECT_EQ(1, CountKinds(TileBitboard::FromTileType(TileType::SOUZU_5)));
+}
+
+TEST_F(TileBitboardTest, KernelTest) {
+  // 111m 2345m 99s 東東 with a pair of 9s and 東.
+  const TileBitboard board = MakeBoard(
+      {TileType::MANZU_1, TileType::MANZU_1, TileType::MANZU_1,
+       TileType::MANZU_2, TileType::MANZU_3, TileType::MANZU_4,
+       TileType::MANZU_5, TileType::SOUZU_9, TileType::SOUZU_9,
+       TileType::WIND_TON, TileType::WIND_TON});
+
+  EXPECT_EQ(MakeBoard({TileType::MANZU_1, TileType::MANZU_2, TileType::MANZU_3,
+                       TileType::MANZU_4, TileType::MANZU_5, TileType::SOUZU_9,
+                       TileType::WIND_TON}),
+            GetOccupiedMask(board));
+  EXPECT_EQ(MakeBoard({TileType::SOUZU_9, TileType::WIND_TON}),
+            GetPairMask(board));
+  EXPECT_EQ(MakeBoard({TileType::MANZU_1, TileType::MANZU_2,
+                       TileType::MANZU_3}),
+            GetSequenceMask(board));
+
+  EXPECT_EQ(7, CountTiles(board, GetYaochuhaiMask()));
+  EXPECT_EQ(11, CountTiles(board, GetAllTilesMask()));
+  EXPECT_FALSE(IsSubset(board, GetYaochuhaiMask()));
+  EXPECT_TRUE(IsSubset(board, GetAllTilesMask()));
+  EXPECT_EQ(0x7, GetLaneBits(board));
+
+  // Sequences never span suits: 89m 1s.
+  EXPECT_EQ(TileBitboard::Empty(),
+            GetSequenceMask(MakeBoard({TileType::MANZU_8, TileType::MANZU_9,
+                                       TileType::SOUZU_1})));
+}
+
+TEST_F(TileBitboardTest, ScalarTest) {
+  // The kernels give the same results as the scalar ones.
+  std::mt19937 random(20161211);
+  std::uniform_int_distribution<int> count_distribution(0, 4);
+  std::uniform_int_distribution<int> mask_distribution(0, 1);
+  for (int round = 0; round < 1000; ++round) {
+    int counts[kNumTileIndices];
+    int mask_counts[kNumTileIndices];
+    for (int index = 0; index < kNumTileIndices; ++index) {
+      counts[index] = count_distribution(random);
+      mask_counts[index] = mask_distribution(random);
+    }
+    const TileBitboard board = TileBitboard::FromCounts(counts);
+    const TileBitboard mask = TileBitboard::FromCounts(mask_counts);
+
+    int num_tiles = 0;
+    int num_pairs = 0;
+    for (int index = 0; index < kNumTileIndices; ++index) {
+      num_tiles += mask_counts[index] * counts[index];
+      num_pairs += counts[index] == 2;
+    }
+    ASSERT_EQ(num_tiles, CountTiles(board, mask));
+    ASSERT_EQ(num_pairs, CountKinds(GetPairMask(board)));
+
+    ASSERT_EQ(scalar::GetOccupiedMask(board), GetOccupiedMask(board));
+    ASSERT_EQ(scalar::GetPairMask(board), GetPairMask(board));
+    ASSERT_EQ(scalar::GetSequenceMask(board), GetSequenceMask(board));
+    ASSERT_EQ(scalar::CountTiles(board, mask), CountTiles(board, mask));
+    ASSERT_EQ(scalar::IsSubset(board, mask), IsSubset(board, mask));
+    ASSERT_EQ(scalar::IsSubset(mask, GetOccupiedMask(board)),
+              IsSubset(mask, GetOccupiedMask(board)));
+    ASSERT_EQ(scalar::GetLaneBits(board & mask), GetLaneBits(board & mask));
+  }
+}
+
+}  // namespace mahjong
+}  // namespace ycraft
@@ -0,0 +1,45 @@
+// Copyright 2016 Yuki Hamada
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <iostream>
+
+#include "src/suit_decomposition_table.h"
+
+using std::cerr;
+using std::endl;
+
+using ycraft::mahjong::SuitDecompositionTable;
+
+// Enumerates decompositions of every complete suit shape and saves them as an
+// image that SuitDecompositionTable::Load maps into memory.
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    cerr << "Missing arguments" << endl;
+    return -1;
+  }
+
+  const char* output_path = argv[1];
+
+  const SuitDecompositionTable& table = SuitDecompositionTable::GetInstance();
+  if (!table.Save(output_path)) {
+    cerr << "Failed to save the suit decomposition table to the given output "
+            "path."
+         << endl;
+    return -1;
+  }
+
+  cerr << "Saved " << table.num_decompositions() << " decompositions of "
+       << table.num_keys() << " suit shapes." << endl;
+  return 0;
+}